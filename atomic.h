@@ -0,0 +1,107 @@
+#ifndef __MALLIE_ATOMIC_H__
+#define __MALLIE_ATOMIC_H__
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace mallie {
+
+// Atomic operations on values shared by render threads. OpenMP atomics in
+// OpenMP build, compiler intrinsics(as in tasksys.cc) otherwise.
+
+inline void AtomicAdd(float *dst, float delta) {
+#if defined(_OPENMP)
+#pragma omp atomic
+  *dst += delta;
+#elif defined(_WIN32)
+  volatile LONG *p = reinterpret_cast<volatile LONG *>(dst);
+  LONG oldBits, newBits;
+  do {
+    oldBits = *p;
+    float oldValue;
+    memcpy(&oldValue, &oldBits, sizeof(float));
+    float newValue = oldValue + delta;
+    memcpy(&newBits, &newValue, sizeof(float));
+  } while (InterlockedCompareExchange(p, newBits, oldBits) != oldBits);
+#else
+  volatile int *p = reinterpret_cast<volatile int *>(dst);
+  int oldBits, newBits;
+  do {
+    oldBits = *p;
+    float oldValue;
+    memcpy(&oldValue, &oldBits, sizeof(float));
+    float newValue = oldValue + delta;
+    memcpy(&newBits, &newValue, sizeof(float));
+  } while (!__sync_bool_compare_and_swap(p, oldBits, newBits));
+#endif
+}
+
+inline void AtomicIncrement(int *dst) {
+#if defined(_OPENMP)
+#pragma omp atomic
+  (*dst)++;
+#elif defined(_WIN32)
+  InterlockedIncrement(reinterpret_cast<volatile LONG *>(dst));
+#else
+  __sync_fetch_and_add(dst, 1);
+#endif
+}
+
+inline void AtomicAdd(int *dst, int delta) {
+#if defined(_OPENMP)
+#pragma omp atomic
+  *dst += delta;
+#elif defined(_WIN32)
+  InterlockedExchangeAdd(reinterpret_cast<volatile LONG *>(dst), delta);
+#else
+  __sync_fetch_and_add(dst, delta);
+#endif
+}
+
+// Add `delta` and return the previous value.
+inline int AtomicFetchAdd(int *dst, int delta) {
+#if defined(_WIN32)
+  return (int)InterlockedExchangeAdd(reinterpret_cast<volatile LONG *>(dst),
+                                     delta);
+#else
+  return __sync_fetch_and_add(dst, delta);
+#endif
+}
+
+// Store `newValue` if `*dst` equals `oldValue`. Returns the previous value.
+inline unsigned int AtomicCompareAndSwap(unsigned int *dst,
+                                         unsigned int oldValue,
+                                         unsigned int newValue) {
+#if defined(_WIN32)
+  return (unsigned int)InterlockedCompareExchange(
+      reinterpret_cast<volatile LONG *>(dst), (LONG)newValue, (LONG)oldValue);
+#else
+  return __sync_val_compare_and_swap(dst, oldValue, newValue);
+#endif
+}
+
+// AtomicAdd() by a compare-and-swap loop in all builds. Returns the number of
+// failed attempts, that is the contention on `dst`.
+inline int AtomicAddCAS(float *dst, float delta) {
+  unsigned int *bits = reinterpret_cast<unsigned int *>(dst);
+  int retries = 0;
+  for (;;) {
+    unsigned int oldBits = *reinterpret_cast<volatile unsigned int *>(bits);
+    float oldValue, newValue;
+    memcpy(&oldValue, &oldBits, sizeof(float));
+    newValue = oldValue + delta;
+    unsigned int newBits;
+    memcpy(&newBits, &newValue, sizeof(float));
+    if (AtomicCompareAndSwap(bits, oldBits, newBits) == oldBits) {
+      return retries;
+    }
+    retries++;
+  }
+}
+
+} // namespace
+
+#endif // __MALLIE_ATOMIC_H__
@@ -0,0 +1,276 @@
+#include <cmath>
+#include <algorithm>
+
+#include "bsdf.h"
+
+using namespace mallie;
+
+namespace {
+
+const real kEpsCosine = 1.0e-6;
+
+inline real MaxComponent(const real3 &c) {
+  return std::max(c[0], std::max(c[1], c[2]));
+}
+
+// Fresnel reflectance of dielectric. cosI can be negative(from inside).
+real FresnelDielectric(real cosI, real ior) {
+  if (ior < 0.0) {
+    return 1.0;
+  }
+
+  real etaIncOverEtaTrans;
+  if (cosI < 0.0) {
+    cosI = -cosI;
+    etaIncOverEtaTrans = ior;
+  } else {
+    etaIncOverEtaTrans = 1.0 / ior;
+  }
+
+  const real sinTrans2 = etaIncOverEtaTrans * etaIncOverEtaTrans *
+                         (1.0 - cosI * cosI);
+  if (sinTrans2 >= 1.0) {
+    return 1.0; // Total internal reflection
+  }
+
+  const real cosTrans = sqrt(std::max((real)0.0, 1.0 - sinTrans2));
+
+  const real term1 = etaIncOverEtaTrans * cosTrans;
+  const real rParallel = (cosI - term1) / (cosI + term1);
+
+  const real term2 = etaIncOverEtaTrans * cosI;
+  const real rPerpendicular = (term2 - cosTrans) / (term2 + cosTrans);
+
+  return 0.5 * (rParallel * rParallel + rPerpendicular * rPerpendicular);
+}
+
+} // namespace
+
+void Frame::SetFromZ(const real3 &n) {
+  z = n;
+  real3 tmp = (std::abs(z[0]) > 0.99) ? real3(0.0, 1.0, 0.0)
+                                      : real3(1.0, 0.0, 0.0);
+  y = vcross(z, tmp);
+  y.normalize();
+  x = vcross(y, z);
+}
+
+void BSDF::Setup(const real3 &rayDir, const real3 &normal, const Material &mat,
+                 int matID, bool isFromLight) {
+  materialID = -1;
+
+  diffuse = mat.diffuse;
+  reflection = mat.reflection;
+  refraction = mat.refraction;
+  ior = (MaxComponent(mat.refraction) > 0.0) ? mat.ior : -1.0;
+  fromLight = isFromLight;
+
+  // Only dielectric needs the orientation of the surface. Others are
+  // two-sided.
+  real3 n = normal;
+  if ((ior < 0.0) && (vdot(n, rayDir) > 0.0)) {
+    n = n.neg();
+  }
+
+  frame.SetFromZ(n);
+  localDirFix = frame.ToLocal(rayDir * -1.0);
+
+  // Reject rays that are too parallel with tangent plane
+  if (std::abs(localDirFix[2]) < kEpsCosine) {
+    return;
+  }
+
+  ComputeProbabilities();
+
+  isDelta = (diffProb == 0.0);
+
+  materialID = matID;
+}
+
+void BSDF::ComputeProbabilities() {
+  reflectCoeff = FresnelDielectric(localDirFix[2], ior);
+
+  const real albedoDiffuse = MaxComponent(diffuse);
+  const real albedoReflect = reflectCoeff * MaxComponent(reflection);
+  const real albedoRefract =
+      (ior > 0.0) ? (1.0 - reflectCoeff) * MaxComponent(refraction) : 0.0;
+
+  const real totalAlbedo = albedoDiffuse + albedoReflect + albedoRefract;
+
+  if (totalAlbedo < 1.0e-9) {
+    diffProb = 0.0;
+    reflProb = 0.0;
+    refrProb = 0.0;
+    continuationProb = 0.0;
+    return;
+  }
+
+  diffProb = albedoDiffuse / totalAlbedo;
+  reflProb = albedoReflect / totalAlbedo;
+  refrProb = albedoRefract / totalAlbedo;
+
+  // Max component of the reflectance, so that the weight of the sample never
+  // rises.
+  continuationProb = MaxComponent(diffuse + reflection * reflectCoeff +
+                                  refraction * (1.0 - reflectCoeff));
+  continuationProb = std::min((real)1.0, continuationProb);
+}
+
+real3 BSDF::Evaluate(const real3 &worldDirGen, real &cosThetaGen,
+                     real *directPdfW, real *reversePdfW) const {
+  real3 result(0.0, 0.0, 0.0);
+
+  if (directPdfW)
+    *directPdfW = 0.0;
+  if (reversePdfW)
+    *reversePdfW = 0.0;
+
+  const real3 localDirGen = frame.ToLocal(worldDirGen);
+
+  if (localDirGen[2] * localDirFix[2] < 0.0) {
+    return result;
+  }
+
+  cosThetaGen = std::abs(localDirGen[2]);
+
+  if ((diffProb == 0.0) || (localDirFix[2] < kEpsCosine) ||
+      (localDirGen[2] < kEpsCosine)) {
+    return result;
+  }
+
+  if (directPdfW)
+    *directPdfW += diffProb * localDirGen[2] / M_PI;
+  if (reversePdfW)
+    *reversePdfW += diffProb * localDirFix[2] / M_PI;
+
+  return diffuse * (1.0 / M_PI);
+}
+
+real BSDF::Pdf(const real3 &worldDirGen, bool evalRevPdf) const {
+  if (isDelta) {
+    return 0.0;
+  }
+
+  const real3 localDirGen = frame.ToLocal(worldDirGen);
+
+  if ((localDirGen[2] * localDirFix[2] < 0.0) || (localDirFix[2] < kEpsCosine) ||
+      (localDirGen[2] < kEpsCosine)) {
+    return 0.0;
+  }
+
+  if (evalRevPdf) {
+    return diffProb * localDirFix[2] / M_PI;
+  }
+  return diffProb * localDirGen[2] / M_PI;
+}
+
+real3 BSDF::Sample(const real rnd[3], real3 &worldDirGen, real &pdfW,
+                   real &cosThetaGen, unsigned int *sampledEvent) const {
+  unsigned int event;
+  if (rnd[2] < diffProb) {
+    event = kDiffuse;
+  } else if (rnd[2] < (diffProb + reflProb)) {
+    event = kReflect;
+  } else {
+    event = kRefract;
+  }
+
+  if (sampledEvent) {
+    *sampledEvent = event;
+  }
+
+  pdfW = 0.0;
+  real3 result(0.0, 0.0, 0.0);
+  real3 localDirGen;
+
+  if (event == kDiffuse) {
+    result = SampleDiffuse(rnd, localDirGen, pdfW);
+  } else if (event == kReflect) {
+    result = SampleReflect(localDirGen, pdfW);
+  } else {
+    result = SampleRefract(localDirGen, pdfW);
+  }
+
+  if (pdfW <= 0.0) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  cosThetaGen = std::abs(localDirGen[2]);
+  if (cosThetaGen < kEpsCosine) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  worldDirGen = frame.ToWorld(localDirGen);
+  return result;
+}
+
+real3 BSDF::SampleDiffuse(const real rnd[2], real3 &localDirGen,
+                          real &pdfW) const {
+  if (localDirFix[2] < kEpsCosine) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  // Cosine weighted hemisphere
+  real phi = 2.0 * M_PI * rnd[0];
+  real cosTheta = sqrt(1.0 - rnd[1]);
+  real sinTheta = sqrt(rnd[1]);
+  localDirGen = real3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+
+  pdfW = diffProb * cosTheta / M_PI;
+
+  return diffuse * (1.0 / M_PI);
+}
+
+real3 BSDF::SampleReflect(real3 &localDirGen, real &pdfW) const {
+  localDirGen = real3(-localDirFix[0], -localDirFix[1], localDirFix[2]);
+
+  pdfW = reflProb;
+
+  // BSDF is multiplied(outside) by cosine, which shouldn't be done for the
+  // mirror. Pre-divide here.
+  return reflection * (reflectCoeff / std::abs(localDirGen[2]));
+}
+
+real3 BSDF::SampleRefract(real3 &localDirGen, real &pdfW) const {
+  if (ior < 0.0) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  real cosI = localDirFix[2];
+
+  real cosT;
+  real etaIncOverEtaTrans;
+
+  if (cosI < 0.0) { // Inside
+    etaIncOverEtaTrans = ior;
+    cosI = -cosI;
+    cosT = 1.0;
+  } else {
+    etaIncOverEtaTrans = 1.0 / ior;
+    cosT = -1.0;
+  }
+
+  const real sinI2 = 1.0 - cosI * cosI;
+  const real sinT2 = etaIncOverEtaTrans * etaIncOverEtaTrans * sinI2;
+
+  if (sinT2 >= 1.0) {
+    return real3(0.0, 0.0, 0.0); // Total internal reflection
+  }
+
+  cosT *= sqrt(std::max((real)0.0, 1.0 - sinT2));
+
+  localDirGen = real3(-etaIncOverEtaTrans * localDirFix[0],
+                      -etaIncOverEtaTrans * localDirFix[1], cosT);
+
+  pdfW = refrProb;
+
+  const real refractCoeff = 1.0 - reflectCoeff;
+
+  // Only camera paths are multiplied by this factor, and etas are swapped
+  // because radiance flows in the opposite direction.
+  if (!fromLight) {
+    return refraction * (refractCoeff * etaIncOverEtaTrans *
+                         etaIncOverEtaTrans / std::abs(cosT));
+  }
+  return refraction * (refractCoeff / std::abs(cosT));
+}
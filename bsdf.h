@@ -2,29 +2,105 @@
 #define __MALLIE_BSDF_H__
 
 #include "common.h"
+#include "material.h"
 
+namespace mallie {
+
+///< Local shading frame. z = normal.
+class Frame {
+public:
+  Frame() {}
+
+  void SetFromZ(const real3 &z);
+
+  real3 ToWorld(const real3 &a) const {
+    return x * a[0] + y * a[1] + z * a[2];
+  }
+
+  real3 ToLocal(const real3 &a) const {
+    return real3(vdot(a, x), vdot(a, y), vdot(a, z));
+  }
+
+  real3 x, y, z;
+};
+
+///< BSDF at the path vertex. Mixture of Lambertian diffuse, perfect mirror
+///< and smooth dielectric(glass) built from Material. One of the components
+///< is chosen by its albedo when sampling.
+///< `Fix` direction is the one the path arrived from, `Gen` is the one
+///< generated(sampled or connected). `fromLight` tells the path is traced from
+///< the light, which matters for the refraction(non-symmetric BSDF).
 class BSDF {
+public:
   typedef enum {
+    kNone = 0,
     kDiffuse = 1,
-    kGlossy = 2,
+    kGlossy = 2, // Not yet supported
     kReflect = 4,
     kRefract = 8,
+    kSpecular = (kReflect | kRefract),
+    kNonSpecular = (kDiffuse | kGlossy),
   } Type;
 
-  real3 Eval();
-  real3 Pdf();
-  real3 Sample();
+  BSDF() : materialID(-1) {}
+
+  ///< Setup BSDF for the hit of the ray with direction `rayDir`.
+  void Setup(const real3 &rayDir, const real3 &normal, const Material &mat,
+             int matID, bool fromLight);
 
+  bool IsValid() const { return materialID >= 0; }
+
+  ///< True when the BSDF only has specular components.
   bool IsDelta() const { return isDelta; }
 
-  real3 N;
-  real3 Wo;
-  real3 Wi;
-  Type type;
+  ///< Russian roulette probability.
+  real ContinuationProb() const { return continuationProb; }
+
+  ///< Cosine between the normal and the fixed direction(can be negative).
+  real CosThetaFix() const { return localDirFix[2]; }
 
-  int materialID;
+  real3 WorldDirFix() const { return frame.ToWorld(localDirFix); }
+
+  ///< Evaluate non-specular components for `worldDirGen`. Returns BSDF
+  ///< value(without cosine). PDFs are in solid angle measure and include the
+  ///< component selection probability.
+  real3 Evaluate(const real3 &worldDirGen, real &cosThetaGen,
+                 real *directPdfW = NULL, real *reversePdfW = NULL) const;
+
+  ///< PDF of non-specular components.
+  real Pdf(const real3 &worldDirGen, bool evalRevPdf = false) const;
+
+  ///< Sample direction. rnd[0], rnd[1] for direction, rnd[2] for component.
+  ///< Returns BSDF value(without cosine), 0 if sampling failed.
+  real3 Sample(const real rnd[3], real3 &worldDirGen, real &pdfW,
+               real &cosThetaGen, unsigned int *sampledEvent = NULL) const;
+
+  int materialID; // -1 = invalid
+
+private:
+  void ComputeProbabilities();
+
+  real3 SampleDiffuse(const real rnd[2], real3 &localDirGen, real &pdfW) const;
+  real3 SampleReflect(real3 &localDirGen, real &pdfW) const;
+  real3 SampleRefract(real3 &localDirGen, real &pdfW) const;
+
+  real3 diffuse;
+  real3 reflection;
+  real3 refraction;
+  real ior;
+  bool fromLight;
+
+  Frame frame;
+  real3 localDirFix;
 
   bool isDelta;
+  real reflectCoeff; // Fresnel reflectance
+  real diffProb;
+  real reflProb;
+  real refrProb;
+  real continuationProb;
 };
 
+} // namespace
+
 #endif // __MALLIE_BSDF_H__
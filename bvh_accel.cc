@@ -696,6 +696,29 @@ bool TestLeafNode(Intersection &isect, // [inout]
   return hit;
 }
 
+bool TestLeafNodeAny(const BVHNode &node,
+                     const std::vector<unsigned int> &indices,
+                     const Mesh *mesh, const Ray &ray, real maxT) {
+  unsigned int numTriangles = node.data[0];
+  unsigned int offset = node.data[1];
+
+  for (unsigned int i = 0; i < numTriangles; i++) {
+    int faceIdx = indices[i + offset];
+
+    real3 v0(&mesh->vertices[3 * mesh->faces[3 * faceIdx + 0]]);
+    real3 v1(&mesh->vertices[3 * mesh->faces[3 * faceIdx + 1]]);
+    real3 v2(&mesh->vertices[3 * mesh->faces[3 * faceIdx + 2]]);
+
+    real t = maxT;
+    real u, v;
+    if (TriangleIsect(t, u, v, v0, v1, v2, ray.org, ray.dir)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 void BuildIntersection(Intersection &isect, const Mesh *mesh, Ray &ray) {
   // face index
   const unsigned int *faces = mesh->faces;
@@ -842,3 +865,48 @@ bool BVHAccel::Traverse(Intersection &isect, const Mesh *mesh, Ray &ray) {
 
   return false;
 }
+
+bool BVHAccel::Occluded(const Mesh *mesh, const Ray &ray, real maxT) {
+  int nodeStackIndex = 0;
+  int nodeStack[kMaxStackDepth];
+  nodeStack[0] = 0;
+
+  int dirSign[3];
+  dirSign[0] = ray.dir[0] < 0.0 ? 1 : 0;
+  dirSign[1] = ray.dir[1] < 0.0 ? 1 : 0;
+  dirSign[2] = ray.dir[2] < 0.0 ? 1 : 0;
+
+  real3 rayInvDir;
+  rayInvDir[0] = 1.0 / ray.dir[0];
+  rayInvDir[1] = 1.0 / ray.dir[1];
+  rayInvDir[2] = 1.0 / ray.dir[2];
+
+  real minT, tmaxAABB;
+  while (nodeStackIndex >= 0) {
+    BVHNode &node = nodes_[nodeStack[nodeStackIndex]];
+
+    nodeStackIndex--;
+
+    bool hit = IntersectRayAABB(minT, tmaxAABB, maxT, node.bmin, node.bmax,
+                                ray.org, rayInvDir, dirSign);
+    if (!hit) {
+      continue;
+    }
+
+    if (node.flag == 0) { // branch node
+      int orderNear = dirSign[node.axis];
+      int orderFar = 1 - orderNear;
+
+      nodeStack[++nodeStackIndex] = node.data[orderFar];
+      nodeStack[++nodeStackIndex] = node.data[orderNear];
+
+      assert(nodeStackIndex < kMaxStackDepth);
+    } else { // leaf node
+      if (TestLeafNodeAny(node, indices_, mesh, ray, maxT)) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
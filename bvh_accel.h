@@ -71,6 +71,10 @@ public:
   ///< Traverse into BVH along ray and find closest hit point if found
   bool Traverse(Intersection &isect, const Mesh *mesh, Ray &ray);
 
+  ///< Returns true if any primitive is hit in (0, maxT). Terminates at the
+  ///< first hit found(for shadow rays).
+  bool Occluded(const Mesh *mesh, const Ray &ray, real maxT);
+
   const std::vector<BVHNode> &GetNodes() const { return nodes_; }
   const std::vector<unsigned int> &GetIndices() const { return indices_; }
 
@@ -187,6 +187,10 @@ void Camera::BuildCameraFrame(double origin[3], double corner[3], double u[3],
     vnormalize(v);
 
     vnormalize(look1);
+    forward_[0] = look1[0];
+    forward_[1] = look1[1];
+    forward_[2] = look1[2];
+
     look1[0] = flen * look1[0] + eye1[0];
     look1[1] = flen * look1[1] + eye1[1];
     look1[2] = flen * look1[2] + eye1[2];
@@ -216,6 +220,7 @@ void Camera::BuildCameraFrame(double origin[3], double corner[3], double u[3],
     dv_[2] = v[2];
 
     fov_ = fov;
+    flen_ = flen;
   }
 }
 
@@ -239,6 +244,36 @@ Ray Camera::GenerateRay(double u, double v) const {
   return ray;
 }
 
+bool Camera::WorldToRaster(double &px, double &py, const real3 &p) const {
+  double d[3];
+  d[0] = p[0] - origin_[0];
+  d[1] = p[1] - origin_[1];
+  d[2] = p[2] - origin_[2];
+
+  double t = d[0] * forward_[0] + d[1] * forward_[1] + d[2] * forward_[2];
+  if (t <= 0.0) {
+    return false;
+  }
+
+  // Intersect with the image plane and measure from the corner.
+  double s = flen_ / t;
+  double q[3];
+  q[0] = origin_[0] + s * d[0] - corner_[0];
+  q[1] = origin_[1] + s * d[1] - corner_[1];
+  q[2] = origin_[2] + s * d[2] - corner_[2];
+
+  px = q[0] * du_[0] + q[1] * du_[1] + q[2] * du_[2];
+  py = q[0] * dv_[0] + q[1] * dv_[1] + q[2] * dv_[2];
+
+  // Pixel x covers [x - 0.5, x + 0.5) in raster coordinate.
+  if ((px < -0.5) || (py < -0.5) || (px >= width_ - 0.5) ||
+      (py >= height_ - 0.5)) {
+    return false;
+  }
+
+  return true;
+}
+
 Ray Camera::GenerateEnvRay(double u, double v) const {
   double theta = M_PI * (v / height_);
   double phi = 2.0 * M_PI * (u / width_);
@@ -29,6 +29,16 @@ public:
   Ray GenerateEnvRay(double u, double v) const;
   Ray GenerateStereoEnvRay(double u, double v) const;
 
+  // Project world position `p` onto the image plane. Returns raster
+  // coordinate(the one given to GenerateRay()) in (px, py), and false when `p`
+  // is behind the camera or outside of the screen.
+  bool WorldToRaster(double &px, double &py, const real3 &p) const;
+
+  // Distance to the image plane(in pixel units).
+  double ImagePlaneDist() const { return flen_; }
+
+  real3 Forward() const { return real3(forward_[0], forward_[1], forward_[2]); }
+
   double eye_[3];
   double up_[3];
   double lookat_[3];
@@ -39,6 +49,8 @@ public:
   double du_[3];
   double dv_[3];
   double fov_;
+  double flen_;
+  double forward_[3];
 
   int height_;
   int width_;
@@ -0,0 +1,184 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "camera_path.h"
+#include "importers/vmd_reader.h"
+
+using namespace mallie;
+
+namespace {
+
+void RotateX(double v[3], double a) {
+  double c = cos(a), s = sin(a);
+  double y = v[1] * c - v[2] * s;
+  double z = v[1] * s + v[2] * c;
+  v[1] = y;
+  v[2] = z;
+}
+
+void RotateY(double v[3], double a) {
+  double c = cos(a), s = sin(a);
+  double x = v[0] * c + v[2] * s;
+  double z = -v[0] * s + v[2] * c;
+  v[0] = x;
+  v[2] = z;
+}
+
+void RotateZ(double v[3], double a) {
+  double c = cos(a), s = sin(a);
+  double x = v[0] * c - v[1] * s;
+  double y = v[0] * s + v[1] * c;
+  v[0] = x;
+  v[1] = y;
+}
+
+// Rotate `v` around the unit `axis`(Rodrigues).
+void RotateAxis(double v[3], const double axis[3], double a) {
+  double c = cos(a), s = sin(a);
+  double d = axis[0] * v[0] + axis[1] * v[1] + axis[2] * v[2];
+  double cross[3] = {axis[1] * v[2] - axis[2] * v[1],
+                     axis[2] * v[0] - axis[0] * v[2],
+                     axis[0] * v[1] - axis[1] * v[0]};
+  for (int k = 0; k < 3; k++) {
+    v[k] = v[k] * c + cross[k] * s + axis[k] * d * (1.0 - c);
+  }
+}
+
+// MMD camera: `location` is the target and the eye is `length`(negative
+// distance) along z from it, rotated by the Euler angles in Z, X, Y order.
+// Coordinates are kept as in the PMD model.
+void VMDCameraToKey(CameraKey &key, const mmd::VMDCamera &cam) {
+  double offset[3] = {0.0, 0.0, cam.length};
+  double up[3] = {0.0, 1.0, 0.0};
+
+  double *v[2] = {offset, up};
+  for (int i = 0; i < 2; i++) {
+    RotateZ(v[i], cam.rotation[2]);
+    RotateX(v[i], cam.rotation[0]);
+    RotateY(v[i], cam.rotation[1]);
+  }
+
+  key.frame = cam.frame_no;
+  for (int k = 0; k < 3; k++) {
+    key.lookat[k] = cam.location[k];
+    key.eye[k] = cam.location[k] + offset[k];
+    key.up[k] = up[k];
+  }
+  key.fov = cam.viewing_angle;
+}
+
+} // namespace
+
+namespace mallie {
+
+bool LoadVMDCameraKeys(std::vector<CameraKey> &keys,
+                       const std::string &filename) {
+  mmd::VMDReader reader;
+  mmd::VMDAnimation *anim = reader.LoadFromFile(filename);
+  if (!anim) {
+    return false;
+  }
+
+  // Camera frames are sorted by the reader.
+  keys.resize(anim->camera_frames_.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    VMDCameraToKey(keys[i], anim->camera_frames_[i]);
+  }
+  delete anim;
+
+  return !keys.empty();
+}
+
+void GetSequenceCamera(double eye[3], double lookat[3], double up[3],
+                       double &fov, const RenderConfig &config,
+                       const std::vector<CameraKey> &keys, int frame) {
+  if (keys.empty()) {
+    double axis[3] = {config.up[0], config.up[1], config.up[2]};
+    double len =
+        sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    if (len > 0.0) {
+      axis[0] /= len;
+      axis[1] /= len;
+      axis[2] /= len;
+    }
+
+    double angle = 2.0 * M_PI * frame / (std::max)(1, config.num_frames);
+    for (int k = 0; k < 3; k++) {
+      eye[k] = config.eye[k] - config.lookat[k];
+    }
+    RotateAxis(eye, axis, angle);
+    for (int k = 0; k < 3; k++) {
+      eye[k] += config.lookat[k];
+      lookat[k] = config.lookat[k];
+      up[k] = config.up[k];
+    }
+    fov = config.fov;
+    return;
+  }
+
+  // Keys around `frame`.
+  size_t i = 0;
+  while ((i + 1 < keys.size()) && (keys[i + 1].frame <= frame)) {
+    i++;
+  }
+  const CameraKey &k0 = keys[i];
+  const CameraKey &k1 = keys[(i + 1 < keys.size()) ? i + 1 : i];
+
+  double t = 0.0;
+  if (k1.frame > k0.frame) {
+    t = (frame - k0.frame) / (k1.frame - k0.frame);
+    t = (std::max)(0.0, (std::min)(1.0, t));
+  }
+
+  for (int k = 0; k < 3; k++) {
+    eye[k] = (1.0 - t) * k0.eye[k] + t * k1.eye[k];
+    lookat[k] = (1.0 - t) * k0.lookat[k] + t * k1.lookat[k];
+    up[k] = (1.0 - t) * k0.up[k] + t * k1.up[k];
+  }
+
+  double fov0 = (k0.fov > 0.0) ? k0.fov : config.fov;
+  double fov1 = (k1.fov > 0.0) ? k1.fov : config.fov;
+  fov = (1.0 - t) * fov0 + t * fov1;
+}
+
+std::string GetFrameFilename(const std::string &pattern, int frame) {
+  // Accept one %d with an optional zero padding width only, since the
+  // pattern comes from the config.
+  size_t pos = pattern.find('%');
+  size_t end = pos;
+  if (pos != std::string::npos) {
+    end = pos + 1;
+    while ((end < pattern.size()) && (pattern[end] >= '0') &&
+           (pattern[end] <= '9')) {
+      end++;
+    }
+    if ((end >= pattern.size()) || (pattern[end] != 'd') ||
+        (end - pos > 4) || (pattern.find('%', end) != std::string::npos)) {
+      pos = std::string::npos;
+    }
+  }
+
+  char number[32];
+  if (pos == std::string::npos) {
+    // name.ext -> name0000.ext
+    size_t dot = pattern.rfind('.');
+    size_t slash = pattern.find_last_of("/\\");
+    if ((dot == std::string::npos) ||
+        ((slash != std::string::npos) && (dot < slash))) {
+      dot = pattern.size();
+    }
+    sprintf(number, "%04d", frame);
+    return pattern.substr(0, dot) + number + pattern.substr(dot);
+  }
+
+  std::string format = pattern.substr(pos, end + 1 - pos);
+  sprintf(number, format.c_str(), frame);
+
+  return pattern.substr(0, pos) + number + pattern.substr(end + 1);
+}
+
+} // namespace
@@ -0,0 +1,31 @@
+#ifndef __MALLIE_CAMERA_PATH_H__
+#define __MALLIE_CAMERA_PATH_H__
+
+#include <string>
+#include <vector>
+
+#include "render.h"
+
+namespace mallie {
+
+///< Camera keys from the camera frames of a VMD(MikuMikuDance motion) file.
+///< Returns false when the file has no camera frame.
+bool LoadVMDCameraKeys(std::vector<CameraKey> &keys,
+                       const std::string &filename);
+
+///< Camera of `frame` of the sequence of `config`. `keys` are linearly
+///< interpolated(clamped outside of the keys). Without keys, the eye orbits
+///< around `lookat` about the `up` axis and turns once in `num_frames`
+///< frames(turntable). `fov` is the fov of the frame.
+void GetSequenceCamera(double eye[3], double lookat[3], double up[3],
+                       double &fov, const RenderConfig &config,
+                       const std::vector<CameraKey> &keys, int frame);
+
+///< `pattern` with the printf style frame number(e.g. "frame%04d.jpg")
+///< replaced by `frame`. The number is inserted before the extension when
+///< `pattern` has no %d.
+std::string GetFrameFilename(const std::string &pattern, int frame);
+
+} // namespace
+
+#endif // __MALLIE_CAMERA_PATH_H__
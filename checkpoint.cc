@@ -0,0 +1,205 @@
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "checkpoint.h"
+#include "mmm_io.h"
+
+using namespace mallie;
+
+namespace {
+
+typedef struct {
+  unsigned long long hash;
+  int width;
+  int height;
+  int numBuffers;
+  int numPasses;
+} CheckpointHeader;
+
+// FNV-1a
+void HashBytes(unsigned long long &h, const void *data, size_t size) {
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+}
+
+void HashString(unsigned long long &h, const std::string &s) {
+  HashBytes(h, s.c_str(), s.size() + 1); // With the terminator
+}
+
+// Name of the chunk `prefix` of buffer `i`, e.g. "color0".
+std::string ChunkName(const char *prefix, int i) {
+  std::stringstream ss;
+  ss << prefix << i;
+  return ss.str();
+}
+
+template <typename T>
+void AddChunk(std::vector<MMMChunk> &chunks, const char *name, const T *data,
+              size_t n) {
+  MMMChunk chunk;
+  chunks.push_back(chunk);
+  chunks.back().name = name;
+  chunks.back().data.resize(sizeof(T) * n);
+  if (n > 0) {
+    memcpy(&chunks.back().data.at(0), data, sizeof(T) * n);
+  }
+}
+
+template <typename T>
+bool GetChunk(T *data, size_t n, const std::vector<MMMChunk> &chunks,
+              const char *name) {
+  const MMMChunk *chunk = FindMMMChunk(chunks, name);
+  if (!chunk || (chunk->data.size() != sizeof(T) * n)) {
+    return false;
+  }
+  if (n > 0) {
+    memcpy(data, &chunk->data.at(0), sizeof(T) * n);
+  }
+  return true;
+}
+
+} // namespace
+
+unsigned long long mallie::ConfigHash(const RenderConfig &config) {
+  unsigned long long h = 14695981039346656037ULL;
+
+  HashBytes(h, &config.width, sizeof(int));
+  HashBytes(h, &config.height, sizeof(int));
+  HashBytes(h, &config.fov, sizeof(double));
+  HashBytes(h, config.eye, sizeof(double) * 3);
+  HashBytes(h, config.lookat, sizeof(double) * 3);
+  HashBytes(h, config.up, sizeof(double) * 3);
+  HashBytes(h, config.quat, sizeof(double) * 4);
+  HashBytes(h, &config.scene_scale, sizeof(double));
+  HashBytes(h, &config.envmap_scale, sizeof(double));
+
+  unsigned char flags[3] = {config.scene_fit, config.plane,
+                            config.aov || config.denoise}; // AOV buffers
+  HashBytes(h, flags, sizeof(flags));
+
+  HashString(h, config.integrator);
+  HashString(h, config.obj_filename);
+  HashString(h, config.eson_filename);
+  HashString(h, config.magicavoxel_filename);
+  HashString(h, config.material_filename);
+  HashString(h, config.envmap_filename);
+
+  return h;
+}
+
+bool mallie::IsCheckpointSupported(const RenderConfig &config) {
+  return (config.integrator != "vcm") && (config.integrator != "sppm") &&
+         (config.integrator != "mlt");
+}
+
+bool mallie::SaveCheckpoint(const std::string &filename,
+                            const RenderConfig &config,
+                            const AccumBuffer *accum, int numBuffers,
+                            int numPasses) {
+  CheckpointHeader header;
+  header.hash = ConfigHash(config);
+  header.width = accum[0].width;
+  header.height = accum[0].height;
+  header.numBuffers = numBuffers;
+  header.numPasses = numPasses;
+
+  std::vector<unsigned int> rng;
+  GetRandomState(rng);
+
+  std::vector<MMMChunk> chunks;
+  AddChunk(chunks, "header", &header, 1);
+  AddChunk(chunks, "rng", rng.empty() ? NULL : &rng.at(0), rng.size());
+  for (int i = 0; i < numBuffers; i++) {
+    AddChunk(chunks, ChunkName("color", i).c_str(), &accum[i].color.at(0),
+             accum[i].color.size());
+    AddChunk(chunks, ChunkName("count", i).c_str(), &accum[i].count.at(0),
+             accum[i].count.size());
+
+    if (accum[i].HasAOV()) {
+      AddChunk(chunks, ChunkName("aov", i).c_str(), &accum[i].aov.at(0),
+               accum[i].aov.size());
+      AddChunk(chunks, ChunkName("materialID", i).c_str(),
+               &accum[i].materialID.at(0), accum[i].materialID.size());
+      AddChunk(chunks, ChunkName("faceID", i).c_str(), &accum[i].faceID.at(0),
+               accum[i].faceID.size());
+    }
+  }
+
+  return SaveMMMChunks(filename.c_str(), chunks);
+}
+
+bool mallie::LoadCheckpoint(AccumBuffer *accum, int numBuffers,
+                            int &numPasses, const std::string &filename,
+                            const RenderConfig &config) {
+  std::vector<MMMChunk> chunks;
+  if (!LoadMMMChunks(chunks, filename.c_str())) {
+    return false;
+  }
+
+  CheckpointHeader header;
+  if (!GetChunk(&header, 1, chunks, "header")) {
+    printf("Mallie:warn\tmsg:Invalid checkpoint [ %s ]\n", filename.c_str());
+    return false;
+  }
+
+  if ((header.hash != ConfigHash(config)) ||
+      (header.width != config.width) || (header.height != config.height) ||
+      (header.numBuffers != numBuffers)) {
+    printf("Mallie:warn\tmsg:Checkpoint [ %s ] is of other settings. "
+           "Starting over.\n",
+           filename.c_str());
+    return false;
+  }
+
+  // Read into temporaries so that a broken file leaves `accum` as is.
+  std::vector<AccumBuffer> buffers(numBuffers);
+  for (int i = 0; i < numBuffers; i++) {
+    buffers[i].Resize(header.width, header.height);
+    buffers[i].EnableAOV(accum[i].HasAOV());
+
+    bool ok = GetChunk(&buffers[i].color.at(0), buffers[i].color.size(),
+                       chunks, ChunkName("color", i).c_str()) &&
+              GetChunk(&buffers[i].count.at(0), buffers[i].count.size(),
+                       chunks, ChunkName("count", i).c_str());
+
+    if (ok && buffers[i].HasAOV()) {
+      ok = GetChunk(&buffers[i].aov.at(0), buffers[i].aov.size(), chunks,
+                    ChunkName("aov", i).c_str()) &&
+           GetChunk(&buffers[i].materialID.at(0),
+                    buffers[i].materialID.size(), chunks,
+                    ChunkName("materialID", i).c_str()) &&
+           GetChunk(&buffers[i].faceID.at(0), buffers[i].faceID.size(),
+                    chunks, ChunkName("faceID", i).c_str());
+    }
+
+    if (!ok) {
+      printf("Mallie:warn\tmsg:Invalid checkpoint [ %s ]\n", filename.c_str());
+      return false;
+    }
+  }
+
+  const MMMChunk *rngChunk = FindMMMChunk(chunks, "rng");
+  if (rngChunk) {
+    std::vector<unsigned int> rng(rngChunk->data.size() /
+                                  sizeof(unsigned int));
+    if (GetChunk(rng.empty() ? NULL : &rng.at(0), rng.size(), chunks, "rng")) {
+      SetRandomState(rng);
+    }
+  }
+
+  for (int i = 0; i < numBuffers; i++) {
+    accum[i].color.swap(buffers[i].color);
+    accum[i].count.swap(buffers[i].count);
+    accum[i].aov.swap(buffers[i].aov);
+    accum[i].materialID.swap(buffers[i].materialID);
+    accum[i].faceID.swap(buffers[i].faceID);
+  }
+  numPasses = header.numPasses;
+
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef __MALLIE_CHECKPOINT_H__
+#define __MALLIE_CHECKPOINT_H__
+
+#include <string>
+
+#include "render.h"
+
+namespace mallie {
+
+///< Hash of the settings which change the expected image(camera, resolution,
+///< scene, integrator). A checkpoint of another hash is not resumed.
+unsigned long long ConfigHash(const RenderConfig &config);
+
+///< False for integrators which keep progressive state across passes(VCM and
+///< SPPM radii, MLT chains). Their passes can't be continued from the
+///< accumulation buffers alone.
+bool IsCheckpointSupported(const RenderConfig &config);
+
+///< Save `numBuffers` accumulation buffers, the # of passes done and the
+///< random number state into a chunked MMM file.
+bool SaveCheckpoint(const std::string &filename, const RenderConfig &config,
+                    const AccumBuffer *accum, int numBuffers, int numPasses);
+
+///< Restore the state saved by SaveCheckpoint(). Returns false and leaves
+///< `accum` untouched when there is no checkpoint or it does not match
+///< `config`.
+bool LoadCheckpoint(AccumBuffer *accum, int numBuffers, int &numPasses,
+                    const std::string &filename, const RenderConfig &config);
+
+} // namespace
+
+#endif // __MALLIE_CHECKPOINT_H__
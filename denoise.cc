@@ -0,0 +1,396 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "denoise.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Defined in tasksys.cc
+extern "C" {
+void ISPCLaunch(void **handlePtr, void *f, void *data, int count);
+void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+void ISPCSync(void *handle);
+}
+
+using namespace mallie;
+
+namespace {
+
+const float kSigmaLuminance = 4.0f;
+const float kSigmaNormal = 128.0f; // Exponent of the normal weight
+const float kSigmaDepth = 1.0f;
+const float kMinAlbedo = 1.0e-3f;
+const int kRowsPerTask = 8;
+
+// B3 spline
+const float kKernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f,
+                          1.0f / 16.0f};
+
+enum {
+  kStageSetup = 0,    // Demodulate the color, per-pixel variance
+  kStageFeatures,     // Depth gradient(and the spatial variance)
+  kStageBlurVariance, // 3x3 gaussian of the variance for the weights
+  kStageFilter        // One a-trous iteration
+};
+
+inline float Luminance(float r, float g, float b) {
+  return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// Images are planar(structure of arrays), so that the per-row loops access
+// memory contiguously.
+struct DenoiseContext {
+  const AccumBuffer *accum;
+  int numBuffers;
+  int width;
+  int height;
+
+  std::vector<float> albedo[3];
+  std::vector<float> normal[3]; // Zero for background
+  std::vector<float> depth;     // Zero for background
+  std::vector<float> gradX;     // Depth gradient
+  std::vector<float> gradY;
+
+  std::vector<float> color[2][3]; // Demodulated, ping-pong
+  std::vector<float> variance[2]; // Of the luminance, ping-pong
+  std::vector<float> blurred;     // 3x3 gaussian of the variance
+  int src;                        // Input of the iteration
+  int step;                       // 2^iteration
+};
+
+void Setup(DenoiseContext &ctx, int y0, int y1) {
+  const AccumBuffer *accum = ctx.accum;
+  int width = ctx.width;
+
+  for (int y = y0; y < y1; y++) {
+    for (int x = 0; x < width; x++) {
+      int i = y * width + x;
+
+      double c[3] = {0.0, 0.0, 0.0};
+      double l[2] = {0.0, 0.0}; // Mean luminance of the first two buffers
+      float aov[kNumAOVs];
+      std::fill(aov, aov + kNumAOVs, 0.0f);
+      int count = 0;
+      for (int b = 0; b < ctx.numBuffers; b++) {
+        const double *bc = &accum[b].color[3 * i];
+        for (int k = 0; k < 3; k++) {
+          c[k] += bc[k];
+        }
+        for (int k = 0; k < kNumAOVs; k++) {
+          aov[k] += accum[b].aov[kNumAOVs * i + k];
+        }
+        if ((b < 2) && (accum[b].count[i] > 0)) {
+          l[b] = Luminance(bc[0], bc[1], bc[2]) / accum[b].count[i];
+        }
+        count += accum[b].count[i];
+      }
+
+      float scale = (count > 0) ? 1.0f / count : 0.0f;
+      float depth = aov[kAOVDepth] * scale;
+
+      // Untextured irradiance. Lights and the background are kept as is.
+      float albedo[3];
+      float n[3];
+      for (int k = 0; k < 3; k++) {
+        albedo[k] = aov[kAOVAlbedoR + k] * scale;
+        if (albedo[k] < kMinAlbedo) {
+          albedo[k] = 1.0f;
+        }
+        n[k] = aov[kAOVNormalX + k] * scale;
+      }
+      float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      float invLen = (len > 0.0f) ? 1.0f / len : 0.0f;
+
+      float e[3];
+      for (int k = 0; k < 3; k++) {
+        e[k] = float(c[k] * scale) / albedo[k];
+        ctx.albedo[k][i] = albedo[k];
+        ctx.normal[k][i] = n[k] * invLen;
+        ctx.color[0][k][i] = e[k];
+      }
+      ctx.depth[i] = depth;
+
+      // Variance of the mean from the difference of the two halves:
+      // Var = (l0 - l1)^2 n0 n1 / (n0 + n1)^2
+      float variance = 0.0f;
+      if ((ctx.numBuffers >= 2) && (count > 0)) {
+        double n0 = accum[0].count[i];
+        double n1 = accum[1].count[i];
+        double d = l[0] - l[1];
+        variance = float(d * d * n0 * n1 / (double(count) * double(count)));
+        float lumAlbedo = Luminance(albedo[0], albedo[1], albedo[2]);
+        variance /= lumAlbedo * lumAlbedo; // Demodulated
+      }
+      ctx.variance[0][i] = variance;
+    }
+  }
+}
+
+void Features(DenoiseContext &ctx, int y0, int y1) {
+  int width = ctx.width;
+  int height = ctx.height;
+  const std::vector<float> &z = ctx.depth;
+
+  for (int y = y0; y < y1; y++) {
+    for (int x = 0; x < width; x++) {
+      int i = y * width + x;
+
+      // Central differences between surface pixels.
+      float gx = 0.0f, gy = 0.0f;
+      if (z[i] > 0.0f) {
+        int xl = (std::max)(x - 1, 0), xr = (std::min)(x + 1, width - 1);
+        int yu = (std::max)(y - 1, 0), yd = (std::min)(y + 1, height - 1);
+        float zl = z[y * width + xl], zr = z[y * width + xr];
+        float zu = z[yu * width + x], zd = z[yd * width + x];
+        if ((zl > 0.0f) && (zr > 0.0f) && (xr > xl)) {
+          gx = (zr - zl) / (xr - xl);
+        }
+        if ((zu > 0.0f) && (zd > 0.0f) && (yd > yu)) {
+          gy = (zd - zu) / (yd - yu);
+        }
+      }
+      ctx.gradX[i] = gx;
+      ctx.gradY[i] = gy;
+
+      if (ctx.numBuffers >= 2) {
+        continue;
+      }
+
+      // Luminance variance of the 3x3 neighbourhood.
+      float sum = 0.0f, sum2 = 0.0f;
+      int n = 0;
+      for (int v = -1; v <= 1; v++) {
+        int yy = y + v;
+        if ((yy < 0) || (yy >= height)) {
+          continue;
+        }
+        for (int u = -1; u <= 1; u++) {
+          int xx = x + u;
+          if ((xx < 0) || (xx >= width)) {
+            continue;
+          }
+          int j = yy * width + xx;
+          float l = Luminance(ctx.color[0][0][j], ctx.color[0][1][j],
+                              ctx.color[0][2][j]);
+          sum += l;
+          sum2 += l * l;
+          n++;
+        }
+      }
+      float mean = sum / n;
+      ctx.variance[0][i] = (std::max)(0.0f, sum2 / n - mean * mean);
+    }
+  }
+}
+
+void BlurVariance(DenoiseContext &ctx, int y0, int y1) {
+  const float kGaussian[2] = {1.0f / 4.0f, 1.0f / 8.0f}; // center, side
+  int width = ctx.width;
+  int height = ctx.height;
+  const std::vector<float> &variance = ctx.variance[ctx.src];
+
+  for (int y = y0; y < y1; y++) {
+    for (int x = 0; x < width; x++) {
+      float sum = 0.0f, weight = 0.0f;
+      for (int v = -1; v <= 1; v++) {
+        int yy = y + v;
+        if ((yy < 0) || (yy >= height)) {
+          continue;
+        }
+        for (int u = -1; u <= 1; u++) {
+          int xx = x + u;
+          if ((xx < 0) || (xx >= width)) {
+            continue;
+          }
+          float w = kGaussian[abs(u)] * kGaussian[abs(v)] * 4.0f;
+          sum += w * variance[yy * width + xx];
+          weight += w;
+        }
+      }
+      ctx.blurred[y * width + x] = sum / weight;
+    }
+  }
+}
+
+void Filter(DenoiseContext &ctx, int y0, int y1) {
+  int width = ctx.width;
+  int height = ctx.height;
+  int step = ctx.step;
+  const std::vector<float> *color = ctx.color[ctx.src];
+  std::vector<float> *out = ctx.color[1 - ctx.src];
+  const std::vector<float> &variance = ctx.variance[ctx.src];
+  std::vector<float> &outVariance = ctx.variance[1 - ctx.src];
+
+  for (int y = y0; y < y1; y++) {
+    for (int x = 0; x < width; x++) {
+      int p = y * width + x;
+
+      float lp = Luminance(color[0][p], color[1][p], color[2][p]);
+      float zp = ctx.depth[p];
+      float np[3] = {ctx.normal[0][p], ctx.normal[1][p], ctx.normal[2][p]};
+      float sigmaL = kSigmaLuminance * sqrtf(ctx.blurred[p]) + 1.0e-6f;
+
+      float sum[3] = {0.0f, 0.0f, 0.0f};
+      float sumVariance = 0.0f;
+      float weight = 0.0f;
+
+      for (int v = -2; v <= 2; v++) {
+        int yy = y + v * step;
+        if ((yy < 0) || (yy >= height)) {
+          continue;
+        }
+        for (int u = -2; u <= 2; u++) {
+          int xx = x + u * step;
+          if ((xx < 0) || (xx >= width)) {
+            continue;
+          }
+          int q = yy * width + xx;
+
+          float w = kKernel[u + 2] * kKernel[v + 2];
+          if (q != p) {
+            float zq = ctx.depth[q];
+            if ((zp > 0.0f) != (zq > 0.0f)) {
+              continue; // Surface and background
+            }
+
+            // Depth, relative to the change expected along the surface.
+            float dz = fabsf(ctx.gradX[p] * (u * step)) +
+                       fabsf(ctx.gradY[p] * (v * step));
+            float wz = fabsf(zp - zq) / (kSigmaDepth * dz + 1.0e-3f);
+
+            float dotN = np[0] * ctx.normal[0][q] + np[1] * ctx.normal[1][q] +
+                         np[2] * ctx.normal[2][q];
+            float wn = (zp > 0.0f)
+                           ? powf((std::max)(0.0f, dotN), kSigmaNormal)
+                           : 1.0f;
+
+            float lq = Luminance(color[0][q], color[1][q], color[2][q]);
+            float wl = fabsf(lp - lq) / sigmaL;
+
+            w *= wn * expf(-wz - wl);
+          }
+
+          for (int k = 0; k < 3; k++) {
+            sum[k] += w * color[k][q];
+          }
+          sumVariance += w * w * variance[q];
+          weight += w;
+        }
+      }
+
+      // weight > 0: the center tap is always taken.
+      float invWeight = 1.0f / weight;
+      for (int k = 0; k < 3; k++) {
+        out[k][p] = sum[k] * invWeight;
+      }
+      outVariance[p] = sumVariance * invWeight * invWeight;
+    }
+  }
+}
+
+void RunStageRows(DenoiseContext &ctx, int stage, int task) {
+  int y0 = task * kRowsPerTask;
+  int y1 = (std::min)(y0 + kRowsPerTask, ctx.height);
+
+  if (stage == kStageSetup) {
+    Setup(ctx, y0, y1);
+  } else if (stage == kStageFeatures) {
+    Features(ctx, y0, y1);
+  } else if (stage == kStageBlurVariance) {
+    BlurVariance(ctx, y0, y1);
+  } else {
+    Filter(ctx, y0, y1);
+  }
+}
+
+#if !defined(_OPENMP) // Tasksys version
+typedef struct {
+  DenoiseContext *ctx;
+  int stage;
+} DenoiseTask;
+
+void DenoiseTaskFunc(void *data, int threadIndex, int threadCount,
+                     int taskIndex, int taskCount) {
+  const DenoiseTask *task = reinterpret_cast<const DenoiseTask *>(data);
+  RunStageRows(*(task->ctx), task->stage, taskIndex);
+}
+#endif
+
+// Run `stage` over all rows in parallel.
+void RunDenoiseStage(DenoiseContext &ctx, int stage) {
+  int numTasks = (ctx.height + kRowsPerTask - 1) / kRowsPerTask;
+
+#if !defined(_OPENMP) // Tasksys version
+  DenoiseTask task;
+  task.ctx = &ctx;
+  task.stage = stage;
+
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(DenoiseTaskFunc), &task,
+             numTasks);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < numTasks; i++) {
+    RunStageRows(ctx, stage, i);
+  }
+#endif
+}
+
+} // namespace
+
+bool mallie::Denoise(std::vector<float> &rgb, const AccumBuffer *accum,
+                     int numBuffers, int iterations) {
+  if ((numBuffers <= 0) || !accum[0].HasAOV()) {
+    return false;
+  }
+
+  DenoiseContext ctx;
+  ctx.accum = accum;
+  ctx.numBuffers = numBuffers;
+  ctx.width = accum[0].width;
+  ctx.height = accum[0].height;
+
+  size_t numPixels = size_t(ctx.width) * size_t(ctx.height);
+  for (int k = 0; k < 3; k++) {
+    ctx.albedo[k].resize(numPixels);
+    ctx.normal[k].resize(numPixels);
+    ctx.color[0][k].resize(numPixels);
+    ctx.color[1][k].resize(numPixels);
+  }
+  ctx.depth.resize(numPixels);
+  ctx.gradX.resize(numPixels);
+  ctx.gradY.resize(numPixels);
+  ctx.variance[0].resize(numPixels);
+  ctx.variance[1].resize(numPixels);
+  ctx.blurred.resize(numPixels);
+  ctx.src = 0;
+  ctx.step = 1;
+
+  RunDenoiseStage(ctx, kStageSetup);
+  RunDenoiseStage(ctx, kStageFeatures);
+
+  for (int i = 0; i < iterations; i++) {
+    RunDenoiseStage(ctx, kStageBlurVariance);
+    RunDenoiseStage(ctx, kStageFilter);
+    ctx.src = 1 - ctx.src;
+    ctx.step *= 2;
+  }
+
+  // Remodulate the albedo.
+  rgb.resize(3 * numPixels);
+  for (size_t i = 0; i < numPixels; i++) {
+    for (int k = 0; k < 3; k++) {
+      rgb[3 * i + k] = ctx.color[ctx.src][k][i] * ctx.albedo[k][i];
+    }
+  }
+
+  return true;
+}
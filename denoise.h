@@ -0,0 +1,22 @@
+#ifndef __MALLIE_DENOISE_H__
+#define __MALLIE_DENOISE_H__
+
+#include <vector>
+
+#include "render.h"
+
+namespace mallie {
+
+///< Edge-avoiding a-trous wavelet filter(Dammertz et al. 2010) with the
+///< variance guided weights of SVGF(Schied et al. 2017). The first-hit AOVs
+///< of the buffers guide the filter: the color is divided by the albedo so
+///< that textures are kept, and normal and depth stop the filter at edges.
+///< Per-pixel variance comes from the difference of two buffers(even and
+///< odd passes), or from the 3x3 neighbourhood with one buffer.
+///< Returns false when the buffers have no AOVs.
+bool Denoise(std::vector<float> &rgb, // out: RGB
+             const AccumBuffer *accum, int numBuffers, int iterations);
+
+} // namespace
+
+#endif // __MALLIE_DENOISE_H__
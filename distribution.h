@@ -0,0 +1,115 @@
+#ifndef __MALLIE_DISTRIBUTION_H__
+#define __MALLIE_DISTRIBUTION_H__
+
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+
+namespace mallie {
+
+///< Piecewise-constant 1D distribution over [0, 1).
+class Distribution1D {
+public:
+  Distribution1D() : integral_(0.0) {}
+  ~Distribution1D() {}
+
+  void Build(const real *f, int n) {
+    func_.assign(f, f + n);
+    cdf_.resize(n + 1);
+    cdf_[0] = 0.0;
+    for (int i = 0; i < n; i++) {
+      cdf_[i + 1] = cdf_[i] + func_[i] / n;
+    }
+
+    integral_ = cdf_[n];
+    if (integral_ <= 0.0) {
+      // Fall back to uniform.
+      for (int i = 1; i <= n; i++) {
+        cdf_[i] = (real)i / (real)n;
+      }
+    } else {
+      for (int i = 1; i <= n; i++) {
+        cdf_[i] /= integral_;
+      }
+    }
+  }
+
+  ///< Returns sample in [0, 1) and its PDF. `offset` is the selected bin.
+  real Sample(real &pdf, int &offset, real rnd) const {
+    int n = Count();
+    offset = (int)(std::upper_bound(cdf_.begin(), cdf_.end(), rnd) -
+                   cdf_.begin()) - 1;
+    offset = std::max(0, std::min(offset, n - 1));
+
+    pdf = Pdf(offset);
+
+    real du = rnd - cdf_[offset];
+    real width = cdf_[offset + 1] - cdf_[offset];
+    if (width > 0.0) {
+      du /= width;
+    }
+
+    return (offset + du) / n;
+  }
+
+  ///< PDF(w.r.t. [0, 1) measure) of the bin.
+  real Pdf(int offset) const {
+    if (integral_ <= 0.0) {
+      return 1.0;
+    }
+    return func_[offset] / integral_;
+  }
+
+  int Count() const { return (int)func_.size(); }
+
+  real Integral() const { return integral_; }
+
+private:
+  std::vector<real> func_;
+  std::vector<real> cdf_;
+  real integral_;
+};
+
+///< Piecewise-constant 2D distribution over [0, 1)^2. f[v * nu + u]
+class Distribution2D {
+public:
+  Distribution2D() {}
+  ~Distribution2D() {}
+
+  void Build(const real *f, int nu, int nv) {
+    conditional_.resize(nv);
+    std::vector<real> marginal(nv);
+    for (int v = 0; v < nv; v++) {
+      conditional_[v].Build(&f[v * nu], nu);
+      marginal[v] = conditional_[v].Integral();
+    }
+    marginal_.Build(&marginal.at(0), nv);
+  }
+
+  ///< Returns PDF of the sample(u, v) in [0, 1)^2 measure.
+  real Sample(real uv[2], const real rnd[2]) const {
+    real pdfs[2];
+    int v;
+    uv[1] = marginal_.Sample(pdfs[1], v, rnd[1]);
+    int u;
+    uv[0] = conditional_[v].Sample(pdfs[0], u, rnd[0]);
+    return pdfs[0] * pdfs[1];
+  }
+
+  real Pdf(const real uv[2]) const {
+    int nv = marginal_.Count();
+    int nu = conditional_[0].Count();
+    int iu = std::max(0, std::min((int)(uv[0] * nu), nu - 1));
+    int iv = std::max(0, std::min((int)(uv[1] * nv), nv - 1));
+    return conditional_[iv].Pdf(iu) * marginal_.Pdf(iv);
+  }
+
+private:
+  std::vector<Distribution1D> conditional_;
+  Distribution1D marginal_;
+};
+
+} // namespace
+
+#endif // __MALLIE_DISTRIBUTION_H__
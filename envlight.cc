@@ -0,0 +1,135 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "envlight.h"
+#include "tinyexr.h"
+
+using namespace mallie;
+
+namespace {
+
+// Same parameterization with Camera::GenerateEnvRay()
+inline real3 UVToDir(real u, real v) {
+  real theta = M_PI * v;
+  real phi = 2.0 * M_PI * u;
+  return real3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+inline void DirToUV(real &u, real &v, const real3 &dir) {
+  real theta = acos(std::max((real)-1.0, std::min((real)1.0, dir[1])));
+  real phi = atan2(dir[2], dir[0]);
+  if (phi < 0.0) {
+    phi += 2.0 * M_PI;
+  }
+  u = phi / (2.0 * M_PI);
+  v = theta / M_PI;
+}
+
+} // namespace
+
+EnvLight::EnvLight() : width_(0), height_(0), scale_(1.0) {
+  SetConstant(real3(0.0, 0.0, 0.0));
+}
+
+EnvLight::~EnvLight() {}
+
+bool EnvLight::Load(const char *filename, real scale) {
+  float *rgba = NULL;
+  int width, height;
+  const char *err = NULL;
+
+  int ret = LoadEXR(&rgba, &width, &height, filename, &err);
+  if (ret != 0) {
+    if (err) {
+      fprintf(stderr, "[EnvLight] %s\n", err);
+    }
+    return false;
+  }
+
+  width_ = width;
+  height_ = height;
+  scale_ = scale;
+  image_.resize(3 * width * height);
+  for (size_t i = 0; i < (size_t)width * height; i++) {
+    image_[3 * i + 0] = rgba[4 * i + 0];
+    image_[3 * i + 1] = rgba[4 * i + 1];
+    image_[3 * i + 2] = rgba[4 * i + 2];
+  }
+
+  free(rgba);
+
+  BuildDistribution();
+
+  return true;
+}
+
+void EnvLight::SetConstant(const real3 &radiance) {
+  width_ = 1;
+  height_ = 1;
+  scale_ = 1.0;
+  image_.resize(3);
+  image_[0] = radiance[0];
+  image_[1] = radiance[1];
+  image_[2] = radiance[2];
+
+  BuildDistribution();
+}
+
+void EnvLight::BuildDistribution() {
+  std::vector<real> f(width_ * height_);
+  for (int y = 0; y < height_; y++) {
+    // Compensate for the distortion of lat-long mapping.
+    real sinTheta = sin(M_PI * (y + 0.5) / height_);
+    for (int x = 0; x < width_; x++) {
+      const float *c = &image_[3 * (y * width_ + x)];
+      real lum = 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+      f[y * width_ + x] = std::max((real)0.0, lum) * sinTheta;
+    }
+  }
+
+  distribution_.Build(&f.at(0), width_, height_);
+}
+
+int EnvLight::Lookup(const real3 &dir) const {
+  real u, v;
+  DirToUV(u, v, dir);
+  int x = std::max(0, std::min((int)(u * width_), width_ - 1));
+  int y = std::max(0, std::min((int)(v * height_), height_ - 1));
+  return y * width_ + x;
+}
+
+real3 EnvLight::Radiance(const real3 &dir) const {
+  int i = Lookup(dir);
+  return real3(image_[3 * i + 0], image_[3 * i + 1], image_[3 * i + 2]) *
+         scale_;
+}
+
+real EnvLight::Sample(real3 &dir, real3 &radiance, const real rnd[2]) const {
+  real uv[2];
+  real pdf = distribution_.Sample(uv, rnd);
+
+  real sinTheta = sin(M_PI * uv[1]);
+  if ((pdf <= 0.0) || (sinTheta <= 0.0)) {
+    return 0.0;
+  }
+
+  dir = UVToDir(uv[0], uv[1]);
+  radiance = Radiance(dir);
+
+  // (u, v) -> solid angle
+  return pdf / (2.0 * M_PI * M_PI * sinTheta);
+}
+
+real EnvLight::Pdf(const real3 &dir) const {
+  real uv[2];
+  DirToUV(uv[0], uv[1], dir);
+
+  real sinTheta = sin(M_PI * uv[1]);
+  if (sinTheta <= 0.0) {
+    return 0.0;
+  }
+
+  return distribution_.Pdf(uv) / (2.0 * M_PI * M_PI * sinTheta);
+}
@@ -0,0 +1,51 @@
+#ifndef __MALLIE_ENVLIGHT_H__
+#define __MALLIE_ENVLIGHT_H__
+
+#include <vector>
+
+#include "common.h"
+#include "distribution.h"
+
+namespace mallie {
+
+///< Environment light from equirectangular(latitude-longitude) map. Y up.
+///< Importance sampled with piecewise-constant 2D distribution of the map.
+class EnvLight {
+public:
+  EnvLight();
+  ~EnvLight();
+
+  ///< Load HDR environment map from OpenEXR file.
+  bool Load(const char *filename, real scale = 1.0);
+
+  ///< Set constant radiance(dome light).
+  void SetConstant(const real3 &radiance);
+
+  ///< Radiance arriving from direction `dir`(pointing to the environment).
+  real3 Radiance(const real3 &dir) const;
+
+  ///< Sample incoming direction. Returns PDF in solid angle measure.
+  real Sample(real3 &dir, real3 &radiance, const real rnd[2]) const;
+
+  ///< PDF of direction `dir` in solid angle measure.
+  real Pdf(const real3 &dir) const;
+
+  int Width() const { return width_; }
+  int Height() const { return height_; }
+
+private:
+  void BuildDistribution();
+
+  int Lookup(const real3 &dir) const;
+
+  int width_;
+  int height_;
+  std::vector<float> image_; // RGB
+  real scale_;
+
+  Distribution2D distribution_;
+};
+
+} // namespace
+
+#endif // __MALLIE_ENVLIGHT_H__
@@ -0,0 +1,333 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "guiding.h"
+#include "atomic.h"
+
+using namespace mallie;
+
+namespace {
+
+const int kMaxDTreeDepth = 20;
+const int kMaxSpatialDepth = 16;
+const int kSpatialSplitSamples = 4000; // x sqrt(# of passes) to split a leaf
+const float kDTreeThreshold = 0.01f;   // Energy fraction to subdivide
+
+// Direction <-> [0, 1)^2. The cylindrical mapping is equal area, thus the
+// solid angle pdf is the square pdf / 4pi.
+void DirToSquare(real &x, real &y, const real3 &dir) {
+  real cosTheta = (std::min)((real)1.0, (std::max)((real)-1.0, dir[2]));
+  real phi = atan2(dir[1], dir[0]);
+  if (phi < 0.0) {
+    phi += 2.0 * M_PI;
+  }
+
+  x = (std::min)(0.5 * (cosTheta + 1.0), 1.0 - 1.0e-7);
+  y = (std::min)(phi / (2.0 * M_PI), 1.0 - 1.0e-7);
+}
+
+real3 SquareToDir(real x, real y) {
+  real cosTheta = 2.0 * x - 1.0;
+  real sinTheta = sqrt((std::max)((real)0.0, 1.0 - cosTheta * cosTheta));
+  real phi = 2.0 * M_PI * y;
+  return real3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+} // namespace
+
+DTree::DTree() : total_(0.0f) {
+  Node root;
+  memset(&root, 0, sizeof(Node));
+  nodes_.push_back(root);
+}
+
+DTree::~DTree() {}
+
+real DTree::Sample(real3 &dir, const real rnd[2]) const {
+  real u = rnd[0];
+  real v = rnd[1];
+  real x0 = 0.0, y0 = 0.0, size = 1.0;
+  real pdf = 1.0;
+
+  int node = 0;
+  for (;;) {
+    const float *s = nodes_[node].sum;
+    real total = s[0] + s[1] + s[2] + s[3];
+    if (total <= 0.0) {
+      break; // Uniform in the remaining region
+    }
+
+    // Column(x), then the row(y) in the column.
+    int xi, yi;
+    real pLeft = (s[0] + s[2]) / total;
+    if (u < pLeft) {
+      xi = 0;
+      u = u / pLeft;
+    } else {
+      xi = 1;
+      u = (u - pLeft) / (1.0 - pLeft);
+    }
+
+    real pBottom = s[xi] / (s[xi] + s[xi + 2]);
+    if (v < pBottom) {
+      yi = 0;
+      v = v / pBottom;
+    } else {
+      yi = 1;
+      v = (v - pBottom) / (1.0 - pBottom);
+    }
+    u = (std::min)(u, 1.0 - 1.0e-7);
+    v = (std::min)(v, 1.0 - 1.0e-7);
+
+    int i = xi + 2 * yi;
+    pdf *= 4.0 * s[i] / total;
+    size *= 0.5;
+    x0 += xi * size;
+    y0 += yi * size;
+
+    if (nodes_[node].child[i] == 0) {
+      break;
+    }
+    node = nodes_[node].child[i];
+  }
+
+  dir = SquareToDir(x0 + u * size, y0 + v * size);
+  return pdf / (4.0 * M_PI);
+}
+
+real DTree::Pdf(const real3 &dir) const {
+  real x, y;
+  DirToSquare(x, y, dir);
+
+  real pdf = 1.0;
+  int node = 0;
+  for (;;) {
+    const float *s = nodes_[node].sum;
+    real total = s[0] + s[1] + s[2] + s[3];
+    if (total <= 0.0) {
+      break;
+    }
+
+    int xi = (x < 0.5) ? 0 : 1;
+    int yi = (y < 0.5) ? 0 : 1;
+    x = 2.0 * x - xi;
+    y = 2.0 * y - yi;
+
+    int i = xi + 2 * yi;
+    pdf *= 4.0 * s[i] / total;
+
+    if ((s[i] <= 0.0f) || (nodes_[node].child[i] == 0)) {
+      break;
+    }
+    node = nodes_[node].child[i];
+  }
+
+  return pdf / (4.0 * M_PI);
+}
+
+void DTree::Record(const real3 &dir, float value) {
+  if (!(value > 0.0f)) { // Also rejects NaN
+    return;
+  }
+
+  real x, y;
+  DirToSquare(x, y, dir);
+
+  int node = 0;
+  for (;;) {
+    int xi = (x < 0.5) ? 0 : 1;
+    int yi = (y < 0.5) ? 0 : 1;
+    x = 2.0 * x - xi;
+    y = 2.0 * y - yi;
+
+    int i = xi + 2 * yi;
+    if (nodes_[node].child[i] == 0) {
+      AtomicAdd(&nodes_[node].sum[i], value);
+      return;
+    }
+    node = nodes_[node].child[i];
+  }
+}
+
+float DTree::BuildNode(int node) {
+  float total = 0.0f;
+  for (int i = 0; i < 4; i++) {
+    if (nodes_[node].child[i]) {
+      nodes_[node].sum[i] = BuildNode(nodes_[node].child[i]);
+    }
+    total += nodes_[node].sum[i];
+  }
+  return total;
+}
+
+void DTree::Build() { total_ = BuildNode(0); }
+
+void DTree::RefineNode(int node, const DTree &src, int srcNode,
+                       const float sums[4], float threshold, int depth) {
+  for (int i = 0; i < 4; i++) {
+    if ((depth >= kMaxDTreeDepth) || (sums[i] <= threshold)) {
+      nodes_[node].sum[i] = sums[i]; // Keep the energy learned so far
+      continue;
+    }
+
+    Node child;
+    memset(&child, 0, sizeof(Node));
+    int childIndex = int(nodes_.size());
+    nodes_.push_back(child);
+    nodes_[node].child[i] = childIndex;
+
+    // Energy of the sub-quadrants. Spread evenly when `src` has no detail.
+    int srcChild = (srcNode >= 0) ? src.nodes_[srcNode].child[i] : 0;
+    float childSums[4];
+    for (int k = 0; k < 4; k++) {
+      childSums[k] = srcChild ? src.nodes_[srcChild].sum[k] : 0.25f * sums[i];
+    }
+
+    RefineNode(childIndex, src, srcChild ? srcChild : -1, childSums,
+               threshold, depth + 1);
+  }
+}
+
+void DTree::Refine(const DTree &src, float threshold) {
+  Node root;
+  memset(&root, 0, sizeof(Node));
+  nodes_.clear();
+  nodes_.push_back(root);
+  total_ = 0.0f;
+
+  if (src.total_ <= 0.0f) {
+    return;
+  }
+
+  RefineNode(0, src, 0, src.nodes_[0].sum, threshold * src.total_, 1);
+}
+
+void DTree::Scale(float s) {
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    for (int k = 0; k < 4; k++) {
+      nodes_[i].sum[k] *= s;
+    }
+  }
+  total_ *= s;
+}
+
+GuidingField::GuidingField() : size_(0.0), iteration_(0) {}
+
+GuidingField::~GuidingField() {}
+
+void GuidingField::Init(const real3 &bmin, const real3 &bmax) {
+  real3 extent = bmax - bmin;
+  size_ = (std::max)(extent[0], (std::max)(extent[1], extent[2]));
+  size_ *= 1.01; // Margin
+  real3 center = (bmin + bmax) * 0.5;
+  origin_ = center - real3(0.5 * size_, 0.5 * size_, 0.5 * size_);
+  iteration_ = 0;
+
+  SpatialNode root;
+  root.child = 0;
+  root.dtree = 0;
+  root.samples = 0;
+  root.depth = 0;
+
+  nodes_.clear();
+  nodes_.push_back(root);
+
+  sampling_.clear();
+  sampling_.push_back(DTree());
+  building_.clear();
+  building_.push_back(DTree());
+}
+
+int GuidingField::FindLeaf(const real3 &P) const {
+  real p[3];
+  for (int j = 0; j < 3; j++) {
+    p[j] = (P[j] - origin_[j]) / size_;
+    p[j] = (std::min)((std::max)(p[j], (real)0.0), 1.0 - 1.0e-7);
+  }
+
+  int node = 0;
+  while (nodes_[node].child) {
+    int octant = 0;
+    for (int j = 0; j < 3; j++) {
+      p[j] *= 2.0;
+      if (p[j] >= 1.0) {
+        octant |= (1 << j);
+        p[j] -= 1.0;
+      }
+    }
+    node = nodes_[node].child + octant;
+  }
+
+  return node;
+}
+
+const DTree *GuidingField::Lookup(const real3 &P) const {
+  if (nodes_.empty()) {
+    return NULL;
+  }
+
+  const DTree &dtree = sampling_[nodes_[FindLeaf(P)].dtree];
+  return dtree.IsTrained() ? &dtree : NULL;
+}
+
+void GuidingField::Record(const real3 &P, const real3 &dir, float value) {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  SpatialNode &leaf = nodes_[FindLeaf(P)];
+  AtomicIncrement(&leaf.samples);
+  building_[leaf.dtree].Record(dir, value);
+}
+
+void GuidingField::Update() {
+  if (nodes_.empty()) {
+    return;
+  }
+
+  iteration_++;
+
+  // 1. Learned energy becomes the sampling distribution.
+  for (size_t i = 0; i < building_.size(); i++) {
+    building_[i].Build();
+  }
+  sampling_ = building_;
+
+  // 2. Split octree leaves which received many records. Children start from
+  //    the parent's distribution and share its records.
+  int threshold = int(kSpatialSplitSamples * sqrt(double(iteration_)));
+  size_t numNodes = nodes_.size();
+  for (size_t n = 0; n < numNodes; n++) {
+    if (nodes_[n].child || (nodes_[n].samples < threshold) ||
+        (nodes_[n].depth >= kMaxSpatialDepth)) {
+      continue;
+    }
+
+    int dtree = nodes_[n].dtree;
+    sampling_[dtree].Scale(1.0f / 8.0f);
+
+    int firstChild = int(nodes_.size());
+    for (int k = 0; k < 8; k++) {
+      SpatialNode child;
+      child.child = 0;
+      child.samples = nodes_[n].samples / 8;
+      child.depth = nodes_[n].depth + 1;
+      if (k == 0) {
+        child.dtree = dtree; // Reuse the parent's
+      } else {
+        child.dtree = int(sampling_.size());
+        sampling_.push_back(sampling_[dtree]);
+        building_.push_back(DTree()); // Refined below
+      }
+      nodes_.push_back(child);
+    }
+    nodes_[n].child = firstChild;
+  }
+
+  // 3. New structure for the next pass, which keeps accumulating the energy.
+  for (size_t i = 0; i < building_.size(); i++) {
+    building_[i].Refine(sampling_[i], kDTreeThreshold);
+  }
+}
@@ -0,0 +1,105 @@
+#ifndef __MALLIE_GUIDING_H__
+#define __MALLIE_GUIDING_H__
+
+#include <vector>
+
+#include "common.h"
+
+namespace mallie {
+
+///< Directional distribution over the sphere. Stored as a quadtree over the
+///< cylindrical(equal area) mapping (cosTheta, phi) of directions, so that
+///< each quadrant keeps the energy which arrived through it.
+class DTree {
+public:
+  DTree();
+  ~DTree();
+
+  bool IsTrained() const { return total_ > 0.0f; }
+
+  ///< Sample a direction proportional to the stored energy.
+  ///< Returns the solid angle pdf.
+  real Sample(real3 &dir, const real rnd[2]) const;
+
+  ///< Solid angle pdf of `dir`.
+  real Pdf(const real3 &dir) const;
+
+  ///< Add energy arriving along `dir`. Thread safe, the tree structure is not
+  ///< modified.
+  void Record(const real3 &dir, float value);
+
+  ///< Sum up recorded energy to the inner nodes. Called after the pass.
+  void Build();
+
+  ///< Rebuild the structure from the energy of `src`. Quadrants holding more
+  ///< than `threshold` of the total energy are subdivided. The energy of
+  ///< `src` is kept, so that records accumulate over passes.
+  void Refine(const DTree &src, float threshold);
+
+  void Scale(float s);
+
+  int NumNodes() const { return int(nodes_.size()); }
+
+private:
+  typedef struct {
+    float sum[4];
+    int child[4]; // 0 = leaf quadrant
+  } Node;
+
+  float BuildNode(int node);
+  void RefineNode(int node, const DTree &src, int srcNode, const float sums[4],
+                  float threshold, int depth);
+
+  std::vector<Node> nodes_;
+  float total_;
+};
+
+///< Spatial-directional radiance cache for path guiding(after Mueller et al.
+///< 2017, "Practical Path Guiding"). An octree over the scene bounds holds a
+///< DTree in each leaf. Paths of the current pass record their incident
+///< radiance into the `building` trees while sampling uses the `sampling`
+///< trees learned in the previous passes. Update() swaps them at the end of
+///< each pass and refines both the octree and the quadtrees. Records are
+///< accumulated over all passes.
+class GuidingField {
+public:
+  GuidingField();
+  ~GuidingField();
+
+  void Init(const real3 &bmin, const real3 &bmax);
+  bool IsInitialized() const { return !nodes_.empty(); }
+
+  ///< Sampling distribution at `P`, NULL if nothing is learned there yet.
+  const DTree *Lookup(const real3 &P) const;
+
+  ///< Record incident radiance(`value` = luminance / pdf) arriving at `P`
+  ///< along `dir`. Thread safe.
+  void Record(const real3 &P, const real3 &dir, float value);
+
+  ///< End of pass.
+  void Update();
+
+  int Iteration() const { return iteration_; }
+
+private:
+  typedef struct {
+    int child; // First of 8 children, 0 = leaf
+    int dtree; // Leaf only
+    int samples;
+    int depth;
+  } SpatialNode;
+
+  int FindLeaf(const real3 &P) const;
+
+  real3 origin_; // Cube enclosing the scene
+  real size_;
+  int iteration_;
+
+  std::vector<SpatialNode> nodes_;
+  std::vector<DTree> sampling_;
+  std::vector<DTree> building_;
+};
+
+} // namespace
+
+#endif // __MALLIE_GUIDING_H__
@@ -28,10 +28,25 @@
 #include <vector>
 #include <cmath>
 #include <cstring>
-//#include "math.hxx"
+#include <algorithm>
+#include <utility>
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "vector3.h"
 
+#if !defined(_OPENMP)
+// Defined in tasksys.cc
+extern "C" {
+void ISPCLaunch(void **handlePtr, void *f, void *data, int count);
+void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+void ISPCSync(void *handle);
+}
+#endif
+
 namespace glrs {
 
 class vector3i {
@@ -51,9 +66,65 @@ public:
   int x, y;
 };
 
+typedef void (*HashGridBlockFunc)(void *data, int block);
+
+#if !defined(_OPENMP) // Tasksys version
+typedef struct {
+  HashGridBlockFunc func;
+  void *data;
+} HashGridBlockTask;
+
+inline void HashGridBlockTaskFunc(void *data, int threadIndex,
+                                  int threadCount, int taskIndex,
+                                  int taskCount) {
+  const HashGridBlockTask *task =
+      reinterpret_cast<const HashGridBlockTask *>(data);
+  task->func(task->data, taskIndex);
+}
+#endif
+
+// Run func(data, block) for each block in parallel.
+inline void HashGridParallelFor(HashGridBlockFunc func, void *data,
+                                int numBlocks) {
+  if (numBlocks == 1) {
+    func(data, 0);
+    return;
+  }
+
+#if !defined(_OPENMP) // Tasksys version
+  HashGridBlockTask task;
+  task.func = func;
+  task.data = data;
+
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(HashGridBlockTaskFunc), &task,
+             numBlocks);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < numBlocks; i++) {
+    func(data, i);
+  }
+#endif
+}
+
+///< Uniform hash grid over particles, all queried with the same radius.
+///< Particles must provide `vector3 GetPosition() const`, queries
+///< `vector3 GetPosition() const` and `void Process(const tParticle &)`.
+///<
+///< Build runs in parallel: particles are split into blocks, each block
+///< counts its cells into its own histogram, the histograms are prefix-summed
+///< in parallel over cell ranges, then each block scatters its particles.
+///< The resulting order is the same as the serial build.
 class HashGrid {
 public:
-  void Reserve(int aNumCells) { mCellEnds.resize(aNumCells); }
+  HashGrid()
+      : mRadius(0.f), mRadiusSqr(0.f), mCellSize(0.f), mInvCellSize(0.f) {}
+
+  void Reserve(int aNumCells) { mCellEnds.resize(std::max(aNumCells, 1)); }
 
   template <typename tParticle>
   void Build(const std::vector<tParticle> &aParticles, float aRadius) {
@@ -62,73 +133,264 @@ public:
     mCellSize = mRadius * 2.f;
     mInvCellSize = 1.f / mCellSize;
 
+    if (mCellEnds.empty()) {
+      Reserve(int(aParticles.size()));
+    }
+
+    BuildContext<tParticle> ctx;
+    ctx.grid = this;
+    ctx.particles = &aParticles;
+    ctx.numParticles = int(aParticles.size());
+    ctx.numCells = int(mCellEnds.size());
+    ctx.numBlocks = NumBuildBlocks(aParticles.size());
+    ctx.blockSize = (ctx.numParticles + ctx.numBlocks - 1) / ctx.numBlocks;
+    ctx.blockMin.resize(ctx.numBlocks, vector3(0.0f, 0.0f, 0.0f));
+    ctx.blockMax.resize(ctx.numBlocks, vector3(0.0f, 0.0f, 0.0f));
+    ctx.rangeStarts.resize(ctx.numBlocks);
+
+    // 1. Bounding box
+    HashGridParallelFor(&BoundsBlock<tParticle>, &ctx, ctx.numBlocks);
+
     mBBoxMin = vector3(1e36f, 1e36f, 1e36f);
     mBBoxMax = vector3(-1e36f, -1e36f, -1e36f);
-
-    for (size_t i = 0; i < aParticles.size(); i++) {
-      const vector3 &pos = aParticles[i].GetPosition();
+    for (int b = 0; b < ctx.numBlocks; b++) {
       for (int j = 0; j < 3; j++) {
-        mBBoxMax[j] = std::max(mBBoxMax[j], pos[j]);
-        mBBoxMin[j] = std::min(mBBoxMin[j], pos[j]);
+        mBBoxMin[j] = std::min(mBBoxMin[j], ctx.blockMin[b][j]);
+        mBBoxMax[j] = std::max(mBBoxMax[j], ctx.blockMax[b][j]);
       }
     }
 
     mIndices.resize(aParticles.size());
-    memset(&mCellEnds[0], 0, mCellEnds.size() * sizeof(int));
+    mCellOf.resize(aParticles.size());
+    mHistogram.assign(size_t(ctx.numBlocks) * ctx.numCells, 0);
 
-    // set mCellEnds[x] to number of particles within x
-    for (size_t i = 0; i < aParticles.size(); i++) {
-      const vector3 &pos = aParticles[i].GetPosition();
-      mCellEnds[GetCellIndex(pos)]++;
-    }
+    // 2. Per-block cell histogram
+    HashGridParallelFor(&CountBlock<tParticle>, &ctx, ctx.numBlocks);
+
+    // 3. Exclusive prefix sum over (cell, block). Cells are split into
+    //    ranges: sum each range, scan the sums, then scan inside the ranges.
+    HashGridParallelFor(&RangeSumBlock<tParticle>, &ctx, ctx.numBlocks);
 
-    // run exclusive prefix sum to really get the cell starts
-    // mCellEnds[x] is now where the cell starts
     int sum = 0;
-    for (size_t i = 0; i < mCellEnds.size(); i++) {
-      int temp = mCellEnds[i];
-      mCellEnds[i] = sum;
+    for (int r = 0; r < ctx.numBlocks; r++) {
+      int temp = ctx.rangeStarts[r];
+      ctx.rangeStarts[r] = sum;
       sum += temp;
     }
 
-    for (size_t i = 0; i < aParticles.size(); i++) {
-      const vector3 &pos = aParticles[i].GetPosition();
-      const int targetIdx = mCellEnds[GetCellIndex(pos)]++;
-      mIndices[targetIdx] = int(i);
-    }
+    HashGridParallelFor(&RangeScanBlock<tParticle>, &ctx, ctx.numBlocks);
+
+    // 4. Scatter. mHistogram[(b, x)] is where block b writes into cell x.
+    HashGridParallelFor(&ScatterBlock<tParticle>, &ctx, ctx.numBlocks);
 
     // now mCellEnds[x] points to the index right after the last
     // element of cell x
-
-    //// DEBUG
-    // for(size_t i=0; i<aParticles.size(); i++)
-    //{
-    //    const vector3 &pos  = aParticles[i].GetPosition();
-    //    vector2i range = GetCellRange(GetCellIndex(pos));
-    //    bool found = false;
-    //    for(;range.x < range.y; range.x++)
-    //    {
-    //        if(mIndices[range.x] == i)
-    //            found = true;
-    //    }
-    //    if(!found)
-    //        printf("Error at particle %d\n", i);
-    //}
   }
 
   template <typename tParticle, typename tQuery>
-  void Process(const std::vector<tParticle> &aParticles, tQuery &aQuery) {
+  void Process(const std::vector<tParticle> &aParticles,
+               tQuery &aQuery) const {
+    if (mIndices.empty()) {
+      return;
+    }
+
     const vector3 queryPos = aQuery.GetPosition();
 
-    const vector3 distMin = queryPos - mBBoxMin;
-    const vector3 distMax = mBBoxMax - queryPos;
+    int cells[8];
+    int numCells = GetNeighborCells(cells, queryPos);
+
+    for (int j = 0; j < numCells; j++) {
+      vector2i activeRange = GetCellRange(cells[j]);
+
+      for (; activeRange.x < activeRange.y; activeRange.x++) {
+        const int particleIndex = mIndices[activeRange.x];
+        const tParticle &particle = aParticles[particleIndex];
+
+        const float distSqr =
+            (queryPos - particle.GetPosition()).sqr_length();
+
+        if (distSqr <= mRadiusSqr)
+          aQuery.Process(particle);
+      }
+    }
+  }
+
+  ///< Process many queries at once. Queries are visited in the order of
+  ///< their cells, so that neighboring queries reuse the same cells.
+  template <typename tParticle, typename tQuery>
+  void ProcessBatch(const std::vector<tParticle> &aParticles,
+                    std::vector<tQuery> &aQueries) const {
+    if (mIndices.empty() || aQueries.empty()) {
+      return;
+    }
+
+    std::vector<std::pair<int, int> > order(aQueries.size());
+    for (size_t i = 0; i < aQueries.size(); i++) {
+      const vector3 queryPos = aQueries[i].GetPosition();
+      order[i].first = IsInside(queryPos) ? GetCellIndex(queryPos) : -1;
+      order[i].second = int(i);
+    }
+
+    std::sort(order.begin(), order.end());
+
+    for (size_t i = 0; i < order.size(); i++) {
+      if (order[i].first < 0) {
+        continue; // Outside of the grid
+      }
+      Process(aParticles, aQueries[order[i].second]);
+    }
+  }
+
+  float GetRadius() const { return mRadius; }
+
+private:
+  static const int kMinBlockSize = 4096; // particles
+  static const int kMaxBuildBlocks = 16;
+
+  template <typename tParticle> struct BuildContext {
+    HashGrid *grid;
+    const std::vector<tParticle> *particles;
+    int numParticles;
+    int numCells;
+    int numBlocks;
+    int blockSize;
+    std::vector<vector3> blockMin;
+    std::vector<vector3> blockMax;
+    std::vector<int> rangeStarts;
+
+    void ParticleRange(int block, int &begin, int &end) const {
+      begin = std::min(block * blockSize, numParticles);
+      end = std::min(begin + blockSize, numParticles);
+    }
+
+    void CellRange(int block, int &begin, int &end) const {
+      int rangeSize = (numCells + numBlocks - 1) / numBlocks;
+      begin = std::min(block * rangeSize, numCells);
+      end = std::min(begin + rangeSize, numCells);
+    }
+  };
+
+  static int NumBuildBlocks(size_t aNumParticles) {
+    int maxBlocks = kMaxBuildBlocks;
+#ifdef _OPENMP
+    maxBlocks = std::min(maxBlocks, omp_get_max_threads());
+#endif
+    int blocks = int(aNumParticles / kMinBlockSize);
+    return std::max(1, std::min(blocks, maxBlocks));
+  }
+
+  template <typename tParticle>
+  static void BoundsBlock(void *data, int block) {
+    BuildContext<tParticle> *ctx =
+        reinterpret_cast<BuildContext<tParticle> *>(data);
+
+    vector3 bmin(1e36f, 1e36f, 1e36f);
+    vector3 bmax(-1e36f, -1e36f, -1e36f);
+
+    int begin, end;
+    ctx->ParticleRange(block, begin, end);
+    for (int i = begin; i < end; i++) {
+      const vector3 &pos = (*ctx->particles)[i].GetPosition();
+      for (int j = 0; j < 3; j++) {
+        bmax[j] = std::max(bmax[j], pos[j]);
+        bmin[j] = std::min(bmin[j], pos[j]);
+      }
+    }
+
+    ctx->blockMin[block] = bmin;
+    ctx->blockMax[block] = bmax;
+  }
+
+  template <typename tParticle>
+  static void CountBlock(void *data, int block) {
+    BuildContext<tParticle> *ctx =
+        reinterpret_cast<BuildContext<tParticle> *>(data);
+    HashGrid *grid = ctx->grid;
+    int *histogram = &grid->mHistogram[size_t(block) * ctx->numCells];
+
+    int begin, end;
+    ctx->ParticleRange(block, begin, end);
+    for (int i = begin; i < end; i++) {
+      const vector3 &pos = (*ctx->particles)[i].GetPosition();
+      int cell = grid->GetCellIndex(pos);
+      grid->mCellOf[i] = cell;
+      histogram[cell]++;
+    }
+  }
+
+  template <typename tParticle>
+  static void RangeSumBlock(void *data, int range) {
+    BuildContext<tParticle> *ctx =
+        reinterpret_cast<BuildContext<tParticle> *>(data);
+    const std::vector<int> &histogram = ctx->grid->mHistogram;
+
+    int begin, end;
+    ctx->CellRange(range, begin, end);
+    int sum = 0;
+    for (int b = 0; b < ctx->numBlocks; b++) {
+      const int *h = &histogram[size_t(b) * ctx->numCells];
+      for (int c = begin; c < end; c++) {
+        sum += h[c];
+      }
+    }
+    ctx->rangeStarts[range] = sum;
+  }
+
+  template <typename tParticle>
+  static void RangeScanBlock(void *data, int range) {
+    BuildContext<tParticle> *ctx =
+        reinterpret_cast<BuildContext<tParticle> *>(data);
+    HashGrid *grid = ctx->grid;
+
+    int begin, end;
+    ctx->CellRange(range, begin, end);
+    int sum = ctx->rangeStarts[range];
+    for (int c = begin; c < end; c++) {
+      for (int b = 0; b < ctx->numBlocks; b++) {
+        int &h = grid->mHistogram[size_t(b) * ctx->numCells + c];
+        int temp = h;
+        h = sum;
+        sum += temp;
+      }
+      grid->mCellEnds[c] = sum;
+    }
+  }
+
+  template <typename tParticle>
+  static void ScatterBlock(void *data, int block) {
+    BuildContext<tParticle> *ctx =
+        reinterpret_cast<BuildContext<tParticle> *>(data);
+    HashGrid *grid = ctx->grid;
+    int *histogram = &grid->mHistogram[size_t(block) * ctx->numCells];
+
+    int begin, end;
+    ctx->ParticleRange(block, begin, end);
+    for (int i = begin; i < end; i++) {
+      const int targetIdx = histogram[grid->mCellOf[i]]++;
+      grid->mIndices[targetIdx] = i;
+    }
+  }
+
+  // Whether a query at aPoint can find any particle. Points outside of the
+  // bounding box but within the radius of it can.
+  bool IsInside(const vector3 &aPoint) const {
     for (int i = 0; i < 3; i++) {
-      if (distMin[i] < 0.f)
-        return;
-      if (distMax[i] < 0.f)
-        return;
+      if ((aPoint[i] < mBBoxMin[i] - mRadius) ||
+          (aPoint[i] > mBBoxMax[i] + mRadius))
+        return false;
+    }
+    return true;
+  }
+
+  // Cells which can contain particles within the radius: the cell of the
+  // point and its neighbors toward the point. Returns # of distinct cells.
+  int GetNeighborCells(int aCells[8], const vector3 &aPoint) const {
+    if (!IsInside(aPoint)) {
+      return 0;
     }
 
+    const vector3 distMin = aPoint - mBBoxMin;
+
     const vector3 cellPt = mInvCellSize * distMin;
     const vector3 coordF(std::floor(cellPt[0]), std::floor(cellPt[1]),
                          std::floor(cellPt[2]));
@@ -143,51 +405,27 @@ public:
     const int pyo = py + (fractCoord[1] < 0.5f ? -1 : +1);
     const int pzo = pz + (fractCoord[2] < 0.5f ? -1 : +1);
 
-    int found = 0;
-
+    int numCells = 0;
     for (int j = 0; j < 8; j++) {
-      vector2i activeRange;
-      switch (j) {
-      case 0:
-        activeRange = GetCellRange(GetCellIndex(vector3i(px, py, pz)));
-        break;
-      case 1:
-        activeRange = GetCellRange(GetCellIndex(vector3i(px, py, pzo)));
-        break;
-      case 2:
-        activeRange = GetCellRange(GetCellIndex(vector3i(px, pyo, pz)));
-        break;
-      case 3:
-        activeRange = GetCellRange(GetCellIndex(vector3i(px, pyo, pzo)));
-        break;
-      case 4:
-        activeRange = GetCellRange(GetCellIndex(vector3i(pxo, py, pz)));
-        break;
-      case 5:
-        activeRange = GetCellRange(GetCellIndex(vector3i(pxo, py, pzo)));
-        break;
-      case 6:
-        activeRange = GetCellRange(GetCellIndex(vector3i(pxo, pyo, pz)));
-        break;
-      case 7:
-        activeRange = GetCellRange(GetCellIndex(vector3i(pxo, pyo, pzo)));
-        break;
+      int cell = GetCellIndex(vector3i((j & 4) ? pxo : px, (j & 2) ? pyo : py,
+                                       (j & 1) ? pzo : pz));
+
+      // Different coordinates may hash to the same cell.
+      bool found = false;
+      for (int k = 0; k < numCells; k++) {
+        if (aCells[k] == cell) {
+          found = true;
+          break;
+        }
       }
-
-      for (; activeRange.x < activeRange.y; activeRange.x++) {
-        const int particleIndex = mIndices[activeRange.x];
-        const tParticle &particle = aParticles[particleIndex];
-
-        const float distSqr =
-            (aQuery.GetPosition() - particle.GetPosition()).LenSqr();
-
-        if (distSqr <= mRadiusSqr)
-          aQuery.Process(particle);
+      if (!found) {
+        aCells[numCells++] = cell;
       }
     }
+
+    return numCells;
   }
 
-private:
   vector2i GetCellRange(int aCellIndex) const {
     if (aCellIndex == 0)
       return vector2i(0, mCellEnds[0]);
@@ -222,6 +460,10 @@ private:
   std::vector<int> mIndices;
   std::vector<int> mCellEnds;
 
+  // Build-time work buffers, kept to avoid reallocation per iteration.
+  std::vector<int> mCellOf;
+  std::vector<int> mHistogram; // [block][cell]
+
   float mRadius;
   float mRadiusSqr;
   float mCellSize;
@@ -0,0 +1,511 @@
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+#include "image_writer.h"
+#include "tinyexr.h"
+#include "jpge.h"
+
+using namespace mallie;
+
+namespace {
+
+inline unsigned char fclamp(float x) {
+  int i = x * 255.5;
+  if (i < 0)
+    return 0;
+  if (i > 255)
+    return 255;
+  return (unsigned char)i;
+}
+
+bool HasExtension(const std::string &filename, const char *ext) {
+  size_t n = strlen(ext);
+  if (filename.size() < n) {
+    return false;
+  }
+  std::string tail = filename.substr(filename.size() - n);
+  for (size_t i = 0; i < n; i++) {
+    if (tolower(tail[i]) != ext[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SaveJPEG(const std::string &filename, const float *rgb, int width,
+              int height) {
+  // Simple [0, 1] -> [0, 255]
+  std::vector<unsigned char> ldr(width * height * 3);
+  for (int i = 0; i < width * height * 3; i++) {
+    ldr[i] = fclamp(rgb[i]);
+  }
+
+  jpge::params comp_params;
+  comp_params.m_quality = 100;
+  return jpge::compress_image_to_jpeg_file_parallel(filename.c_str(), width,
+                                                    height, 3, &ldr.at(0),
+                                                    comp_params);
+}
+
+bool SaveEXR(const std::string &filename, const float *rgb, int width,
+             int height) {
+  std::vector<float> images[3];
+  for (int k = 0; k < 3; k++) {
+    images[k].resize(width * height);
+  }
+
+  // Channels are stored in B, G, R order.
+  for (int i = 0; i < width * height; i++) {
+    images[0][i] = rgb[3 * i + 2];
+    images[1][i] = rgb[3 * i + 1];
+    images[2][i] = rgb[3 * i + 0];
+  }
+
+  float *image_ptr[3];
+  image_ptr[0] = &(images[0].at(0));
+  image_ptr[1] = &(images[1].at(0));
+  image_ptr[2] = &(images[2].at(0));
+
+  EXRImage image;
+
+  image.num_channels = 3;
+  const char *channel_names[] = {"B", "G", "R"};
+
+  image.channel_names = channel_names;
+  image.images = image_ptr;
+  image.pixel_types = NULL; // HALF
+  image.width = width;
+  image.height = height;
+
+  const char *err;
+  int fail = SaveMultiChannelEXR(&image, filename.c_str(), &err);
+  if (fail) {
+    fprintf(stderr, "%s\n", err);
+    return false;
+  }
+  return true;
+}
+
+typedef struct {
+  const char *name;
+  int pixelType;
+  int source; // Color(0-2), kNumAOVs after 3 colors, then IDs and count
+} AOVChannel;
+
+const int kMaterialID = 3 + kNumAOVs;
+const int kFaceID = kMaterialID + 1;
+const int kCount = kMaterialID + 2;
+const int kMaxChannels = kCount + 1;
+
+bool CompareChannel(const AOVChannel &a, const AOVChannel &b) {
+  return strcmp(a.name, b.name) < 0;
+}
+
+// Channels of the EXR output sorted by name, as EXR requires: the beauty,
+// with the AOVs when `aov` is true. IDs, sample counts and positions are
+// stored as FLOAT so that they stay exact. Returns the # of channels.
+int GetChannels(AOVChannel channels[kMaxChannels], bool aov) {
+  const int kHalf = TINYEXR_PIXELTYPE_HALF;
+  const int kFloat = TINYEXR_PIXELTYPE_FLOAT;
+
+  const AOVChannel allChannels[] = {
+      {"R", kHalf, 0},
+      {"G", kHalf, 1},
+      {"B", kHalf, 2},
+      {"albedo.R", kHalf, 3 + kAOVAlbedoR},
+      {"albedo.G", kHalf, 3 + kAOVAlbedoG},
+      {"albedo.B", kHalf, 3 + kAOVAlbedoB},
+      {"N.X", kHalf, 3 + kAOVNormalX},
+      {"N.Y", kHalf, 3 + kAOVNormalY},
+      {"N.Z", kHalf, 3 + kAOVNormalZ},
+      {"P.X", kFloat, 3 + kAOVPositionX},
+      {"P.Y", kFloat, 3 + kAOVPositionY},
+      {"P.Z", kFloat, 3 + kAOVPositionZ},
+      {"Z", kFloat, 3 + kAOVDepth},
+      {"uv.U", kHalf, 3 + kAOVTexcoordU},
+      {"uv.V", kHalf, 3 + kAOVTexcoordV},
+      {"materialID", kFloat, kMaterialID},
+      {"faceID", kFloat, kFaceID},
+      {"sampleCount", kFloat, kCount}};
+
+  int numChannels = aov ? kMaxChannels : 3;
+  std::copy(allChannels, allChannels + numChannels, channels);
+  std::sort(channels, channels + numChannels, CompareChannel);
+
+  return numChannels;
+}
+
+// Value of the channel from `source` of pixel `i`.
+inline float ChannelValue(int source, size_t i, const float *rgb,
+                          const float *aov, const int *materialID,
+                          const int *faceID, const int *count) {
+  if (source < 3) {
+    return rgb[3 * i + source];
+  } else if (source < kMaterialID) {
+    return aov[kNumAOVs * i + (source - 3)];
+  } else if (source == kMaterialID) {
+    return float(materialID[i]);
+  } else if (source == kFaceID) {
+    return float(faceID[i]);
+  }
+  return float(count[i]);
+}
+
+// Beauty and AOVs in one EXR.
+bool SaveEXRWithAOV(const std::string &filename, const float *rgb,
+                    const float *aov, const int *materialID,
+                    const int *faceID, const int *count, int width,
+                    int height) {
+  AOVChannel channels[kMaxChannels];
+  int numChannels = GetChannels(channels, /* aov */ true);
+
+  size_t numPixels = size_t(width) * size_t(height);
+  std::vector<std::vector<float> > images(numChannels);
+  std::vector<float *> image_ptr(numChannels);
+  std::vector<const char *> channel_names(numChannels);
+  std::vector<int> pixel_types(numChannels);
+
+  for (int c = 0; c < numChannels; c++) {
+    std::vector<float> &image = images[c];
+    int source = channels[c].source;
+    image.resize(numPixels);
+    for (size_t i = 0; i < numPixels; i++) {
+      image[i] = ChannelValue(source, i, rgb, aov, materialID, faceID, count);
+    }
+    image_ptr[c] = &image.at(0);
+    channel_names[c] = channels[c].name;
+    pixel_types[c] = channels[c].pixelType;
+  }
+
+  EXRImage image;
+  image.num_channels = numChannels;
+  image.channel_names = &channel_names.at(0);
+  image.images = &image_ptr.at(0);
+  image.pixel_types = &pixel_types.at(0);
+  image.width = width;
+  image.height = height;
+
+  const char *err;
+  int fail = SaveMultiChannelEXR(&image, filename.c_str(), &err);
+  if (fail) {
+    fprintf(stderr, "%s\n", err);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+namespace mallie {
+
+bool SaveImage(const std::string &filename, const float *rgb, int width,
+               int height) {
+  if ((width <= 0) || (height <= 0)) {
+    return false;
+  }
+
+  if (HasExtension(filename, ".exr")) {
+    return SaveEXR(filename, rgb, width, height);
+  }
+  return SaveJPEG(filename, rgb, width, height);
+}
+
+} // namespace
+
+ImageWriter::ImageWriter(bool queue)
+    : thread_(NULL), queue_(queue), busy_(false), quit_(false),
+      numDropped_(0) {}
+
+ImageWriter::~ImageWriter() {
+  if (thread_) {
+    {
+      tthread::lock_guard<tthread::mutex> guard(mutex_);
+      quit_ = true;
+    }
+    cond_.notify_all();
+    thread_->join();
+    delete thread_;
+  }
+}
+
+void ImageWriter::Submit(const AccumBuffer *accum, int numBuffers,
+                         const std::string &filename) {
+  if (numBuffers <= 0) {
+    return;
+  }
+
+  int width = accum[0].width;
+  int height = accum[0].height;
+
+  // The mean is taken without the lock, so that concurrent submissions and
+  // the writer thread don't wait for each other.
+  Snapshot snapshot;
+  snapshot.width = width;
+  snapshot.height = height;
+  snapshot.filename = filename;
+  snapshot.rgb.resize(3 * width * height);
+
+  bool aov = accum[0].HasAOV();
+  if (aov) {
+    snapshot.aov.resize(kNumAOVs * width * height);
+    snapshot.materialID.resize(width * height);
+    snapshot.faceID.resize(width * height);
+    snapshot.count.resize(width * height);
+  }
+
+  for (int i = 0; i < width * height; i++) {
+    double c[3] = {0.0, 0.0, 0.0};
+    int count = 0;
+    for (int b = 0; b < numBuffers; b++) {
+      for (int k = 0; k < 3; k++) {
+        c[k] += accum[b].color[3 * i + k];
+      }
+      count += accum[b].count[i];
+    }
+    double scale = (count > 0) ? 1.0 / count : 0.0;
+    for (int k = 0; k < 3; k++) {
+      snapshot.rgb[3 * i + k] = float(c[k] * scale);
+    }
+
+    if (aov) {
+      float *values = &snapshot.aov[kNumAOVs * i];
+      std::fill(values, values + kNumAOVs, 0.0f);
+      snapshot.materialID[i] = -1;
+      snapshot.faceID[i] = -1;
+      for (int b = 0; b < numBuffers; b++) {
+        for (int k = 0; k < kNumAOVs; k++) {
+          values[k] += accum[b].aov[kNumAOVs * i + k];
+        }
+        if (accum[b].count[i] > 0) {
+          snapshot.materialID[i] = accum[b].materialID[i];
+          snapshot.faceID[i] = accum[b].faceID[i];
+        }
+      }
+      for (int k = 0; k < kNumAOVs; k++) {
+        values[k] = float(values[k] * scale);
+      }
+      snapshot.count[i] = count;
+    }
+  }
+
+  Push(snapshot);
+}
+
+void ImageWriter::Submit(const std::vector<float> &rgb, int width,
+                         int height, const std::string &filename) {
+  Snapshot snapshot;
+  snapshot.width = width;
+  snapshot.height = height;
+  snapshot.filename = filename;
+  snapshot.rgb = rgb;
+
+  Push(snapshot);
+}
+
+void ImageWriter::Flush() {
+  tthread::lock_guard<tthread::mutex> guard(mutex_);
+  while (!pending_.empty() || busy_) {
+    cond_.wait(mutex_);
+  }
+}
+
+void ImageWriter::WaitPending() {
+  tthread::lock_guard<tthread::mutex> guard(mutex_);
+  while (!pending_.empty()) {
+    cond_.wait(mutex_);
+  }
+}
+
+// The buffers are swapped, not copied.
+void ImageWriter::Swap(Snapshot &a, Snapshot &b) {
+  a.rgb.swap(b.rgb);
+  a.aov.swap(b.aov);
+  a.materialID.swap(b.materialID);
+  a.faceID.swap(b.faceID);
+  a.count.swap(b.count);
+  a.filename.swap(b.filename);
+  std::swap(a.width, b.width);
+  std::swap(a.height, b.height);
+}
+
+// Moves `snapshot` to the pending ones.
+void ImageWriter::Push(Snapshot &snapshot) {
+  {
+    tthread::lock_guard<tthread::mutex> guard(mutex_);
+
+    if (!queue_ && !pending_.empty()) {
+      numDropped_ += int(pending_.size());
+      pending_.clear();
+    }
+
+    pending_.push_back(Snapshot());
+    Swap(pending_.back(), snapshot);
+
+    if (!thread_) {
+      thread_ = new tthread::thread(ThreadFunc, this);
+    }
+  }
+
+  cond_.notify_all();
+}
+
+void ImageWriter::ThreadFunc(void *arg) {
+  reinterpret_cast<ImageWriter *>(arg)->Run();
+}
+
+void ImageWriter::Run() {
+  for (;;) {
+    {
+      tthread::lock_guard<tthread::mutex> guard(mutex_);
+      while (pending_.empty() && !quit_) {
+        cond_.wait(mutex_);
+      }
+      if (pending_.empty()) { // quit
+        return;
+      }
+
+      // Take the oldest pending snapshot.
+      Swap(writing_, pending_.front());
+      pending_.pop_front();
+      busy_ = true;
+    }
+    cond_.notify_all(); // For WaitPending()
+
+    bool ok;
+    if (!writing_.aov.empty() && HasExtension(writing_.filename, ".exr")) {
+      ok = SaveEXRWithAOV(writing_.filename, &writing_.rgb.at(0),
+                          &writing_.aov.at(0), &writing_.materialID.at(0),
+                          &writing_.faceID.at(0), &writing_.count.at(0),
+                          writing_.width, writing_.height);
+    } else {
+      ok = !writing_.rgb.empty() &&
+           SaveImage(writing_.filename, &writing_.rgb.at(0), writing_.width,
+                     writing_.height);
+    }
+    if (ok) {
+      printf("Mallie:info\tmsg:Saved [ %s ]\n", writing_.filename.c_str());
+    } else {
+      printf("Mallie:error\tmsg:Failed to save [ %s ]\n",
+             writing_.filename.c_str());
+    }
+    fflush(stdout);
+
+    {
+      tthread::lock_guard<tthread::mutex> guard(mutex_);
+      busy_ = false;
+    }
+    cond_.notify_all();
+  }
+}
+
+TiledEXRWriter::TiledEXRWriter()
+    : writer_(NULL), tileSize_(0), aov_(false), numWritten_(0),
+      numTiles_(0) {}
+
+TiledEXRWriter::~TiledEXRWriter() { Close(); }
+
+bool TiledEXRWriter::Open(const std::string &filename, int width, int height,
+                          int tileSize, bool aov) {
+  Close();
+
+  AOVChannel channels[kMaxChannels];
+  int numChannels = GetChannels(channels, aov);
+
+  const char *channel_names[kMaxChannels];
+  int pixel_types[kMaxChannels];
+  for (int c = 0; c < numChannels; c++) {
+    channel_names[c] = channels[c].name;
+    pixel_types[c] = channels[c].pixelType;
+  }
+
+  EXRImage header;
+  header.num_channels = numChannels;
+  header.channel_names = channel_names;
+  header.images = NULL;
+  header.pixel_types = pixel_types;
+  header.width = width;
+  header.height = height;
+
+  const char *err;
+  if (BeginTiledEXR(&writer_, &header, tileSize, tileSize, filename.c_str(),
+                    &err)) {
+    fprintf(stderr, "%s\n", err);
+    writer_ = NULL;
+    return false;
+  }
+
+  tileSize_ = tileSize;
+  aov_ = aov;
+  numWritten_ = 0;
+  numTiles_ = ((width + tileSize - 1) / tileSize) *
+              ((height + tileSize - 1) / tileSize);
+  return true;
+}
+
+bool TiledEXRWriter::Write(const AccumBuffer &bucket, int x, int y) {
+  if (aov_ && !bucket.HasAOV()) {
+    return false; // Tiles must have the channels of the header.
+  }
+
+  AOVChannel channels[kMaxChannels];
+  int numChannels = GetChannels(channels, aov_);
+
+  // Means of the pixels, then the channels of the tile.
+  size_t numPixels = size_t(bucket.width) * size_t(bucket.height);
+  std::vector<float> rgb(3 * numPixels);
+  std::vector<float> aov(aov_ ? kNumAOVs * numPixels : 0);
+  for (size_t i = 0; i < numPixels; i++) {
+    bucket.Get(&rgb[3 * i], int(i));
+    if (!aov.empty()) {
+      bucket.GetAOV(&aov[kNumAOVs * i], int(i));
+    }
+  }
+
+  std::vector<std::vector<float> > images(numChannels);
+  std::vector<const float *> image_ptr(numChannels);
+  for (int c = 0; c < numChannels; c++) {
+    images[c].resize(numPixels);
+    for (size_t i = 0; i < numPixels; i++) {
+      images[c][i] = ChannelValue(
+          channels[c].source, i, &rgb.at(0), aov.empty() ? NULL : &aov.at(0),
+          aov.empty() ? NULL : &bucket.materialID.at(0),
+          aov.empty() ? NULL : &bucket.faceID.at(0), &bucket.count.at(0));
+    }
+    image_ptr[c] = &images[c].at(0);
+  }
+
+  tthread::lock_guard<tthread::mutex> guard(mutex_);
+
+  if (!writer_) {
+    return false;
+  }
+
+  const char *err;
+  if (WriteEXRTile(writer_, x / tileSize_, y / tileSize_, &image_ptr.at(0),
+                   &err)) {
+    fprintf(stderr, "%s\n", err);
+    return false;
+  }
+
+  numWritten_++;
+  return true;
+}
+
+bool TiledEXRWriter::Close() {
+  tthread::lock_guard<tthread::mutex> guard(mutex_);
+
+  if (!writer_) {
+    return false;
+  }
+
+  const char *err;
+  int fail = EndTiledEXR(writer_, &err);
+  writer_ = NULL;
+  if (fail) {
+    fprintf(stderr, "%s\n", err);
+    return false;
+  }
+  return true;
+}
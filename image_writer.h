@@ -0,0 +1,114 @@
+#ifndef __MALLIE_IMAGE_WRITER_H__
+#define __MALLIE_IMAGE_WRITER_H__
+
+#include <deque>
+#include <vector>
+#include <string>
+
+#include "render.h"
+#include "tinyexr.h"
+#include "tinythread.h"
+
+namespace mallie {
+
+///< Save a linear RGB image. JPEG or EXR is chosen by the extension of
+///< `filename`. Returns false on failure.
+bool SaveImage(const std::string &filename, const float *rgb, int width,
+               int height);
+
+///< Asynchronous image output. Submit() copies the mean of accumulation
+///< buffers into a snapshot and returns, and a dedicated thread encodes it.
+///< AOVs of the buffers are written together with the image to .exr files.
+///< Snapshots are double buffered: while one is being written, a newer
+///< submission replaces the pending one, so the renderer never waits for
+///< the encoder. With `queue`, every submission is kept and written in
+///< order(e.g. the views of a batch); Flush() waits for all of them.
+class ImageWriter {
+public:
+  explicit ImageWriter(bool queue = false);
+  ~ImageWriter(); ///< Writes the pending snapshot before returning.
+
+  ///< Snapshot of the sum of `numBuffers` accumulation buffers(e.g. the even
+  ///< and odd passes) to be saved as `filename`.
+  void Submit(const AccumBuffer *accum, int numBuffers,
+              const std::string &filename);
+
+  ///< Snapshot of a linear RGB image(e.g. denoised).
+  void Submit(const std::vector<float> &rgb, int width, int height,
+              const std::string &filename);
+
+  ///< Wait until all submitted snapshots are written.
+  void Flush();
+
+  ///< Wait until the writer thread takes the pending snapshot, so that the
+  ///< next Submit() does not replace it. The snapshot being written is not
+  ///< waited for, e.g. a frame is written while the next one is rendered.
+  void WaitPending();
+
+  ///< # of snapshots replaced before they are written.
+  int NumDropped() const { return numDropped_; }
+
+private:
+  typedef struct {
+    std::vector<float> rgb; // Mean of the pixels
+    std::vector<float> aov; // Mean AOVs, empty when disabled
+    std::vector<int> materialID;
+    std::vector<int> faceID;
+    std::vector<int> count;
+    int width;
+    int height;
+    std::string filename;
+  } Snapshot;
+
+  static void Swap(Snapshot &a, Snapshot &b);
+  void Push(Snapshot &snapshot);
+
+  static void ThreadFunc(void *arg);
+  void Run();
+
+  tthread::thread *thread_;
+  tthread::mutex mutex_;
+  tthread::condition_variable cond_;
+
+  std::deque<Snapshot> pending_; // Guarded by mutex_
+  Snapshot writing_;             // Owned by the writer thread
+  bool queue_;
+  bool busy_;
+  bool quit_;
+  int numDropped_;
+};
+
+///< Tiled EXR output of RenderBuckets(). Buckets are written as tiles when
+///< they are finished, thus the image is never in memory as a whole. Write()
+///< may be called from the render threads.
+class TiledEXRWriter {
+public:
+  TiledEXRWriter();
+  ~TiledEXRWriter(); ///< Closes the file.
+
+  ///< Beauty, with the AOVs when `aov` is true. `tileSize` is the bucket
+  ///< size.
+  bool Open(const std::string &filename, int width, int height, int tileSize,
+            bool aov);
+
+  ///< Mean of `bucket`, whose first pixel is (`x`, `y`) of the image.
+  bool Write(const AccumBuffer &bucket, int x, int y);
+
+  ///< Writes the offsets of the tiles and closes the file.
+  bool Close();
+
+  int NumWritten() const { return numWritten_; }
+  int NumTiles() const { return numTiles_; }
+
+private:
+  tthread::mutex mutex_;
+  EXRTiledWriter *writer_; // Guarded by mutex_
+  int tileSize_;
+  bool aov_;
+  int numWritten_;
+  int numTiles_;
+};
+
+} // namespace
+
+#endif // __MALLIE_IMAGE_WRITER_H__
@@ -9,6 +9,7 @@
 #include "magicavoxel_loader.h"
 #include "mesh_loader.h"
 #include "eson.h"
+#include "parson.h"
 
 namespace {
 
@@ -23,17 +24,49 @@ void calcNormal(real3& N, real3 v0, real3 v1, real3 v2)
 
 }
 
-bool MeshLoader::LoadObj(Mesh &mesh, const char *filename) {
+bool MeshLoader::LoadObj(Mesh &mesh, std::vector<Material> &materials,
+                         const char *filename) {
   std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
+  std::vector<tinyobj::material_t> objMaterials;
 
-  std::string err = tinyobj::LoadObj(shapes, materials, filename);
+  std::string err = tinyobj::LoadObj(shapes, objMaterials, filename);
 
   if (!err.empty()) {
     std::cerr << err << std::endl;
     return false;
   }
 
+  std::cout << "[LoadOBJ] # of materials in .obj : " << objMaterials.size()
+            << std::endl;
+
+  materials.clear();
+  for (size_t i = 0; i < objMaterials.size(); i++) {
+    Material m;
+    m.diffuse[0] = objMaterials[i].diffuse[0];
+    m.diffuse[1] = objMaterials[i].diffuse[1];
+    m.diffuse[2] = objMaterials[i].diffuse[2];
+    m.emission[0] = objMaterials[i].emission[0];
+    m.emission[1] = objMaterials[i].emission[1];
+    m.emission[2] = objMaterials[i].emission[2];
+
+    // illum 3, 5: mirror reflection. 4, 6, 7, 9: glass(reflection + refraction)
+    int illum = objMaterials[i].illum;
+    if ((illum >= 3) && (illum <= 7)) {
+      m.reflection[0] = objMaterials[i].specular[0];
+      m.reflection[1] = objMaterials[i].specular[1];
+      m.reflection[2] = objMaterials[i].specular[2];
+    }
+    if ((illum == 4) || (illum == 6) || (illum == 7) || (illum == 9)) {
+      m.refraction[0] = objMaterials[i].transmittance[0];
+      m.refraction[1] = objMaterials[i].transmittance[1];
+      m.refraction[2] = objMaterials[i].transmittance[2];
+      m.ior = objMaterials[i].ior;
+    }
+
+    m.id = i;
+    materials.push_back(m);
+  }
+
   std::cout << "[LoadOBJ] # of shapes in .obj : " << shapes.size() << std::endl;
 
   size_t numVertices = 0;
@@ -399,3 +432,87 @@ bool MeshLoader::LoadMagicaVoxel(Mesh &mesh, std::vector<Material> &materials,
 
   return true;
 }
+
+bool MeshLoader::LoadMaterialJSON(std::vector<Material> &materials,
+                                  const char *filename) {
+  JSON_Value *root = json_parse_file(filename);
+  if (json_value_get_type(root) != JSONArray) {
+    fprintf(stderr, "Failed to load material file: %s\n", filename);
+    json_value_free(root);
+    return false;
+  }
+
+  JSON_Array *array = json_value_get_array(root);
+
+  for (size_t i = 0; i < json_array_get_count(array); i++) {
+    JSON_Object *object = json_array_get_object(array, i);
+    if (!object) {
+      continue;
+    }
+
+    if (json_value_get_type(json_object_get_value(object, "id")) !=
+        JSONNumber) {
+      continue;
+    }
+    int id = (int)json_object_get_number(object, "id");
+    if (id < 0) {
+      continue;
+    }
+
+    if (id >= (int)materials.size()) {
+      materials.resize(id + 1);
+    }
+
+    Material &m = materials[id];
+    m.id = id;
+
+    if (json_value_get_type(json_object_dotget_value(
+            object, "params.diffuse")) == JSONArray) {
+      JSON_Array *v = json_object_dotget_array(object, "params.diffuse");
+      if (json_array_get_count(v) == 3) {
+        m.diffuse[0] = json_array_get_number(v, 0);
+        m.diffuse[1] = json_array_get_number(v, 1);
+        m.diffuse[2] = json_array_get_number(v, 2);
+      }
+    }
+
+    if (json_value_get_type(json_object_dotget_value(
+            object, "params.emission")) == JSONArray) {
+      JSON_Array *v = json_object_dotget_array(object, "params.emission");
+      if (json_array_get_count(v) == 3) {
+        m.emission[0] = json_array_get_number(v, 0);
+        m.emission[1] = json_array_get_number(v, 1);
+        m.emission[2] = json_array_get_number(v, 2);
+      }
+    }
+
+    if (json_value_get_type(json_object_dotget_value(
+            object, "params.reflection")) == JSONArray) {
+      JSON_Array *v = json_object_dotget_array(object, "params.reflection");
+      if (json_array_get_count(v) == 3) {
+        m.reflection[0] = json_array_get_number(v, 0);
+        m.reflection[1] = json_array_get_number(v, 1);
+        m.reflection[2] = json_array_get_number(v, 2);
+      }
+    }
+
+    if (json_value_get_type(json_object_dotget_value(
+            object, "params.refraction")) == JSONArray) {
+      JSON_Array *v = json_object_dotget_array(object, "params.refraction");
+      if (json_array_get_count(v) == 3) {
+        m.refraction[0] = json_array_get_number(v, 0);
+        m.refraction[1] = json_array_get_number(v, 1);
+        m.refraction[2] = json_array_get_number(v, 2);
+      }
+    }
+
+    if (json_value_get_type(json_object_dotget_value(object, "params.ior")) ==
+        JSONNumber) {
+      m.ior = json_object_dotget_number(object, "params.ior");
+    }
+  }
+
+  json_value_free(root);
+
+  return true;
+}
@@ -1,6 +1,8 @@
 #ifndef __MESH_LOADER_H__
 #define __MESH_LOADER_H__
 
+#include <vector>
+
 #include "mesh.h"
 #include "material.h"
 
@@ -8,9 +10,10 @@ class MeshLoader {
 public:
   MeshLoader();
 
-  ///< Load wavefront obj data from a file.
+  ///< Load wavefront obj data(and its .mtl materials) from a file.
   ///< Allocated memory for the mesh must be free'ed by the application.
-  static bool LoadObj(Mesh &mesh, const char *filename);
+  static bool LoadObj(Mesh &mesh, std::vector<Material> &materials,
+                      const char *filename);
 
   ///< Load ESON mesh from a file.
   ///< Allocated memory for the mesh must be free'ed by the application.
@@ -22,6 +25,11 @@ public:
   ///< Allocated memory for the mesh must be free'ed by the application.
   static bool LoadMagicaVoxel(Mesh &mesh, std::vector<Material> &materials,
                               const char *filename);
+
+  ///< Load material parameters(diffuse, emission) from JSON file and
+  ///< overwrite `materials`[id]. Grows `materials` if required.
+  static bool LoadMaterialJSON(std::vector<Material> &materials,
+                               const char *filename);
 };
 
 #endif // __MESH_LOADER_H__
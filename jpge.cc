@@ -26,6 +26,17 @@
 #include <malloc.h>
 #endif
 
+#if !defined(_OPENMP)
+#include <stdint.h>
+
+// Defined in tasksys.cc of mallie
+extern "C" {
+void ISPCLaunch(void **handlePtr, void *f, void *data, int count);
+void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+void ISPCSync(void *handle);
+}
+#endif
+
 #define JPGE_MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define JPGE_MIN(a, b) (((a) < (b)) ? (a) : (b))
 
@@ -38,10 +49,12 @@ static inline void jpge_free(void *p) { free(p); }
 enum {
   M_SOF0 = 0xC0,
   M_DHT = 0xC4,
+  M_RST0 = 0xD0,
   M_SOI = 0xD8,
   M_EOI = 0xD9,
   M_SOS = 0xDA,
   M_DQT = 0xDB,
+  M_DRI = 0xDD,
   M_APP0 = 0xE0
 };
 enum {
@@ -476,6 +489,13 @@ void jpeg_encoder::emit_dhts() {
   }
 }
 
+// Emit restart interval(in MCUs)
+void jpeg_encoder::emit_dri() {
+  emit_marker(M_DRI);
+  emit_word(4);
+  emit_word(m_restart_mcu_rows * m_mcus_per_row);
+}
+
 // emit start of scan
 void jpeg_encoder::emit_sos() {
   emit_marker(M_SOS);
@@ -500,6 +520,8 @@ void jpeg_encoder::emit_markers() {
   emit_dqt();
   emit_sof();
   emit_dhts();
+  if (m_restart_mcu_rows)
+    emit_dri();
   emit_sos();
 }
 
@@ -559,6 +581,7 @@ void jpeg_encoder::first_pass_init() {
   m_bits_in = 0;
   memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
   m_mcu_y_ofs = 0;
+  m_mcu_row_index = 0;
   m_pass_num = 1;
 }
 
@@ -574,7 +597,8 @@ bool jpeg_encoder::second_pass_init() {
                           m_huff_bits[2 + 1], m_huff_val[2 + 1]);
   }
   first_pass_init();
-  emit_markers();
+  if (!m_band_flag)
+    emit_markers();
   m_pass_num = 2;
   return true;
 }
@@ -634,6 +658,11 @@ bool jpeg_encoder::jpg_open(int p_x_res, int p_y_res, int src_channels) {
   m_image_bpl_mcu = m_image_x_mcu * m_num_components;
   m_mcus_per_row = m_image_x_mcu / m_mcu_x;
 
+  // The restart interval is a 16 bit # of MCUs.
+  m_restart_mcu_rows = m_params.m_restart_mcu_rows;
+  if (m_restart_mcu_rows * m_mcus_per_row > 0xFFFF)
+    m_restart_mcu_rows = 0xFFFF / m_mcus_per_row;
+
   if ((m_mcu_lines[0] = static_cast<uint8 *>(
            jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL)
     return false;
@@ -974,7 +1003,8 @@ bool jpeg_encoder::terminate_pass_one() {
 bool jpeg_encoder::terminate_pass_two() {
   put_bits(0x7F, 7);
   flush_output_buffer();
-  emit_marker(M_EOI);
+  if (!m_band_flag)
+    emit_marker(M_EOI);
   m_pass_num++; // purposely bump up m_pass_num, for debugging
   return true;
 }
@@ -1037,13 +1067,34 @@ void jpeg_encoder::load_mcu(const void *pSrc) {
   if (++m_mcu_y_ofs == m_mcu_y) {
     process_mcu_row();
     m_mcu_y_ofs = 0;
+
+    m_mcu_row_index++;
+    if (m_restart_mcu_rows && ((m_mcu_row_index % m_restart_mcu_rows) == 0) &&
+        (m_mcu_row_index * m_mcu_y < m_image_y))
+      emit_restart();
   }
 }
 
+// End of a restart interval: the bits are padded with 1s to a byte boundary
+// and followed by RSTn. DC prediction starts over.
+void jpeg_encoder::emit_restart() {
+  if (m_pass_num == 2) {
+    put_bits(0x7F, 7);
+    m_bit_buffer = 0;
+    m_bits_in = 0;
+    flush_output_buffer();
+    emit_marker(M_RST0 + ((m_mcu_row_index / m_restart_mcu_rows - 1) & 7));
+  }
+  memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+}
+
 void jpeg_encoder::clear() {
   m_mcu_lines[0] = NULL;
   m_pass_num = 0;
   m_all_stream_writes_succeeded = true;
+  m_restart_mcu_rows = 0;
+  m_mcu_row_index = 0;
+  m_band_flag = false;
 }
 
 jpeg_encoder::jpeg_encoder() { clear(); }
@@ -1062,6 +1113,21 @@ bool jpeg_encoder::init(output_stream *pStream, int width, int height,
   return jpg_open(width, height, src_channels);
 }
 
+bool jpeg_encoder::init_band(output_stream *pStream, int width, int height,
+                             int src_channels, const params &comp_params) {
+  deinit();
+  // Optimized Huffman tables would differ between the bands.
+  if (((!pStream) || (width < 1) || (height < 1)) ||
+      ((src_channels != 1) && (src_channels != 3) && (src_channels != 4)) ||
+      (!comp_params.check()) || comp_params.m_two_pass_flag)
+    return false;
+  m_pStream = pStream;
+  m_params = comp_params;
+  m_params.m_restart_mcu_rows = 0; // The band is one interval
+  m_band_flag = true;
+  return jpg_open(width, height, src_channels);
+}
+
 void jpeg_encoder::deinit() {
   jpge_free(m_mcu_lines[0]);
   clear();
@@ -1149,6 +1215,140 @@ bool compress_image_to_jpeg_file(const char *pFilename, int width, int height,
   return dst_stream.close();
 }
 
+// Memory stream which grows as needed. Holds a band of the parallel encoder.
+class growable_memory_stream : public output_stream {
+  growable_memory_stream(const growable_memory_stream &);
+  growable_memory_stream &operator=(const growable_memory_stream &);
+
+  uint8 *m_pBuf;
+  uint m_buf_size, m_buf_ofs;
+
+public:
+  growable_memory_stream() : m_pBuf(NULL), m_buf_size(0), m_buf_ofs(0) {}
+
+  virtual ~growable_memory_stream() { jpge_free(m_pBuf); }
+
+  virtual bool put_buf(const void *pBuf, int len) {
+    if (m_buf_ofs + len > m_buf_size) {
+      uint new_size = JPGE_MAX(m_buf_ofs + len, m_buf_size * 2);
+      uint8 *pNew_buf = static_cast<uint8 *>(realloc(m_pBuf, new_size));
+      if (!pNew_buf)
+        return false;
+      m_pBuf = pNew_buf;
+      m_buf_size = new_size;
+    }
+    memcpy(m_pBuf + m_buf_ofs, pBuf, len);
+    m_buf_ofs += len;
+    return true;
+  }
+
+  const uint8 *get_buf() const { return m_pBuf; }
+  uint get_size() const { return m_buf_ofs; }
+};
+
+// A band between restart markers. Bands are encoded independently.
+struct band_task {
+  growable_memory_stream *bands;
+  bool *band_ok;
+  int width, height, num_channels, band_height;
+  const uint8 *pImage_data;
+  const params *pParams;
+};
+
+static void encode_band(const band_task &task, int b) {
+  int start_y = b * task.band_height;
+  int end_y = JPGE_MIN(start_y + task.band_height, task.height);
+  int pitch = task.width * task.num_channels;
+
+  jpge::jpeg_encoder band;
+  bool ok = band.init_band(&task.bands[b], task.width, end_y - start_y,
+                           task.num_channels, *task.pParams);
+  for (int i = start_y; ok && (i < end_y); i++) {
+    ok = band.process_scanline(task.pImage_data + i * pitch);
+  }
+  task.band_ok[b] = ok && band.process_scanline(NULL);
+}
+
+#if !defined(_OPENMP) // Tasksys version
+static void encode_band_task(void *data, int threadIndex, int threadCount,
+                             int taskIndex, int taskCount) {
+  encode_band(*reinterpret_cast<band_task *>(data), taskIndex);
+}
+#endif
+
+// Writes JPEG image to file, encoding the bands between restart markers in
+// parallel.
+bool compress_image_to_jpeg_file_parallel(const char *pFilename, int width,
+                                          int height, int num_channels,
+                                          const uint8 *pImage_data,
+                                          const params &comp_params) {
+  if (comp_params.m_two_pass_flag)
+    return compress_image_to_jpeg_file(pFilename, width, height, num_channels,
+                                       pImage_data, comp_params);
+
+  params band_params = comp_params;
+  if (band_params.m_restart_mcu_rows == 0)
+    band_params.m_restart_mcu_rows = 1;
+
+  cfile_stream dst_stream;
+  if (!dst_stream.open(pFilename))
+    return false;
+
+  // Markers up to the start of scan, with the restart interval.
+  jpge::jpeg_encoder header;
+  if (!header.init(&dst_stream, width, height, num_channels, band_params))
+    return false;
+
+  int band_height = header.get_restart_scanlines();
+  int num_bands = (height + band_height - 1) / band_height;
+
+  growable_memory_stream *bands = new growable_memory_stream[num_bands];
+  bool *band_ok = new bool[num_bands];
+
+  band_task task;
+  task.bands = bands;
+  task.band_ok = band_ok;
+  task.width = width;
+  task.height = height;
+  task.num_channels = num_channels;
+  task.band_height = band_height;
+  task.pImage_data = pImage_data;
+  task.pParams = &band_params;
+
+#if !defined(_OPENMP) // Tasksys version
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+  ISPCLaunch(&handle, reinterpret_cast<void *>(encode_band_task), &task,
+             num_bands);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int b = 0; b < num_bands; b++) {
+    encode_band(task, b);
+  }
+#endif
+
+  bool ok = true;
+  for (int b = 0; ok && (b < num_bands); b++) {
+    ok = band_ok[b] && dst_stream.put_buf(bands[b].get_buf(),
+                                          int(bands[b].get_size()));
+    if (b + 1 < num_bands) {
+      uint8 rst[2] = {0xFF, uint8(M_RST0 + (b & 7))};
+      ok = ok && dst_stream.put_buf(rst, 2);
+    }
+  }
+
+  uint8 eoi[2] = {0xFF, M_EOI};
+  ok = ok && dst_stream.put_buf(eoi, 2);
+
+  delete[] bands;
+  delete[] band_ok;
+  header.deinit();
+
+  return dst_stream.close() && ok;
+}
+
 class memory_stream : public output_stream {
   memory_stream(const memory_stream &);
   memory_stream &operator=(const memory_stream &);
@@ -20,13 +20,15 @@ enum subsampling_t { Y_ONLY = 0, H1V1 = 1, H2V1 = 2, H2V2 = 3 };
 struct params {
   inline params()
       : m_quality(85), m_subsampling(H2V2), m_no_chroma_discrim_flag(false),
-        m_two_pass_flag(false) {}
+        m_two_pass_flag(false), m_restart_mcu_rows(0) {}
 
   inline bool check() const {
     if ((m_quality < 1) || (m_quality > 100))
       return false;
     if ((uint)m_subsampling > (uint)H2V2)
       return false;
+    if (m_restart_mcu_rows < 0)
+      return false;
     return true;
   }
 
@@ -45,6 +47,11 @@ struct params {
   bool m_no_chroma_discrim_flag;
 
   bool m_two_pass_flag;
+
+  // Restart markers every m_restart_mcu_rows rows of MCUs(0 = none). Bands
+  // between the markers are coded independently, which allows parallel
+  // encoding.
+  int m_restart_mcu_rows;
 };
 
 // Writes JPEG image to a file.
@@ -54,6 +61,16 @@ bool compress_image_to_jpeg_file(const char *pFilename, int width, int height,
                                  int num_channels, const uint8 *pImage_data,
                                  const params &comp_params = params());
 
+// Same as compress_image_to_jpeg_file(), but the image is split into bands of
+// m_restart_mcu_rows(1 if 0) MCU rows separated by restart markers, which
+// are encoded in parallel(OpenMP) and concatenated. The output does not depend
+// on the # of threads. Two pass encoding(optimized Huffman tables) needs the
+// statistics of the whole image first, thus it is encoded sequentially.
+bool compress_image_to_jpeg_file_parallel(const char *pFilename, int width,
+                                          int height, int num_channels,
+                                          const uint8 *pImage_data,
+                                          const params &comp_params = params());
+
 // Writes JPEG image to memory buffer.
 // On entry, buf_size is the size of the output buffer pointed at by pBuf, which
 // should be at least ~1024 bytes.
@@ -93,8 +110,18 @@ public:
   bool init(output_stream *pStream, int width, int height, int src_channels,
             const params &comp_params = params());
 
+  // Initializes the compressor for one band between restart markers(used by
+  // the parallel encoder). Only the coded data of `height` scanlines is
+  // written, padded to a byte boundary at the end: no markers, no DC
+  // prediction from the previous band.
+  bool init_band(output_stream *pStream, int width, int height,
+                 int src_channels, const params &comp_params = params());
+
   const params &get_params() const { return m_params; }
 
+  // # of scanlines between restart markers, 0 when no restart marker.
+  int get_restart_scanlines() const { return m_restart_mcu_rows * m_mcu_y; }
+
   // Deinitializes the compressor, freeing any allocated memory. May be called
   // at any time.
   void deinit();
@@ -143,6 +170,9 @@ private:
   uint m_bits_in;
   uint8 m_pass_num;
   bool m_all_stream_writes_succeeded;
+  int m_restart_mcu_rows; // Clamped so that the interval fits 16 bits
+  int m_mcu_row_index;    // MCU rows coded in the pass
+  bool m_band_flag;
 
   void optimize_huffman_table(int table_num, int table_len);
   void emit_byte(uint8 i);
@@ -153,6 +183,8 @@ private:
   void emit_sof();
   void emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag);
   void emit_dhts();
+  void emit_dri();
+  void emit_restart();
   void emit_sos();
   void emit_markers();
   void compute_huffman_table(uint *codes, uint8 *code_sizes, uint8 *bits,
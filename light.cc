@@ -2,7 +2,54 @@
 
 using namespace mallie;
 
-real AreaLight::SampleL(real posRnd[2], real dirRnd[2]) const {
-  assert(0);
-  return 0.0;
+namespace {
+
+// Cosine-weighted direction around `N`. Returns PDF in solid angle measure.
+real SampleCosineHemisphere(real3 &dir, const real3 &N, const real rnd[2]) {
+  real3 tangent;
+  if (fabs(N[0]) > 0.9) {
+    tangent = real3(0.0, 1.0, 0.0);
+  } else {
+    tangent = real3(1.0, 0.0, 0.0);
+  }
+  real3 binormal = vcross(N, tangent);
+  binormal.normalize();
+  tangent = vcross(binormal, N);
+
+  real phi = 2.0 * M_PI * rnd[0];
+  real cosTheta = sqrt(1.0 - rnd[1]);
+  real sinTheta = sqrt(rnd[1]);
+
+  dir = tangent * (cos(phi) * sinTheta) + binormal * (sin(phi) * sinTheta) +
+        N * cosTheta;
+
+  return cosTheta / M_PI;
+}
+
+} // namespace
+
+real Light::SampleL(real3 &P, real3 &N, real3 &dir, real &pdfW,
+                    const real posRnd[2], const real dirRnd[2]) const {
+  real pdfA = SamplePosition(P, N, posRnd);
+  pdfW = SampleCosineHemisphere(dir, N, dirRnd);
+  return pdfA;
+}
+
+real AreaLight::SamplePosition(real3 &P, real3 &N,
+                               const real posRnd[2]) const {
+  P = corner_ + du_ * posRnd[0] + dv_ * posRnd[1];
+  N = normal_;
+  return 1.0 / area_;
+}
+
+real TriangleLight::SamplePosition(real3 &P, real3 &N,
+                                   const real posRnd[2]) const {
+  // Uniform sampling of triangle.
+  real su = sqrt(posRnd[0]);
+  real b0 = 1.0 - su;
+  real b1 = posRnd[1] * su;
+
+  P = p0_ + e1_ * b0 + e2_ * b1;
+  N = normal_;
+  return 1.0 / area_;
 }
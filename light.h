@@ -4,10 +4,13 @@
 #include "common.h"
 
 #include <cassert>
+#include <algorithm>
 
 namespace mallie {
 
 class Light {
+public:
+  virtual ~Light() {}
 
   virtual real3 Radiance() const = 0;
 
@@ -17,26 +20,99 @@ class Light {
   // Whether the light has delta function(point, directional) or not(area)
   virtual bool IsDelta() const = 0;
 
+  // Surface area of the light.
+  virtual real Area() const = 0;
+
+  // Total emitted power. Used for light selection.
+  real3 Power() const { return Radiance() * (Area() * M_PI); }
+
+  // Sample a point on the light surface. Returns PDF in area measure.
+  virtual real SamplePosition(real3 &P, real3 &N,
+                              const real posRnd[2]) const = 0;
+
   // Sample light position and direction, and its PDFs.
-  virtual real SampleL(real posRnd[2], real dirRnd[2]) const = 0;
+  // Returns PDF of the position in area measure. `pdfW` is the PDF of the
+  // emitted direction in solid angle measure.
+  real SampleL(real3 &P, real3 &N, real3 &dir, real &pdfW,
+               const real posRnd[2], const real dirRnd[2]) const;
 };
 
+// Parallelogram light spanned by `du` and `dv` at `corner`.
 class AreaLight : public Light {
 public:
-  AreaLight(const real3 &corner, const real3 &du, const real3 &dv) {
-    assert(0); // @todo
+  AreaLight(const real3 &corner, const real3 &du, const real3 &dv)
+      : corner_(corner), du_(du), dv_(dv), radiance_(1.0, 1.0, 1.0) {
+    normal_ = vcross(du_, dv_);
+    area_ = normal_.length();
+    normal_.normalize();
   }
 
-  virtual real3 Radiance() const {
-    assert(0);
-    return real3(0.0, 0.0, 0.0);
+  void SetRadiance(const real3 &radiance) { radiance_ = radiance; }
+
+  virtual real3 Radiance() const { return radiance_; }
+
+  bool IsFinite() const { return true; }
+
+  bool IsDelta() const { return false; }
+
+  real Area() const { return area_; }
+
+  real SamplePosition(real3 &P, real3 &N, const real posRnd[2]) const;
+
+private:
+  real3 corner_;
+  real3 du_;
+  real3 dv_;
+  real3 normal_;
+  real3 radiance_;
+  real area_;
+};
+
+// Emissive triangle of the scene mesh.
+class TriangleLight : public Light {
+public:
+  TriangleLight(const real3 &p0, const real3 &p1, const real3 &p2,
+                const real3 &radiance, unsigned int faceID)
+      : p0_(p0), e1_(p1 - p0), e2_(p2 - p0), radiance_(radiance),
+        faceID_(faceID) {
+    normal_ = vcross(e1_, e2_);
+    area_ = 0.5 * normal_.length();
+    normal_.normalize();
   }
 
-  bool IsFinite() const { return false; }
+  virtual real3 Radiance() const { return radiance_; }
+
+  bool IsFinite() const { return true; }
 
   bool IsDelta() const { return false; }
 
-  real SampleL(real posRnd[2], real dirRnd[2]) const;
+  real Area() const { return area_; }
+
+  real SamplePosition(real3 &P, real3 &N, const real posRnd[2]) const;
+
+  unsigned int FaceID() const { return faceID_; }
+
+  const real3 &Normal() const { return normal_; }
+
+  real3 Center() const { return p0_ + (e1_ + e2_) * (1.0 / 3.0); }
+
+  void BoundingBox(real3 &bmin, real3 &bmax) const {
+    real3 p1 = p0_ + e1_;
+    real3 p2 = p0_ + e2_;
+    for (int i = 0; i < 3; i++) {
+      bmin[i] = std::min(p0_[i], std::min(p1[i], p2[i]));
+      bmax[i] = std::max(p0_[i], std::max(p1[i], p2[i]));
+    }
+  }
+
+private:
+  real3 p0_;
+  real3 e1_;
+  real3 e2_;
+  real3 normal_;
+  real3 radiance_;
+  real area_;
+  unsigned int faceID_;
 };
 
 } // namespace
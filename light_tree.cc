@@ -0,0 +1,328 @@
+#include <cstdio>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include "light_tree.h"
+
+using namespace mallie;
+
+namespace {
+
+inline real Luminance(const real3 &c) {
+  return 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+}
+
+// cos(max(0, theta - alpha)), where cos/sin of theta and alpha are given.
+// theta, alpha in [0, pi].
+inline real CosSubClamped(real cosTheta, real sinTheta, real cosAlpha,
+                          real sinAlpha) {
+  if (cosTheta >= cosAlpha) { // theta <= alpha
+    return 1.0;
+  }
+  return cosTheta * cosAlpha + sinTheta * sinAlpha;
+}
+
+inline real SafeAcos(real x) {
+  if (x <= -1.0)
+    return M_PI;
+  if (x >= 1.0)
+    return 0.0;
+  return acos(x);
+}
+
+// Merge two normal bounds(cone) into the cone which contains both.
+void UnionCone(real3 &axis, real &theta, const real3 &axis0, real theta0,
+               const real3 &axis1, real theta1) {
+  real3 a = axis0;
+  real3 b = axis1;
+  real ta = theta0;
+  real tb = theta1;
+  if (ta < tb) {
+    std::swap(a, b);
+    std::swap(ta, tb);
+  }
+
+  real td = SafeAcos(vdot(a, b));
+  if (std::min(td + tb, (real)M_PI) <= ta) {
+    axis = a;
+    theta = ta;
+    return;
+  }
+
+  real to = 0.5 * (ta + td + tb);
+  if (to >= M_PI) {
+    axis = a;
+    theta = M_PI;
+    return;
+  }
+
+  // Rotate `a` towards `b` by (to - ta)
+  real3 perp = b - a * vdot(a, b);
+  real len = perp.length();
+  if (len < 1.0e-6) {
+    axis = a;
+    theta = M_PI;
+    return;
+  }
+  perp = perp * (1.0 / len);
+
+  real tr = to - ta;
+  axis = a * cos(tr) + perp * sin(tr);
+  axis.normalize();
+  theta = to;
+}
+
+class CenterPred {
+public:
+  CenterPred(const std::vector<real3> &centers, int axis)
+      : centers_(centers), axis_(axis) {}
+
+  bool operator()(unsigned int a, unsigned int b) const {
+    return centers_[a][axis_] < centers_[b][axis_];
+  }
+
+private:
+  const std::vector<real3> &centers_;
+  int axis_;
+};
+
+} // namespace
+
+bool LightTree::Build(const std::vector<TriangleLight> &lights) {
+  nodes_.clear();
+  indices_.clear();
+  lightToLeaf_.clear();
+
+  size_t n = lights.size();
+  if (n == 0) {
+    return false;
+  }
+
+  centers_.resize(n);
+  normals_.resize(n);
+  powers_.resize(n);
+  indices_.resize(n);
+  lightToLeaf_.resize(n);
+
+  for (size_t i = 0; i < n; i++) {
+    centers_[i] = lights[i].Center();
+    normals_[i] = lights[i].Normal();
+    powers_[i] = Luminance(lights[i].Power());
+    indices_[i] = i;
+  }
+
+  nodes_.reserve(2 * n);
+
+  BuildTree(lights, 0, n, -1);
+
+  // Free build-time data.
+  std::vector<real3>().swap(centers_);
+  std::vector<real3>().swap(normals_);
+  std::vector<real>().swap(powers_);
+
+  return true;
+}
+
+unsigned int LightTree::BuildTree(const std::vector<TriangleLight> &lights,
+                                  unsigned int leftIdx, unsigned int rightIdx,
+                                  int parent) {
+  assert(leftIdx < rightIdx);
+
+  unsigned int nodeIdx = nodes_.size();
+  nodes_.push_back(LightTreeNode());
+
+  LightTreeNode node;
+  node.parent = parent;
+
+  real3 bmin, bmax;
+  lights[indices_[leftIdx]].BoundingBox(bmin, bmax);
+  node.axis = normals_[indices_[leftIdx]];
+  node.theta = 0.0;
+  node.power = 0.0;
+
+  real3 cmin = centers_[indices_[leftIdx]];
+  real3 cmax = cmin;
+
+  for (unsigned int i = leftIdx; i < rightIdx; i++) {
+    unsigned int idx = indices_[i];
+
+    real3 lmin, lmax;
+    lights[idx].BoundingBox(lmin, lmax);
+    for (int k = 0; k < 3; k++) {
+      bmin[k] = std::min(bmin[k], lmin[k]);
+      bmax[k] = std::max(bmax[k], lmax[k]);
+      cmin[k] = std::min(cmin[k], centers_[idx][k]);
+      cmax[k] = std::max(cmax[k], centers_[idx][k]);
+    }
+
+    if (i > leftIdx) {
+      UnionCone(node.axis, node.theta, node.axis, node.theta, normals_[idx],
+                0.0);
+    }
+
+    node.power += powers_[idx];
+  }
+
+  for (int k = 0; k < 3; k++) {
+    node.bmin[k] = bmin[k];
+    node.bmax[k] = bmax[k];
+  }
+
+  node.cosTheta = cos(node.theta);
+  node.sinTheta = sin(node.theta);
+
+  if ((rightIdx - leftIdx) == 1) { // leaf
+    node.flag = 1;
+    node.data[0] = indices_[leftIdx];
+    node.data[1] = 0;
+
+    lightToLeaf_[indices_[leftIdx]] = nodeIdx;
+
+    nodes_[nodeIdx] = node;
+    return nodeIdx;
+  }
+
+  // Split at the median of the longest axis of centroid bounds.
+  int axis = 0;
+  real3 cextent = cmax - cmin;
+  if (cextent[1] > cextent[axis])
+    axis = 1;
+  if (cextent[2] > cextent[axis])
+    axis = 2;
+
+  unsigned int midIdx = leftIdx + (rightIdx - leftIdx) / 2;
+  std::nth_element(indices_.begin() + leftIdx, indices_.begin() + midIdx,
+                   indices_.begin() + rightIdx, CenterPred(centers_, axis));
+
+  node.flag = 0;
+  node.data[0] = BuildTree(lights, leftIdx, midIdx, nodeIdx);
+  node.data[1] = BuildTree(lights, midIdx, rightIdx, nodeIdx);
+
+  nodes_[nodeIdx] = node;
+  return nodeIdx;
+}
+
+real LightTree::Importance(const LightTreeNode &node, const real3 &P,
+                           const real3 &N) const {
+  real3 bmin(node.bmin[0], node.bmin[1], node.bmin[2]);
+  real3 bmax(node.bmax[0], node.bmax[1], node.bmax[2]);
+  real3 center = (bmin + bmax) * 0.5;
+
+  real3 w = center - P;
+  real dist2 = vdot(w, w);
+  real3 halfExtent = (bmax - bmin) * 0.5;
+  real radius2 = vdot(halfExtent, halfExtent);
+
+  // Inside of the bound: Only power can be used.
+  if (dist2 <= radius2) {
+    return node.power / std::max(radius2, (real)1.0e-12);
+  }
+
+  real dist = sqrt(dist2);
+  w = w * (1.0 / dist);
+
+  // Angle subtended by the bounding sphere. Angles are handled by their
+  // cos/sin to avoid trigonometric functions in the traversal.
+  real sinU = std::min(sqrt(radius2) / dist, (real)1.0);
+  real cosU = sqrt(1.0 - sinU * sinU);
+
+  // Emitter side. Lights are one-sided, so emission is bounded by pi/2.
+  real cosTerm = 1.0;
+  if (node.theta < M_PI) {
+    real cosT = -vdot(node.axis, w);
+    real sinT = sqrt(std::max((real)0.0, 1.0 - cosT * cosT));
+
+    // alpha = theta_o + theta_u
+    real cosA = node.cosTheta * cosU - node.sinTheta * sinU;
+    real sinA = node.sinTheta * cosU + node.cosTheta * sinU;
+    if (sinA >= 0.0) { // alpha < pi
+      cosTerm = CosSubClamped(cosT, sinT, cosA, sinA);
+      if (cosTerm <= 0.0) {
+        return 0.0;
+      }
+    }
+  }
+
+  // Receiver side.
+  real cosI = vdot(N, w);
+  real sinI = sqrt(std::max((real)0.0, 1.0 - cosI * cosI));
+  real recvTerm = CosSubClamped(cosI, sinI, cosU, sinU);
+  if (recvTerm <= 0.0) {
+    return 0.0;
+  }
+
+  return node.power * cosTerm * recvTerm / dist2;
+}
+
+real LightTree::ChildProbability(const LightTreeNode &node, const real3 &P,
+                                 const real3 &N) const {
+  const LightTreeNode &c0 = nodes_[node.data[0]];
+  const LightTreeNode &c1 = nodes_[node.data[1]];
+
+  real i0 = Importance(c0, P, N);
+  real i1 = Importance(c1, P, N);
+
+  if ((i0 + i1) <= 0.0) {
+    // Fall back to power.
+    i0 = c0.power;
+    i1 = c1.power;
+    if ((i0 + i1) <= 0.0) {
+      return 0.5;
+    }
+  }
+
+  return i0 / (i0 + i1);
+}
+
+int LightTree::Sample(real &pdf, const real3 &P, const real3 &N,
+                      real rnd) const {
+  if (nodes_.empty()) {
+    pdf = 0.0;
+    return -1;
+  }
+
+  pdf = 1.0;
+
+  unsigned int index = 0;
+  while (nodes_[index].flag == 0) {
+    const LightTreeNode &node = nodes_[index];
+
+    real p = ChildProbability(node, P, N);
+    if (rnd < p) {
+      rnd = rnd / p;
+      pdf *= p;
+      index = node.data[0];
+    } else {
+      rnd = (rnd - p) / (1.0 - p);
+      pdf *= (1.0 - p);
+      index = node.data[1];
+    }
+
+    // Guard against precision loss of the rescaled random number.
+    rnd = std::min(rnd, 1.0 - std::numeric_limits<real>::epsilon());
+  }
+
+  return nodes_[index].data[0];
+}
+
+real LightTree::Pdf(int lightID, const real3 &P, const real3 &N) const {
+  if ((lightID < 0) || (lightID >= (int)lightToLeaf_.size())) {
+    return 0.0;
+  }
+
+  real pdf = 1.0;
+
+  unsigned int index = lightToLeaf_[lightID];
+  while (nodes_[index].parent >= 0) {
+    const LightTreeNode &parent = nodes_[nodes_[index].parent];
+
+    real p = ChildProbability(parent, P, N);
+    pdf *= (parent.data[0] == index) ? p : (1.0 - p);
+
+    index = nodes_[index].parent;
+  }
+
+  return pdf;
+}
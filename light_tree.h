@@ -0,0 +1,85 @@
+#ifndef __MALLIE_LIGHT_TREE_H__
+#define __MALLIE_LIGHT_TREE_H__
+
+#include <vector>
+
+#include "common.h"
+#include "light.h"
+
+namespace mallie {
+
+///< Light hierarchy node. Bounds position, power and emission orientation
+///< (cone around `axis` with half angle `theta`) of child lights.
+class LightTreeNode {
+public:
+  LightTreeNode() {}
+  ~LightTreeNode() {}
+
+  real bmin[3];
+  real bmax[3];
+
+  real3 axis;
+  real theta; // Normal bound in radian. pi = whole sphere.
+  real cosTheta;
+  real sinTheta;
+
+  real power; // Sum of luminance power
+
+  int flag;   // 1 = leaf node, 0 = branch node
+  int parent; // -1 for root
+
+  // leaf
+  //   data[0] = light index
+  //
+  // branch
+  //   data[0] = child[0]
+  //   data[1] = child[1]
+  unsigned int data[2];
+};
+
+///< Light BVH for many-light sampling. A light is chosen by stochastic
+///< traversal which descends to a child with probability proportional to its
+///< estimated contribution at the shading point.
+class LightTree {
+public:
+  LightTree() {};
+  ~LightTree() {};
+
+  ///< Build tree for input lights.
+  bool Build(const std::vector<TriangleLight> &lights);
+
+  ///< Pick a light for shading point P(with normal N). Returns light index
+  ///< and its selection probability in `pdf`. -1 if no light.
+  int Sample(real &pdf, const real3 &P, const real3 &N, real rnd) const;
+
+  ///< Selection probability of `lightID` in Sample().
+  real Pdf(int lightID, const real3 &P, const real3 &N) const;
+
+  const std::vector<LightTreeNode> &GetNodes() const { return nodes_; }
+
+private:
+  ///< Builds tree recursively. Returns node index.
+  unsigned int BuildTree(const std::vector<TriangleLight> &lights,
+                         unsigned int leftIdx, unsigned int rightIdx,
+                         int parent);
+
+  ///< Probability to descend into child[0] of `node`.
+  real ChildProbability(const LightTreeNode &node, const real3 &P,
+                        const real3 &N) const;
+
+  real Importance(const LightTreeNode &node, const real3 &P,
+                  const real3 &N) const;
+
+  std::vector<LightTreeNode> nodes_;
+  std::vector<unsigned int> indices_;  // Light indices sorted at build.
+  std::vector<unsigned int> lightToLeaf_; // light index -> leaf node index.
+
+  // Per-light bounds used at build.
+  std::vector<real3> centers_;
+  std::vector<real3> normals_;
+  std::vector<real> powers_;
+};
+
+} // namespace
+
+#endif // __MALLIE_LIGHT_TREE_H__
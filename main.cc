@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <algorithm>
 
 #include <stdint.h>
 #include "version.h"
@@ -90,9 +91,41 @@ static int GetNumCPUs() {
 }
 
 bool InitScene(mallie::Scene &scene, mallie::RenderConfig &config) {
-  return scene.Init(config.obj_filename, config.eson_filename,
-                    config.magicavoxel_filename, config.material_filename,
-                    config.scene_scale, config.scene_fit);
+  if (config.light_sampling == "uniform") {
+    scene.SetLightSamplingMode(mallie::LIGHT_SAMPLING_UNIFORM);
+  } else if (config.light_sampling == "power") {
+    scene.SetLightSamplingMode(mallie::LIGHT_SAMPLING_POWER);
+  } else {
+    scene.SetLightSamplingMode(mallie::LIGHT_SAMPLING_TREE);
+  }
+
+  if (!scene.Init(config.obj_filename, config.eson_filename,
+                  config.magicavoxel_filename, config.material_filename,
+                  config.scene_scale, config.scene_fit)) {
+    return false;
+  }
+
+  if (!config.envmap_filename.empty()) {
+    // Fall back to the constant background when the envmap is not available.
+    scene.LoadEnvMap(config.envmap_filename, config.envmap_scale);
+  }
+
+  return true;
+}
+
+// `name` array of 3 numbers in `object`, or `defaultValue`.
+void GetVec3(double v[3], JSON_Object *object, const char *name,
+             const double defaultValue[3]) {
+  JSON_Array *array = json_object_get_array(object, name);
+  for (int k = 0; k < 3; k++) {
+    v[k] = (array && (json_array_get_count(array) == 3))
+               ? json_array_get_number(array, k)
+               : defaultValue[k];
+  }
+}
+
+bool CameraKeyLess(const mallie::CameraKey &a, const mallie::CameraKey &b) {
+  return a.frame < b.frame;
 }
 
 bool LoadJSONConfig(mallie::RenderConfig &config, // [out]
@@ -135,6 +168,17 @@ bool LoadJSONConfig(mallie::RenderConfig &config, // [out]
         mallie::ExpandFilePath(json_object_dotget_string(object, "material_filename"));
   }
 
+  if (json_value_get_type(json_object_dotget_value(
+          object, "envmap_filename")) == JSONString) {
+    config.envmap_filename =
+        mallie::ExpandFilePath(json_object_dotget_string(object, "envmap_filename"));
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "envmap_scale")) ==
+      JSONNumber) {
+    config.envmap_scale = json_object_dotget_number(object, "envmap_scale");
+  }
+
   if (json_value_get_type(json_object_dotget_value(object, "scene_scale")) ==
       JSONNumber) {
     config.scene_scale = json_object_dotget_number(object, "scene_scale");
@@ -189,9 +233,226 @@ bool LoadJSONConfig(mallie::RenderConfig &config, // [out]
     config.num_passes = json_object_dotget_number(object, "num_passes");
   }
 
+  if (json_value_get_type(json_object_dotget_value(object, "spp")) ==
+      JSONNumber) {
+    config.spp = json_object_dotget_number(object, "spp");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "time_limit")) ==
+      JSONNumber) {
+    config.time_limit = json_object_dotget_number(object, "time_limit");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "convergence_threshold")) == JSONNumber) {
+    config.convergence_threshold =
+        json_object_dotget_number(object, "convergence_threshold");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "snapshot_interval")) == JSONNumber) {
+    config.snapshot_interval =
+        json_object_dotget_number(object, "snapshot_interval");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "snapshot_filename")) == JSONString) {
+    config.snapshot_filename =
+        json_object_dotget_string(object, "snapshot_filename");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "checkpoint_interval")) == JSONNumber) {
+    config.checkpoint_interval =
+        json_object_dotget_number(object, "checkpoint_interval");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "checkpoint_filename")) == JSONString) {
+    config.checkpoint_filename =
+        json_object_dotget_string(object, "checkpoint_filename");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "aov")) ==
+      JSONBoolean) {
+    config.aov = json_object_dotget_boolean(object, "aov");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "denoise")) ==
+      JSONBoolean) {
+    config.denoise = json_object_dotget_boolean(object, "denoise");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "denoise_iterations")) == JSONNumber) {
+    config.denoise_iterations =
+        (int)json_object_dotget_number(object, "denoise_iterations");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "bucket_size")) ==
+      JSONNumber) {
+    config.bucket_size = (int)json_object_dotget_number(object, "bucket_size");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "bucket_filename")) == JSONString) {
+    config.bucket_filename =
+        json_object_dotget_string(object, "bucket_filename");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "num_frames")) ==
+      JSONNumber) {
+    config.num_frames = (int)json_object_dotget_number(object, "num_frames");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "camera_keys")) ==
+      JSONArray) {
+    // [{"frame" : 0, "eye" : [...], "lookat" : [...], "up" : [...],
+    //   "fov" : 45}, ...]. Omitted values are taken from the config.
+    JSON_Array *array = json_object_dotget_array(object, "camera_keys");
+    for (size_t i = 0; i < json_array_get_count(array); i++) {
+      JSON_Object *keyObject = json_array_get_object(array, i);
+      if (!keyObject) {
+        continue;
+      }
+
+      mallie::CameraKey key;
+      key.frame = json_object_get_number(keyObject, "frame");
+      key.fov = json_object_get_number(keyObject, "fov");
+      GetVec3(key.eye, keyObject, "eye", config.eye);
+      GetVec3(key.lookat, keyObject, "lookat", config.lookat);
+      GetVec3(key.up, keyObject, "up", config.up);
+      config.camera_keys.push_back(key);
+    }
+    std::sort(config.camera_keys.begin(), config.camera_keys.end(),
+              CameraKeyLess);
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "vmd_filename")) ==
+      JSONString) {
+    config.vmd_filename = mallie::ExpandFilePath(
+        json_object_dotget_string(object, "vmd_filename"));
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "sequence_filename")) == JSONString) {
+    config.sequence_filename =
+        json_object_dotget_string(object, "sequence_filename");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "views")) ==
+      JSONArray) {
+    // [{"eye" : [...], "lookat" : [...], "up" : [...], "quat" : [...]},
+    //  ...]. Omitted values are taken from the config.
+    JSON_Array *array = json_object_dotget_array(object, "views");
+    for (size_t i = 0; i < json_array_get_count(array); i++) {
+      JSON_Object *viewObject = json_array_get_object(array, i);
+      if (!viewObject) {
+        continue;
+      }
+
+      mallie::CameraView view;
+      GetVec3(view.eye, viewObject, "eye", config.eye);
+      GetVec3(view.lookat, viewObject, "lookat", config.lookat);
+      GetVec3(view.up, viewObject, "up", config.up);
+      JSON_Array *quat = json_object_get_array(viewObject, "quat");
+      for (int k = 0; k < 4; k++) {
+        view.quat[k] = (quat && (json_array_get_count(quat) == 4))
+                           ? json_array_get_number(quat, k)
+                           : config.quat[k];
+      }
+      config.views.push_back(view);
+    }
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "view_filename")) ==
+      JSONString) {
+    config.view_filename = json_object_dotget_string(object, "view_filename");
+  }
+
   if (json_value_get_type(json_object_dotget_value(object, "num_photons")) ==
       JSONNumber) {
-    config.num_passes = json_object_dotget_number(object, "num_photons");
+    config.num_photons = json_object_dotget_number(object, "num_photons");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "sppm_radius")) ==
+      JSONNumber) {
+    config.sppm_radius = json_object_dotget_number(object, "sppm_radius");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "integrator")) ==
+      JSONString) {
+    config.integrator = json_object_dotget_string(object, "integrator");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "vcm_radius")) ==
+      JSONNumber) {
+    config.vcm_radius = json_object_dotget_number(object, "vcm_radius");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "mlt_mutations")) ==
+      JSONNumber) {
+    config.mlt_mutations = json_object_dotget_number(object, "mlt_mutations");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "rr_depth")) ==
+      JSONNumber) {
+    config.rr_depth = json_object_dotget_number(object, "rr_depth");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "split_count")) ==
+      JSONNumber) {
+    config.split_count = json_object_dotget_number(object, "split_count");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "guiding")) ==
+      JSONBoolean) {
+    config.guiding = json_object_dotget_boolean(object, "guiding");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "guiding_fraction")) == JSONNumber) {
+    config.guiding_fraction =
+        json_object_dotget_number(object, "guiding_fraction");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "radiance_cache")) ==
+      JSONBoolean) {
+    config.radiance_cache = json_object_dotget_boolean(object, "radiance_cache");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "radiance_cache_cell")) == JSONNumber) {
+    config.radiance_cache_cell =
+        json_object_dotget_number(object, "radiance_cache_cell");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "radiance_cache_decay")) == JSONNumber) {
+    config.radiance_cache_decay =
+        json_object_dotget_number(object, "radiance_cache_decay");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(object, "primary_cache")) ==
+      JSONBoolean) {
+    config.primary_cache = json_object_dotget_boolean(object, "primary_cache");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "primary_cache_strata")) == JSONNumber) {
+    config.primary_cache_strata =
+        json_object_dotget_number(object, "primary_cache_strata");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "report_efficiency")) == JSONBoolean) {
+    config.report_efficiency =
+        json_object_dotget_boolean(object, "report_efficiency");
+  }
+
+  if (json_value_get_type(json_object_dotget_value(
+          object, "light_sampling")) == JSONString) {
+    config.light_sampling = json_object_dotget_string(object, "light_sampling");
   }
 
   if (json_value_get_type(json_object_dotget_value(object, "plane")) ==
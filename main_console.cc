@@ -11,52 +11,356 @@
 #include <cassert>
 #include <fstream>
 #include <vector>
-#include <sstream>
+#include <algorithm>
+#include <cmath>
 
 #include "camera.h"
 #include "timerutil.h"
 #include "render.h"
-#include "jpge.h"
+#include "image_writer.h"
+#include "checkpoint.h"
+#include "denoise.h"
+#include "camera_path.h"
 
 namespace mallie {
 
 namespace {
 
-inline unsigned char fclamp(float x) {
-  int i = x * 255.5;
-  if (i < 0)
-    return 0;
-  if (i > 255)
-    return 255;
-  return (unsigned char)i;
+// Relative error of the image from the estimates of the even(`a`) and the
+// odd(`b`) passes: sum |a - b| / sum (a + b) over the luminance.
+double EstimateError(const AccumBuffer &a, const AccumBuffer &b) {
+  double diff = 0.0;
+  double sum = 0.0;
+  for (int i = 0; i < a.width * a.height; i++) {
+    float ca[3], cb[3];
+    a.Get(ca, i);
+    b.Get(cb, i);
+    double la = 0.2126 * ca[0] + 0.7152 * ca[1] + 0.0722 * ca[2];
+    double lb = 0.2126 * cb[0] + 0.7152 * cb[1] + 0.0722 * cb[2];
+    diff += fabs(la - lb);
+    sum += la + lb;
+  }
+  return (sum > 0.0) ? diff / sum : 0.0;
 }
 
-void HDRToLDR(std::vector<unsigned char> &out, const std::vector<float> &in,
-              const std::vector<int> &in_count, int width, int height) {
-  out.resize(width * height * 3);
-  assert(in.size() == (width * height * 3));
+// Destination of the buckets of the bucket mode.
+struct BucketOutput {
+  TiledEXRWriter writer;
+  tthread::mutex mutex; // For the progress
+  int numDone;
+  int numFailed;
+};
+
+void WriteBucket(void *data, const AccumBuffer &bucket, int x, int y) {
+  BucketOutput *output = reinterpret_cast<BucketOutput *>(data);
+  bool ok = output->writer.Write(bucket, x, y);
+
+  tthread::lock_guard<tthread::mutex> guard(output->mutex);
+  output->numDone++;
+  if (!ok) {
+    output->numFailed++;
+  }
 
-  // Simple [0, 1] -> [0, 255]
-  for (int i = 0; i < width * height * 3; i++) {
-    out[i] = fclamp(in[i] / in_count[i / 3]);
+  int numTiles = output->writer.NumTiles();
+  if ((output->numDone * 100 / numTiles) !=
+      ((output->numDone - 1) * 100 / numTiles)) {
+    printf("\r[Mallie] Bucket %d/%d", output->numDone, numTiles);
+    fflush(stdout);
   }
 }
 
-void SaveAsJPEG(const char *filename,
-                std::vector<unsigned char> &image, // RGB
-                int width, int height) {
-  jpge::params comp_params;
-  comp_params.m_quality = 100;
-  bool ret = jpge::compress_image_to_jpeg_file(filename, width, height, 3,
-                                               &image.at(0), comp_params);
-  assert(ret);
+// Out-of-core rendering of images larger than memory. No framebuffer is
+// allocated: buckets are written to the tiled EXR as they are finished.
+// Snapshots, checkpoints and the denoiser need the whole image and are not
+// available.
+void DoBucketRender(Scene &scene, const RenderConfig &config) {
+  if (config.integrator != "path") {
+    printf("Mallie:error\tmsg:Bucket rendering supports the path integrator "
+           "only.\n");
+    return;
+  }
+  if (config.guiding || config.radiance_cache || config.primary_cache) {
+    printf("Mallie:warn\tmsg:Path guiding and caches are disabled in bucket "
+           "rendering.\n");
+  }
+
+  BucketOutput output;
+  output.numDone = 0;
+  output.numFailed = 0;
+  if (!output.writer.Open(config.bucket_filename, config.width, config.height,
+                          config.bucket_size, config.aov)) {
+    printf("Mallie:error\tmsg:Failed to create [ %s ]\n",
+           config.bucket_filename.c_str());
+    return;
+  }
+
+  printf("[Mallie] Bucket mode: %d x %d, %d buckets of %d x %d, %d spp\n",
+         config.width, config.height, output.writer.NumTiles(),
+         config.bucket_size, config.bucket_size,
+         (std::max)(1, config.spp) * (std::max)(1, config.num_passes));
+
+  mallie::timerutil t;
+  t.start();
+  unsigned long long numRaysStart = scene.NumRays();
+
+  RenderBuckets(scene, config, config.bucket_size, WriteBucket, &output,
+                config.eye, config.lookat, config.up, config.quat);
+
+  t.end();
+  double totalSec = t.msec() / 1000.0;
+  printf("\n[Mallie] %f sec, %.2f Mrays/sec\n", totalSec,
+         (totalSec > 0.0)
+             ? double(scene.NumRays() - numRaysStart) / totalSec / 1.0e6
+             : 0.0);
+
+  if (output.writer.Close() && (output.numFailed == 0)) {
+    printf("[Mallie] Output %s\n", config.bucket_filename.c_str());
+  } else {
+    printf("Mallie:error\tmsg:Failed to write [ %s ]\n",
+           config.bucket_filename.c_str());
+  }
+}
+
+// Destination of the buckets of the multi-view batch. Views are assembled
+// from their buckets and queued to the writer thread when complete.
+struct ViewOutput {
+  ViewOutput() : writer(/* queue */ true) {}
+
+  const RenderConfig *config;
+  std::vector<AccumBuffer *> images; // Views being assembled, else NULL
+  std::vector<int> numBuckets;       // Finished buckets per view
+  int bucketsPerView;
+  int numViewsDone;
+  tthread::mutex mutex; // For the above
+  ImageWriter writer;
+};
+
+void WriteViewBucket(void *data, int view, const AccumBuffer &bucket, int x,
+                     int y) {
+  ViewOutput *output = reinterpret_cast<ViewOutput *>(data);
+  const RenderConfig &config = *output->config;
+
+  AccumBuffer *image;
+  {
+    tthread::lock_guard<tthread::mutex> guard(output->mutex);
+    if (!output->images[view]) {
+      output->images[view] = new AccumBuffer();
+      output->images[view]->Resize(config.width, config.height);
+      output->images[view]->EnableAOV(bucket.HasAOV());
+    }
+    image = output->images[view];
+  }
+
+  // Buckets don't overlap, thus no lock is required.
+  for (int j = 0; j < bucket.height; j++) {
+    for (int i = 0; i < bucket.width; i++) {
+      size_t src = size_t(j) * bucket.width + i;
+      size_t dst = size_t(y + j) * config.width + (x + i);
+      for (int k = 0; k < 3; k++) {
+        image->color[3 * dst + k] = bucket.color[3 * src + k];
+      }
+      image->count[dst] = bucket.count[src];
+      if (bucket.HasAOV()) {
+        for (int k = 0; k < kNumAOVs; k++) {
+          image->aov[kNumAOVs * dst + k] = bucket.aov[kNumAOVs * src + k];
+        }
+        image->materialID[dst] = bucket.materialID[src];
+        image->faceID[dst] = bucket.faceID[src];
+      }
+    }
+  }
+
+  {
+    tthread::lock_guard<tthread::mutex> guard(output->mutex);
+    if (++output->numBuckets[view] < output->bucketsPerView) {
+      return;
+    }
+    output->images[view] = NULL;
+  }
+
+  // The last bucket of the view. It is queued to the writer, so the render
+  // thread goes on with the next bucket without waiting for the encoder.
+  std::string filename = GetFrameFilename(config.view_filename, view);
+  std::vector<float> denoised;
+  bool denoise = config.denoise &&
+                 Denoise(denoised, image, 1, config.denoise_iterations);
+  if (denoise) {
+    output->writer.Submit(denoised, config.width, config.height, filename);
+  } else {
+    output->writer.Submit(image, 1, filename);
+  }
+  delete image;
+
+  tthread::lock_guard<tthread::mutex> guard(output->mutex);
+  output->numViewsDone++;
+  printf("[Mallie] View %d/%d\n", output->numViewsDone,
+         int(output->images.size()));
+  fflush(stdout);
+}
+
+// Multi-view batch. All views share the scene and the BVH, and their buckets
+// are scheduled across one worker pool, so that no core idles at the end of
+// a view.
+void DoMultiViewRender(Scene &scene, const RenderConfig &config) {
+  if (config.integrator != "path") {
+    printf("Mallie:error\tmsg:Multi-view rendering supports the path "
+           "integrator only.\n");
+    return;
+  }
+  if (config.guiding || config.radiance_cache || config.primary_cache) {
+    printf("Mallie:warn\tmsg:Path guiding and caches are disabled in "
+           "multi-view rendering.\n");
+  }
+
+  const int numViews = int(config.views.size());
+  const int bucketSize = (config.bucket_size > 0) ? config.bucket_size : 32;
+
+  ViewOutput output;
+  output.config = &config;
+  output.images.resize(numViews, NULL);
+  output.numBuckets.resize(numViews, 0);
+  output.bucketsPerView = ((config.width + bucketSize - 1) / bucketSize) *
+                          ((config.height + bucketSize - 1) / bucketSize);
+  output.numViewsDone = 0;
+
+  printf("[Mallie] Multi-view mode: %d views, %d buckets/view, %d spp\n",
+         numViews, output.bucketsPerView,
+         (std::max)(1, config.spp) * (std::max)(1, config.num_passes));
+
+  mallie::timerutil t;
+  t.start();
+  unsigned long long numRaysStart = scene.NumRays();
+
+  RenderViews(scene, config, config.views, bucketSize,
+              config.aov || config.denoise, WriteViewBucket, &output);
+  output.writer.Flush(); // Views still queued
+
+  t.end();
+  double totalSec = t.msec() / 1000.0;
+  printf("[Mallie] %d views, %f sec, %.2f Mrays/sec\n", numViews, totalSec,
+         (totalSec > 0.0)
+             ? double(scene.NumRays() - numRaysStart) / totalSec / 1.0e6
+             : 0.0);
+}
+
+// Camera sequence(animation, turntable). The scene and the BVH are shared by
+// all frames and the buffers are reused. Each frame is written by the writer
+// thread while the next one is rendered.
+void DoSequenceRender(Scene &scene, const RenderConfig &config) {
+  std::vector<CameraKey> keys = config.camera_keys;
+  if (!config.vmd_filename.empty()) {
+    std::vector<CameraKey> vmdKeys;
+    if (LoadVMDCameraKeys(vmdKeys, config.vmd_filename)) {
+      keys.swap(vmdKeys);
+    } else {
+      printf("Mallie:warn\tmsg:No camera frame in [ %s ]\n",
+             config.vmd_filename.c_str());
+    }
+  }
+
+  const int width = config.width;
+  const int height = config.height;
+  const int numPasses = (std::max)(1, config.num_passes);
+
+  // Even and odd passes, for the convergence test and the denoiser.
+  AccumBuffer accum[2];
+  accum[0].Resize(width, height);
+  accum[1].Resize(width, height);
+  accum[0].EnableAOV(config.aov || config.denoise);
+  accum[1].EnableAOV(config.aov || config.denoise);
+
+  RenderConfig frameConfig = config; // With the fov of the frame
+  ImageWriter writer;
+  std::vector<float> denoised;
+
+  printf("[Mallie] Sequence mode: %d frames, %d passes/frame, %s\n",
+         config.num_frames, numPasses,
+         keys.empty() ? "turntable" : "camera keys");
+
+  mallie::timerutil wallTimer;
+  wallTimer.start();
+  unsigned long long numRaysStart = scene.NumRays();
+
+  for (int frame = 0; frame < config.num_frames; frame++) {
+    double eye[3], lookat[3], up[3];
+    GetSequenceCamera(eye, lookat, up, frameConfig.fov, config, keys, frame);
+
+    accum[0].Clear();
+    accum[1].Clear();
+
+    // Nothing of the previous frame is carried over.
+    InvalidateView();
+
+    double error = -1.0;
+    int pass = 0;
+    while (pass < numPasses) {
+      mallie::Render(scene, frameConfig, accum[pass & 1], eye, lookat, up,
+                     config.quat, 1);
+      pass++;
+
+      if ((config.convergence_threshold > 0.0) && ((pass & 1) == 0)) {
+        error = EstimateError(accum[0], accum[1]);
+        if (error <= config.convergence_threshold) {
+          break;
+        }
+      }
+    }
+
+    // The previous frame may still be being written, but must not be
+    // replaced.
+    std::string filename = GetFrameFilename(config.sequence_filename, frame);
+    writer.WaitPending();
+    if (config.denoise &&
+        Denoise(denoised, accum, 2, config.denoise_iterations)) {
+      writer.Submit(denoised, width, height, filename);
+    } else {
+      writer.Submit(accum, 2, filename);
+    }
+
+    wallTimer.end();
+    double elapsed = wallTimer.msec() / 1000.0;
+    double secPerFrame = elapsed / (frame + 1);
+    printf("[Mallie] Frame %d/%d | %d passes | %.2f sec/frame | elapsed %.1f "
+           "sec | ETA %.1f sec",
+           frame + 1, config.num_frames, pass, secPerFrame, elapsed,
+           (config.num_frames - frame - 1) * secPerFrame);
+    if (error >= 0.0) {
+      printf(" | error %f", error);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+  writer.Flush();
+
+  wallTimer.end();
+  double totalSec = wallTimer.msec() / 1000.0;
+  printf("[Mallie] %d frames, %f sec, %.2f Mrays/sec\n", config.num_frames,
+         totalSec,
+         (totalSec > 0.0)
+             ? double(scene.NumRays() - numRaysStart) / totalSec / 1.0e6
+             : 0.0);
 }
 
 } // local
 
 void DoMainConsole(Scene &scene, const RenderConfig &config) {
   printf("[Mallie] Console mode\n");
-#if 1
+
+  if (!config.views.empty()) {
+    DoMultiViewRender(scene, config);
+    return;
+  }
+
+  if (config.bucket_size > 0) {
+    DoBucketRender(scene, config);
+    return;
+  }
+
+  if (config.num_frames > 0) {
+    DoSequenceRender(scene, config);
+    return;
+  }
+
   {
     std::vector<float> image;
     std::vector<int> count;
@@ -64,67 +368,217 @@ void DoMainConsole(Scene &scene, const RenderConfig &config) {
     const int width = config.width;
     const int height = config.height;
 
-    image.resize(width * height * 3);
-    count.resize(width * height);
+    // Batch rendering. Passes are repeated until `num_passes`, the time limit
+    // or the convergence threshold is reached. Multiple passes are also
+    // required to estimate variance.
+    int numPasses = (std::max)(1, config.num_passes);
+    if (config.report_efficiency) {
+      numPasses = (std::max)(2, numPasses);
+    }
 
-    mallie::Render(scene, config, image, count, config.eye, config.lookat, config.up, config.quat, 1);
+    // Even and odd passes are accumulated separately. Their difference
+    // estimates the remaining error.
+    AccumBuffer accum[2];
+    accum[0].Resize(width, height);
+    accum[1].Resize(width, height);
+    accum[0].EnableAOV(config.aov || config.denoise);
+    accum[1].EnableAOV(config.aov || config.denoise);
 
-    std::string outfilename("output.jpg"); // fixme
+    std::vector<double> lumSum, lumSum2; // Per-pixel luminance statistics
+    if (config.report_efficiency) {
+      // The image of each pass is required for the statistics.
+      image.resize(width * height * 3);
+      count.resize(width * height, 0);
+      lumSum.resize(width * height, 0.0);
+      lumSum2.resize(width * height, 0.0);
+    }
 
-    std::vector<unsigned char> out;
-    HDRToLDR(out, image, count, width, height);
-    SaveAsJPEG(outfilename.c_str(), out, width, height);
+    double renderTime = 0.0; // msec
+    double error = -1.0;     // Not estimated yet
+    unsigned long long numRaysStart = scene.NumRays();
 
-    printf("[Mallie] Output %s\n", outfilename.c_str());
-  }
-#else
-  const_cast<RenderConfig &>(config).width = 600;
-  const_cast<RenderConfig &>(config).height = 600;
+    // Snapshots and the final image are encoded by the writer thread.
+    ImageWriter writer;
+    double lastSnapshot = 0.0; // sec
+
+    // Continue a preempted render from its checkpoint.
+    bool checkpoint = (config.checkpoint_interval > 0.0);
+    if (checkpoint && !IsCheckpointSupported(config)) {
+      printf("Mallie:warn\tmsg:Checkpoints are not supported by the %s "
+             "integrator.\n",
+             config.integrator.c_str());
+      checkpoint = false;
+    }
+    double lastCheckpoint = 0.0; // sec
 
-  const_cast<RenderConfig &>(config).eye[0] = 0;
-  const_cast<RenderConfig &>(config).eye[1] = 1;
-  const_cast<RenderConfig &>(config).eye[2] = -4;
+    int pass = 0;
+    if (checkpoint &&
+        LoadCheckpoint(accum, 2, pass, config.checkpoint_filename, config)) {
+      printf("Mallie:info\tmsg:Resumed from [ %s ] at pass %d\n",
+             config.checkpoint_filename.c_str(), pass);
+    }
+    const int startPass = pass;
 
-  const int total_frame = 1;
-  for (int i = 0; i < total_frame; ++i) {
-    std::vector<float> image;
-    std::vector<int> count;
+    mallie::timerutil wallTimer;
+    wallTimer.start();
+
+    while (pass < numPasses) {
+      AccumBuffer &target = accum[pass & 1];
+
+      mallie::timerutil t;
+      t.start();
+
+      unsigned long long numRaysBefore = scene.NumRays();
 
-    int width = config.width;
-    int height = config.height;
+      if (config.report_efficiency) {
+        std::fill(count.begin(), count.end(), 0);
+        mallie::Render(scene, config, image, count, config.eye, config.lookat, config.up, config.quat, 1);
+      } else {
+        // Samples are added to `target` in place.
+        mallie::Render(scene, config, target, config.eye, config.lookat, config.up, config.quat, 1);
+      }
 
-    image.resize(width * height * 3);
-    count.resize(width * height);
+      t.end();
+      renderTime += t.msec();
+      pass++;
 
-    double eye[3];
+      if (config.report_efficiency) {
+        for (int i = 0; i < width * height; i++) {
+          for (int k = 0; k < 3; k++) {
+            target.color[3 * i + k] += image[3 * i + k];
+          }
+          target.count[i] += count[i];
 
-    /*eye[0] = config.eye[0];
-    eye[1] = config.eye[1];
-    eye[2] = config.eye[2];*/
+          double lum = 0.2126 * image[3 * i + 0] + 0.7152 * image[3 * i + 1] +
+                       0.0722 * image[3 * i + 2];
+          lumSum[i] += lum;
+          lumSum2[i] += lum * lum;
+        }
+      }
 
-    eye[0] = 4.0 * sin(2.0 * M_PI * i / total_frame);
-    eye[1] = 1.0;
-    eye[2] = 4.0 * cos(2.0 * M_PI * i / total_frame);
+      // Error after each pair of passes.
+      if ((config.convergence_threshold > 0.0) && ((pass & 1) == 0)) {
+        error = EstimateError(accum[0], accum[1]);
+      }
 
-    // mallie::RenderPanoramic(scene, config, image, count, eye, config.lookat,
-    // config.up, config.quat, /* stereo = */ false);
-    mallie::RenderPanoramic(scene, config, image, count, eye, config.lookat,
-                            config.up, config.quat, /* stereo = */ true);
+      // Progress
+      wallTimer.end();
+      double elapsed = wallTimer.msec() / 1000.0;
+      double secPerPass = elapsed / (pass - startPass);
+      double raysPerSec =
+          (t.msec() > 0)
+              ? double(scene.NumRays() - numRaysBefore) / (t.msec() / 1000.0)
+              : 0.0;
 
-    std::string outfilename;
-    {
-      std::stringstream ss;
-      ss << "output" << i << ".jpg";
-      outfilename = ss.str();
+      double eta = (numPasses - pass) * secPerPass;
+      if (config.time_limit > 0.0) {
+        eta = (std::min)(eta, (std::max)(0.0, config.time_limit - elapsed));
+      }
+      if (error > 0.0) {
+        // Error decreases with 1 / sqrt(# of passes).
+        double ratio = error / config.convergence_threshold;
+        double passesToGo = pass * (ratio * ratio - 1.0);
+        eta = (std::min)(eta, (std::max)(0.0, passesToGo * secPerPass));
+      }
+
+      printf("\r[Mallie] Pass %d/%d | %.2f Mrays/sec | elapsed %.1f sec | "
+             "ETA %.1f sec",
+             pass, numPasses, raysPerSec / 1.0e6, elapsed, eta);
+      if (error >= 0.0) {
+        printf(" | error %f", error);
+      }
+      printf("      ");
+      fflush(stdout);
+
+      if ((config.snapshot_interval > 0.0) &&
+          (elapsed - lastSnapshot >= config.snapshot_interval) &&
+          (pass < numPasses)) {
+        writer.Submit(accum, 2, config.snapshot_filename);
+        lastSnapshot = elapsed;
+      }
+
+      if (checkpoint &&
+          (elapsed - lastCheckpoint >= config.checkpoint_interval) &&
+          (pass < numPasses)) {
+        SaveCheckpoint(config.checkpoint_filename, config, accum, 2, pass);
+        lastCheckpoint = elapsed;
+      }
+
+      if ((config.time_limit > 0.0) && (elapsed >= config.time_limit)) {
+        printf("\nMallie:info\tmsg:Time limit reached.");
+        break;
+      }
+      if ((error >= 0.0) && (error <= config.convergence_threshold) &&
+          !config.report_efficiency) {
+        printf("\nMallie:info\tmsg:Converged.");
+        break;
+      }
     }
+    printf("\n");
+
+    wallTimer.end();
+    double totalSec = wallTimer.msec() / 1000.0;
+    int numRendered = pass - startPass; // In this run
+    printf("[Mallie] %d passes, %f sec, %.2f Mrays/sec\n", numRendered,
+           totalSec,
+           (totalSec > 0.0)
+               ? double(scene.NumRays() - numRaysStart) / totalSec / 1.0e6
+               : 0.0);
 
-    std::vector<unsigned char> out;
-    HDRToLDR(out, image, count, width, height);
-    SaveAsJPEG(outfilename.c_str(), out, width, height);
+    if (checkpoint) {
+      // Allows adding more passes later.
+      if (SaveCheckpoint(config.checkpoint_filename, config, accum, 2, pass)) {
+        printf("[Mallie] Checkpoint %s at pass %d\n",
+               config.checkpoint_filename.c_str(), pass);
+      }
+    }
+
+    if (config.report_efficiency && (numRendered >= 2)) {
+      // Efficiency = 1 / (variance per sample x time per sample)
+      double variance = 0.0;
+      for (int i = 0; i < width * height; i++) {
+        double mean = lumSum[i] / numRendered;
+        variance += (lumSum2[i] - lumSum[i] * mean) / (numRendered - 1);
+      }
+      variance /= (double)(width * height);
+
+      double secPerPass = renderTime / 1000.0 / numRendered;
+
+      printf("[Mallie] Efficiency: integrator = %s, rr_depth = %d, "
+             "split_count = %d, %d passes\n",
+             config.integrator.c_str(), config.rr_depth, config.split_count,
+             numRendered);
+      printf("  variance/pass : %g\n", variance);
+      printf("  time/pass     : %f sec\n", secPerPass);
+      printf("  efficiency    : %g (1 / (variance x time))\n",
+             (variance * secPerPass > 0.0) ? 1.0 / (variance * secPerPass)
+                                           : 0.0);
+    }
+
+    std::string outfilename("output.jpg"); // fixme
+
+    // Sum of the even and odd passes. Their difference gives the variance
+    // for the denoiser.
+    std::vector<float> denoised;
+    if (config.denoise &&
+        Denoise(denoised, accum, 2, config.denoise_iterations)) {
+      writer.Submit(denoised, width, height, outfilename);
+    } else {
+      writer.Submit(accum, 2, outfilename);
+    }
+    writer.Flush();
 
     printf("[Mallie] Output %s\n", outfilename.c_str());
+
+    if (config.aov) {
+      // Beauty(not denoised) and AOVs.
+      std::string aovfilename("output.exr");
+      writer.Submit(accum, 2, aovfilename);
+      writer.Flush();
+
+      printf("[Mallie] Output %s\n", aovfilename.c_str());
+    }
   }
-#endif
 }
 
 } // mallie
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <vector>
+#include <string>
 #include <cassert>
 #include <iostream>
 
@@ -19,6 +20,8 @@
 #include "render.h"
 #include "tinythread.h"
 #include "tinyexr.h"
+#include "image_writer.h"
+#include "denoise.h"
 #include "script_engine.h"
 
 #if defined(_WIN32) && !defined(_USE_MATH_DEFINES)
@@ -65,6 +68,7 @@ static int gRenderPasses = 1;
 static tthread::mutex gRenderThreadMutex;
 static time_t gRenderClock = 0;
 static bool gRenderQuit = false; // Only become true when we quit app.
+static std::string gSaveRequest;  // Framebuffer to save between passes.
 
 int gWidth = 256;
 int gHeight = 256;
@@ -75,9 +79,8 @@ SDL_Surface *gSurface = NULL;
 SDL_Renderer *gSDLRenderer = NULL;
 SDL_mutex *gMutex = NULL;
 
-std::vector<float> gImage;
-std::vector<int> gCount;
-std::vector<float> gFramebuffer; // HDR framebuffer
+AccumBuffer gAccum; // HDR framebuffer. Render() adds samples in place
+ImageWriter gImageWriter; // Saves framebuffer snapshots in the background
 RenderConfig gRenderConfig;
 
 typedef struct {
@@ -135,25 +138,6 @@ static void EulerToQuatZYX(double quat[4], double x, double y,
   quat[3] = cosHx * cosHy * sinHz - sinHx * sinHy * cosHz;
 }
 
-static void AccumImage(std::vector<float> &dst, const std::vector<float> &src) {
-  assert(dst.size() == src.size());
-  for (size_t i = 0; i < src.size(); i++) {
-    dst[i] += src[i];
-  }
-}
-
-static void ClearImage(std::vector<float> &img) {
-  for (size_t i = 0; i < img.size(); i++) {
-    img[i] = 0.0f;
-  }
-}
-
-static void ClearCount(std::vector<int> &img) {
-  for (size_t i = 0; i < img.size(); i++) {
-    img[i] = 0;
-  }
-}
-
 inline unsigned char fclamp(float x) {
   float gamma = 2.2f;
   int i = powf(x, 1.0f / gamma) * 255.5;
@@ -164,49 +148,24 @@ inline unsigned char fclamp(float x) {
   return (unsigned char)i;
 }
 
+// Called from the render thread between passes, so nothing writes to the
+// framebuffer during the copy. Encoding runs on the writer thread.
 void SaveFramebuffer(const char* filename) {
+  gImageWriter.Submit(&gAccum, 1, filename);
+}
 
-  int ret = SDL_LockMutex(gMutex);
-  assert(ret == 0);
-
-
-  float* image_ptr[3];
-  std::vector<float> images[3];
-  images[0].resize(gWidth * gHeight);
-  images[1].resize(gWidth * gHeight);
-  images[2].resize(gWidth * gHeight);
-
-  for (int i = 0; i < gWidth * gHeight; i++) {
-    // per-pixel count
-    float scale = 1.0f / (float)gCount[i];
-    images[0][i] = gFramebuffer[3*i+0] * scale;
-    images[1][i] = gFramebuffer[3*i+1] * scale;
-    images[2][i] = gFramebuffer[3*i+2] * scale;
-  }
-
-  image_ptr[0] = &(images[0].at(0));
-  image_ptr[1] = &(images[1].at(0));
-  image_ptr[2] = &(images[2].at(0));
-
-  EXRImage image;
-
-  image.num_channels = 3;
-  const char* channel_names[] = {"B", "G", "R"};
-
-  image.channel_names = channel_names;
-  image.images = image_ptr;
-  image.width = gWidth;
-  image.height = gHeight;
+void RequestSaveFramebuffer(const std::string &filename) {
+  tthread::lock_guard<tthread::mutex> guard(gRenderThreadMutex);
+  gSaveRequest = filename;
+  return;
+}
 
-  const char* err;
-  int fail = SaveMultiChannelEXR(&image, filename, &err);
-  if (fail) {
-    fprintf(stderr, err);
-  } else {
-    printf("Mallie:info\tmsg:Saved framebuffer to [ %s ]\n", filename);
-  }
+bool GetSaveRequest(std::string &filename) {
+  tthread::lock_guard<tthread::mutex> guard(gRenderThreadMutex);
+  filename.swap(gSaveRequest);
+  gSaveRequest.clear();
 
-  SDL_UnlockMutex(gMutex);
+  return !filename.empty();
 }
 
 void SaveCamera(const std::string &filename) {
@@ -402,7 +361,7 @@ bool HandleKey(SDL_Event e) {
       {
         char buf[1024];
         sprintf(buf, "output%06d.exr", gRenderPasses);
-        SaveFramebuffer(buf);
+        RequestSaveFramebuffer(buf);
         break;
       }
     default:
@@ -417,9 +376,9 @@ bool HandleKey(SDL_Event e) {
   return false;
 }
 
-void Display(SDL_Surface *surface, const std::vector<float> &image,
-             const std::vector<int> &counts, int passes, int width,
-             int height) {
+// `rgb`: Image to show instead of the mean of `accum`(e.g. denoised).
+void Display(SDL_Surface *surface, const AccumBuffer &accum, int passes,
+             int width, int height, const float *rgb = NULL) {
   int ret = SDL_LockMutex(gMutex);
   assert(ret == 0);
 
@@ -433,12 +392,20 @@ void Display(SDL_Surface *surface, const std::vector<float> &image,
 #if 0
   float scale = 1.0f / (float) passes;
 #endif
+  double denoised[3];
   for (int y = 0; y < height; y++) {
     for (int x = 0; x < width; x++) {
-#if 1
       // per-pixel count
-      float scale = 1.0f / (float)counts[y * width + x];
-#endif
+      const double *c = &accum.color[3 * (y * width + x)];
+      int count = accum.count[y * width + x];
+      double scale = (count > 0) ? 1.0 / count : 0.0;
+      if (rgb) {
+        c = &denoised[0];
+        denoised[0] = rgb[3 * (y * width + x) + 0];
+        denoised[1] = rgb[3 * (y * width + x) + 1];
+        denoised[2] = rgb[3 * (y * width + x) + 2];
+        scale = 1.0;
+      }
 
 //#ifdef __APPLE__
 //      // RGBA
@@ -460,12 +427,9 @@ void Display(SDL_Surface *surface, const std::vector<float> &image,
 //      data[4 * (y * width + x) + 3] = 255;
 //#endif
 
-      data[4 * (y * width + x) + 2] =
-          fclamp(scale * image[3 * (y * width + x) + 0]);
-      data[4 * (y * width + x) + 1] =
-          fclamp(scale * image[3 * (y * width + x) + 1]);
-      data[4 * (y * width + x) + 0] =
-          fclamp(scale * image[3 * (y * width + x) + 2]);
+      data[4 * (y * width + x) + 2] = fclamp(float(scale * c[0]));
+      data[4 * (y * width + x) + 1] = fclamp(float(scale * c[1]));
+      data[4 * (y * width + x) + 0] = fclamp(float(scale * c[2]));
       data[4 * (y * width + x) + 3] = 255;
     }
   }
@@ -566,8 +530,16 @@ void RenderThread(void *arg) {
 
   time_t prevRenderClock = 0;
 
+  timerutil snapshotTimer;
+  snapshotTimer.start();
+
   while (!GetRenderQuitRequest()) {
 
+    std::string saveFilename;
+    if (GetSaveRequest(saveFilename)) {
+      SaveFramebuffer(saveFilename.c_str());
+    }
+
     time_t currentRenderClock = GetCurrentRenderClock();
     if ((gRenderPasses >= ctx.config->num_passes) &&
         (currentRenderClock <= prevRenderClock)) {
@@ -582,7 +554,7 @@ void RenderThread(void *arg) {
     if ((gRenderPasses >= ctx.config->num_passes)) {
       // printf("Render finished\n");
       // render finished
-      // Display(gSurface, gFramebuffer, gRenderPasses, config.width,
+      // Display(gSurface, gAccum, gRenderPasses, config.width,
       // config.height);
       continue;
     }
@@ -594,23 +566,36 @@ void RenderThread(void *arg) {
     // printf("quat = %f, %f, %f, %f\n", gCurrQuat[0], gCurrQuat[1],
     // gCurrQuat[2], gCurrQuat[3]);
 
-    Render(*(ctx.scene), *(ctx.config), gImage, gCount, gEye, gLookat, gUp,
-           gCurrQuat, gRenderPixelStep);
+    mallie::timerutil t;
+    t.start();
 
-    // Always clear framebuffer for intermediate result
-    // if (gRenderPixelStep > 1) {
-    if (gRenderPasses == 1) {
-      // ClearImage(gFramebuffer);
-    }
+    // Samples are added to the framebuffer in place.
+    Render(*(ctx.scene), *(ctx.config), gAccum, gEye, gLookat, gUp, gCurrQuat,
+           gRenderPixelStep);
 
-    AccumImage(gFramebuffer, gImage);
+    t.end();
+    printf("\r[Mallie] Render time: %f sec(s) | %f fps",
+           (double)t.msec() / 1000.0, 1000.0 / (double)t.msec());
+    fflush(stdout);
 
-    Display(gSurface, gFramebuffer, gCount, gRenderPasses, ctx.config->width,
-            ctx.config->height);
+    // Denoised preview once the view stops.
+    static std::vector<float> denoised;
+    bool denoise = ctx.config->denoise && !gMouseMoving &&
+                   Denoise(denoised, &gAccum, 1, ctx.config->denoise_iterations);
+
+    Display(gSurface, gAccum, gRenderPasses, ctx.config->width,
+            ctx.config->height, denoise ? &denoised.at(0) : NULL);
+
+    if (ctx.config->snapshot_interval > 0.0) {
+      snapshotTimer.end();
+      if (snapshotTimer.msec() >= 1000.0 * ctx.config->snapshot_interval) {
+        SaveFramebuffer(ctx.config->snapshot_filename.c_str());
+        snapshotTimer.start();
+      }
+    }
 
     if (gMouseMoving) {
-      ClearImage(gFramebuffer);
-      ClearCount(gCount);
+      gAccum.Clear();
     }
 
 // printf("step = %d, interactive = %d\n", gRenderPixelStep,
@@ -626,7 +611,7 @@ void RenderThread(void *arg) {
       gRenderPixelStep >>= 1;
 
       if (gRenderPixelStep == 1) {
-        ClearImage(gFramebuffer);
+        gAccum.Clear();
       }
 
       if (gRenderPixelStep < 1) {
@@ -670,15 +655,8 @@ void DoMainSDL(Scene &scene, const RenderConfig &config) {
 
   gMutex = SDL_CreateMutex();
 
-  gFramebuffer.resize(gWidth * gHeight * 3); // RGB
-  ClearImage(gFramebuffer);
-
-  gImage.resize(gWidth * gHeight * 3); // RGB
-
-  gCount.resize(gWidth * gHeight);
-  for (size_t i = 0; i < gCount.size(); i++) {
-    gCount[i] = 0;
-  }
+  gAccum.Resize(gWidth, gHeight);
+  gAccum.EnableAOV(config.aov || config.denoise); // Also guides the denoiser
 
   Init(config);
 
@@ -728,7 +706,7 @@ void DoMainSDL(Scene &scene, const RenderConfig &config) {
     if ((gRenderPasses >= config.num_passes)) {
       //printf("Render finished\n");
       // render finished
-      //Display(gSurface, gFramebuffer, gRenderPasses, config.width,
+      //Display(gSurface, gAccum, gRenderPasses, config.width,
       //config.height);
       continue;
     }
@@ -740,17 +718,15 @@ void DoMainSDL(Scene &scene, const RenderConfig &config) {
     //printf("quat = %f, %f, %f, %f\n", gCurrQuat[0], gCurrQuat[1],
     //gCurrQuat[2], gCurrQuat[3]);
 
-    Render(scene, config, gImage, gEye, gLookat, gUp, gCurrQuat,
-           gRenderPixelStep);
-
     // Always clear framebuffer for intermediate result
     if (gRenderPixelStep > 1) {
-      ClearImage(gFramebuffer);
+      gAccum.Clear();
     }
 
-    AccumImage(gFramebuffer, gImage);
+    Render(scene, config, gAccum, gEye, gLookat, gUp, gCurrQuat,
+           gRenderPixelStep);
 
-    Display(gSurface, gFramebuffer, gRenderPasses, config.width, config.height);
+    Display(gSurface, gAccum, gRenderPasses, config.width, config.height);
 
     //printf("step = %d, interactive = %d\n", gRenderPixelStep,
     //gRenderInteractive);
@@ -764,7 +740,7 @@ void DoMainSDL(Scene &scene, const RenderConfig &config) {
       gRenderPixelStep >>= 1;
 
       if (gRenderPixelStep == 1) {
-        ClearImage(gFramebuffer);
+        gAccum.Clear();
       }
 
       if (gRenderPixelStep < 1) {
@@ -797,6 +773,8 @@ void DoMainSDL(Scene &scene, const RenderConfig &config) {
   renderThread.join();
 #endif
 
+  gImageWriter.Flush();
+
   printf("\n");
   fflush(stdout); // for safety
 }
@@ -7,6 +7,8 @@ struct Material {
   real3 diffuse;
   real3 reflection;
   real3 refraction;
+  real3 emission; // Non-zero for emissive(area light) material.
+  real ior;       // Index of refraction. Used when refraction is non-zero.
   int id;
 
   Material() {
@@ -19,8 +21,16 @@ struct Material {
 	  refraction[0] = 0.0;
 	  refraction[1] = 0.0;
 	  refraction[2] = 0.0;
+	  emission[0] = 0.0;
+	  emission[1] = 0.0;
+	  emission[2] = 0.0;
+	  ior = 1.5;
 	  id = -1;
   }
+
+  bool IsEmissive() const {
+    return (emission[0] > 0.0) || (emission[1] > 0.0) || (emission[2] > 0.0);
+  }
 };
 
 #endif // __MALLIE_MATERIAL_H__
@@ -0,0 +1,339 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include "mlt.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Defined in tasksys.cc
+extern "C" {
+void ISPCLaunch(void **handlePtr, void *f, void *data, int count);
+void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+void ISPCSync(void *handle);
+}
+
+using namespace mallie;
+
+namespace {
+
+const int kNumBootstrap = 65536;
+const int kBootstrapChunkSize = 1024;
+const int kNumChains = 256;
+const real kSigma = 0.01;        // Small step size
+const real kLargeStepProb = 0.3;
+
+inline real Luminance(const real3 &c) {
+  return 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+}
+
+#if !defined(_OPENMP) // Tasksys version
+typedef struct {
+  MLTRenderer *renderer;
+  bool bootstrap; // bootstrap or chain stage
+} MLTStageTask;
+
+void MLTStageTaskFunc(void *data, int threadIndex, int threadCount,
+                      int taskIndex, int taskCount) {
+  const MLTStageTask *task = reinterpret_cast<const MLTStageTask *>(data);
+  if (task->bootstrap) {
+    task->renderer->BootstrapChunk(taskIndex);
+  } else {
+    task->renderer->MutateChain(taskIndex);
+  }
+}
+#endif
+
+void RunMLTStage(MLTRenderer *renderer, bool bootstrap, int numTasks) {
+  if (numTasks <= 0) {
+    return;
+  }
+
+#if !defined(_OPENMP) // Tasksys version
+  MLTStageTask task;
+  task.renderer = renderer;
+  task.bootstrap = bootstrap;
+
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(MLTStageTaskFunc), &task,
+             numTasks);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < numTasks; i++) {
+    if (bootstrap) {
+      renderer->BootstrapChunk(i);
+    } else {
+      renderer->MutateChain(i);
+    }
+  }
+#endif
+}
+
+} // namespace
+
+MLTSampler::MLTSampler()
+    : rng_(0, 0, 0), sigma_(kSigma), largeStepProb_(kLargeStepProb),
+      currentIteration_(0), lastLargeStepIteration_(0), largeStep_(true),
+      sampleIndex_(0) {}
+
+MLTSampler::~MLTSampler() {}
+
+void MLTSampler::Seed(unsigned int generation, unsigned int index,
+                      unsigned int stage, real sigma, real largeStepProb) {
+  rng_ = XorShift(generation, index, stage);
+  sigma_ = sigma;
+  largeStepProb_ = largeStepProb;
+  X_.clear();
+  currentIteration_ = 0;
+  lastLargeStepIteration_ = 0;
+  largeStep_ = true;
+  sampleIndex_ = 0;
+}
+
+void MLTSampler::Reseed(unsigned int generation, unsigned int index,
+                        unsigned int stage) {
+  rng_ = XorShift(generation, index, stage);
+}
+
+real MLTSampler::Next() {
+  int index = sampleIndex_++;
+  EnsureReady(index);
+  return X_[index].value;
+}
+
+void MLTSampler::StartIteration() {
+  currentIteration_++;
+  largeStep_ = rng_.Next() < largeStepProb_;
+  sampleIndex_ = 0;
+}
+
+void MLTSampler::Accept() {
+  if (largeStep_) {
+    lastLargeStepIteration_ = currentIteration_;
+  }
+}
+
+void MLTSampler::Reject() {
+  for (size_t i = 0; i < X_.size(); i++) {
+    PrimarySample &Xi = X_[i];
+    if (Xi.lastModificationIteration == currentIteration_) {
+      Xi.value = Xi.valueBackup;
+      Xi.lastModificationIteration = Xi.modifyBackup;
+    }
+  }
+  currentIteration_--;
+}
+
+void MLTSampler::EnsureReady(int index) {
+  if (index >= int(X_.size())) {
+    PrimarySample Xi;
+    Xi.value = 0.0;
+    Xi.lastModificationIteration = 0;
+    Xi.valueBackup = 0.0;
+    Xi.modifyBackup = 0;
+    X_.resize(index + 1, Xi);
+  }
+
+  PrimarySample &Xi = X_[index];
+
+  // Reset to a uniform sample if a large step was accepted after the last
+  // modification.
+  if (Xi.lastModificationIteration < lastLargeStepIteration_) {
+    Xi.value = rng_.Next();
+    Xi.lastModificationIteration = lastLargeStepIteration_;
+  }
+
+  Xi.valueBackup = Xi.value;
+  Xi.modifyBackup = Xi.lastModificationIteration;
+
+  if (largeStep_) {
+    Xi.value = rng_.Next();
+  } else {
+    // Apply the small steps skipped since the last modification at once.
+    int numSmall = currentIteration_ - Xi.lastModificationIteration;
+    real u1 = 1.0 - rng_.Next(); // (0, 1]
+    real u2 = rng_.Next();
+    real normal = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+    Xi.value += normal * sigma_ * sqrt((real)numSmall);
+    Xi.value -= floor(Xi.value);
+  }
+
+  Xi.lastModificationIteration = currentIteration_;
+}
+
+MLTRenderer::MLTRenderer()
+    : func_(NULL), data_(NULL), bootstrapped_(false), generation_(0),
+      b_(0.0) {}
+
+MLTRenderer::~MLTRenderer() {}
+
+int MLTRenderer::GridPixel(int px, int py) const {
+  int gx = (std::min)(px / step_, gridWidth_ - 1);
+  int gy = (std::min)(py / step_, gridHeight_ - 1);
+  return gy * gridWidth_ + gx;
+}
+
+void MLTRenderer::BootstrapChunk(int chunk) {
+  int begin = chunk * kBootstrapChunkSize;
+  int end = (std::min)(begin + kBootstrapChunkSize, kNumBootstrap);
+
+  MLTSampler sampler;
+  for (int i = begin; i < end; i++) {
+    sampler.Seed(generation_, i, 0, kSigma, kLargeStepProb);
+
+    int px, py;
+    real3 L = func_(data_, sampler, px, py);
+    real I = Luminance(L);
+    bootstrapWeights_[i] = (I > 0.0) ? I : 0.0;
+  }
+}
+
+void MLTRenderer::MutateChain(int c) {
+  Chain &chain = chains_[c];
+  MLTSampler &sampler = chain.sampler;
+  int numSplats = 0;
+  int numRetries = 0;
+
+  for (int m = 0; m < mutationsPerChain_; m++) {
+    sampler.StartIteration();
+
+    int px, py;
+    real3 L = func_(data_, sampler, px, py);
+    real I = Luminance(L);
+    if (!(I > 0.0)) { // Also rejects NaN
+      I = 0.0;
+    }
+
+    real accept = (chain.I > 0.0) ? (std::min)((real)1.0, I / chain.I) : 1.0;
+
+    // Expected values of both states are splatted.
+    if (I > 0.0) {
+      numRetries += splat_.Splat(GridPixel(px, py), L * (accept / I));
+      numSplats++;
+    }
+    if ((accept < 1.0) && (chain.I > 0.0)) {
+      numRetries += splat_.Splat(GridPixel(chain.px, chain.py),
+                                 chain.L * ((1.0 - accept) / chain.I));
+      numSplats++;
+    }
+
+    if (sampler.Uniform() < accept) {
+      chain.L = L;
+      chain.I = I;
+      chain.px = px;
+      chain.py = py;
+      sampler.Accept();
+    } else {
+      sampler.Reject();
+    }
+  }
+
+  splat_.AddStats(numSplats, numRetries);
+}
+
+bool MLTRenderer::Bootstrap() {
+  bootstrapWeights_.resize(kNumBootstrap);
+
+  int numChunks = (kNumBootstrap + kBootstrapChunkSize - 1) /
+                  kBootstrapChunkSize;
+  RunMLTStage(this, /* bootstrap */ true, numChunks);
+
+  std::vector<real> cdf(kNumBootstrap + 1);
+  cdf[0] = 0.0;
+  for (int i = 0; i < kNumBootstrap; i++) {
+    cdf[i + 1] = cdf[i] + bootstrapWeights_[i];
+  }
+
+  b_ = cdf[kNumBootstrap] / kNumBootstrap;
+  if (b_ <= 0.0) {
+    printf("Mallie:warn\tmsg:MLT bootstrap found no light path.\n");
+    return false;
+  }
+
+  // Start chains from bootstrap samples chosen in proportion to their
+  // luminance, which removes the start-up bias.
+  XorShift rng(generation_, 0, 2);
+  chains_.resize(kNumChains);
+  for (int c = 0; c < kNumChains; c++) {
+    real u = rng.Next() * cdf[kNumBootstrap];
+    int i = int(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+    i = (std::max)(0, (std::min)(i, kNumBootstrap - 1));
+
+    Chain &chain = chains_[c];
+    chain.sampler.Seed(generation_, i, 0, kSigma, kLargeStepProb);
+    chain.L = func_(data_, chain.sampler, chain.px, chain.py);
+    chain.I = (std::max)((real)0.0, Luminance(chain.L));
+
+    // Chains starting from the same sample must not follow the same path.
+    chain.sampler.Reseed(generation_, c, 1);
+  }
+
+  return true;
+}
+
+bool MLTRenderer::RenderPass(const RenderConfig &config,
+                             std::vector<float> &image,
+                             std::vector<int> &count, int step,
+                             MLTPathFunc func, void *data) {
+  func_ = func;
+  data_ = data;
+  width_ = config.width;
+  height_ = config.height;
+  step_ = step;
+  gridWidth_ = (width_ + step - 1) / step;
+  gridHeight_ = (height_ + step - 1) / step;
+
+  int numGridPixels = gridWidth_ * gridHeight_;
+  int mutationsPerPixel = (std::max)(config.mlt_mutations, 1);
+  mutationsPerChain_ =
+      (mutationsPerPixel * numGridPixels + kNumChains - 1) / kNumChains;
+
+  if (!bootstrapped_) {
+    if (!Bootstrap()) {
+      return false;
+    }
+    bootstrapped_ = true;
+  }
+
+  if ((splat_.Width() != gridWidth_) || (splat_.Height() != gridHeight_)) {
+    splat_.Resize(gridWidth_, gridHeight_);
+  } else {
+    splat_.Clear();
+  }
+
+  RunMLTStage(this, /* bootstrap */ false, kNumChains);
+
+  if (config.report_efficiency) {
+    splat_.PrintStats("MLT");
+  }
+
+  // Pixel(cell) value = b * (raster area / cell area) * splats / mutations
+  double totalMutations = double(mutationsPerChain_) * kNumChains;
+  double scale = b_ * double(width_) * double(height_) / totalMutations;
+
+  for (int gy = 0; gy < gridHeight_; gy++) {
+    for (int gx = 0; gx < gridWidth_; gx++) {
+      int cellWidth = (std::min)(step, width_ - gx * step);
+      int cellHeight = (std::min)(step, height_ - gy * step);
+      double cellScale = scale / double(cellWidth * cellHeight);
+      real3 c = splat_.Get(gy * gridWidth_ + gx);
+      for (int v = 0; v < cellHeight; v++) {
+        for (int u = 0; u < cellWidth; u++) {
+          int idx = (gy * step + v) * width_ + (gx * step + u);
+          image[3 * idx + 0] = c[0] * cellScale;
+          image[3 * idx + 1] = c[1] * cellScale;
+          image[3 * idx + 2] = c[2] * cellScale;
+          count[idx]++;
+        }
+      }
+    }
+  }
+
+  return true;
+}
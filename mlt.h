@@ -0,0 +1,120 @@
+#ifndef __MALLIE_MLT_H__
+#define __MALLIE_MLT_H__
+
+#include <vector>
+
+#include "common.h"
+#include "random.h"
+#include "render.h"
+#include "splat.h"
+
+namespace mallie {
+
+///< Primary sample vector of primary sample space MLT(Kelemen et al. 2002).
+///< Samples are mutated lazily when they are requested, so that paths may
+///< consume any number of random numbers.
+class MLTSampler {
+public:
+  MLTSampler();
+  ~MLTSampler();
+
+  void Seed(unsigned int generation, unsigned int index, unsigned int stage,
+            real sigma, real largeStepProb);
+
+  ///< Change the random number sequence only, keeping the samples.
+  void Reseed(unsigned int generation, unsigned int index, unsigned int stage);
+
+  ///< Next primary sample in [0, 1).
+  real Next();
+
+  ///< Start a proposal(large or small step).
+  void StartIteration();
+  void Accept();
+  void Reject();
+
+  ///< Uniform random number which is not a primary sample.
+  real Uniform() { return rng_.Next(); }
+
+private:
+  typedef struct {
+    real value;
+    int lastModificationIteration;
+    real valueBackup;
+    int modifyBackup;
+  } PrimarySample;
+
+  void EnsureReady(int index);
+
+  XorShift rng_;
+  real sigma_;
+  real largeStepProb_;
+  std::vector<PrimarySample> X_;
+  int currentIteration_;
+  int lastLargeStepIteration_;
+  bool largeStep_;
+  int sampleIndex_;
+};
+
+///< Evaluates a path whose random numbers are drawn from `sampler`. Returns
+///< the radiance and the raster pixel it contributes to.
+typedef real3 (*MLTPathFunc)(void *data, MLTSampler &sampler, int &px,
+                             int &py);
+
+///< Primary sample space Metropolis light transport(PSSMLT). Wraps a path
+///< function as the target. The normalization is estimated by independent
+///< bootstrap samples, which also seed the Markov chains in proportion to
+///< their luminance. Chains persist across passes, so call Reset() when the
+///< view changes.
+class MLTRenderer {
+public:
+  MLTRenderer();
+  ~MLTRenderer();
+
+  ///< Render one pass into `image`(same layout as Render()).
+  bool RenderPass(const RenderConfig &config, std::vector<float> &image,
+                  std::vector<int> &count, int step, MLTPathFunc func,
+                  void *data);
+
+  void Reset() {
+    bootstrapped_ = false;
+    generation_++;
+  }
+
+  ///< Markov chain state.
+  struct Chain {
+    MLTSampler sampler;
+    real3 L;
+    real I; // Luminance of L(target function)
+    int px;
+    int py;
+  };
+
+  // Per-chunk work, called from the parallel loops.
+  void BootstrapChunk(int chunk);
+  void MutateChain(int chain);
+
+private:
+  bool Bootstrap();
+  int GridPixel(int px, int py) const;
+
+  MLTPathFunc func_;
+  void *data_;
+  int width_;
+  int height_;
+  int gridWidth_;
+  int gridHeight_;
+  int step_;
+  int mutationsPerChain_;
+
+  bool bootstrapped_;
+  unsigned int generation_;
+  real b_; // Normalization: average luminance over the primary sample space
+
+  std::vector<real> bootstrapWeights_;
+  std::vector<Chain> chains_;
+  SplatBuffer splat_; // Splats of the pass(grid resolution)
+};
+
+} // namespace
+
+#endif // __MALLIE_MLT_H__
@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <cstring>
 
 using namespace mallie;
 
@@ -51,3 +52,118 @@ bool LoadMMM(double **data, int &width, int &height, const char *filename) {
   fclose(fp);
   return true;
 }
+
+namespace {
+
+const char kMMMChunkMagic[4] = {'M', 'M', 'M', 'C'};
+const int kMMMChunkVersion = 1;
+const int kMMMChunkNameLen = 16;
+
+} // namespace
+
+bool mallie::SaveMMMChunks(const char *filename,
+                           const std::vector<MMMChunk> &chunks) {
+  std::string tmpfilename = std::string(filename) + ".tmp";
+
+  FILE *fp = fopen(tmpfilename.c_str(), "wb");
+  if (!fp) {
+    fprintf(stderr, "[MMM] Failed to write file: %s\n", tmpfilename.c_str());
+    return false;
+  }
+
+  int numChunks = int(chunks.size());
+  bool ok = true;
+  ok &= (fwrite(kMMMChunkMagic, 1, 4, fp) == 4);
+  ok &= (fwrite(&kMMMChunkVersion, sizeof(int), 1, fp) == 1);
+  ok &= (fwrite(&numChunks, sizeof(int), 1, fp) == 1);
+
+  for (int i = 0; ok && (i < numChunks); i++) {
+    char name[kMMMChunkNameLen];
+    memset(name, 0, kMMMChunkNameLen);
+    strncpy(name, chunks[i].name.c_str(), kMMMChunkNameLen - 1);
+
+    unsigned long long size = chunks[i].data.size();
+    ok &= (fwrite(name, 1, kMMMChunkNameLen, fp) == size_t(kMMMChunkNameLen));
+    ok &= (fwrite(&size, sizeof(unsigned long long), 1, fp) == 1);
+    if (size > 0) {
+      ok &= (fwrite(&chunks[i].data.at(0), 1, size, fp) == size);
+    }
+  }
+
+  ok &= (fflush(fp) == 0);
+  fclose(fp);
+
+  if (!ok) {
+    fprintf(stderr, "[MMM] Failed to write file: %s\n", tmpfilename.c_str());
+    remove(tmpfilename.c_str());
+    return false;
+  }
+
+#ifdef _WIN32
+  remove(filename); // rename() does not overwrite on Windows.
+#endif
+  if (rename(tmpfilename.c_str(), filename) != 0) {
+    fprintf(stderr, "[MMM] Failed to rename %s to %s\n", tmpfilename.c_str(),
+            filename);
+    return false;
+  }
+
+  return true;
+}
+
+bool mallie::LoadMMMChunks(std::vector<MMMChunk> &chunks,
+                           const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) {
+    return false; // Not an error: no file to resume from.
+  }
+
+  char magic[4];
+  int version = 0;
+  int numChunks = 0;
+  bool ok = true;
+  ok &= (fread(magic, 1, 4, fp) == 4);
+  ok &= (fread(&version, sizeof(int), 1, fp) == 1);
+  ok &= (fread(&numChunks, sizeof(int), 1, fp) == 1);
+  ok &= (memcmp(magic, kMMMChunkMagic, 4) == 0);
+  ok &= (version == kMMMChunkVersion) && (numChunks >= 0);
+
+  chunks.clear();
+  for (int i = 0; ok && (i < numChunks); i++) {
+    char name[kMMMChunkNameLen];
+    unsigned long long size = 0;
+    ok &= (fread(name, 1, kMMMChunkNameLen, fp) == size_t(kMMMChunkNameLen));
+    ok &= (fread(&size, sizeof(unsigned long long), 1, fp) == 1);
+    if (!ok) {
+      break;
+    }
+    name[kMMMChunkNameLen - 1] = '\0';
+
+    MMMChunk chunk;
+    chunks.push_back(chunk);
+    chunks.back().name = name;
+    chunks.back().data.resize(size);
+    if (size > 0) {
+      ok &= (fread(&chunks.back().data.at(0), 1, size, fp) == size);
+    }
+  }
+
+  fclose(fp);
+
+  if (!ok) {
+    fprintf(stderr, "[MMM] Broken file: %s\n", filename);
+    chunks.clear();
+  }
+
+  return ok;
+}
+
+const MMMChunk *mallie::FindMMMChunk(const std::vector<MMMChunk> &chunks,
+                                     const char *name) {
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (chunks[i].name == name) {
+      return &chunks[i];
+    }
+  }
+  return NULL;
+}
@@ -5,11 +5,31 @@
 // MMM = Mallie MonochroMe image format.
 //
 
+#include <vector>
+#include <string>
+
 namespace mallie {
 
 bool SaveMMM(const char *filename, double *data, int width, int height);
 
 bool LoadMMM(double **data, int &width, int &height, const char *filename);
+
+///< Named block of a chunked(multi-channel) MMM file.
+typedef struct {
+  std::string name; // Up to 15 chars
+  std::vector<unsigned char> data;
+} MMMChunk;
+
+///< Chunked MMM file: "MMMC", version, # of chunks, then (name, size, data)
+///< for each chunk. Written to `filename`.tmp first and renamed, so that an
+///< interrupted write never destroys the previous file.
+bool SaveMMMChunks(const char *filename, const std::vector<MMMChunk> &chunks);
+
+bool LoadMMMChunks(std::vector<MMMChunk> &chunks, const char *filename);
+
+///< Chunk of `chunks` named `name`, NULL if not found.
+const MMMChunk *FindMMMChunk(const std::vector<MMMChunk> &chunks,
+                             const char *name);
 };
 
 #endif // __MALLIE_MMM_IO_H__
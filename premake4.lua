@@ -57,6 +57,8 @@ sources = {
    "render.cc",
    "camera.cc",
    "light.cc",
+   "light_tree.cc",
+   "envlight.cc",
    "matrix.cc",
    "trackball.cc",
    "prim-plane.cc",
@@ -86,7 +88,17 @@ sources = {
    "deps/parson/parson.c",
    "tasksys.cc",
    "texture.cc",
+   "bsdf.cc",
+   "guiding.cc",
+   "radiance_cache.cc",
+   "splat.cc",
+   "image_writer.cc",
+   "checkpoint.cc",
+   "denoise.cc",
+   "camera_path.cc",
    "vcm.cc",
+   "sppm.cc",
+   "mlt.cc",
    "script_engine.cc",
    "deps/TinyThread++-1.1/source/tinythread.cpp",
    "miniexr.cpp",
@@ -102,6 +114,7 @@ sources = {
 
 test_sources = {
    "test/cctest/test-atomic.cc",
+   "test/cctest/test-hashgrid.cc",
    "test/cctest/test-main.cc"
 }
 
@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "radiance_cache.h"
+#include "atomic.h"
+
+using namespace mallie;
+
+namespace {
+
+const int kNumEntries = 1 << 18; // Power of 2
+const int kMaxProbes = 8;
+const float kMinWeight = 4.0f; // # of records to use a cell
+const float kEvictWeight = 0.01f;
+
+inline unsigned int HashCell(int x, int y, int z, int face) {
+  unsigned int h = (unsigned int)x * 73856093u;
+  h ^= (unsigned int)y * 19349663u;
+  h ^= (unsigned int)z * 83492791u;
+  h ^= (unsigned int)face * 2654435761u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+} // namespace
+
+RadianceCache::RadianceCache() : invCellSize_(1.0) {}
+
+RadianceCache::~RadianceCache() {}
+
+void RadianceCache::Init(const real3 &bmin, const real3 &bmax,
+                         real cellSize) {
+  real3 extent = bmax - bmin;
+  real diag = extent.length();
+  real size = (std::max)((real)1.0e-6, cellSize * diag);
+
+  origin_ = bmin;
+  invCellSize_ = 1.0 / size;
+
+  entries_.resize(kNumEntries);
+  Clear();
+}
+
+void RadianceCache::Clear() {
+  if (!entries_.empty()) {
+    memset(&entries_[0], 0, sizeof(Entry) * entries_.size());
+  }
+}
+
+unsigned int RadianceCache::Key(const real3 &P, const real3 &N) const {
+  int cell[3];
+  for (int j = 0; j < 3; j++) {
+    cell[j] = int(floor((P[j] - origin_[j]) * invCellSize_));
+  }
+
+  // Dominant axis and sign of the normal, so that both sides of a thin wall
+  // or corners do not share a cell.
+  int axis = 0;
+  for (int j = 1; j < 3; j++) {
+    if (fabs(N[j]) > fabs(N[axis])) {
+      axis = j;
+    }
+  }
+  int face = 2 * axis + ((N[axis] < 0.0) ? 1 : 0);
+
+  unsigned int key = HashCell(cell[0], cell[1], cell[2], face);
+  return key ? key : 1;
+}
+
+int RadianceCache::Find(unsigned int key) const {
+  unsigned int mask = (unsigned int)entries_.size() - 1;
+  for (int i = 0; i < kMaxProbes; i++) {
+    unsigned int slot = (key + i) & mask;
+    unsigned int k = entries_[slot].key;
+    if (k == key) {
+      return int(slot);
+    }
+    if (k == 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+int RadianceCache::Insert(unsigned int key) {
+  unsigned int mask = (unsigned int)entries_.size() - 1;
+  for (int i = 0; i < kMaxProbes; i++) {
+    unsigned int slot = (key + i) & mask;
+    unsigned int prev = AtomicCompareAndSwap(&entries_[slot].key, 0, key);
+    if ((prev == 0) || (prev == key)) {
+      return int(slot);
+    }
+  }
+  return -1; // Neighborhood is full
+}
+
+bool RadianceCache::Lookup(const real3 &P, const real3 &N, real3 &L) const {
+  if (entries_.empty()) {
+    return false;
+  }
+
+  int slot = Find(Key(P, N));
+  if ((slot < 0) || (entries_[slot].weight < kMinWeight)) {
+    return false;
+  }
+
+  const float *value = entries_[slot].value;
+  L = real3(value[0], value[1], value[2]);
+  return true;
+}
+
+void RadianceCache::Record(const real3 &P, const real3 &N, const real3 &L) {
+  if (entries_.empty()) {
+    return;
+  }
+  if (!(L[0] >= 0.0) || !(L[1] >= 0.0) || !(L[2] >= 0.0)) { // Also NaN
+    return;
+  }
+
+  int slot = Insert(Key(P, N));
+  if (slot < 0) {
+    return;
+  }
+
+  Entry &e = entries_[slot];
+  for (int k = 0; k < 3; k++) {
+    AtomicAdd(&e.sum[k], float(L[k]));
+  }
+  AtomicIncrement(&e.count);
+}
+
+void RadianceCache::Update(real decay) {
+  float d = float((std::max)((real)0.0, (std::min)((real)1.0, decay)));
+
+  for (size_t i = 0; i < entries_.size(); i++) {
+    Entry &e = entries_[i];
+    if (e.key == 0) {
+      continue;
+    }
+
+    e.weight = d * e.weight + float(e.count);
+    for (int k = 0; k < 3; k++) {
+      e.total[k] = d * e.total[k] + e.sum[k];
+      e.value[k] = (e.weight > 0.0f) ? e.total[k] / e.weight : 0.0f;
+      e.sum[k] = 0.0f;
+    }
+    e.count = 0;
+
+    // Free cells which are not visited anymore. A later record re-inserts
+    // the key, possibly in an earlier slot of the probe sequence.
+    if (e.weight < kEvictWeight) {
+      memset(&e, 0, sizeof(Entry));
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef __MALLIE_RADIANCE_CACHE_H__
+#define __MALLIE_RADIANCE_CACHE_H__
+
+#include <vector>
+
+#include "common.h"
+
+namespace mallie {
+
+///< World space radiance cache for interactive previews. A hashed grid of
+///< cells keyed by the position and the dominant axis of the normal keeps the
+///< reflected radiance of diffuse vertices of completed paths. Records of a
+///< pass are accumulated atomically and published by Update(), which also
+///< decays the old records so that the cache follows scene edits.
+class RadianceCache {
+public:
+  RadianceCache();
+  ~RadianceCache();
+
+  ///< `cellSize` is relative to the diagonal of the scene bounds.
+  void Init(const real3 &bmin, const real3 &bmax, real cellSize);
+  bool IsInitialized() const { return !entries_.empty(); }
+
+  ///< Drop all records.
+  void Clear();
+
+  ///< Cached reflected radiance at `P`. Returns false if the cell has not
+  ///< enough records yet.
+  bool Lookup(const real3 &P, const real3 &N, real3 &L) const;
+
+  ///< Add reflected radiance `L` at `P`. Thread safe.
+  void Record(const real3 &P, const real3 &N, const real3 &L);
+
+  ///< End of pass. Old records are weighted by `decay`.
+  void Update(real decay);
+
+private:
+  typedef struct {
+    unsigned int key; // 0 = empty
+    float sum[3];     // Records of the current pass
+    int count;
+    float total[3];   // Decayed records of the previous passes
+    float weight;
+    float value[3];   // Published mean, read only during the pass
+  } Entry;
+
+  unsigned int Key(const real3 &P, const real3 &N) const;
+  int Find(unsigned int key) const;
+  int Insert(unsigned int key);
+
+  real3 origin_;
+  real invCellSize_;
+  std::vector<Entry> entries_;
+};
+
+} // namespace
+
+#endif // __MALLIE_RADIANCE_CACHE_H__
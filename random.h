@@ -0,0 +1,50 @@
+#ifndef __MALLIE_RANDOM_H__
+#define __MALLIE_RANDOM_H__
+
+#include "common.h"
+
+namespace mallie {
+
+///< xorshift RNG for parallel work chunks. Seeded by (iteration, chunk,
+///< stage) so that the sequence does not depend on the thread which runs the
+///< chunk.
+class XorShift {
+public:
+  XorShift(unsigned int iteration, unsigned int chunk, unsigned int stage) {
+    x = Hash(iteration * 4 + stage) ^ 123456789;
+    y = Hash(chunk) ^ 362436069;
+    z = Hash(x ^ y) ^ 521288629;
+    w = Hash(z) ^ 88675123;
+
+    // The first outputs depend on a part of the state only.
+    for (int i = 0; i < 4; i++) {
+      Next();
+    }
+  }
+
+  ///< [0, 1)
+  real Next() {
+    unsigned int t = x ^ (x << 11);
+    x = y;
+    y = z;
+    z = w;
+    w = (w ^ (w >> 19)) ^ (t ^ (t >> 8));
+    return w * (1.0 / 4294967296.0);
+  }
+
+private:
+  static unsigned int Hash(unsigned int a) {
+    a = (a ^ 61) ^ (a >> 16);
+    a = a + (a << 3);
+    a = a ^ (a >> 4);
+    a = a * 0x27d4eb2d;
+    a = a ^ (a >> 15);
+    return a;
+  }
+
+  unsigned int x, y, z, w;
+};
+
+} // namespace
+
+#endif // __MALLIE_RANDOM_H__
@@ -12,8 +12,12 @@
 #endif
 #include <cmath>
 
-#include "hashgrid.h"
 #include "render.h"
+#include "vcm.h"
+#include "sppm.h"
+#include "guiding.h"
+#include "radiance_cache.h"
+#include "mlt.h"
 #include "camera.h"
 #include "timerutil.h"
 #include "scene.h"
@@ -56,16 +60,6 @@ const int kTileSize = 8;
 
 const int kPtexMaxMem = 1024 * 1024; // @fixme.
 
-struct PathVertex {
-  real3 P;          // Position
-  real3 N;          // Normal
-  real3 wi;         // Incident vector
-  real3 throughput; // Path throughput(RGB)
-  int matID;        // Material ID
-};
-
-typedef std::vector<PathVertex> Path;
-
 namespace {
 
 typedef real3 (*ShaderFun)(Scene *scene, const Camera *camera, const RenderConfig *config, float *image, int* count, int px, int py, int step);
@@ -113,9 +107,125 @@ void PtexTest(PtexTexture *r) {
 bool gPlane = false;
 Plane gPlaneObject;
 
+// Path guiding(RenderConfig::guiding). The field is learned across passes.
+GuidingField gGuidingField;
+GuidingField *gGuiding = NULL; // Non-NULL when enabled in the pass
+double gGuidingFraction = 0.5;
+
+// Radiance cache(RenderConfig::radiance_cache). Kept when the view changes,
+// cleared when the scene changes.
+RadianceCache gRadianceCacheData;
+RadianceCache *gRadianceCache = NULL; // Non-NULL when enabled in the pass
+bool gRadianceCacheLookup = false;    // Terminate paths into the cache
+bool gRadianceCacheInvalid = false;   // Set by InvalidateRadianceCache()
+
+// First hit of a camera ray, stored compactly.
+typedef struct {
+  float t;
+  float normal[3];
+  float geometricNormal[3];
+  float texcoord[2];
+  unsigned int faceID;
+  unsigned int materialID;
+  unsigned char state; // 0 = not traced yet, 1 = miss, 2 = hit, 3 = hit plane
+} PrimaryHit;
+
+// Primary hit cache(RenderConfig::primary_cache). Camera rays are jittered
+// to one of strata x strata fixed sub-pixel positions, so that the first hit
+// of each pixel and stratum is traced once and reused by later passes.
+struct PrimaryCache {
+  int width;
+  int height;
+  int strata; // Per axis
+  std::vector<PrimaryHit> hits;
+
+  PrimaryCache() : width(0), height(0), strata(0) {}
+
+  void Resize(int w, int h, int n) {
+    width = w;
+    height = h;
+    strata = n;
+    hits.resize(size_t(w) * size_t(h) * size_t(n * n));
+    Clear();
+  }
+
+  void Clear() {
+    if (!hits.empty()) {
+      memset(&hits[0], 0, sizeof(PrimaryHit) * hits.size());
+    }
+  }
+
+  // Choose a stratum of the pixel. Returns its sub-pixel offset in
+  // [-0.5, 0.5)^2 and the cache slot.
+  PrimaryHit *Jitter(int px, int py, real rnd, float &u, float &v) {
+    int numStrata = strata * strata;
+    int s = (std::min)(int(rnd * numStrata), numStrata - 1);
+    u = (s % strata + 0.5f) / strata - 0.5f;
+    v = (s / strata + 0.5f) / strata - 0.5f;
+    return &hits[(size_t(py) * width + px) * numStrata + s];
+  }
+};
+
+PrimaryCache gPrimaryCacheData;
+PrimaryCache *gPrimaryCache = NULL; // Non-NULL when enabled in the pass
+bool gPrimaryCacheInvalid = false;  // Set by InvalidatePrimaryCache()
+int gViewGeneration = 0;            // Bumped by InvalidateView()
+
 unsigned int gSeed[1024][4];
+unsigned int gSeedGeneration = 0; // Bumped when resumed from a checkpoint
+bool gSeedRestored = false;       // Set by SetRandomState()
+
+// Primary sample vector of the thread while evaluating an MLT path. When
+// set, randomreal() draws from it.
+#ifdef _OPENMP
+MLTSampler *gMLTSampler[1024];
+#else
+static THREAD_TLS MLTSampler *gMLTSampler = NULL;
+#endif
+
+inline void SetThreadSampler(MLTSampler *sampler) {
+#ifdef _OPENMP
+  gMLTSampler[omp_get_thread_num()] = sampler;
+#else
+  gMLTSampler = sampler;
+#endif
+}
+
+// First hit of a camera path, for AOV output.
+typedef struct {
+  float values[kNumAOVs];
+  int materialID;
+  int faceID;
+} AOVSample;
+
+// AOV record of the thread. When set, PathTrace() fills it.
+#ifdef _OPENMP
+AOVSample *gAOVSample[1024];
+#else
+static THREAD_TLS AOVSample *gAOVSample = NULL;
+#endif
+
+inline void SetThreadAOV(AOVSample *sample) {
+#ifdef _OPENMP
+  gAOVSample[omp_get_thread_num()] = sample;
+#else
+  gAOVSample = sample;
+#endif
+}
+
+inline AOVSample *GetThreadAOV() {
+#ifdef _OPENMP
+  return gAOVSample[omp_get_thread_num()];
+#else
+  return gAOVSample;
+#endif
+}
 
 inline void init_randomreal(void) {
+  if (gSeedRestored) {
+    return;
+  }
+
 #if _OPENMP
   // @todo { Remove calling omp_XYZ for each time. }
   assert(omp_get_max_threads() < 1024);
@@ -139,6 +249,9 @@ inline double randomreal(void) {
 #ifdef _OPENMP
   // @todo { don't use omp_get_thread_num() }
   int tid = omp_get_thread_num();
+  if (gMLTSampler[tid]) {
+    return gMLTSampler[tid]->Next();
+  }
   unsigned int x = gSeed[tid][0];
   unsigned int y = gSeed[tid][1];
   unsigned int z = gSeed[tid][2];
@@ -155,9 +268,22 @@ inline double randomreal(void) {
   gSeed[tid][3] = w;
   return w * (1.0 / 4294967296.0);
 #else
+  if (gMLTSampler) {
+    return gMLTSampler->Next();
+  }
   // @fixme { don't use __thread keyword? }
   static unsigned int THREAD_TLS x = 123456789, y = 362436069, z = 521288629,
                                  w = 88675123;
+  static unsigned int THREAD_TLS generation = 0;
+  if (generation != gSeedGeneration) {
+    // Per-thread streams can't be saved. Start new ones instead of
+    // repeating the samples of the previous run.
+    generation = gSeedGeneration;
+    x = 123456789 + generation * 2654435761u;
+    y = 362436069;
+    z = 521288629;
+    w = 88675123;
+  }
   unsigned t = x ^ (x << 11);
   x = y;
   y = z;
@@ -167,6 +293,93 @@ inline double randomreal(void) {
 #endif
 }
 
+// Destination of the samples of a pass. Either the image of the pass with
+// per-pixel counts, or the accumulation buffer(`accum` non-NULL).
+typedef struct {
+  float *image;
+  int *count;
+  AccumBuffer *accum;
+  int originX; // Pixel of the image at the first pixel of the buffer(bucket)
+  int originY;
+} PassOutput;
+
+// Store `L`, the sum of `numSamples` samples of `pixel`. The image of the
+// pass receives their mean.
+inline void StoreSample(const PassOutput &output, int pixel, const real3 &L,
+                        int numSamples) {
+  if (output.accum) {
+    double *c = &output.accum->color[3 * pixel];
+    c[0] += L[0];
+    c[1] += L[1];
+    c[2] += L[2];
+    output.accum->count[pixel] += numSamples;
+  } else {
+    real scale = 1.0 / numSamples;
+    output.image[3 * pixel + 0] = L[0] * scale;
+    output.image[3 * pixel + 1] = L[1] * scale;
+    output.image[3 * pixel + 2] = L[2] * scale;
+    output.count[pixel]++;
+  }
+}
+
+// Add `sample`, the sum of the AOVs of the samples of `pixel`.
+inline void StoreAOV(const PassOutput &output, int pixel,
+                     const AOVSample &sample) {
+  float *values = &output.accum->aov[kNumAOVs * size_t(pixel)];
+  for (int k = 0; k < kNumAOVs; k++) {
+    values[k] += sample.values[k];
+  }
+  output.accum->materialID[pixel] = sample.materialID;
+  output.accum->faceID[pixel] = sample.faceID;
+}
+
+// Trace `spp` paths of the pixel and store them to the pixels of the
+// block(clipped by `endX` and `endY`). `width` is the width of the output
+// buffer.
+inline void RenderPixel(Scene *scene, const Camera *camera,
+                        const RenderConfig *config, const PassOutput &output,
+                        ShaderFun shader, int px, int py, int width, int endX,
+                        int endY, int step, int spp) {
+  bool aov = output.accum && output.accum->HasAOV();
+
+  AOVSample sum;
+  memset(&sum, 0, sizeof(AOVSample));
+
+  real3 radiance(0.0, 0.0, 0.0);
+  for (int s = 0; s < spp; s++) {
+    AOVSample sample;
+    if (aov) {
+      memset(&sample, 0, sizeof(AOVSample));
+      sample.materialID = -1;
+      sample.faceID = -1;
+      SetThreadAOV(&sample);
+    }
+
+    radiance += shader(scene, camera, config, output.image, output.count, px,
+                       py, 1);
+
+    if (aov) {
+      SetThreadAOV(NULL);
+      for (int k = 0; k < kNumAOVs; k++) {
+        sum.values[k] += sample.values[k];
+      }
+      sum.materialID = sample.materialID;
+      sum.faceID = sample.faceID;
+    }
+  }
+
+  // block fill for step > 1
+  for (int v = 0; (v < step) && ((py + v) < endY); v++) {
+    for (int u = 0; (u < step) && ((px + u) < endX); u++) {
+      int pixel = (py + v - output.originY) * width + (px + u - output.originX);
+      StoreSample(output, pixel, radiance, spp);
+      if (aov) {
+        StoreAOV(output, pixel, sum);
+      }
+    }
+  }
+}
+
 typedef struct {
 	int startX;
 	int startY;
@@ -178,8 +391,8 @@ typedef struct {
 	const Camera* camera;
 	const RenderConfig* config;
   int step;
-	float* image;		// [rw]
-	int* count;		// [rw]
+  int spp;		// Samples per pixel
+  PassOutput output;	// [rw]
 
   ShaderFun shader;
 	int  taskId;
@@ -189,49 +402,27 @@ void RenderTaskFunc(void *data, int threadIndex, int threadCount, int taskIndex,
   const RenderTile* tiles = reinterpret_cast<const RenderTile*>(data);
   const RenderTile* tile = &tiles[taskIndex];
 
-  int step = 1; // @todo { tile->step }
+  int step = tile->step;
+  int spp = tile->spp;
 
   for (int y = tile->startY; y < tile->endY; y += step) {
 
     for (int x = tile->startX; x < tile->endX; x += step) {
 
-      int px = x;
-      int py = y;
-
-      real3 radiance =
-          tile->shader(tile->scene, tile->camera, tile->config, tile->image, tile->count, px, py, 1);
-
-      tile->image[3 * (py * tile->width + px) + 0] = radiance[0];
-      tile->image[3 * (py * tile->width + px) + 1] = radiance[1];
-      tile->image[3 * (py * tile->width + px) + 2] = radiance[2];
-
-      if (tile->step == 1) {
-        tile->count[py * tile->width + px]++;
-      }
+      // block fill for step > 1 is clipped by the tile, which other tasks
+      // may write concurrently.
+      RenderPixel(tile->scene, tile->camera, tile->config, tile->output,
+                  tile->shader, x, y, tile->width, tile->endX, tile->endY,
+                  step, spp);
 
     }
 
-    // @todo { block fill }
-    //if (tile->step > 1) {
-    //  for (int x = 0; x < tile->width; x += step) {
-    //    for (int v = 0; v < step; v++) {
-    //      for (int u = 0; u < step; u++) {
-    //        for (int k = 0; k < 3; k++) {
-    //          image[((y + v) * width * 3 + (x + u) * 3) + k] =
-    //              image[3 * (y * width + x) + k];
-    //          count[(y + v) * width + (x + u)]++;
-    //        }
-    //      }
-    //    }
-    //  }
-    //}
-
   }
 
   //printf("%d, %d, %d, %d\n", tiles[taskIndex].startX, threadCount, taskIndex, taskCount);
 }
 
-void SetupRenderTask(std::vector<RenderTile>& tiles, const Scene& scene, const Camera& camera, const RenderConfig& config, std::vector<float>& image, std::vector<int>& count, int width, int height, int step, int tileSize, ShaderFun shader)
+void SetupRenderTask(std::vector<RenderTile>& tiles, const Scene& scene, const Camera& camera, const RenderConfig& config, const PassOutput& output, int width, int height, int step, int spp, int tileSize, ShaderFun shader)
 {
 	int tw = width / tileSize;
 	int th = height / tileSize;
@@ -248,16 +439,16 @@ void SetupRenderTask(std::vector<RenderTile>& tiles, const Scene& scene, const C
 			tile.startX = x * tileSize;
 			tile.startY = y * tileSize;
 			tile.endX = (x == (tw-1)) ? width : (x+1) * tileSize;
-			tile.endY = (x == (tw-1)) ? height : (y+1) * tileSize;
+			tile.endY = (y == (th-1)) ? height : (y+1) * tileSize;
 			tile.width = width;
 			tile.height = height;
       tile.step = step;
+      tile.spp = spp;
 
 			tile.scene = const_cast<Scene*>(&scene);
 			tile.camera = &camera;
 			tile.config = &config;
-			tile.image = &image.at(0);
-			tile.count = &count.at(0);
+			tile.output = output;
 
       tile.shader = shader;
 			tile.taskId = y * tw + x;
@@ -338,6 +529,50 @@ double SampleDiffuseIS(real3 &dir, const real3 &normal) {
   return cos_theta; // PDF = weight
 }
 
+// Solid angle pdf of the bounce direction at a diffuse vertex. Cosine
+// sampling, mixed with the guiding distribution `dtree`(if any).
+double BouncePdf(const DTree *dtree, const real3 &N, const real3 &dir) {
+  double pdfW = (std::max)(vdot(N, dir), 0.0) / M_PI;
+  if (dtree) {
+    pdfW = gGuidingFraction * dtree->Pdf(dir) +
+           (1.0 - gGuidingFraction) * pdfW;
+  }
+  return pdfW;
+}
+
+// Sample the bounce direction at a diffuse vertex. With a guiding
+// distribution, either technique is chosen by gGuidingFraction(one-sample
+// MIS). Returns the weight f * cosTheta / pdf(= kd without guiding).
+bool SampleBounce(real3 &dir, real3 &weight, double &pdfW, const DTree *dtree,
+                  const real3 &N, const real3 &kd) {
+  if (dtree && (randomreal() < gGuidingFraction)) {
+    real rnd[2];
+    rnd[0] = randomreal();
+    rnd[1] = randomreal();
+    dtree->Sample(dir, rnd);
+  } else {
+    SampleDiffuseIS(dir, N);
+  }
+
+  double cosTheta = vdot(N, dir);
+  if (cosTheta <= 0.0) {
+    return false;
+  }
+
+  if (!dtree) {
+    pdfW = cosTheta / M_PI;
+    weight = kd;
+    return true;
+  }
+
+  pdfW = BouncePdf(dtree, N, dir);
+  if (pdfW <= 0.0) {
+    return false;
+  }
+  weight = kd * (cosTheta / (M_PI * pdfW));
+  return true;
+}
+
 // Mis power (1 for balance heuristic)
 double Mis(double aPdf) { return aPdf; }
 
@@ -346,46 +581,339 @@ double Mis2(double aSamplePdf, double aOtherPdf) {
   return Mis(aSamplePdf) / (Mis(aSamplePdf) + Mis(aOtherPdf));
 }
 
-void GenEyePath(const Scene &scene, int x, int y) {
+// Shadow ray test against the scene and the debug plane.
+bool Occluded(Scene *scene, const real3 &org, const real3 &dir, real dist) {
+  Ray ray;
+  ray.org = org;
+  ray.dir = dir;
+
+  if (scene->Occluded(ray, dist)) {
+    return true;
+  }
+
+  if (gPlane) {
+    Intersection isect;
+    isect.t = dist;
+    if (gPlaneObject.intersect(&isect, ray)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Solid angle pdf with which NEE at (P, N) would have sampled the point of
+// area light `lightID` hit at distance `t` by a BSDF sampled ray. Includes
+// the probability of not choosing the environment light.
+real LightHitPdfW(Scene *scene, int lightID, const real3 &P, const real3 &N,
+                  real t, real cosLight) {
+  const TriangleLight &light = scene->GetLight(lightID);
+  return (1.0 - scene->EnvLightSelectProb()) * scene->LightPdf(lightID, P, N) *
+         t * t / (cosLight * light.Area());
+}
+
+// Next event estimation: Sample a point on the area light and compute its
+// contribution at the diffuse surface point P, MIS'ed against BSDF sampling.
+// The environment light(if loaded) is chosen with EnvLightSelectProb().
+// Visibility is not tested here; the caller traces the returned shadow ray
+// (shadowOrg, shadowDir, shadowDist). Returns false if there's no
+// contribution. `dtree` is the guiding distribution at P(NULL = unguided).
+bool SampleDirectLightUnoccluded(Scene *scene, const real3 &P, const real3 &N,
+                                 const real3 &kd, const DTree *dtree, real3 &L,
+                                 real3 &shadowOrg, real3 &shadowDir,
+                                 real &shadowDist) {
+  real envProb = scene->EnvLightSelectProb();
+  real rnd = randomreal();
+
+  if (rnd < envProb) {
+    // Environment light.
+    real envRnd[2];
+    envRnd[0] = randomreal();
+    envRnd[1] = randomreal();
+
+    real3 wi, Le;
+    real pdfW = scene->GetEnvLight().Sample(wi, Le, envRnd);
+    if (pdfW <= 0.0) {
+      return false;
+    }
+
+    real cosSurf = vdot(N, wi);
+    if (cosSurf <= 0.0) {
+      return false;
+    }
+
+    real pdfLightW = envProb * pdfW;
+    real pdfBsdfW = BouncePdf(dtree, N, wi);
+    real weight = Mis2(pdfLightW, pdfBsdfW);
+
+    L = Le * kd * (weight * cosSurf / (M_PI * pdfLightW));
+    shadowOrg = P + kEPS * wi;
+    shadowDir = wi;
+    shadowDist = kFar;
+    return true;
+  }
+
+  real lightPickPdf;
+  int lightID = scene->SampleLight(lightPickPdf, P, N,
+                                   (rnd - envProb) / (1.0 - envProb));
+  if (lightID < 0) {
+    return false;
+  }
+  lightPickPdf *= (1.0 - envProb);
+
+  const TriangleLight &light = scene->GetLight(lightID);
+
+  real posRnd[2];
+  posRnd[0] = randomreal();
+  posRnd[1] = randomreal();
+
+  real3 lightP, lightN;
+  real pdfA = light.SamplePosition(lightP, lightN, posRnd);
+
+  real3 wi = lightP - P;
+  real dist2 = vdot(wi, wi);
+  real dist = sqrt(dist2);
+  wi = wi * (1.0 / dist);
+
+  real cosLight = -vdot(lightN, wi);
+  real cosSurf = vdot(N, wi);
+  if ((cosLight <= 0.0) || (cosSurf <= 0.0)) {
+    return false;
+  }
 
-  double u0 = randomreal();
-  double u1 = randomreal();
+  real pdfLightW = lightPickPdf * pdfA * dist2 / cosLight;
+  real pdfBsdfW = BouncePdf(dtree, N, wi);
+  real weight = Mis2(pdfLightW, pdfBsdfW);
+
+  L = light.Radiance() * kd * (weight * cosSurf / (M_PI * pdfLightW));
+  shadowOrg = P + kEPS * wi;
+  shadowDir = wi;
+  shadowDist = dist - 2.0 * kEPS;
+  return true;
 }
 
-void TraceRay(const Scene &scene, Ray &ray) {}
+real3 SampleDirectLight(Scene *scene, const real3 &P, const real3 &N,
+                        const real3 &kd, const DTree *dtree) {
+  real3 L, shadowOrg, shadowDir;
+  real shadowDist;
+  if (!SampleDirectLightUnoccluded(scene, P, N, kd, dtree, L, shadowOrg,
+                                   shadowDir, shadowDist)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  if (Occluded(scene, shadowOrg, shadowDir, shadowDist)) {
+    return real3(0.0, 0.0, 0.0);
+  }
 
-void GenLightPath(Scene &scene, int numPhotons) {
-  std::vector<Path> paths;
+  return L;
+}
 
-  real3 lightPos = real3(0.0, 20.0, 0.0);
-  real3 lightDir = real3(0.0, -1.0, 0.0);
+// First-bounce splitting. The path is restarted from the first diffuse
+// vertex until `left` secondary paths are consumed.
+struct SplitVertex {
+  int left;
+  real3 P;
+  real3 N;
+  real3 kd;
+  const DTree *dtree;
+  real3 throughput; // Before the bounce. Includes 1 / (# of splits)
+};
 
-  for (int i = 0; i < numPhotons; i++) {
-    Path path;
+// Sample the bounce of the next secondary path. Returns false when no split
+// is left.
+bool SampleSplitBounce(SplitVertex &split, real3 &org, real3 &dir,
+                       real3 &throughput, double &lastPdfW) {
+  while (split.left > 0) {
+    split.left--;
+
+    real3 sampledDir, weight;
+    if (!SampleBounce(sampledDir, weight, lastPdfW, split.dtree, split.N,
+                      split.kd)) {
+      continue;
+    }
 
-    Ray ray;
+    org = split.P + kEPS * sampledDir;
+    dir = sampledDir;
+    throughput = split.throughput * weight;
+    return true;
+  }
 
-    real3 dir = lightDir;
-    dir.normalize();
+  return false;
+}
 
-    ray.dir = dir;
-    ray.org = lightPos;
+// Russian roulette after `rr_depth` vertices. Survival probability follows the
+// path throughput(which includes albedo of visited vertices). The split
+// factor is removed so that splitting does not kill secondary paths early.
+// Returns false if the path is terminated.
+bool RussianRoulette(real3 &throughput, unsigned int pathLength,
+                     const RenderConfig *config) {
+  if ((config->rr_depth <= 0) || ((int)pathLength < config->rr_depth)) {
+    return true;
+  }
 
-    Intersection isect;
-    bool hit = scene.Trace(isect, ray);
+  real scale = (std::max)(config->split_count, 1);
+  real q = (std::max)(throughput[0], (std::max)(throughput[1], throughput[2]));
+  q = (std::min)((real)1.0, q * scale);
+
+  if (randomreal() >= q) {
+    return false;
+  }
+
+  throughput = throughput * (1.0 / q);
+  return true;
+}
+
+// Diffuse vertices of a path, for training the guiding field. Radiance
+// gathered after a vertex divided by the throughput(after the bounce) is the
+// incident radiance along the sampled direction.
+struct GuidingPath {
+  int numVertices;
+  real3 P[kMaxPathLength];
+  real3 dir[kMaxPathLength];
+  real3 throughput[kMaxPathLength];
+  real3 radiance[kMaxPathLength]; // Path radiance when the vertex is added
+  double pdfW[kMaxPathLength];
+
+  GuidingPath() : numVertices(0) {}
+
+  void Add(const real3 &hitP, const real3 &sampledDir, const real3 &weight,
+           double pdf, const real3 &pathRadiance) {
+    if (numVertices >= kMaxPathLength) {
+      return;
+    }
+    P[numVertices] = hitP;
+    dir[numVertices] = sampledDir;
+    throughput[numVertices] = weight;
+    radiance[numVertices] = pathRadiance;
+    pdfW[numVertices] = pdf;
+    numVertices++;
+  }
+
+  // Record the vertices with the final path radiance.
+  void Commit(GuidingField *field, const real3 &pathRadiance) {
+    for (int i = 0; i < numVertices; i++) {
+      real3 Li = pathRadiance - radiance[i];
+      real lum = 0.0;
+      const real lumWeight[3] = {0.2126, 0.7152, 0.0722};
+      for (int k = 0; k < 3; k++) {
+        if (throughput[i][k] > 0.0) {
+          lum += lumWeight[k] * Li[k] / throughput[i][k];
+        }
+      }
+      field->Record(P[i], dir[i], float(lum / pdfW[i]));
+    }
+    numVertices = 0;
+  }
+};
+
+// Trace the scene and the infinite plane.
+bool TraceScene(Scene *scene, Intersection &isect, Ray &ray,
+                bool &hitPlane) {
+  // Texcoords are only set for meshes with UVs.
+  isect.texcoord[0] = 0.0;
+  isect.texcoord[1] = 0.0;
+  bool hit = scene->Trace(isect, ray);
+  hitPlane = false;
+  if (gPlane) { // @fixme
+    hitPlane = gPlaneObject.intersect(&isect, ray);
+    hit |= hitPlane;
+  }
+  return hit;
+}
+
+// TraceScene() for a camera ray, through the primary hit cache. Only the
+// members which the path tracer uses are restored.
+bool TracePrimary(Scene *scene, Intersection &isect, Ray &ray,
+                  bool &hitPlane, PrimaryHit *cached) {
+  if (cached->state == 0) {
+    bool hit = TraceScene(scene, isect, ray, hitPlane);
+    if (hit) {
+      cached->t = float(isect.t);
+      for (int k = 0; k < 3; k++) {
+        cached->normal[k] = float(isect.normal[k]);
+        cached->geometricNormal[k] = float(isect.geometricNormal[k]);
+      }
+      cached->texcoord[0] = float(isect.texcoord[0]);
+      cached->texcoord[1] = float(isect.texcoord[1]);
+      cached->faceID = isect.faceID;
+      cached->materialID = isect.materialID;
+    }
+    cached->state = hit ? (hitPlane ? 3 : 2) : 1;
+    return hit;
+  }
 
-    paths.push_back(path);
+  hitPlane = (cached->state == 3);
+  if (cached->state == 1) {
+    return false;
   }
+
+  isect.t = cached->t;
+  isect.normal = real3(cached->normal[0], cached->normal[1], cached->normal[2]);
+  isect.geometricNormal =
+      real3(cached->geometricNormal[0], cached->geometricNormal[1],
+            cached->geometricNormal[2]);
+  isect.texcoord[0] = cached->texcoord[0];
+  isect.texcoord[1] = cached->texcoord[1];
+  isect.faceID = cached->faceID;
+  isect.materialID = cached->materialID;
+  isect.position = ray.org + isect.t * ray.dir;
+  return true;
 }
 
+// Diffuse vertices of a path, for the radiance cache. Radiance gathered from a
+// vertex on(NEE included, emission excluded) divided by the throughput which
+// arrives at the vertex is its reflected radiance.
+struct CachePath {
+  int numVertices;
+  real3 P[kMaxPathLength];
+  real3 N[kMaxPathLength];
+  real3 throughput[kMaxPathLength];
+  real3 radiance[kMaxPathLength]; // Path radiance when the vertex is added
+
+  CachePath() : numVertices(0) {}
+
+  void Add(const real3 &hitP, const real3 &n, const real3 &pathThroughput,
+           const real3 &pathRadiance) {
+    if (numVertices >= kMaxPathLength) {
+      return;
+    }
+    P[numVertices] = hitP;
+    N[numVertices] = n;
+    throughput[numVertices] = pathThroughput;
+    radiance[numVertices] = pathRadiance;
+    numVertices++;
+  }
+
+  // Record the vertices from `first` on with the final path radiance. The
+  // vertices before `first`(the split vertex) are kept for the next
+  // secondary path.
+  void Commit(RadianceCache *cache, const real3 &pathRadiance, int first) {
+    for (int i = first; i < numVertices; i++) {
+      real3 Li = pathRadiance - radiance[i];
+      real3 L;
+      for (int k = 0; k < 3; k++) {
+        L[k] = (throughput[i][k] > 0.0) ? Li[k] / throughput[i][k] : 0.0;
+      }
+      cache->Record(P[i], N[i], L);
+    }
+    numVertices = (std::min)(numVertices, first);
+  }
+};
+
 real3 PathTrace(Scene *scene, const Camera *camera, const RenderConfig *config,
                 float* image, // RGB
                 int* count, int px, int py, int step) {
   //
   // 1. Sample eye(E0)
   //
-  float u = randomreal() - 0.5;
-  float v = randomreal() - 0.5;
+  float u, v;
+  PrimaryHit *primaryHit = NULL;
+  if (gPrimaryCache) {
+    primaryHit = gPrimaryCache->Jitter(px, py, randomreal(), u, v);
+  } else {
+    u = randomreal() - 0.5;
+    v = randomreal() - 0.5;
+  }
 
   // Ray ray = camera.GenerateRay(px + u + step / 2.0f, py + v + step / 2.0f);
   Ray ray = camera->GenerateRay(px + u, py + v);
@@ -398,37 +926,73 @@ real3 PathTrace(Scene *scene, const Camera *camera, const RenderConfig *config,
   unsigned int pathLength = 1;
   bool lastSpecular = true;
   double lastPdfW = 1.0;
+  real3 lastP, lastN; // Previous diffuse vertex
+
+  SplitVertex split;
+  split.left = 0;
+
+  GuidingPath guidingPath;
+  CachePath cachePath;
+
+  for (;;) {
+    for (;; ++pathLength) {
+      bool hitPlane;
+      bool hit;
+      if (primaryHit) {
+        hit = TracePrimary(scene, isect, ray, hitPlane, primaryHit);
+        primaryHit = NULL;
+      } else {
+        hit = TraceScene(scene, isect, ray, hitPlane);
+      }
+      if (!hit) {
+
+        if (scene->HasEnvMap()) {
+          // Hit environment light.
+          real3 Le = scene->GetBackgroundRadiance(ray.dir);
+          if (lastSpecular) {
+            radiance += throughput * Le;
+          } else {
+            real pdfLightW =
+                scene->EnvLightSelectProb() * scene->GetEnvLight().Pdf(ray.dir);
+            radiance += throughput * Le * Mis2(lastPdfW, pdfLightW);
+          }
+          break;
+        }
 
-  for (;; ++pathLength) {
-    bool hit = scene->Trace(isect, ray);
-    if (gPlane) { // @fixme
-      hit |= gPlaneObject.intersect(&isect, ray);
-    }
-    if (!hit) {
+        if (pathLength < kMinPathLength) {
+          // eye -> background hit.
+          break;
+        }
 
-      if (pathLength < kMinPathLength) {
-        // eye -> background hit.
+        // Hit background.
+        real3 kd = real3(0.5, 0.5, 0.5);
+        radiance += throughput * kd / real3(pathLength, pathLength, pathLength);
         break;
       }
 
-      // Hit background.
-      real3 kd = real3(0.5, 0.5, 0.5);
-      radiance += throughput * kd / real3(pathLength, pathLength, pathLength);
-    }
-
-    if (pathLength >= kMaxPathLength) {
-      break;
-    }
-
-    real3 hitP = ray.org + isect.t * ray.dir;
-
-    // 2. Next event estimation{todo}
-    {}
+      real3 hitP = ray.org + isect.t * ray.dir;
+
+      // Hit area light. Emission is one-sided(front face).
+      int lightID = hitPlane ? -1 : scene->GetLightID(isect.faceID);
+      if (lightID >= 0) {
+        const TriangleLight &light = scene->GetLight(lightID);
+        real cosLight = -vdot(isect.geometricNormal, ray.dir);
+        if (cosLight > 0.0) {
+          if (lastSpecular) {
+            radiance += throughput * light.Radiance();
+          } else {
+            // Light also could be sampled by NEE at the previous vertex.
+            real pdfLightW =
+                LightHitPdfW(scene, lightID, lastP, lastN, isect.t, cosLight);
+            radiance +=
+                throughput * light.Radiance() * Mis2(lastPdfW, pdfLightW);
+          }
+        }
+      }
 
-    // 3. Continue path tracing.
-    {
-      double r = randomreal();
-      real3 sampledDir;
+      if (pathLength >= kMaxPathLength) {
+        break;
+      }
 
       // faceforward.
       real3 n = isect.normal;
@@ -436,77 +1000,669 @@ real3 PathTrace(Scene *scene, const Camera *camera, const RenderConfig *config,
       if (ndoti < 0.0) {
         n = n.neg();
       }
-      double pdf = SampleDiffuseIS(sampledDir, n);
 
-      if (isect.materialID != (unsigned int)(-1)) {
-        const Material& mat = scene->GetMaterial(isect.materialID);
-        throughput[0] *= mat.diffuse[0]; // @fixme { factor * (cosThetaOut / pdf); }
-        throughput[1] *= mat.diffuse[1]; 
-        throughput[2] *= mat.diffuse[2]; 
+      const Material &mat = scene->GetMaterial(isect.materialID);
+
+      if (pathLength == 1) {
+        AOVSample *aov = GetThreadAOV();
+        if (aov) {
+          for (int k = 0; k < 3; k++) {
+            aov->values[kAOVAlbedoR + k] = mat.diffuse[k];
+            aov->values[kAOVNormalX + k] = n[k];
+            aov->values[kAOVPositionX + k] = hitP[k];
+          }
+          aov->values[kAOVDepth] = isect.t;
+          aov->values[kAOVTexcoordU] = isect.texcoord[0];
+          aov->values[kAOVTexcoordV] = isect.texcoord[1];
+          aov->materialID = isect.materialID;
+          aov->faceID = hitPlane ? -1 : int(isect.faceID);
+        }
+      }
+
+      // Preview: the rest of the path is approximated by the cached
+      // reflected radiance after the first bounce.
+      if (gRadianceCache) {
+        real3 cached;
+        if (gRadianceCacheLookup && (pathLength > 1) &&
+            gRadianceCache->Lookup(hitP, n, cached)) {
+          radiance += throughput * cached;
+          break;
+        }
+        cachePath.Add(hitP, n, throughput, radiance);
       }
 
-      ray.org = hitP + kEPS * sampledDir;
-      ray.dir = sampledDir;
+      const DTree *dtree = gGuiding ? gGuiding->Lookup(hitP) : NULL;
+
+      // 2. Next event estimation
+      radiance +=
+          throughput * SampleDirectLight(scene, hitP, n, mat.diffuse, dtree);
+
+      // 3. Continue path tracing.
+      {
+        if ((pathLength == 1) && (config->split_count > 1)) {
+          throughput = throughput * (1.0 / config->split_count);
+          split.left = config->split_count - 1;
+          split.P = hitP;
+          split.N = n;
+          split.kd = mat.diffuse;
+          split.dtree = dtree;
+          split.throughput = throughput;
+        }
 
-      isect.t = kFar;
-    }
-  }
+        real3 sampledDir, weight;
+        double pdfW;
+        if (!SampleBounce(sampledDir, weight, pdfW, dtree, n, mat.diffuse)) {
+          break;
+        }
 
-  return radiance;
-}
+        // f * cosTheta / pdf = (kd / pi) * cosTheta / (cosTheta / pi) = kd
+        // without guiding.
+        throughput = throughput * weight;
 
-real3 ShowNormal(Scene &scene, const Camera &camera, const RenderConfig &config,
-                std::vector<float> &image, // RGB
-                std::vector<int> &count, int px, int py, int step) {
-  //
-  // 1. Sample eye(E0)
-  //
-  float u = randomreal() - 0.5;
-  float v = randomreal() - 0.5;
+        if (!RussianRoulette(throughput, pathLength, config)) {
+          break;
+        }
 
-  // Ray ray = camera.GenerateRay(px + u + step / 2.0f, py + v + step / 2.0f);
-  Ray ray = camera.GenerateRay(px + u, py + v);
+        if (gGuiding) {
+          guidingPath.Add(hitP, sampledDir, throughput, pdfW, radiance);
+        }
 
-  Intersection isect;
-  isect.t = kFar;
+        lastPdfW = pdfW;
+        lastSpecular = false;
+        lastP = hitP;
+        lastN = n;
 
-  real3 radiance(0.0, 0.0, 0.0);
+        ray.org = hitP + kEPS * sampledDir;
+        ray.dir = sampledDir;
 
-  bool hit = scene.Trace(isect, ray);
-  if (hit) {
+        isect.t = kFar;
+      }
+    }
 
-      real3 kd = real3(0.5, 0.5, 0.5);
-      radiance[0] = isect.normal[0] * 0.5 + 0.5;
-      radiance[1] = isect.normal[1] * 0.5 + 0.5;
-      radiance[2] = isect.normal[2] * 0.5 + 0.5;
+    if (gGuiding) {
+      guidingPath.Commit(gGuiding, radiance);
+    }
+    if (gRadianceCache) {
+      cachePath.Commit(gRadianceCache, radiance, 1);
+    }
+
+    // Restart from the first vertex for the next secondary path.
+    if (!SampleSplitBounce(split, ray.org, ray.dir, throughput, lastPdfW)) {
+      break;
+    }
+
+    if (gGuiding) {
+      guidingPath.Add(split.P, ray.dir, throughput, lastPdfW, radiance);
+    }
+
+    pathLength = 2;
+    lastSpecular = false;
+    lastP = split.P;
+    lastN = split.N;
+    isect.t = kFar;
+  }
+
+  if (gRadianceCache) {
+    cachePath.Commit(gRadianceCache, radiance, 0);
   }
 
   return radiance;
 }
 
-real3 ShowUV(Scene &scene, const Camera &camera, const RenderConfig &config,
-                std::vector<float> &image, // RGB
-                std::vector<int> &count, int px, int py, int step) {
-  //
-  // 1. Sample eye(E0)
-  //
-  float u = randomreal() - 0.5;
-  float v = randomreal() - 0.5;
+// Target function of PSSMLT. PathTrace() whose random numbers, including the
+// raster position, are the primary samples of `sampler`.
+typedef struct {
+  Scene *scene;
+  const Camera *camera;
+  const RenderConfig *config;
+} MLTPathContext;
 
-  // Ray ray = camera.GenerateRay(px + u + step / 2.0f, py + v + step / 2.0f);
-  Ray ray = camera.GenerateRay(px + u, py + v);
+real3 MLTPathTrace(void *data, MLTSampler &sampler, int &px, int &py) {
+  const MLTPathContext *ctx = reinterpret_cast<const MLTPathContext *>(data);
+  int width = ctx->config->width;
+  int height = ctx->config->height;
 
-  Intersection isect;
-  isect.t = kFar;
+  SetThreadSampler(&sampler);
 
-  real3 radiance(0.0, 0.0, 0.0);
+  px = (std::min)(int(randomreal() * width), width - 1);
+  py = (std::min)(int(randomreal() * height), height - 1);
 
-  bool hit = scene.Trace(isect, ray);
-  if (hit) {
+  real3 L = PathTrace(ctx->scene, ctx->camera, ctx->config, NULL, NULL, px, py,
+                      1);
 
-      real3 kd = real3(0.5, 0.5, 0.5);
-      radiance[0] = 0.1*isect.texcoord[0];
-      radiance[1] = 0.0f; //isect.texcoord[0];
+  SetThreadSampler(NULL);
+
+  return L;
+}
+
+//
+// Wavefront path tracer.
+//
+// Paths are kept in a fixed-size pool whose state is stored as SoA, and each
+// iteration runs the stages below over queues of path slots:
+//
+//   generate -> extend -> shade -> connect -> accumulate
+//
+// Terminated slots are refilled with new camera paths(path regeneration) so
+// that queues stay large until the image is exhausted. Each stage only
+// touches the fields it needs, which lets ray traversal and shading be
+// batched(and sorted/vectorized) independently.
+//
+
+const int kWavefrontPoolSize = 1 << 16;
+const int kWavefrontChunkSize = 256; // # of queue items per task
+
+struct WavefrontPaths {
+  void Resize(size_t n) {
+    pixel.resize(n);
+    org.resize(n);
+    dir.resize(n);
+    throughput.resize(n);
+    radiance.resize(n);
+    pathLength.resize(n);
+    lastPdfW.resize(n);
+    lastSpecular.resize(n);
+    lastP.resize(n);
+    lastN.resize(n);
+    split.resize(n);
+
+    hit.resize(n);
+    hitPlane.resize(n);
+    hitT.resize(n);
+    hitFaceID.resize(n);
+    hitMaterialID.resize(n);
+    hitNormal.resize(n);
+    hitGeometricNormal.resize(n);
+
+    alive.resize(n);
+    shadowValid.resize(n);
+    shadowOrg.resize(n);
+    shadowDir.resize(n);
+    shadowDist.resize(n);
+    shadowL.resize(n);
+  }
+
+  // Path state
+  std::vector<int> pixel; // -1 = free slot
+  std::vector<real3> org;
+  std::vector<real3> dir;
+  std::vector<real3> throughput;
+  std::vector<real3> radiance;
+  std::vector<int> pathLength;
+  std::vector<real> lastPdfW;
+  std::vector<char> lastSpecular;
+  std::vector<real3> lastP; // Previous diffuse vertex
+  std::vector<real3> lastN;
+  std::vector<SplitVertex> split;
+
+  // Extend stage output
+  std::vector<char> hit;
+  std::vector<char> hitPlane;
+  std::vector<real> hitT;
+  std::vector<unsigned int> hitFaceID;
+  std::vector<unsigned int> hitMaterialID;
+  std::vector<real3> hitNormal;
+  std::vector<real3> hitGeometricNormal;
+
+  // Shade stage output
+  std::vector<char> alive;
+  std::vector<char> shadowValid;
+  std::vector<real3> shadowOrg;
+  std::vector<real3> shadowDir;
+  std::vector<real> shadowDist;
+  std::vector<real3> shadowL; // Unoccluded contribution(incl. throughput)
+};
+
+struct WavefrontContext {
+  Scene *scene;
+  const Camera *camera;
+  const RenderConfig *config;
+  float *image;
+  int *count;
+  int width;
+  int gridWidth; // # of pixels to render in x(= width / step)
+  int step;
+
+  WavefrontPaths paths;
+
+  std::vector<int> generateQueue;
+  std::vector<int> rayQueue;
+  std::vector<int> shadowQueue;
+  std::vector<int> finishedQueue;
+};
+
+typedef void (*WavefrontStageFunc)(WavefrontContext *ctx, int begin, int end);
+
+void WavefrontGenerate(WavefrontContext *ctx, int begin, int end) {
+  WavefrontPaths &paths = ctx->paths;
+
+  for (int i = begin; i < end; i++) {
+    int slot = ctx->generateQueue[i];
+
+    int g = paths.pixel[slot];
+    int px = (g % ctx->gridWidth) * ctx->step;
+    int py = (g / ctx->gridWidth) * ctx->step;
+    paths.pixel[slot] = py * ctx->width + px;
+
+    float u = randomreal() - 0.5;
+    float v = randomreal() - 0.5;
+
+    Ray ray = ctx->camera->GenerateRay(px + u, py + v);
+
+    paths.org[slot] = ray.org;
+    paths.dir[slot] = ray.dir;
+    paths.throughput[slot] = real3(1.0, 1.0, 1.0);
+    paths.radiance[slot] = real3(0.0, 0.0, 0.0);
+    paths.pathLength[slot] = 1;
+    paths.lastPdfW[slot] = 1.0;
+    paths.lastSpecular[slot] = true;
+    paths.split[slot].left = 0;
+  }
+}
+
+void WavefrontExtend(WavefrontContext *ctx, int begin, int end) {
+  WavefrontPaths &paths = ctx->paths;
+
+  for (int i = begin; i < end; i++) {
+    int slot = ctx->rayQueue[i];
+
+    Ray ray;
+    ray.org = paths.org[slot];
+    ray.dir = paths.dir[slot];
+
+    Intersection isect;
+    isect.t = kFar;
+    isect.materialID = (unsigned int)(-1);
+
+    bool hit = ctx->scene->Trace(isect, ray);
+    bool hitPlane = false;
+    if (gPlane) { // @fixme
+      hitPlane = gPlaneObject.intersect(&isect, ray);
+      hit |= hitPlane;
+    }
+
+    paths.hit[slot] = hit;
+    paths.hitPlane[slot] = hitPlane;
+    if (hit) {
+      paths.hitT[slot] = isect.t;
+      paths.hitFaceID[slot] = isect.faceID;
+      paths.hitMaterialID[slot] = isect.materialID;
+      paths.hitNormal[slot] = isect.normal;
+      paths.hitGeometricNormal[slot] = isect.geometricNormal;
+    }
+  }
+}
+
+// Same as the loop body of PathTrace().
+void WavefrontShadePath(WavefrontContext *ctx, int slot) {
+  WavefrontPaths &paths = ctx->paths;
+  Scene *scene = ctx->scene;
+  const RenderConfig *config = ctx->config;
+
+  paths.alive[slot] = false;
+  paths.shadowValid[slot] = false;
+
+  const real3 &dir = paths.dir[slot];
+  real3 throughput = paths.throughput[slot];
+  real3 radiance = paths.radiance[slot];
+  int pathLength = paths.pathLength[slot];
+
+  if (!paths.hit[slot]) {
+    if (scene->HasEnvMap()) {
+      // Hit environment light.
+      real3 Le = scene->GetBackgroundRadiance(dir);
+      if (paths.lastSpecular[slot]) {
+        radiance += throughput * Le;
+      } else {
+        real pdfLightW =
+            scene->EnvLightSelectProb() * scene->GetEnvLight().Pdf(dir);
+        radiance += throughput * Le * Mis2(paths.lastPdfW[slot], pdfLightW);
+      }
+    } else if (pathLength >= kMinPathLength) {
+      // Hit background.
+      real3 kd = real3(0.5, 0.5, 0.5);
+      radiance +=
+          throughput * kd / real3(pathLength, pathLength, pathLength);
+    }
+
+    paths.radiance[slot] = radiance;
+    return;
+  }
+
+  real t = paths.hitT[slot];
+  real3 hitP = paths.org[slot] + t * dir;
+
+  // Hit area light. Emission is one-sided(front face).
+  int lightID =
+      paths.hitPlane[slot] ? -1 : scene->GetLightID(paths.hitFaceID[slot]);
+  if (lightID >= 0) {
+    const TriangleLight &light = scene->GetLight(lightID);
+    real cosLight = -vdot(paths.hitGeometricNormal[slot], dir);
+    if (cosLight > 0.0) {
+      if (paths.lastSpecular[slot]) {
+        radiance += throughput * light.Radiance();
+      } else {
+        real pdfLightW = LightHitPdfW(scene, lightID, paths.lastP[slot],
+                                      paths.lastN[slot], t, cosLight);
+        radiance += throughput * light.Radiance() *
+                    Mis2(paths.lastPdfW[slot], pdfLightW);
+      }
+    }
+  }
+
+  paths.radiance[slot] = radiance;
+
+  if (pathLength >= kMaxPathLength) {
+    return;
+  }
+
+  // faceforward.
+  real3 n = paths.hitNormal[slot];
+  if (vdot(n, dir) > 0.0) {
+    n = n.neg();
+  }
+
+  const Material &mat = scene->GetMaterial(paths.hitMaterialID[slot]);
+
+  // Next event estimation. The shadow ray is traced in the connect stage.
+  real3 L;
+  if (SampleDirectLightUnoccluded(scene, hitP, n, mat.diffuse, NULL, L,
+                                  paths.shadowOrg[slot],
+                                  paths.shadowDir[slot],
+                                  paths.shadowDist[slot])) {
+    paths.shadowL[slot] = throughput * L;
+    paths.shadowValid[slot] = true;
+  }
+
+  // Continue path tracing.
+  if ((pathLength == 1) && (config->split_count > 1)) {
+    throughput = throughput * (1.0 / config->split_count);
+    SplitVertex &split = paths.split[slot];
+    split.left = config->split_count - 1;
+    split.P = hitP;
+    split.N = n;
+    split.kd = mat.diffuse;
+    split.dtree = NULL;
+    split.throughput = throughput;
+  }
+
+  real3 sampledDir, weight;
+  double pdfW;
+  if (!SampleBounce(sampledDir, weight, pdfW, NULL, n, mat.diffuse)) {
+    return;
+  }
+
+  throughput = throughput * weight;
+
+  if (!RussianRoulette(throughput, pathLength, config)) {
+    return;
+  }
+
+  paths.throughput[slot] = throughput;
+  paths.lastPdfW[slot] = pdfW;
+  paths.lastSpecular[slot] = false;
+  paths.lastP[slot] = hitP;
+  paths.lastN[slot] = n;
+  paths.org[slot] = hitP + kEPS * sampledDir;
+  paths.dir[slot] = sampledDir;
+  paths.pathLength[slot] = pathLength + 1;
+  paths.alive[slot] = true;
+}
+
+void WavefrontShade(WavefrontContext *ctx, int begin, int end) {
+  WavefrontPaths &paths = ctx->paths;
+
+  for (int i = begin; i < end; i++) {
+    int slot = ctx->rayQueue[i];
+
+    WavefrontShadePath(ctx, slot);
+
+    if (paths.alive[slot]) {
+      continue;
+    }
+
+    // Restart from the first vertex for the next secondary path.
+    SplitVertex &split = paths.split[slot];
+    double lastPdfW;
+    if (SampleSplitBounce(split, paths.org[slot], paths.dir[slot],
+                          paths.throughput[slot], lastPdfW)) {
+      paths.lastPdfW[slot] = lastPdfW;
+      paths.lastSpecular[slot] = false;
+      paths.lastP[slot] = split.P;
+      paths.lastN[slot] = split.N;
+      paths.pathLength[slot] = 2;
+      paths.alive[slot] = true;
+    }
+  }
+}
+
+void WavefrontConnect(WavefrontContext *ctx, int begin, int end) {
+  WavefrontPaths &paths = ctx->paths;
+
+  for (int i = begin; i < end; i++) {
+    int slot = ctx->shadowQueue[i];
+
+    if (!Occluded(ctx->scene, paths.shadowOrg[slot], paths.shadowDir[slot],
+                  paths.shadowDist[slot])) {
+      paths.radiance[slot] += paths.shadowL[slot];
+    }
+  }
+}
+
+void WavefrontAccumulate(WavefrontContext *ctx, int begin, int end) {
+  WavefrontPaths &paths = ctx->paths;
+
+  for (int i = begin; i < end; i++) {
+    int slot = ctx->finishedQueue[i];
+    int pixel = paths.pixel[slot];
+
+    // Each pixel is owned by exactly one path in a pass.
+    ctx->image[3 * pixel + 0] = paths.radiance[slot][0];
+    ctx->image[3 * pixel + 1] = paths.radiance[slot][1];
+    ctx->image[3 * pixel + 2] = paths.radiance[slot][2];
+
+    if (ctx->step == 1) {
+      ctx->count[pixel]++;
+    }
+
+    paths.pixel[slot] = -1;
+  }
+}
+
+#if !defined(_OPENMP) // Tasksys version
+typedef struct {
+  WavefrontStageFunc func;
+  WavefrontContext *ctx;
+  int numItems;
+} WavefrontStageTask;
+
+void WavefrontStageTaskFunc(void *data, int threadIndex, int threadCount,
+                            int taskIndex, int taskCount) {
+  const WavefrontStageTask *task =
+      reinterpret_cast<const WavefrontStageTask *>(data);
+
+  int begin = taskIndex * kWavefrontChunkSize;
+  int end = (std::min)(begin + kWavefrontChunkSize, task->numItems);
+  task->func(task->ctx, begin, end);
+}
+#endif
+
+// Run the stage over `numItems` queue items in parallel.
+void RunWavefrontStage(WavefrontStageFunc func, WavefrontContext *ctx,
+                       int numItems) {
+  if (numItems <= 0) {
+    return;
+  }
+
+  int numChunks = (numItems + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+
+#if !defined(_OPENMP) // Tasksys version
+  WavefrontStageTask task;
+  task.func = func;
+  task.ctx = ctx;
+  task.numItems = numItems;
+
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(WavefrontStageTaskFunc), &task,
+             numChunks);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < numChunks; i++) {
+    int begin = i * kWavefrontChunkSize;
+    int end = (std::min)(begin + kWavefrontChunkSize, numItems);
+    func(ctx, begin, end);
+  }
+#endif
+}
+
+void RenderWavefront(Scene &scene, const Camera &camera,
+                     const RenderConfig &config, std::vector<float> &image,
+                     std::vector<int> &count, int step) {
+  int width = config.width;
+  int height = config.height;
+
+  int gridWidth = (width + step - 1) / step;
+  int gridHeight = (height + step - 1) / step;
+  int numPixels = gridWidth * gridHeight;
+
+  // Reuse buffers across passes.
+  static WavefrontContext ctx;
+  ctx.scene = &scene;
+  ctx.camera = &camera;
+  ctx.config = &config;
+  ctx.image = &image.at(0);
+  ctx.count = &count.at(0);
+  ctx.width = width;
+  ctx.gridWidth = gridWidth;
+  ctx.step = step;
+
+  int poolSize = (std::min)(kWavefrontPoolSize, numPixels);
+  WavefrontPaths &paths = ctx.paths;
+  paths.Resize(poolSize);
+  std::fill(paths.pixel.begin(), paths.pixel.end(), -1);
+
+  ctx.generateQueue.reserve(poolSize);
+  ctx.rayQueue.reserve(poolSize);
+  ctx.shadowQueue.reserve(poolSize);
+  ctx.finishedQueue.reserve(poolSize);
+
+  int nextPixel = 0;
+
+  for (;;) {
+    // Refill free slots with camera paths.
+    ctx.generateQueue.clear();
+    for (int slot = 0; (slot < poolSize) && (nextPixel < numPixels); slot++) {
+      if (paths.pixel[slot] < 0) {
+        paths.pixel[slot] = nextPixel++; // grid index. Resolved in generate.
+        ctx.generateQueue.push_back(slot);
+      }
+    }
+    RunWavefrontStage(WavefrontGenerate, &ctx, ctx.generateQueue.size());
+
+    ctx.rayQueue.clear();
+    for (int slot = 0; slot < poolSize; slot++) {
+      if (paths.pixel[slot] >= 0) {
+        ctx.rayQueue.push_back(slot);
+      }
+    }
+
+    if (ctx.rayQueue.empty()) {
+      break;
+    }
+
+    RunWavefrontStage(WavefrontExtend, &ctx, ctx.rayQueue.size());
+    RunWavefrontStage(WavefrontShade, &ctx, ctx.rayQueue.size());
+
+    ctx.shadowQueue.clear();
+    ctx.finishedQueue.clear();
+    for (size_t i = 0; i < ctx.rayQueue.size(); i++) {
+      int slot = ctx.rayQueue[i];
+      if (paths.shadowValid[slot]) {
+        ctx.shadowQueue.push_back(slot);
+      }
+      if (!paths.alive[slot]) {
+        ctx.finishedQueue.push_back(slot);
+      }
+    }
+
+    RunWavefrontStage(WavefrontConnect, &ctx, ctx.shadowQueue.size());
+    RunWavefrontStage(WavefrontAccumulate, &ctx, ctx.finishedQueue.size());
+  }
+
+  // block fill
+  if (step > 1) {
+    for (int y = 0; y < height; y += step) {
+      for (int x = 0; x < width; x += step) {
+        for (int v = 0; (v < step) && ((y + v) < height); v++) {
+          for (int u = 0; (u < step) && ((x + u) < width); u++) {
+            for (int k = 0; k < 3; k++) {
+              image[((y + v) * width * 3 + (x + u) * 3) + k] =
+                  image[3 * (y * width + x) + k];
+            }
+            count[(y + v) * width + (x + u)]++;
+          }
+        }
+      }
+    }
+  }
+}
+
+real3 ShowNormal(Scene &scene, const Camera &camera, const RenderConfig &config,
+                std::vector<float> &image, // RGB
+                std::vector<int> &count, int px, int py, int step) {
+  //
+  // 1. Sample eye(E0)
+  //
+  float u = randomreal() - 0.5;
+  float v = randomreal() - 0.5;
+
+  // Ray ray = camera.GenerateRay(px + u + step / 2.0f, py + v + step / 2.0f);
+  Ray ray = camera.GenerateRay(px + u, py + v);
+
+  Intersection isect;
+  isect.t = kFar;
+
+  real3 radiance(0.0, 0.0, 0.0);
+
+  bool hit = scene.Trace(isect, ray);
+  if (hit) {
+
+      real3 kd = real3(0.5, 0.5, 0.5);
+      radiance[0] = isect.normal[0] * 0.5 + 0.5;
+      radiance[1] = isect.normal[1] * 0.5 + 0.5;
+      radiance[2] = isect.normal[2] * 0.5 + 0.5;
+  }
+
+  return radiance;
+}
+
+real3 ShowUV(Scene &scene, const Camera &camera, const RenderConfig &config,
+                std::vector<float> &image, // RGB
+                std::vector<int> &count, int px, int py, int step) {
+  //
+  // 1. Sample eye(E0)
+  //
+  float u = randomreal() - 0.5;
+  float v = randomreal() - 0.5;
+
+  // Ray ray = camera.GenerateRay(px + u + step / 2.0f, py + v + step / 2.0f);
+  Ray ray = camera.GenerateRay(px + u, py + v);
+
+  Intersection isect;
+  isect.t = kFar;
+
+  real3 radiance(0.0, 0.0, 0.0);
+
+  bool hit = scene.Trace(isect, ray);
+  if (hit) {
+
+      real3 kd = real3(0.5, 0.5, 0.5);
+      radiance[0] = 0.1*isect.texcoord[0];
+      radiance[1] = 0.0f; //isect.texcoord[0];
       radiance[2] = 0.0f; //isect.texcoord[0];
       //radiance[1] = isect.st[1] * 0.5 + 0.5;
       //radiance[2] = isect.normal[2] * 0.5 + 0.5;
@@ -590,28 +1746,119 @@ real3 PathTraceEnv(Scene &scene, const Camera &camera,
 }
 }
 
-void Render(Scene &scene, const RenderConfig &config,
-            std::vector<float> &image, // RGB
-            std::vector<int> &count, const double eye[3],
-            const double lookat[3], const double up[3], const double quat[4],
-            int step) {
-  int width = config.width;
-  int height = config.height;
-  double fov = config.fov;
+// Returns true when the view(camera, fov, resolution or the preview step)
+// differs from the one recorded in `lastView`, or InvalidateView() was
+// called, and records the new one.
+bool ViewChanged(double lastView[18], const RenderConfig &config,
+                 const double eye[3], const double lookat[3],
+                 const double up[3], const double quat[4], int step) {
+  double view[18];
+  for (int i = 0; i < 3; i++) {
+    view[i] = eye[i];
+    view[3 + i] = lookat[i];
+    view[6 + i] = up[i];
+  }
+  for (int i = 0; i < 4; i++) {
+    view[9 + i] = quat[i];
+  }
+  view[13] = config.fov;
+  view[14] = config.width;
+  view[15] = config.height;
+  view[16] = step;
+  view[17] = gViewGeneration;
+
+  bool changed = false;
+  for (int i = 0; i < 18; i++) {
+    if (view[i] != lastView[i]) {
+      changed = true;
+    }
+    lastView[i] = view[i];
+  }
 
-  double origin[3], corner[3], du[3], dv[3];
-  Camera camera(eye, lookat, up);
-  camera.BuildCameraFrame(origin, corner, du, dv, fov, quat, width, height);
-  // printf("[Mallie] origin = %f, %f, %f\n", gOrigin[0], gOrigin[1],
-  // gOrigin[2]);
-  // printf("[Mallie] corner = %f, %f, %f\n", gCorner[0], gCorner[1],
-  // gCorner[2]);
-  // printf("[Mallie] du     = %f, %f, %f\n", gDu[0], gDu[1], gDu[2]);
-  // printf("[Mallie] dv     = %f, %f, %f\n", gDv[0], gDv[1], gDv[2]);
+  return changed;
+}
 
-  assert(image.size() >= 3 * width * height);
-  // memset(&image.at(0), 0, sizeof(float) * width * height * 3);
+// Returns true when the scene(geometry or lights) differs from the one
+// recorded in `lastScene`, and records the new one. Edits which keep the
+// bounds and the number of lights need InvalidateRadianceCache().
+bool SceneChanged(double lastScene[8], Scene &scene) {
+  real3 bmin, bmax;
+  scene.BoundingBox(bmin, bmax);
+
+  double signature[8];
+  for (int i = 0; i < 3; i++) {
+    signature[i] = bmin[i];
+    signature[3 + i] = bmax[i];
+  }
+  signature[6] = scene.NumLights();
+  signature[7] = double(reinterpret_cast<size_t>(&scene));
+
+  bool changed = false;
+  for (int i = 0; i < 8; i++) {
+    if (signature[i] != lastScene[i]) {
+      changed = true;
+    }
+    lastScene[i] = signature[i];
+  }
+
+  return changed;
+}
+
+// VCM/BPT integrator. The renderer is kept across passes since the merging
+// radius shrinks with the iteration count. It restarts when the view changes.
+void RenderVCM(Scene &scene, const Camera &camera, const RenderConfig &config,
+               std::vector<float> &image, std::vector<int> &count,
+               const double eye[3], const double lookat[3],
+               const double up[3], const double quat[4], int step) {
+  static VCMRenderer renderer;
+  static double lastView[18];
+
+  if (ViewChanged(lastView, config, eye, lookat, up, quat, step)) {
+    renderer.Reset();
+  }
+
+  renderer.RenderPass(scene, camera, config, image, count, step,
+                      gPlane ? &gPlaneObject : NULL);
+}
 
+// SPPM. Per-pixel radius and photon statistics are kept across passes.
+void RenderSPPM(Scene &scene, const Camera &camera, const RenderConfig &config,
+                std::vector<float> &image, std::vector<int> &count,
+                const double eye[3], const double lookat[3],
+                const double up[3], const double quat[4], int step) {
+  static SPPMRenderer renderer;
+  static double lastView[18];
+
+  if (ViewChanged(lastView, config, eye, lookat, up, quat, step)) {
+    renderer.Reset();
+  }
+
+  renderer.RenderPass(scene, camera, config, image, count, step,
+                      gPlane ? &gPlaneObject : NULL);
+}
+
+// PSSMLT. Markov chains are kept across passes.
+void RenderMLT(Scene &scene, const Camera &camera, const RenderConfig &config,
+               std::vector<float> &image, std::vector<int> &count,
+               const double eye[3], const double lookat[3],
+               const double up[3], const double quat[4], int step) {
+  static MLTRenderer renderer;
+  static double lastView[18];
+
+  if (ViewChanged(lastView, config, eye, lookat, up, quat, step)) {
+    renderer.Reset();
+  }
+
+  MLTPathContext ctx;
+  ctx.scene = &scene;
+  ctx.camera = &camera;
+  ctx.config = &config;
+
+  renderer.RenderPass(config, image, count, step, MLTPathTrace, &ctx);
+}
+
+// Random number streams and the debug plane, at the first pass.
+static void InitRender(Scene &scene, const RenderConfig &config) {
   static bool initial_pass = true;
   if (initial_pass) {
     init_randomreal();
@@ -626,85 +1873,389 @@ void Render(Scene &scene, const RenderConfig &config,
       gPlaneObject.set(0, 1, 0, -(zmin - zsize * 0.0001f));
     }
   }
+}
+
+// Render a pass to `image` and `count`, or add it to `accum` when non-NULL.
+// In the latter case the path tracer adds samples in place, while other
+// integators write `image`(scratch) which is added afterwards.
+static void RenderPass(Scene &scene, const RenderConfig &config,
+                       std::vector<float> &image, // RGB
+                       std::vector<int> &count, AccumBuffer *accum,
+                       const double eye[3], const double lookat[3],
+                       const double up[3], const double quat[4], int step) {
+  int width = config.width;
+  int height = config.height;
+  double fov = config.fov;
+
+  double origin[3], corner[3], du[3], dv[3];
+  Camera camera(eye, lookat, up);
+  camera.BuildCameraFrame(origin, corner, du, dv, fov, quat, width, height);
+  // printf("[Mallie] origin = %f, %f, %f\n", gOrigin[0], gOrigin[1],
+  // gOrigin[2]);
+  // printf("[Mallie] corner = %f, %f, %f\n", gCorner[0], gCorner[1],
+  // gCorner[2]);
+  // printf("[Mallie] du     = %f, %f, %f\n", gDu[0], gDu[1], gDu[2]);
+  // printf("[Mallie] dv     = %f, %f, %f\n", gDv[0], gDv[1], gDv[2]);
+
+  // memset(&image.at(0), 0, sizeof(float) * width * height * 3);
+
+  InitRender(scene, config);
 
-  mallie::timerutil t;
   mallie::timerutil tEventTimer;
 
-  t.start();
   tEventTimer.start();
 
-  //
-  // Clear background with gradation.
-  //
-  memset(&image[0], 0, sizeof(float) * width * height * 3);
+  // Integrators other than the path tracer write whole pixels of the pass.
+  const std::string &integrator = config.integrator;
+  bool wholePixels = (integrator == "wavefront") || (integrator == "vcm") ||
+                     (integrator == "bpt") || (integrator == "sppm") ||
+                     (integrator == "mlt");
+
+  PassOutput output;
+  output.accum = accum;
+  output.originX = 0;
+  output.originY = 0;
+  if (accum) {
+    output.image = NULL;
+    output.count = NULL;
+    if (wholePixels) {
+      image.resize(3 * width * height);
+      count.assign(width * height, 0);
+    }
+  } else {
+    assert(image.size() >= 3 * width * height);
 
+    //
+    // Clear background with gradation.
+    //
+    memset(&image[0], 0, sizeof(float) * width * height * 3);
+
+    output.image = &image.at(0);
+    output.count = &count.at(0);
+  }
+
+  gGuiding = NULL;
+  gRadianceCache = NULL;
+  gPrimaryCache = NULL;
+
+  if (config.integrator == "wavefront") {
+    RenderWavefront(scene, camera, config, image, count, step);
+  } else if ((config.integrator == "vcm") || (config.integrator == "bpt")) {
+    RenderVCM(scene, camera, config, image, count, eye, lookat, up, quat,
+              step);
+  } else if (config.integrator == "sppm") {
+    RenderSPPM(scene, camera, config, image, count, eye, lookat, up, quat,
+               step);
+  } else if (config.integrator == "mlt") {
+    RenderMLT(scene, camera, config, image, count, eye, lookat, up, quat,
+              step);
+  } else {
+
+    // Path guiding. The field depends only on the scene, thus it is kept
+    // when the view changes.
+    if (config.guiding) {
+      if (!gGuidingField.IsInitialized()) {
+        real3 bmin, bmax;
+        scene.BoundingBox(bmin, bmax);
+        gGuidingField.Init(bmin, bmax);
+        printf("Mallie:info\tmsg:Path guiding enabled\n");
+      }
+      gGuiding = &gGuidingField;
+      gGuidingFraction =
+          (std::max)(0.0, (std::min)(1.0, config.guiding_fraction));
+    }
+
+    // Radiance cache. Learned in every pass, used by previews(step > 1).
+    if (config.radiance_cache) {
+      static double lastScene[8];
+      if (SceneChanged(lastScene, scene) ||
+          !gRadianceCacheData.IsInitialized()) {
+        real3 bmin, bmax;
+        scene.BoundingBox(bmin, bmax);
+        gRadianceCacheData.Init(bmin, bmax, config.radiance_cache_cell);
+        printf("Mallie:info\tmsg:Radiance cache initialized\n");
+      } else if (gRadianceCacheInvalid) {
+        gRadianceCacheData.Clear();
+      }
+      gRadianceCacheInvalid = false;
+      gRadianceCache = &gRadianceCacheData;
+      gRadianceCacheLookup = (step > 1);
+    }
+
+    // Primary hit cache. Cleared when the camera or the scene changes.
+    if (config.primary_cache) {
+      static double lastView[18];
+      static double lastScene[8];
+      int strata = (std::max)(1, config.primary_cache_strata);
+      bool viewChanged =
+          ViewChanged(lastView, config, eye, lookat, up, quat, 0);
+      bool sceneChanged = SceneChanged(lastScene, scene);
+      if ((gPrimaryCacheData.width != width) ||
+          (gPrimaryCacheData.height != height) ||
+          (gPrimaryCacheData.strata != strata)) {
+        gPrimaryCacheData.Resize(width, height, strata);
+      } else if (viewChanged || sceneChanged || gPrimaryCacheInvalid) {
+        gPrimaryCacheData.Clear();
+      }
+      gPrimaryCacheInvalid = false;
+      gPrimaryCache = &gPrimaryCacheData;
+    }
+
+    // Samples per pixel of the pass, taken in a row by the worker.
+    int spp = (std::max)(1, config.spp);
 
 #if !defined(_OPENMP) // Tasksys version
 
-  std::vector<RenderTile> tiles;
-  SetupRenderTask(tiles, scene, camera, config, image, count, width, height, step, 32, PathTrace);
+    std::vector<RenderTile> tiles;
+    SetupRenderTask(tiles, scene, camera, config, output, width, height, step, spp, 32, PathTrace);
 
-  void* handle = NULL;
-  // @note { No need to alloc memory with ISPCAlloc. }
-  void* memPtr = ISPCAlloc(&handle, 0, /* align */16);
+    void* handle = NULL;
+    // @note { No need to alloc memory with ISPCAlloc. }
+    void* memPtr = ISPCAlloc(&handle, 0, /* align */16);
 
-  int ntasks = (int)tiles.size();
-  ISPCLaunch(&handle, reinterpret_cast<void*>(RenderTaskFunc), &tiles.at(0), ntasks);
-  ISPCSync(handle);
+    int ntasks = (int)tiles.size();
+    ISPCLaunch(&handle, reinterpret_cast<void*>(RenderTaskFunc), &tiles.at(0), ntasks);
+    ISPCSync(handle);
 
 #else // OMP version
 
 #pragma omp parallel for schedule(dynamic, 1)
-  for (int y = 0; y < height; y += step) {
+    for (int y = 0; y < height; y += step) {
 
-    // if ((y % 100) == 0) {
-    // printf("\rMallie:info\tRender %d of %d", y, height);
-    // fflush(stdout);
-    //}
+      // if ((y % 100) == 0) {
+      // printf("\rMallie:info\tRender %d of %d", y, height);
+      // fflush(stdout);
+      //}
 
-    for (int x = 0; x < width; x += step) {
+      for (int x = 0; x < width; x += step) {
 
-      int px = x;
-      int py = y;
+        RenderPixel(&scene, &camera, &config, output, PathTrace, x, y, width,
+                    width, height, step, spp);
 
-      real3 radiance =
-          PathTrace(&scene, &camera, &config, &image.at(0), &count.at(0), px, py, 1);
+      }
 
-      image[3 * (py * width + px) + 0] = radiance[0];
-      image[3 * (py * width + px) + 1] = radiance[1];
-      image[3 * (py * width + px) + 2] = radiance[2];
+    }
 
-      if (step == 1) {
-        count[py * width + px]++;
-      }
+#endif // !OMP version
 
+    // Learn from this pass.
+    if (gGuiding) {
+      gGuiding->Update();
+    }
+    if (gRadianceCache) {
+      gRadianceCache->Update(config.radiance_cache_decay);
     }
+  }
 
-    // block fill
-    if (step > 1) {
-      for (int x = 0; x < width; x += step) {
-        for (int v = 0; v < step; v++) {
-          for (int u = 0; u < step; u++) {
-            for (int k = 0; k < 3; k++) {
-              image[((y + v) * width * 3 + (x + u) * 3) + k] =
-                  image[3 * (y * width + x) + k];
-              count[(y + v) * width + (x + u)]++;
-            }
-          }
-        }
+  // Add the image of the pass. Pixels are written once per pass.
+  if (accum && wholePixels) {
+    for (int i = 0; i < width * height; i++) {
+      if (count[i] > 0) {
+        StoreSample(output, i,
+                    real3(image[3 * i + 0], image[3 * i + 1], image[3 * i + 2]),
+                    1);
       }
     }
+  }
+}
+
+void InvalidateRadianceCache() { gRadianceCacheInvalid = true; }
+
+void InvalidatePrimaryCache() { gPrimaryCacheInvalid = true; }
+
+void InvalidateView() { gViewGeneration++; }
+
+void GetRandomState(std::vector<unsigned int> &state) {
+  state.resize(1 + 1024 * 4);
+  state[0] = gSeedGeneration;
+  memcpy(&state[1], &gSeed[0][0], sizeof(unsigned int) * 1024 * 4);
+}
 
+void SetRandomState(const std::vector<unsigned int> &state) {
+  if (state.size() != 1 + 1024 * 4) {
+    return;
   }
 
-#endif // !OMP version
+  init_randomreal();
 
-  t.end();
+  // Slots of threads which did not run before keep their initial seed.
+  for (int i = 0; i < 1024; i++) {
+    const unsigned int *seed = &state[1 + 4 * i];
+    if (seed[0] | seed[1] | seed[2] | seed[3]) {
+      memcpy(gSeed[i], seed, sizeof(unsigned int) * 4);
+    }
+  }
 
-  double fps = 1000.0 / (double)t.msec();
-  printf("\r[Mallie] Render time: %f sec(s) | %f fps",
-         (double)t.msec() / 1000.0, fps);
-  fflush(stdout);
+  gSeedGeneration = state[0] + 1;
+  gSeedRestored = true;
+}
+
+void Render(Scene &scene, const RenderConfig &config,
+            std::vector<float> &image, // RGB
+            std::vector<int> &count, const double eye[3],
+            const double lookat[3], const double up[3], const double quat[4],
+            int step) {
+  RenderPass(scene, config, image, count, NULL, eye, lookat, up, quat, step);
+}
+
+void Render(Scene &scene, const RenderConfig &config, AccumBuffer &accum,
+            const double eye[3], const double lookat[3], const double up[3],
+            const double quat[4], int step) {
+  if ((accum.width != config.width) || (accum.height != config.height)) {
+    accum.Resize(config.width, config.height);
+  }
+
+  // Image of the pass for integrators which write whole pixels.
+  static std::vector<float> image;
+  static std::vector<int> count;
+
+  RenderPass(scene, config, image, count, &accum, eye, lookat, up, quat, step);
+}
+
+// Buckets of RenderBuckets() and RenderViews(). A task renders all samples
+// of one bucket of one view.
+typedef struct {
+  Scene *scene;
+  const Camera *cameras; // Of the views
+  const RenderConfig *config;
+  int bucketSize;
+  int numXBuckets;
+  int numBuckets; // Per view
+  int spp;
+  bool aov;
+  BucketFunc func;         // RenderBuckets()
+  ViewBucketFunc viewFunc; // RenderViews()
+  void *data;
+} BucketTask;
+
+static void RenderBucket(const BucketTask *task, int index) {
+  const RenderConfig &config = *task->config;
+  int view = index / task->numBuckets;
+  index -= view * task->numBuckets;
+
+  int startX = (index % task->numXBuckets) * task->bucketSize;
+  int startY = (index / task->numXBuckets) * task->bucketSize;
+  int endX = (std::min)(startX + task->bucketSize, config.width);
+  int endY = (std::min)(startY + task->bucketSize, config.height);
+
+  // Only the buckets being rendered are in memory.
+  AccumBuffer bucket;
+  bucket.Resize(endX - startX, endY - startY);
+  bucket.EnableAOV(task->aov);
+
+  PassOutput output;
+  output.image = NULL;
+  output.count = NULL;
+  output.accum = &bucket;
+  output.originX = startX;
+  output.originY = startY;
+
+  const Camera *camera = &task->cameras[view];
+  for (int y = startY; y < endY; y++) {
+    for (int x = startX; x < endX; x++) {
+      RenderPixel(task->scene, camera, task->config, output, PathTrace, x, y,
+                  bucket.width, endX, endY, /* step */ 1, task->spp);
+    }
+  }
+
+  if (task->viewFunc) {
+    task->viewFunc(task->data, view, bucket, startX, startY);
+  } else {
+    task->func(task->data, bucket, startX, startY);
+  }
+}
+
+#if !defined(_OPENMP) // Tasksys version
+static void BucketTaskFunc(void *data, int threadIndex, int threadCount,
+                           int taskIndex, int taskCount) {
+  RenderBucket(reinterpret_cast<const BucketTask *>(data), taskIndex);
+}
+#endif
+
+// Render the buckets of the `numViews` cameras of `task` by one worker pool.
+static void LaunchBuckets(Scene &scene, const RenderConfig &config,
+                          BucketTask &task, int bucketSize, int numViews) {
+  InitRender(scene, config);
+
+  // Caches learned across passes are not used, since every bucket takes all
+  // of its samples at once.
+  gGuiding = NULL;
+  gRadianceCache = NULL;
+  gPrimaryCache = NULL;
+
+  bucketSize = (std::max)(1, bucketSize);
+
+  task.scene = &scene;
+  task.config = &config;
+  task.bucketSize = bucketSize;
+  task.numXBuckets = (config.width + bucketSize - 1) / bucketSize;
+  task.numBuckets =
+      task.numXBuckets * ((config.height + bucketSize - 1) / bucketSize);
+  task.spp = (std::max)(1, config.spp) * (std::max)(1, config.num_passes);
+
+  // View major, so that the views are finished(and can be written) in order
+  // while the workers move on to the next ones.
+  int numTasks = task.numBuckets * numViews;
+
+#if !defined(_OPENMP) // Tasksys version
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(BucketTaskFunc), &task,
+             numTasks);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < numTasks; i++) {
+    RenderBucket(&task, i);
+  }
+#endif
+}
+
+void RenderBuckets(Scene &scene, const RenderConfig &config, int bucketSize,
+                   BucketFunc func, void *data, const double eye[3],
+                   const double lookat[3], const double up[3],
+                   const double quat[4]) {
+  double origin[3], corner[3], du[3], dv[3];
+  Camera camera(eye, lookat, up);
+  camera.BuildCameraFrame(origin, corner, du, dv, config.fov, quat,
+                          config.width, config.height);
+
+  BucketTask task;
+  task.cameras = &camera;
+  task.aov = config.aov;
+  task.func = func;
+  task.viewFunc = NULL;
+  task.data = data;
+
+  LaunchBuckets(scene, config, task, bucketSize, 1);
+}
+
+void RenderViews(Scene &scene, const RenderConfig &config,
+                 const std::vector<CameraView> &views, int bucketSize,
+                 bool aov, ViewBucketFunc func, void *data) {
+  if (views.empty()) {
+    return;
+  }
+
+  std::vector<Camera> cameras;
+  for (size_t i = 0; i < views.size(); i++) {
+    const CameraView &view = views[i];
+    double origin[3], corner[3], du[3], dv[3];
+    cameras.push_back(Camera(view.eye, view.lookat, view.up));
+    cameras.back().BuildCameraFrame(origin, corner, du, dv, config.fov,
+                                    view.quat, config.width, config.height);
+  }
+
+  BucketTask task;
+  task.cameras = &cameras.at(0);
+  task.aov = aov;
+  task.func = NULL;
+  task.viewFunc = func;
+  task.data = data;
+
+  LaunchBuckets(scene, config, task, bucketSize, int(views.size()));
 }
 
 void RenderPanoramic(Scene &scene, const RenderConfig &config,
@@ -3,11 +3,108 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include "scene.h"
 
 namespace mallie {
 
+///< Arbitrary output variables(AOVs) of the first hit of camera paths.
+enum {
+  kAOVAlbedoR = 0,
+  kAOVAlbedoG,
+  kAOVAlbedoB,
+  kAOVNormalX, // Shading normal facing the camera
+  kAOVNormalY,
+  kAOVNormalZ,
+  kAOVPositionX,
+  kAOVPositionY,
+  kAOVPositionZ,
+  kAOVDepth, // Distance from the camera, 0 = background
+  kAOVTexcoordU,
+  kAOVTexcoordV,
+  kNumAOVs
+};
+
+///< Accumulation buffer of progressive rendering. Sums are kept in double
+///< precision so that thousands of passes do not lose precision.
+struct AccumBuffer {
+  int width;
+  int height;
+  std::vector<double> color; // RGB sum
+  std::vector<int> count;    // # of samples per pixel
+
+  // Optional AOVs("path" integrator), empty when disabled. Sums over the
+  // same samples as `color`, except for the IDs of the latest sample.
+  std::vector<float> aov;       // kNumAOVs per pixel
+  std::vector<int> materialID;  // -1 = background
+  std::vector<int> faceID;      // -1 = background or the debug plane
+
+  AccumBuffer() : width(0), height(0) {}
+
+  void Resize(int w, int h) {
+    width = w;
+    height = h;
+    color.resize(3 * size_t(w) * size_t(h));
+    count.resize(size_t(w) * size_t(h));
+    if (HasAOV()) {
+      EnableAOV(true);
+    }
+    Clear();
+  }
+
+  void Clear() {
+    std::fill(color.begin(), color.end(), 0.0);
+    std::fill(count.begin(), count.end(), 0);
+    std::fill(aov.begin(), aov.end(), 0.0f);
+    std::fill(materialID.begin(), materialID.end(), -1);
+    std::fill(faceID.begin(), faceID.end(), -1);
+  }
+
+  bool HasAOV() const { return !aov.empty(); }
+
+  void EnableAOV(bool enable) {
+    size_t n = enable ? size_t(width) * size_t(height) : 0;
+    aov.resize(kNumAOVs * n, 0.0f);
+    materialID.resize(n, -1);
+    faceID.resize(n, -1);
+  }
+
+  ///< Mean AOVs of `pixel`.
+  void GetAOV(float values[kNumAOVs], int pixel) const {
+    float scale = (count[pixel] > 0) ? 1.0f / count[pixel] : 0.0f;
+    for (int k = 0; k < kNumAOVs; k++) {
+      values[k] = aov[kNumAOVs * size_t(pixel) + k] * scale;
+    }
+  }
+
+  ///< Mean of `pixel`. Zero when no sample is added yet.
+  void Get(float rgb[3], int pixel) const {
+    double scale = (count[pixel] > 0) ? 1.0 / count[pixel] : 0.0;
+    rgb[0] = float(color[3 * pixel + 0] * scale);
+    rgb[1] = float(color[3 * pixel + 1] * scale);
+    rgb[2] = float(color[3 * pixel + 2] * scale);
+  }
+};
+
+///< Camera key of a sequence. Keys are linearly interpolated between their
+///< frames.
+struct CameraKey {
+  double frame;
+  double eye[3];
+  double lookat[3];
+  double up[3];
+  double fov; // <= 0: fov of the config
+};
+
+///< Camera of a view of RenderViews().
+struct CameraView {
+  double eye[3];
+  double lookat[3];
+  double up[3];
+  double quat[4];
+};
+
 struct RenderConfig {
   double fov;
   int width;
@@ -23,16 +120,69 @@ struct RenderConfig {
   bool plane; // Infinite plane for debugging purpose
 
   int num_passes;
+  int spp; // Samples per pixel per pass("path" integrator)
+  double time_limit; // Console mode stops after this many seconds(0 = off)
+  double convergence_threshold; // Console mode stops below this error(0 = off)
+  double snapshot_interval; // Seconds between snapshots(0 = off)
+  std::string snapshot_filename; // .jpg or .exr
+  double checkpoint_interval; // Seconds between checkpoints(0 = off)
+  std::string checkpoint_filename; // Resumed from when it exists
+  bool aov; // Write albedo, normal, depth, IDs, ... with the image to .exr
+  bool denoise; // AOV guided denoising of the output and SDL previews
+  int denoise_iterations; // # of a-trous passes(filter radius 2^n pixels)
+  int bucket_size; // Console mode renders buckets of this size straight to
+                   // a tiled EXR, without a framebuffer(0 = off)
+  std::string bucket_filename; // Tiled EXR of the bucket mode
+  int num_frames; // Console mode renders a camera sequence(0 = off)
+  std::vector<CameraKey> camera_keys; // Turntable around lookat when empty
+  std::string vmd_filename; // Camera keys from the camera frames of a VMD
+  std::string sequence_filename; // Frame # by %d, e.g. "frame%04d.jpg"
+  std::vector<CameraView> views; // Console mode renders all views(multi-view)
+  std::string view_filename; // View # by %d, e.g. "view%04d.jpg"
   int num_photons; // # of photon to shoot per pass.
+  double sppm_radius; // SPPM initial gather radius relative to the scene radius
+
+  std::string integrator; // "path"(default), "wavefront", "vcm", "bpt", "sppm",
+                          // "mlt"
+  double vcm_radius; // VCM merging radius relative to the scene radius
+  int mlt_mutations; // PSSMLT mutations per pixel per pass
+  int rr_depth;    // Russian roulette starts at this path length(0 = off)
+  int split_count; // # of secondary paths at the first bounce
+  bool guiding;    // Path guiding for "path" integrator
+  double guiding_fraction; // Probability of guided bounce sampling
+  bool radiance_cache; // Cache indirect lighting for previews(step > 1)
+  double radiance_cache_cell;  // Cell size relative to the scene diagonal
+  double radiance_cache_decay; // Weight of the old records per pass
+  bool primary_cache;       // Reuse first hits of camera rays across passes
+  int primary_cache_strata; // Sub-pixel positions per axis for primary_cache
+
+  bool report_efficiency; // Report variance x time in console mode
+  std::string light_sampling; // "uniform", "power" or "tree"
 
   std::string obj_filename;
   std::string eson_filename;
   std::string magicavoxel_filename;
   std::string material_filename;
 
+  std::string envmap_filename; // Equirectangular HDR(EXR) envmap
+  double envmap_scale;
+
   RenderConfig()
       : fov(45.0), width(512), height(512), scene_scale(1.0), plane(false),
-        num_passes(10), num_photons(10000) {
+        num_passes(10), spp(1), time_limit(0.0), convergence_threshold(0.0),
+        snapshot_interval(0.0), snapshot_filename("snapshot.jpg"),
+        checkpoint_interval(0.0), checkpoint_filename("checkpoint.mmm"),
+        aov(false), denoise(false), denoise_iterations(5), bucket_size(0),
+        bucket_filename("output_tiled.exr"), num_frames(0),
+        sequence_filename("frame%04d.jpg"), view_filename("view%04d.jpg"),
+        num_photons(10000), sppm_radius(0.005),
+        integrator("path"), vcm_radius(0.003), mlt_mutations(1), rr_depth(3),
+        split_count(1),
+        guiding(false), guiding_fraction(0.5), radiance_cache(false),
+        radiance_cache_cell(0.01), radiance_cache_decay(0.9),
+        primary_cache(false), primary_cache_strata(2),
+        light_sampling("tree"),
+        envmap_scale(1.0) {
 
     eye[0] = 0.0;
     eye[1] = 0.0;
@@ -45,6 +195,7 @@ struct RenderConfig {
     up[2] = 0.0;
     quat[0] = quat[1] = quat[2] = quat[3] = 0.0;
     scene_fit = false;
+    report_efficiency = false;
   }
 };
 
@@ -53,12 +204,68 @@ extern void Render(Scene &scene, const RenderConfig &config,
                    std::vector<int> &count,   // per-pixel counter
                    const double eye[3], const double lookat[3],
                    const double up[3], const double quat[4], int step);
+
+///< Accumulation mode: adds the samples of a pass in place to `accum`. No
+///< per-pass image is cleared or copied by the path tracer.
+extern void Render(Scene &scene, const RenderConfig &config,
+                   AccumBuffer &accum, const double eye[3],
+                   const double lookat[3], const double up[3],
+                   const double quat[4], int step);
+
+///< Receives the buckets of RenderBuckets(). `bucket` holds the pixels from
+///< (`x`, `y`) of the image. Called from the render threads concurrently.
+typedef void (*BucketFunc)(void *data, const AccumBuffer &bucket, int x,
+                           int y);
+
+///< Out-of-core mode for images larger than memory("path" integrator).
+///< The image is split into `bucketSize` x `bucketSize` buckets, each of
+///< which takes all samples of its pixels(spp x num_passes) at once and is
+///< handed to `func`. Only the buckets being rendered are in memory. AOVs
+///< are captured with `aov` of `config`.
+extern void RenderBuckets(Scene &scene, const RenderConfig &config,
+                          int bucketSize, BucketFunc func, void *data,
+                          const double eye[3], const double lookat[3],
+                          const double up[3], const double quat[4]);
+
+///< Receives the buckets of RenderViews(). `bucket` holds the pixels from
+///< (`x`, `y`) of view `view`. Called from the render threads concurrently.
+typedef void (*ViewBucketFunc)(void *data, int view, const AccumBuffer &bucket,
+                               int x, int y);
+
+///< Multi-view batch("path" integrator). Buckets of all `views` are rendered
+///< by one worker pool as (view, bucket) work items, in view order, each
+///< taking all samples of its pixels(spp x num_passes) at once. AOVs are
+///< captured when `aov` is true.
+extern void RenderViews(Scene &scene, const RenderConfig &config,
+                        const std::vector<CameraView> &views, int bucketSize,
+                        bool aov, ViewBucketFunc func, void *data);
+
 extern void RenderPanoramic(Scene &scene, const RenderConfig &config,
                             std::vector<float> &image, // out image
                             std::vector<int> &count,   // per-pixel counter
                             const double eye[3], const double lookat[3],
                             const double up[3], const double quat[4],
                             bool stereo);
+
+///< Clear the radiance cache at the next pass. Call after editing geometry or
+///< lights.
+extern void InvalidateRadianceCache();
+
+///< Clear the primary hit cache at the next pass. Call after editing
+///< geometry(camera changes are detected).
+extern void InvalidatePrimaryCache();
+
+///< Treat the next pass as a new view even if the camera is the same: the
+///< primary hit cache is cleared and the progressive integrators(VCM, SPPM,
+///< MLT) restart. Call when the passes start a new image, e.g. a frame.
+extern void InvalidateView();
+
+///< State of the random number streams of the passes, for checkpoints.
+extern void GetRandomState(std::vector<unsigned int> &state);
+
+///< Continue the random number streams from `state` instead of repeating the
+///< samples of the previous run. Call before the first Render().
+extern void SetRandomState(const std::vector<unsigned int> &state);
 }
 
 #endif // __MALLIE_RENDER_H__
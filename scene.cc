@@ -7,15 +7,45 @@
 #include "importers/mesh_loader.h"
 #include "scene.h"
 #include "timerutil.h"
+#include "atomic.h"
 
 #ifdef ENABLE_EMBREE
 #include "embree2/rtcore_ray.h"
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef _WIN32
+#define THREAD_TLS __declspec(thread)
+#else // Assume gcc-like compiler
+#define THREAD_TLS __thread
+#endif
+
 namespace mallie {
 
 namespace {
 
+const int kMaxRayCounters = 1024; // Power of 2
+
+#if !defined(_OPENMP)
+int gNumRayCounterSlots = 0;
+#endif
+
+// Ray counter of the calling thread.
+inline int RayCounterSlot() {
+#ifdef _OPENMP
+  return omp_get_thread_num() & (kMaxRayCounters - 1);
+#else
+  static THREAD_TLS int slot = -1;
+  if (slot < 0) {
+    slot = AtomicFetchAdd(&gNumRayCounterSlots, 1) & (kMaxRayCounters - 1);
+  }
+  return slot;
+#endif
+}
+
 #ifdef ENABLE_EMBREE
 void error_handler(const RTCError code, const char *str) {
   printf("Embree: ");
@@ -52,7 +82,11 @@ void error_handler(const RTCError code, const char *str) {
 
 void Node::UpdateTransform() {}
 
-Scene::Scene() {}
+Scene::Scene() : lightSampling_(LIGHT_SAMPLING_TREE), hasEnvMap_(false) {
+  RayCounter zero;
+  memset(&zero, 0, sizeof(RayCounter));
+  rayCounters_.resize(kMaxRayCounters, zero);
+}
 
 Scene::~Scene() {
 #ifdef ENABLE_EMBREE
@@ -71,7 +105,7 @@ bool Scene::Init(const std::string &objFilename,
   bool ret = false;
 
   if (!objFilename.empty()) {
-    ret = MeshLoader::LoadObj(mesh_, objFilename.c_str());
+    ret = MeshLoader::LoadObj(mesh_, materials_, objFilename.c_str());
 
     if (!ret) {
       printf("Mallie:err\tmsg:Failed to load .obj file [ %s ]\n",
@@ -109,6 +143,16 @@ bool Scene::Init(const std::string &objFilename,
     return ret;
   }
 
+  if (!materialFilename.empty()) {
+    if (MeshLoader::LoadMaterialJSON(materials_, materialFilename.c_str())) {
+      printf("Mallie:info\tmsg:Success to load material file [ %s ]\n",
+             materialFilename.c_str());
+    } else {
+      printf("Mallie:warn\tmsg:Failed to load material file [ %s ]\n",
+             materialFilename.c_str());
+    }
+  }
+
   if (sceneFit) {
     real3 bmin = real3(std::numeric_limits<real>::max(),
                        std::numeric_limits<real>::max(),
@@ -247,10 +291,146 @@ bool Scene::Init(const std::string &objFilename,
   printf("    bmin = (%f, %f, %f)\n", bmin[0], bmin[1], bmin[2]);
   printf("    bmax = (%f, %f, %f)\n", bmax[0], bmax[1], bmax[2]);
 
+  BuildLights();
+  printf("  # of area lights: %d\n", NumLights());
+
   return true;
 }
 
+void Scene::BuildLights() {
+  lights_.clear();
+  faceToLight_.clear();
+
+  if (!mesh_.materialIDs) {
+    return;
+  }
+
+  faceToLight_.resize(mesh_.numFaces, -1);
+
+  for (size_t i = 0; i < mesh_.numFaces; i++) {
+    const Material &mat = GetMaterial(mesh_.materialIDs[i]);
+    if (!mat.IsEmissive()) {
+      continue;
+    }
+
+    real3 p0(&mesh_.vertices[3 * mesh_.faces[3 * i + 0]]);
+    real3 p1(&mesh_.vertices[3 * mesh_.faces[3 * i + 1]]);
+    real3 p2(&mesh_.vertices[3 * mesh_.faces[3 * i + 2]]);
+
+    TriangleLight light(p0, p1, p2, mat.emission, i);
+    if (light.Area() <= 0.0) { // degenerated
+      continue;
+    }
+
+    faceToLight_[i] = (int)lights_.size();
+    lights_.push_back(light);
+  }
+
+  if (lights_.empty()) {
+    lightCdf_.clear();
+    return;
+  }
+
+  // Power CDF
+  lightCdf_.resize(lights_.size());
+  real sum = 0.0;
+  for (size_t i = 0; i < lights_.size(); i++) {
+    real3 power = lights_[i].Power();
+    sum += 0.2126 * power[0] + 0.7152 * power[1] + 0.0722 * power[2];
+    lightCdf_[i] = sum;
+  }
+  for (size_t i = 0; i < lights_.size(); i++) {
+    lightCdf_[i] /= sum;
+  }
+  lightCdf_[lights_.size() - 1] = 1.0;
+
+  mallie::timerutil t;
+  t.start();
+
+  lightTree_.Build(lights_);
+
+  t.end();
+  printf("  Light tree: %d nodes, build time: %d msecs\n",
+         (int)lightTree_.GetNodes().size(), (int)t.msec());
+}
+
+int Scene::SampleLight(real &pdf, const real3 &P, const real3 &N,
+                       real rnd) const {
+  if (lights_.empty()) {
+    pdf = 0.0;
+    return -1;
+  }
+
+  int n = (int)lights_.size();
+
+  if (lightSampling_ == LIGHT_SAMPLING_TREE) {
+    return lightTree_.Sample(pdf, P, N, rnd);
+  } else if (lightSampling_ == LIGHT_SAMPLING_POWER) {
+    int lightID = std::upper_bound(lightCdf_.begin(), lightCdf_.end(), rnd) -
+                  lightCdf_.begin();
+    lightID = std::min(lightID, n - 1);
+    pdf = LightPdf(lightID, P, N);
+    return lightID;
+  }
+
+  // Uniform light selection.
+  int lightID = std::min((int)(rnd * n), n - 1);
+  pdf = 1.0 / n;
+
+  return lightID;
+}
+
+real Scene::LightPdf(int lightID, const real3 &P, const real3 &N) const {
+  if ((lightID < 0) || (lightID >= (int)lights_.size())) {
+    return 0.0;
+  }
+
+  if (lightSampling_ == LIGHT_SAMPLING_TREE) {
+    return lightTree_.Pdf(lightID, P, N);
+  } else if (lightSampling_ == LIGHT_SAMPLING_POWER) {
+    return (lightID == 0) ? lightCdf_[0]
+                          : (lightCdf_[lightID] - lightCdf_[lightID - 1]);
+  }
+
+  return 1.0 / lights_.size();
+}
+
+int Scene::SampleLightPower(real &pdf, real rnd) const {
+  if (lights_.empty()) {
+    pdf = 0.0;
+    return -1;
+  }
+
+  int n = (int)lights_.size();
+  int lightID = std::upper_bound(lightCdf_.begin(), lightCdf_.end(), rnd) -
+                lightCdf_.begin();
+  lightID = std::min(lightID, n - 1);
+  pdf = LightPowerPdf(lightID);
+  return lightID;
+}
+
+real Scene::LightPowerPdf(int lightID) const {
+  if ((lightID < 0) || (lightID >= (int)lights_.size())) {
+    return 0.0;
+  }
+
+  return (lightID == 0) ? lightCdf_[0]
+                        : (lightCdf_[lightID] - lightCdf_[lightID - 1]);
+}
+
+void Scene::CountRay() { rayCounters_[RayCounterSlot()].count++; }
+
+unsigned long long Scene::NumRays() const {
+  unsigned long long n = 0;
+  for (size_t i = 0; i < rayCounters_.size(); i++) {
+    n += rayCounters_[i].count;
+  }
+  return n;
+}
+
 bool Scene::Trace(Intersection &isect, Ray &ray) {
+  CountRay();
+
 #ifdef ENABLE_EMBREE
 
   // Convert to Embree's ray structure.
@@ -314,6 +494,32 @@ bool Scene::Trace(Intersection &isect, Ray &ray) {
 #endif
 }
 
+bool Scene::Occluded(const Ray &ray, real maxT) {
+  CountRay();
+
+#ifdef ENABLE_EMBREE
+  RTCRay r;
+  r.org[0] = ray.org[0];
+  r.org[1] = ray.org[1];
+  r.org[2] = ray.org[2];
+  r.dir[0] = ray.dir[0];
+  r.dir[1] = ray.dir[1];
+  r.dir[2] = ray.dir[2];
+  r.tnear = 0.0f;
+  r.tfar = maxT;
+  r.geomID = RTC_INVALID_GEOMETRY_ID;
+  r.primID = RTC_INVALID_GEOMETRY_ID;
+  r.mask = -1;
+  r.time = 0;
+
+  rtcOccluded(scene_, r);
+
+  return (r.geomID == 0);
+#else
+  return accel_.Occluded(&mesh_, ray, maxT);
+#endif
+}
+
 void Scene::BoundingBox(real3 &bmin, real3 &bmax) {
 #ifdef ENABLE_EMBREE
   bmin = bmin_;
@@ -332,9 +538,36 @@ void Scene::BoundingBox(real3 &bmin, real3 &bmax) {
 #endif
 }
 
-real3 Scene::GetBackgroundRadiance(real3 &dir) {
+real3 Scene::GetBackgroundRadiance(const real3 &dir) const {
+  if (hasEnvMap_) {
+    return envLight_.Radiance(dir);
+  }
+
   // Constant dome light
   return real3(0.75, 0.75, 0.75);
 }
 
+bool Scene::LoadEnvMap(const std::string &filename, real scale) {
+  mallie::timerutil t;
+  t.start();
+
+  if (!envLight_.Load(filename.c_str(), scale)) {
+    printf("Mallie:err\tmsg:Failed to load envmap [ %s ]\n",
+           filename.c_str());
+    hasEnvMap_ = false;
+    return false;
+  }
+
+  t.end();
+
+  hasEnvMap_ = true;
+
+  printf("Mallie:info\tmsg:Success to load envmap [ %s ]\n",
+         filename.c_str());
+  printf("  Envmap: %d x %d, build time: %d msecs\n", envLight_.Width(),
+         envLight_.Height(), (int)t.msec());
+
+  return true;
+}
+
 } // namespace
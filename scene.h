@@ -5,6 +5,9 @@
 
 #include "bvh_accel.h"
 #include "material.h"
+#include "light.h"
+#include "light_tree.h"
+#include "envlight.h"
 
 #ifdef ENABLE_EMBREE
 #include "embree2/rtcore.h"
@@ -16,6 +19,12 @@ typedef enum {
   PRIMITIVE_POLYGON,
 } PrimitiveType;
 
+typedef enum {
+  LIGHT_SAMPLING_UNIFORM, //< Uniform selection
+  LIGHT_SAMPLING_POWER,   //< Proportional to power(flat CDF)
+  LIGHT_SAMPLING_TREE,    //< Stochastic traversal of light BVH
+} LightSamplingMode;
+
 typedef struct {
   PrimitiveType type;
   BVHAccel *accel;
@@ -51,9 +60,32 @@ public:
 
   bool Trace(Intersection &isect, Ray &ray);
 
+  //< Shadow ray query. Returns true if something is hit in (0, maxT).
+  bool Occluded(const Ray &ray, real maxT);
+
+  //< # of rays traced by Trace() and Occluded() so far. Counted per thread
+  //< so that the counter is not shared by the render threads.
+  unsigned long long NumRays() const;
+
   void BoundingBox(real3 &bmin, real3 &bmax);
 
-  real3 GetBackgroundRadiance(real3 &dir);
+  real3 GetBackgroundRadiance(const real3 &dir) const;
+
+  //< Load HDR environment map(equirectangular EXR).
+  bool LoadEnvMap(const std::string &filename, real scale = 1.0);
+
+  bool HasEnvMap() const { return hasEnvMap_; }
+
+  const EnvLight &GetEnvLight() const { return envLight_; }
+
+  //< Probability of choosing the environment light(instead of area lights)
+  //< in next event estimation.
+  real EnvLightSelectProb() const {
+    if (!hasEnvMap_) {
+      return 0.0;
+    }
+    return lights_.empty() ? 1.0 : 0.5;
+  }
 
   const Material &GetMaterial(int matID) const {
 	static Material s_default_aterial;
@@ -64,9 +96,59 @@ public:
 	}
   }
 
+  int NumLights() const { return (int)lights_.size(); }
+
+  const TriangleLight &GetLight(int lightID) const { return lights_[lightID]; }
+
+  //< Returns light index of the face, or -1 if the face is not emissive.
+  int GetLightID(unsigned int faceID) const {
+    if (faceID < faceToLight_.size()) {
+      return faceToLight_[faceID];
+    }
+    return -1;
+  }
+
+  void SetLightSamplingMode(LightSamplingMode mode) { lightSampling_ = mode; }
+
+  LightSamplingMode GetLightSamplingMode() const { return lightSampling_; }
+
+  //< Pick a light for next event estimation at shading point P(with normal
+  //< N). Returns the light index and its selection probability in `pdf`
+  //< (-1 when the scene has no lights).
+  int SampleLight(real &pdf, const real3 &P, const real3 &N, real rnd) const;
+
+  //< Selection probability of `lightID` in SampleLight().
+  real LightPdf(int lightID, const real3 &P, const real3 &N) const;
+
+  //< Pick a light by its power, independently of the receiver. Used to start
+  //< light paths. Returns -1 when the scene has no lights.
+  int SampleLightPower(real &pdf, real rnd) const;
+
+  //< Selection probability of `lightID` in SampleLightPower().
+  real LightPowerPdf(int lightID) const;
+
 protected:
+  //< Collect emissive triangles as area lights.
+  void BuildLights();
+
+  void CountRay();
+
+  typedef struct {
+    unsigned long long count;
+    char pad[56]; // One cache line per thread
+  } RayCounter;
+
+
   Mesh mesh_;
   std::vector<Material> materials_;
+  std::vector<TriangleLight> lights_;
+  std::vector<int> faceToLight_; //< face index -> light index(-1 = none)
+  std::vector<real> lightCdf_;   //< Power CDF. lightCdf_[n-1] = 1
+  LightTree lightTree_;
+  LightSamplingMode lightSampling_;
+  EnvLight envLight_;
+  bool hasEnvMap_;
+  std::vector<RayCounter> rayCounters_;
 #ifdef ENABLE_EMBREE
   RTCScene scene_;
   real3 bmin_;
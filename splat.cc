@@ -0,0 +1,49 @@
+#include <cstdio>
+#include <cstring>
+
+#include "splat.h"
+#include "atomic.h"
+
+using namespace mallie;
+
+SplatBuffer::SplatBuffer()
+    : width_(0), height_(0), numSplats_(0), numRetries_(0) {}
+
+SplatBuffer::~SplatBuffer() {}
+
+void SplatBuffer::Resize(int width, int height) {
+  width_ = width;
+  height_ = height;
+  data_.resize(3 * size_t(width) * size_t(height));
+  Clear();
+}
+
+void SplatBuffer::Clear() {
+  if (!data_.empty()) {
+    memset(&data_[0], 0, sizeof(float) * data_.size());
+  }
+  numSplats_ = 0;
+  numRetries_ = 0;
+}
+
+int SplatBuffer::Splat(int pixel, const real3 &color) {
+  float *p = &data_[3 * pixel];
+  int retries = 0;
+  for (int k = 0; k < 3; k++) {
+    if (color[k] != 0.0) {
+      retries += AtomicAddCAS(&p[k], float(color[k]));
+    }
+  }
+  return retries;
+}
+
+void SplatBuffer::AddStats(int numSplats, int numRetries) {
+  AtomicAdd(&numSplats_, numSplats);
+  AtomicAdd(&numRetries_, numRetries);
+}
+
+void SplatBuffer::PrintStats(const char *name) const {
+  double rate = (numSplats_ > 0) ? double(numRetries_) / numSplats_ : 0.0;
+  printf("Mallie:info\tmsg:%s splats: %d, CAS retries: %d(%f per splat)\n",
+         name, numSplats_, numRetries_, rate);
+}
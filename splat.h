@@ -0,0 +1,58 @@
+#ifndef __MALLIE_SPLAT_H__
+#define __MALLIE_SPLAT_H__
+
+#include <vector>
+
+#include "common.h"
+
+namespace mallie {
+
+///< RGB framebuffer which accepts splats to arbitrary pixels from any thread,
+///< for contributions which do not belong to the pixel being rendered(light
+///< tracing, BPT/VCM camera connections, MLT). Lock free: each channel is
+///< added by a float compare-and-swap loop. Failed attempts are counted as
+///< the contention of the pass.
+class SplatBuffer {
+public:
+  SplatBuffer();
+  ~SplatBuffer();
+
+  ///< Resize to `width` x `height` pixels and clear.
+  void Resize(int width, int height);
+
+  ///< Zero the pixels and the stats.
+  void Clear();
+
+  ///< Add `color` to `pixel`(= y * width + x). Thread safe. Returns the
+  ///< number of retries caused by other threads.
+  int Splat(int pixel, const real3 &color);
+
+  ///< Add the stats of a worker. Called once per task so that the counters
+  ///< themselves do not become a point of contention.
+  void AddStats(int numSplats, int numRetries);
+
+  real3 Get(int pixel) const {
+    const float *p = &data_[3 * pixel];
+    return real3(p[0], p[1], p[2]);
+  }
+
+  int Width() const { return width_; }
+  int Height() const { return height_; }
+
+  int NumSplats() const { return numSplats_; }
+  int NumRetries() const { return numRetries_; }
+
+  ///< Print the contention stats as `name`.
+  void PrintStats(const char *name) const;
+
+private:
+  int width_;
+  int height_;
+  std::vector<float> data_; // RGB
+  int numSplats_;
+  int numRetries_;
+};
+
+} // namespace
+
+#endif // __MALLIE_SPLAT_H__
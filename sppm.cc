@@ -0,0 +1,505 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include "sppm.h"
+#include "light.h"
+#include "random.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Defined in tasksys.cc
+extern "C" {
+void ISPCLaunch(void **handlePtr, void *f, void *data, int count);
+void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+void ISPCSync(void *handle);
+}
+
+using namespace mallie;
+
+namespace {
+
+const double kFar = 1.0e+30;
+const double kEPS = 1.0e-3;
+const int kMaxPathLength = 16;
+
+const int kCameraChunkSize = 256;  // # of pixels per task
+const int kPhotonChunkSize = 1024; // # of photons per task
+const real kAlpha = 0.7; // Fraction of photons kept per iteration
+
+inline bool IsZero(const real3 &c) {
+  return (c[0] == 0.0) && (c[1] == 0.0) && (c[2] == 0.0);
+}
+
+// Photon gather query for HashGrid::ProcessBatch(). The grid is built with
+// the largest radius, so the pixel's own radius is tested here.
+class PhotonQuery {
+public:
+  PhotonQuery(const real3 &position, const real3 &wi, const real3 &flux,
+              SPPMRenderer::PhotonChunk *out)
+      : position_(position), wi_(wi), flux_(flux), out_(out) {}
+
+  glrs::vector3 GetPosition() const {
+    return glrs::vector3(position_[0], position_[1], position_[2]);
+  }
+
+  void Process(const SPPMRenderer::VisiblePoint &vp) {
+    real3 d = vp.position - position_;
+    if (vdot(d, d) > vp.radiusSqr) {
+      return;
+    }
+
+    real cosTheta;
+    const real3 f = vp.bsdf.Evaluate(wi_, cosTheta);
+    if (IsZero(f)) {
+      return;
+    }
+
+    out_->pixels.push_back(vp.pixel);
+    out_->flux.push_back(flux_ * f);
+  }
+
+private:
+  real3 position_;
+  real3 wi_; // Towards the photon origin
+  real3 flux_;
+  SPPMRenderer::PhotonChunk *out_;
+};
+
+#if !defined(_OPENMP) // Tasksys version
+typedef struct {
+  SPPMRenderer *renderer;
+  bool photon; // photon or camera stage
+} SPPMStageTask;
+
+void SPPMStageTaskFunc(void *data, int threadIndex, int threadCount,
+                       int taskIndex, int taskCount) {
+  const SPPMStageTask *task = reinterpret_cast<const SPPMStageTask *>(data);
+  if (task->photon) {
+    task->renderer->TracePhotonChunk(taskIndex);
+  } else {
+    task->renderer->TraceCameraChunk(taskIndex);
+  }
+}
+#endif
+
+void RunSPPMStage(SPPMRenderer *renderer, bool photon, int numChunks) {
+  if (numChunks <= 0) {
+    return;
+  }
+
+#if !defined(_OPENMP) // Tasksys version
+  SPPMStageTask task;
+  task.renderer = renderer;
+  task.photon = photon;
+
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(SPPMStageTaskFunc), &task,
+             numChunks);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < numChunks; i++) {
+    if (photon) {
+      renderer->TracePhotonChunk(i);
+    } else {
+      renderer->TraceCameraChunk(i);
+    }
+  }
+#endif
+}
+
+} // namespace
+
+SPPMRenderer::SPPMRenderer()
+    : scene_(NULL), camera_(NULL), plane_(NULL), iteration_(0) {}
+
+SPPMRenderer::~SPPMRenderer() {}
+
+bool SPPMRenderer::Trace(Intersection &isect, const Ray &ray) const {
+  Ray r = ray;
+  bool hit = scene_->Trace(isect, r);
+
+  if (plane_ && plane_->intersect(&isect, ray)) {
+    isect.faceID = (unsigned int)(-1); // Not a light
+    hit = true;
+  }
+
+  return hit;
+}
+
+bool SPPMRenderer::Occluded(const real3 &org, const real3 &dir,
+                            real dist) const {
+  Ray ray;
+  ray.org = org + kEPS * dir;
+  ray.dir = dir;
+
+  real maxT = dist - 2.0 * kEPS;
+
+  if (scene_->Occluded(ray, maxT)) {
+    return true;
+  }
+
+  if (plane_) {
+    Intersection isect;
+    isect.t = maxT;
+    if (plane_->intersect(&isect, ray)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+real3 SPPMRenderer::DirectIllumination(const real3 &hitpoint, const BSDF &bsdf,
+                                       const real rnd[3]) const {
+  real lightPickProb;
+  int lightID = scene_->SampleLightPower(lightPickProb, rnd[0]);
+  if (lightID < 0) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  const TriangleLight &light = scene_->GetLight(lightID);
+
+  real3 lightP, lightN;
+  const real posPdfA = light.SamplePosition(lightP, lightN, &rnd[1]);
+
+  real3 directionToLight = lightP - hitpoint;
+  const real distSqr = vdot(directionToLight, directionToLight);
+  const real distance = sqrt(distSqr);
+  directionToLight = directionToLight * (1.0 / distance);
+
+  const real cosAtLight = -vdot(lightN, directionToLight);
+  if (cosAtLight <= 1.0e-6) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  real cosToLight;
+  const real3 f = bsdf.Evaluate(directionToLight, cosToLight);
+  if (IsZero(f)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  // Light hits after a non-specular vertex are not counted, so no MIS.
+  const real3 contrib = light.Radiance() * f *
+                        (cosToLight * cosAtLight /
+                         (distSqr * posPdfA * lightPickProb));
+
+  if (Occluded(hitpoint, directionToLight, distance)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  return contrib;
+}
+
+void SPPMRenderer::TraceCameraChunk(int chunk) {
+  XorShift rng(iteration_, chunk, 0);
+
+  int numPixels = gridWidth_ * gridHeight_;
+  int begin = chunk * kCameraChunkSize;
+  int end = (std::min)(begin + kCameraChunkSize, numPixels);
+
+  for (int pixel = begin; pixel < end; pixel++) {
+    int gx = pixel % gridWidth_;
+    int gy = pixel / gridWidth_;
+
+    VisiblePoint &vp = cameraPoints_[pixel];
+    vp.throughput = real3(0.0, 0.0, 0.0);
+    vp.pixel = pixel;
+
+    real3 L(0.0, 0.0, 0.0);
+
+    // Jitter over the grid pixel(step x step pixels).
+    double u = gx * step_ - 0.5 + rng.Next() * step_;
+    double v = gy * step_ - 0.5 + rng.Next() * step_;
+    Ray ray = camera_->GenerateRay(u, v);
+
+    real3 throughput(1.0, 1.0, 1.0);
+
+    // Follow specular bounces until the first non-specular hit.
+    for (int pathLength = 1; pathLength <= kMaxPathLength; pathLength++) {
+      Intersection isect;
+      isect.t = kFar;
+      if (!Trace(isect, ray)) {
+        if (scene_->HasEnvMap()) {
+          L += throughput * scene_->GetBackgroundRadiance(ray.dir);
+        }
+        break;
+      }
+
+      const real3 hitpoint = ray.org + isect.t * ray.dir;
+
+      // Directly visible, or seen through specular surfaces: no other way
+      // to sample it. Lights are not reflective.
+      int lightID = scene_->GetLightID(isect.faceID);
+      if (lightID >= 0) {
+        const TriangleLight &light = scene_->GetLight(lightID);
+        if (-vdot(light.Normal(), ray.dir) > 0.0) {
+          L += throughput * light.Radiance();
+        }
+        break;
+      }
+
+      BSDF bsdf;
+      bsdf.Setup(ray.dir, isect.normal, scene_->GetMaterial(isect.materialID),
+                 isect.materialID, /* fromLight */ false);
+      if (!bsdf.IsValid()) {
+        break;
+      }
+
+      if (!bsdf.IsDelta()) {
+        real lrnd[3];
+        for (int k = 0; k < 3; k++) {
+          lrnd[k] = rng.Next();
+        }
+        L += throughput * DirectIllumination(hitpoint, bsdf, lrnd);
+
+        vp.position = hitpoint;
+        vp.throughput = throughput;
+        vp.bsdf = bsdf;
+        break;
+      }
+
+      real srnd[3];
+      for (int k = 0; k < 3; k++) {
+        srnd[k] = rng.Next();
+      }
+
+      real3 dir;
+      real pdfW, cosTheta;
+      const real3 f = bsdf.Sample(srnd, dir, pdfW, cosTheta);
+      if (IsZero(f)) {
+        break;
+      }
+
+      throughput = throughput * f * (cosTheta / pdfW);
+
+      ray.org = hitpoint + kEPS * dir;
+      ray.dir = dir;
+    }
+
+    direct_[pixel] = L;
+  }
+}
+
+void SPPMRenderer::TracePhotonChunk(int chunk) {
+  PhotonChunk &out = chunks_[chunk];
+  out.pixels.clear();
+  out.flux.clear();
+
+  XorShift rng(iteration_, chunk, 1);
+
+  int begin = chunk * kPhotonChunkSize;
+  int end = (std::min)(begin + kPhotonChunkSize, numPhotons_);
+
+  // Photon hits of the chunk are gathered at once, sorted by grid cell.
+  std::vector<PhotonQuery> queries;
+
+  for (int i = begin; i < end; i++) {
+    real rnd[5];
+    for (int k = 0; k < 5; k++) {
+      rnd[k] = rng.Next();
+    }
+
+    real lightPickProb;
+    int lightID = scene_->SampleLightPower(lightPickProb, rnd[0]);
+    if (lightID < 0) {
+      return;
+    }
+
+    const TriangleLight &light = scene_->GetLight(lightID);
+
+    real3 P, N, dir;
+    real cosPdfW;
+    real posPdfA = light.SampleL(P, N, dir, cosPdfW, &rnd[1], &rnd[3]);
+
+    const real cosLight = vdot(N, dir);
+    const real pdf = lightPickProb * posPdfA * cosPdfW;
+    if ((pdf <= 0.0) || (cosLight <= 0.0)) {
+      continue;
+    }
+
+    real3 flux = light.Radiance() * (cosLight / pdf);
+
+    Ray ray;
+    ray.org = P + kEPS * dir;
+    ray.dir = dir;
+
+    for (int pathLength = 1; pathLength <= kMaxPathLength; pathLength++) {
+      Intersection isect;
+      isect.t = kFar;
+      if (!Trace(isect, ray)) {
+        break;
+      }
+
+      if (scene_->GetLightID(isect.faceID) >= 0) {
+        break;
+      }
+
+      const real3 hitpoint = ray.org + isect.t * ray.dir;
+
+      BSDF bsdf;
+      bsdf.Setup(ray.dir, isect.normal, scene_->GetMaterial(isect.materialID),
+                 isect.materialID, /* fromLight */ true);
+      if (!bsdf.IsValid()) {
+        break;
+      }
+
+      // The first hit is direct lighting, which is computed at the visible
+      // point by light sampling.
+      if ((pathLength > 1) && !bsdf.IsDelta()) {
+        queries.push_back(PhotonQuery(hitpoint, ray.dir * -1.0, flux, &out));
+      }
+
+      real srnd[4];
+      for (int k = 0; k < 4; k++) {
+        srnd[k] = rng.Next();
+      }
+
+      real3 newDir;
+      real pdfW, cosTheta;
+      const real3 f = bsdf.Sample(srnd, newDir, pdfW, cosTheta);
+      if (IsZero(f)) {
+        break;
+      }
+
+      // Russian roulette
+      const real contProb = bsdf.ContinuationProb();
+      if (srnd[3] > contProb) {
+        break;
+      }
+
+      flux = flux * f * (cosTheta / (pdfW * contProb));
+
+      ray.org = hitpoint + kEPS * newDir;
+      ray.dir = newDir;
+    }
+  }
+
+  hashGrid_.ProcessBatch(visiblePoints_, queries);
+}
+
+bool SPPMRenderer::RenderPass(Scene &scene, const Camera &camera,
+                              const RenderConfig &config,
+                              std::vector<float> &image,
+                              std::vector<int> &count, int step,
+                              Plane *plane) {
+  if (scene.NumLights() == 0) {
+    printf("Mallie:warn\tmsg:SPPM requires area lights(emissive triangles).\n");
+  }
+
+  scene_ = &scene;
+  camera_ = &camera;
+  plane_ = plane;
+  step_ = step;
+
+  gridWidth_ = (config.width + step - 1) / step;
+  gridHeight_ = (config.height + step - 1) / step;
+  numPhotons_ = (std::max)(1, config.num_photons);
+
+  int numPixels = gridWidth_ * gridHeight_;
+
+  if (iteration_ == 0) {
+    // Initial radius relative to the scene size.
+    real3 bmin, bmax;
+    scene.BoundingBox(bmin, bmax);
+    real3 extent = bmax - bmin;
+    real radius = config.sppm_radius * 0.5 * extent.length();
+
+    radiusSqr_.assign(numPixels, radius * radius);
+    photonCount_.assign(numPixels, 0.0);
+  }
+
+  //
+  // 1. Visible points
+  //
+  cameraPoints_.resize(numPixels);
+  direct_.resize(numPixels);
+  RunSPPMStage(this, /* photon */ false,
+               (numPixels + kCameraChunkSize - 1) / kCameraChunkSize);
+
+  visiblePoints_.clear();
+  real maxRadiusSqr = 0.0;
+  for (int i = 0; i < numPixels; i++) {
+    if (!IsZero(cameraPoints_[i].throughput)) {
+      visiblePoints_.push_back(cameraPoints_[i]);
+      visiblePoints_.back().radiusSqr = radiusSqr_[i];
+      maxRadiusSqr = (std::max)(maxRadiusSqr, radiusSqr_[i]);
+    }
+  }
+
+  //
+  // 2. Photons
+  //
+  int numChunks = (numPhotons_ + kPhotonChunkSize - 1) / kPhotonChunkSize;
+  chunks_.resize(numChunks);
+
+  if (!visiblePoints_.empty()) {
+    hashGrid_.Reserve(visiblePoints_.size());
+    hashGrid_.Build(visiblePoints_, sqrt(maxRadiusSqr));
+    RunSPPMStage(this, /* photon */ true, numChunks);
+  } else {
+    for (int c = 0; c < numChunks; c++) {
+      chunks_[c].pixels.clear();
+      chunks_[c].flux.clear();
+    }
+  }
+
+  phi_.assign(numPixels, real3(0.0, 0.0, 0.0));
+  newPhotons_.assign(numPixels, 0);
+  for (int c = 0; c < numChunks; c++) {
+    const PhotonChunk &chunk = chunks_[c];
+    for (size_t k = 0; k < chunk.pixels.size(); k++) {
+      phi_[chunk.pixels[k]] += chunk.flux[k];
+      newPhotons_[chunk.pixels[k]]++;
+    }
+  }
+
+  //
+  // 3. Write the estimate of this iteration and reduce the radius.
+  //
+  // Since tau_i / R_i^2 = (tau_(i-1) + Phi_i) / R_(i-1)^2, the progressive
+  // estimate tau_i / (i * Np * pi * R_i^2) equals the average of
+  // Phi_i / (Np * pi * R_(i-1)^2) over iterations. So the per-pass image is
+  // the photon estimate with the current radius, and the accumulation done
+  // by the caller gives the SPPM result.
+  //
+  int width = config.width;
+  int height = config.height;
+  for (int gy = 0; gy < gridHeight_; gy++) {
+    for (int gx = 0; gx < gridWidth_; gx++) {
+      int pixel = gy * gridWidth_ + gx;
+
+      real3 c = direct_[pixel];
+      if (newPhotons_[pixel] > 0) {
+        c += cameraPoints_[pixel].throughput * phi_[pixel] *
+             (1.0 / (M_PI * radiusSqr_[pixel] * numPhotons_));
+
+        real N = photonCount_[pixel];
+        real M = newPhotons_[pixel];
+        real newN = N + kAlpha * M;
+        radiusSqr_[pixel] *= newN / (N + M);
+        photonCount_[pixel] = newN;
+      }
+
+      for (int v = 0; (v < step) && ((gy * step + v) < height); v++) {
+        for (int u = 0; (u < step) && ((gx * step + u) < width); u++) {
+          int idx = (gy * step + v) * width + (gx * step + u);
+          image[3 * idx + 0] = c[0];
+          image[3 * idx + 1] = c[1];
+          image[3 * idx + 2] = c[2];
+          count[idx]++;
+        }
+      }
+    }
+  }
+
+  iteration_++;
+
+  return true;
+}
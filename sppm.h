@@ -0,0 +1,92 @@
+#ifndef __MALLIE_SPPM_H__
+#define __MALLIE_SPPM_H__
+
+#include <vector>
+
+#include "common.h"
+#include "bsdf.h"
+#include "camera.h"
+#include "render.h"
+#include "prim-plane.h"
+#include "hashgrid.h"
+
+namespace mallie {
+
+///< Stochastic progressive photon mapping(SPPM, Hachisuka and Jensen 2009).
+///< Each iteration traces camera paths through specular surfaces up to the
+///< first non-specular hit(visible point), shoots a batch of photons and
+///< gathers them at the visible points through the hash grid built over the
+///< visible points. The gather radius of each pixel shrinks progressively.
+///< Direct lighting at the visible point is computed by light sampling.
+class SPPMRenderer {
+public:
+  SPPMRenderer();
+  ~SPPMRenderer();
+
+  ///< Render one iteration into `image`(same layout as Render()). Pixel
+  ///< statistics(radius, photon count) persist across iterations, so call
+  ///< Reset() when the view changes.
+  bool RenderPass(Scene &scene, const Camera &camera,
+                  const RenderConfig &config, std::vector<float> &image,
+                  std::vector<int> &count, int step, Plane *plane);
+
+  void Reset() { iteration_ = 0; }
+
+  int Iteration() const { return iteration_; }
+
+  ///< Camera path vertex where photons are gathered.
+  struct VisiblePoint {
+    real3 position;
+    real3 throughput; // Camera path weight. 0 = no visible point
+    BSDF bsdf;
+    int pixel;
+    real radiusSqr; // Gather radius of the pixel
+
+    glrs::vector3 GetPosition() const {
+      return glrs::vector3(position[0], position[1], position[2]);
+    }
+  };
+
+  ///< Photon flux gathered by one chunk.
+  struct PhotonChunk {
+    std::vector<int> pixels;
+    std::vector<real3> flux; // Photon flux x BSDF at the visible point
+  };
+
+  // Per-chunk work, called from the parallel loops.
+  void TraceCameraChunk(int chunk);
+  void TracePhotonChunk(int chunk);
+
+private:
+  bool Trace(Intersection &isect, const Ray &ray) const;
+  bool Occluded(const real3 &org, const real3 &dir, real dist) const;
+
+  real3 DirectIllumination(const real3 &hitpoint, const BSDF &bsdf,
+                           const real rnd[3]) const;
+
+  // Per iteration
+  Scene *scene_;
+  const Camera *camera_;
+  Plane *plane_;
+  int iteration_;
+  int gridWidth_;
+  int gridHeight_;
+  int step_;
+  int numPhotons_;
+
+  // Per(grid) pixel
+  std::vector<VisiblePoint> cameraPoints_;
+  std::vector<real3> direct_;    // Emission + direct lighting
+  std::vector<real> radiusSqr_;  // Persistent
+  std::vector<real> photonCount_; // Persistent(N in the paper)
+  std::vector<real3> phi_;       // Gathered flux of the iteration
+  std::vector<int> newPhotons_;  // # of gathered photons(M in the paper)
+
+  std::vector<VisiblePoint> visiblePoints_;
+  std::vector<PhotonChunk> chunks_;
+  glrs::HashGrid hashGrid_;
+};
+
+} // namespace
+
+#endif // __MALLIE_SPPM_H__
@@ -0,0 +1,153 @@
+#include "gtest/gtest.h"
+
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "hashgrid.h"
+
+namespace {
+
+struct Particle {
+  glrs::vector3 position;
+
+  glrs::vector3 GetPosition() const { return position; }
+};
+
+// Collects the indices of the particles found.
+struct Query {
+  glrs::vector3 position;
+  const Particle *base;
+  std::vector<int> found;
+
+  glrs::vector3 GetPosition() const { return position; }
+
+  void Process(const Particle &particle) {
+    found.push_back(int(&particle - base));
+  }
+};
+
+float Uniform() { return float(rand()) / float(RAND_MAX); }
+
+void GenerateParticles(std::vector<Particle> &particles, int n) {
+  particles.clear();
+  for (int i = 0; i < n; i++) {
+    Particle p;
+    p.position = glrs::vector3(Uniform(), Uniform(), Uniform());
+    particles.push_back(p);
+  }
+}
+
+std::vector<int> BruteForce(const std::vector<Particle> &particles,
+                            const glrs::vector3 &position, float radius) {
+  std::vector<int> found;
+  for (size_t i = 0; i < particles.size(); i++) {
+    glrs::vector3 d = particles[i].position - position;
+    if (d.sqr_length() <= radius * radius) {
+      found.push_back(int(i));
+    }
+  }
+  return found;
+}
+
+Query MakeQuery(const std::vector<Particle> &particles) {
+  Query query;
+  // Also query slightly outside of the particle bounds.
+  query.position = glrs::vector3(1.2f * Uniform() - 0.1f,
+                                 1.2f * Uniform() - 0.1f,
+                                 1.2f * Uniform() - 0.1f);
+  query.base = particles.empty() ? NULL : &particles[0];
+  return query;
+}
+
+} // namespace
+
+TEST(HashGridTest, ProcessMatchesBruteForce) {
+  srand(1);
+
+  // Large enough to be built in multiple blocks.
+  std::vector<Particle> particles;
+  GenerateParticles(particles, 100000);
+
+  const float radius = 0.02f;
+  glrs::HashGrid grid;
+  grid.Reserve(int(particles.size()));
+  grid.Build(particles, radius);
+
+  for (int i = 0; i < 200; i++) {
+    Query query = MakeQuery(particles);
+    grid.Process(particles, query);
+
+    std::vector<int> expected =
+        BruteForce(particles, query.position, radius);
+    std::sort(query.found.begin(), query.found.end());
+    EXPECT_EQ(expected, query.found);
+  }
+}
+
+TEST(HashGridTest, ProcessBatchMatchesProcess) {
+  srand(2);
+
+  std::vector<Particle> particles;
+  GenerateParticles(particles, 20000);
+
+  glrs::HashGrid grid;
+  grid.Reserve(1024); // Many particles per cell
+  grid.Build(particles, 0.05f);
+
+  std::vector<Query> queries;
+  for (int i = 0; i < 500; i++) {
+    queries.push_back(MakeQuery(particles));
+  }
+
+  std::vector<Query> batch = queries;
+  grid.ProcessBatch(particles, batch);
+
+  for (size_t i = 0; i < queries.size(); i++) {
+    grid.Process(particles, queries[i]);
+    EXPECT_EQ(queries[i].found, batch[i].found);
+  }
+}
+
+TEST(HashGridTest, Rebuild) {
+  srand(3);
+
+  std::vector<Particle> particles;
+  GenerateParticles(particles, 30000);
+
+  glrs::HashGrid grid;
+  grid.Reserve(int(particles.size()));
+  grid.Build(particles, 0.1f);
+
+  // Rebuild with fewer particles and a smaller radius.
+  particles.erase(particles.begin() + 5000, particles.end());
+  const float radius = 0.03f;
+  grid.Build(particles, radius);
+
+  for (int i = 0; i < 100; i++) {
+    Query query = MakeQuery(particles);
+    grid.Process(particles, query);
+
+    std::vector<int> expected =
+        BruteForce(particles, query.position, radius);
+    std::sort(query.found.begin(), query.found.end());
+    EXPECT_EQ(expected, query.found);
+  }
+}
+
+TEST(HashGridTest, Empty) {
+  std::vector<Particle> particles;
+
+  glrs::HashGrid grid;
+  grid.Build(particles, 0.1f);
+
+  Query query;
+  query.position = glrs::vector3(0.0f, 0.0f, 0.0f);
+  query.base = NULL;
+  grid.Process(particles, query);
+  EXPECT_TRUE(query.found.empty());
+
+  std::vector<Query> queries(1, query);
+  grid.ProcessBatch(particles, queries);
+  EXPECT_TRUE(queries[0].found.empty());
+}
@@ -35,6 +35,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "tinyexr.h"
 
+#if !defined(_OPENMP)
+#include <stdint.h>
+
+// Defined in tasksys.cc of mallie
+extern "C" {
+void ISPCLaunch(void **handlePtr, void *f, void *data, int count);
+void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+void ISPCSync(void *handle);
+}
+#endif
+
 namespace {
 
 namespace miniz {
@@ -6963,13 +6974,250 @@ void DecompressZip(unsigned char *dst, unsigned long &uncompressedSize,
   }
 }
 
+int PixelTypeSize(int pixelType) {
+  return (pixelType == TINYEXR_PIXELTYPE_HALF) ? 2 : 4;
+}
+
+// Convert a sample of the file(little endian) to float.
+float ReadPixel(const unsigned char *src, int pixelType) {
+  if (pixelType == TINYEXR_PIXELTYPE_HALF) {
+    FP16 hf;
+    memcpy(&hf.u, src, sizeof(unsigned short));
+    if (IsBigEndian()) {
+      swap2(reinterpret_cast<unsigned short*>(&hf.u));
+    }
+    return half_to_float(hf).f;
+  }
+
+  unsigned int u;
+  memcpy(&u, src, sizeof(unsigned int));
+  if (IsBigEndian()) {
+    swap4(&u);
+  }
+  if (pixelType == TINYEXR_PIXELTYPE_UINT) {
+    return float(u);
+  }
+  FP32 f32;
+  f32.u = u;
+  return f32.f;
+}
+
+// Convert float to a sample of the file(little endian).
+void WritePixel(unsigned char *dst, float f, int pixelType) {
+  if (pixelType == TINYEXR_PIXELTYPE_HALF) {
+    FP32 f32;
+    f32.f = f;
+    FP16 h16 = float_to_half_full(f32);
+    if (IsBigEndian()) {
+      swap2(reinterpret_cast<unsigned short*>(&h16.u));
+    }
+    memcpy(dst, &h16.u, sizeof(unsigned short));
+    return;
+  }
+
+  unsigned int u;
+  if (pixelType == TINYEXR_PIXELTYPE_UINT) {
+    u = (f > 0.0f) ? (unsigned int)f : 0;
+  } else {
+    FP32 f32;
+    f32.f = f;
+    u = f32.u;
+  }
+  if (IsBigEndian()) {
+    swap4(&u);
+  }
+  memcpy(dst, &u, sizeof(unsigned int));
+}
+
+// Block tasks have the signature of ISPC tasks.
+typedef void (*BlockTaskFunc)(void *data, int threadIndex, int threadCount,
+                              int taskIndex, int taskCount);
+
+// Run `func` for `count` blocks in parallel, with OpenMP or the task system.
+void RunBlockTasks(BlockTaskFunc func, void *data, int count) {
+  if (count <= 0) {
+    return;
+  }
+
+#if !defined(_OPENMP) // Tasksys version
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(func), data, count);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < count; i++) {
+    func(data, 0, 1, i, count);
+  }
+#endif
+}
+
+// Scanline blocks of LoadMultiChannelEXR().
+typedef struct {
+  EXRImage *exrImage;
+  const char *head;
+  const long long *offsets;
+  const ChannelInfo *channels;
+  const int *channelOffsets;
+  int numChannels;
+  int numScanlineBlocks;
+  int compressionType;
+  int bytesPerLine;
+  int dataWidth;
+  int dataHeight;
+} LoadBlockTask;
+
+// Decompress block `y` into its scanlines of the image.
+void LoadBlock(const LoadBlockTask &task, int y) {
+  const char *head = task.head;
+  const long long *offsets = task.offsets;
+  const ChannelInfo *channels = task.channels;
+  const int *channelOffsets = task.channelOffsets;
+  int numChannels = task.numChannels;
+  int numScanlineBlocks = task.numScanlineBlocks;
+  int compressionType = task.compressionType;
+  int bytesPerLine = task.bytesPerLine;
+  int dataWidth = task.dataWidth;
+  int dataHeight = task.dataHeight;
+
+  const unsigned char *dataPtr =
+      reinterpret_cast<const unsigned char *>(head + offsets[y]);
+  // 4 byte: scan line
+  // 4 byte: data size
+  // ~     : pixel data(uncompressed or compressed)
+  int lineNo;
+  memcpy(&lineNo, dataPtr, sizeof(int));
+  int dataLen;
+  memcpy(&dataLen, dataPtr + 4, sizeof(int));
+  if (IsBigEndian()) {
+    swap4(reinterpret_cast<unsigned int*>(&lineNo));
+    swap4(reinterpret_cast<unsigned int*>(&dataLen));
+  }
+
+  int endLineNo = std::min(lineNo + numScanlineBlocks, dataHeight);
+
+  int numLines = endLineNo - lineNo;
+
+  // For ZIP_COMPRESSION:
+  //   pixel sample data for channel 0 for scanline 0
+  //   pixel sample data for channel 1 for scanline 0
+  //   pixel sample data for channel ... for scanline 0
+  //   pixel sample data for channel n for scanline 0
+  //   pixel sample data for channel 0 for scanline 1
+  //   pixel sample data for channel 1 for scanline 1
+  //   pixel sample data for channel ... for scanline 1
+  //   pixel sample data for channel n for scanline 1
+  //   ...
+  std::vector<unsigned char> outBuf;
+  const unsigned char *src = dataPtr + 8;
+
+  if (compressionType == 3) { // ZIP
+    // Allocate original data size.
+    outBuf.resize(numLines * bytesPerLine);
+
+    unsigned long dstLen = outBuf.size();
+    DecompressZip(&outBuf.at(0), dstLen, dataPtr + 8, dataLen);
+    src = &outBuf.at(0);
+  }
+
+  for (int v = 0; v < numLines; v++) {
+    const unsigned char *line = src + v * bytesPerLine;
+    for (int c = 0; c < numChannels; c++) {
+      int pixelType = channels[c].pixelType;
+      int size = PixelTypeSize(pixelType);
+      const unsigned char *p = line + channelOffsets[c] * dataWidth;
+
+      for (int u = 0; u < dataWidth; u++) {
+        // Assume increasing Y.
+        task.exrImage->images[c][(lineNo + v) * dataWidth + u] =
+            ReadPixel(p + size * u, pixelType);
+      }
+    }
+  }
+}
+
+void LoadBlockTaskFunc(void *data, int threadIndex, int threadCount,
+                       int taskIndex, int taskCount) {
+  LoadBlock(*reinterpret_cast<const LoadBlockTask *>(data), taskIndex);
+}
+
+// Scanline blocks of SaveMultiChannelEXR().
+typedef struct {
+  const EXRImage *exrImage;
+  std::vector<unsigned char> *blocks; // out
+  const int *channelOffsets;
+  size_t bytesPerLine;
+  int numScanlineBlocks;
+  bool isBigEndian;
+} SaveBlockTask;
+
+// Convert and compress block `i` into `blocks[i]`(with the block header).
+void SaveBlock(const SaveBlockTask &task, int i) {
+  const EXRImage *exrImage = task.exrImage;
+  std::vector<unsigned char> *blocks = task.blocks;
+  const int *channelOffsets = task.channelOffsets;
+  size_t bytesPerLine = task.bytesPerLine;
+  int numScanlineBlocks = task.numScanlineBlocks;
+  bool isBigEndian = task.isBigEndian;
+
+  int startY = numScanlineBlocks * i;
+  int endY = std::min(numScanlineBlocks * (i + 1), exrImage->height);
+  int h = endY - startY;
+
+  std::vector<unsigned char> buf(bytesPerLine * h);
+
+  for (int y = 0; y < h; y++) {
+    for (int c = 0; c < exrImage->num_channels; c++) {
+      int pixelType = exrImage->pixel_types ? exrImage->pixel_types[c]
+                                            : TINYEXR_PIXELTYPE_HALF;
+      int size = PixelTypeSize(pixelType);
+      unsigned char *p =
+          &buf.at(y * bytesPerLine + channelOffsets[c] * exrImage->width);
+
+      for (int x = 0; x < exrImage->width; x++) {
+        // Assume increasing Y
+        WritePixel(p + size * x,
+                   exrImage->images[c][(y + startY) * exrImage->width + x],
+                   pixelType);
+      }
+    }
+  }
+
+  // 4 byte: scan line
+  // 4 byte: data size
+  // ~     : pixel data(compressed)
+  std::vector<unsigned char> &block = blocks[i];
+  block.resize(8 + miniz::mz_compressBound(buf.size()));
+  unsigned long long outSize = block.size() - 8;
+
+  CompressZip(&block.at(8), outSize, &buf.at(0), buf.size());
+
+  unsigned int dataLen = outSize; // truncate
+  memcpy(&block.at(0), &startY, sizeof(int));
+  memcpy(&block.at(4), &dataLen, sizeof(unsigned int));
+
+  if (isBigEndian) {
+    swap4(reinterpret_cast<unsigned int*>(&block.at(0)));
+    swap4(reinterpret_cast<unsigned int*>(&block.at(4)));
+  }
+
+  block.resize(8 + dataLen);
+}
+
+void SaveBlockTaskFunc(void *data, int threadIndex, int threadCount,
+                       int taskIndex, int taskCount) {
+  SaveBlock(*reinterpret_cast<const SaveBlockTask *>(data), taskIndex);
+}
+
 } // namespace
 
 int LoadEXR(float **out_rgba, int *width, int *height, const char *filename,
             const char **err) {
 
   if (out_rgba == NULL) {
-    if (*err) {
+    if (err) {
       (*err) = "Invalid argument.\n";
     }
     return -1;
@@ -6999,7 +7247,7 @@ int LoadEXR(float **out_rgba, int *width, int *height, const char *filename,
   }
 
   if (idxR == -1) {
-    if (*err) {
+    if (err) {
       (*err) = "R channel not found\n";
     }
 
@@ -7008,7 +7256,7 @@ int LoadEXR(float **out_rgba, int *width, int *height, const char *filename,
   }
 
   if (idxG == -1) {
-    if (*err) {
+    if (err) {
       (*err) = "G channel not found\n";
     }
     // @todo { free exrImage }
@@ -7016,33 +7264,33 @@ int LoadEXR(float **out_rgba, int *width, int *height, const char *filename,
   }
 
   if (idxB == -1) {
-    if (*err) {
+    if (err) {
       (*err) = "B channel not found\n";
     }
     // @todo { free exrImage }
     return -1;
   }
 
-  if (idxA == -1) {
-    if (*err) {
-      (*err) = "A channel not found\n";
-    }
-    // @todo { free exrImage }
-    return -1;
-  }
-
   (*out_rgba) = (float*)malloc(4 * sizeof(float) * exrImage.width * exrImage.height);
   for (size_t i = 0; i < exrImage.width * exrImage.height; i++) {
     (*out_rgba)[4 * i + 0] = exrImage.images[idxR][i];
     (*out_rgba)[4 * i + 1] = exrImage.images[idxG][i];
     (*out_rgba)[4 * i + 2] = exrImage.images[idxB][i];
-    (*out_rgba)[4 * i + 3] = exrImage.images[idxA][i];
+    // Alpha is optional(e.g. RGB environment map).
+    (*out_rgba)[4 * i + 3] = (idxA == -1) ? 1.0f : exrImage.images[idxA][i];
   }
 
   (*width) = exrImage.width;
   (*height) = exrImage.height;
 
-  // @todo { free exrImage }
+  for (int c = 0; c < exrImage.num_channels; c++) {
+    free(exrImage.images[c]);
+    free(const_cast<char *>(exrImage.channel_names[c]));
+  }
+  free(exrImage.images);
+  free(exrImage.channel_names);
+  free(exrImage.pixel_types);
+
   return 0;
 
 }
@@ -7234,104 +7482,42 @@ int LoadMultiChannelEXR(EXRImage *exrImage, const char *filename,
     return -10;
   }
 
+  // Byte offset of each channel in a scanline(per pixel of the line).
+  std::vector<int> channelOffsets(numChannels);
+  int bytesPerLine = 0;
+  for (int c = 0; c < numChannels; c++) {
+    if ((channels[c].pixelType < TINYEXR_PIXELTYPE_UINT) ||
+        (channels[c].pixelType > TINYEXR_PIXELTYPE_FLOAT)) {
+      if (err) {
+        (*err) = "Unsupported pixel type.";
+      }
+      return -11;
+    }
+    channelOffsets[c] = bytesPerLine;
+    bytesPerLine += PixelTypeSize(channels[c].pixelType);
+  }
+  bytesPerLine *= dataWidth;
+
   exrImage->images = (float **)malloc(sizeof(float *) * numChannels);
   for (int c = 0; c < numChannels; c++) {
     exrImage->images[c] =
         (float *)malloc(sizeof(float) * dataWidth * dataHeight);
   }
 
-  for (int y = 0; y < numBlocks; y++) {
-    const unsigned char *dataPtr =
-        reinterpret_cast<const unsigned char *>(head + offsets[y]);
-    // 4 byte: scan line
-    // 4 byte: data size
-    // ~     : pixel data(uncompressed or compressed)
-    int lineNo;
-    memcpy(&lineNo, dataPtr, sizeof(int));
-    int dataLen;
-    memcpy(&dataLen, dataPtr + 4, sizeof(int));
-    if (IsBigEndian()) {
-      swap4(reinterpret_cast<unsigned int*>(&lineNo));
-      swap4(reinterpret_cast<unsigned int*>(&dataLen));
-    }
-
-    int endLineNo = std::min(lineNo + numScanlineBlocks, dataHeight);
-
-    int numLines = endLineNo - lineNo;
-
-    if (compressionType == 3) { // ZIP
-
-      // Allocate original data size.
-      std::vector<unsigned short> outBuf(dataWidth * numLines * numChannels);
-
-      unsigned long dstLen = outBuf.size() * sizeof(short);
-      DecompressZip(reinterpret_cast<unsigned char *>(&outBuf.at(0)), dstLen,
-                    dataPtr + 8, dataLen);
-
-      bool isBigEndian = IsBigEndian();
-
-      // For ZIP_COMPRESSION:
-      //   pixel sample data for channel 0 for scanline 0
-      //   pixel sample data for channel 1 for scanline 0
-      //   pixel sample data for channel ... for scanline 0
-      //   pixel sample data for channel n for scanline 0
-      //   pixel sample data for channel 0 for scanline 1
-      //   pixel sample data for channel 1 for scanline 1
-      //   pixel sample data for channel ... for scanline 1
-      //   pixel sample data for channel n for scanline 1
-      //   ...
-      for (int v = 0; v < numLines; v++) {
-        for (int c = 0; c < numChannels; c++) {
-          for (int u = 0; u < dataWidth; u++) {
-            FP16 hf;
-
-            hf.u = outBuf[v * (numChannels * dataWidth) + (c * dataWidth) + u];
-
-            if (isBigEndian) {
-              swap2(reinterpret_cast<unsigned short*>(&hf.u));
-            }
-
-            FP32 f32 = half_to_float(hf);
-
-            // Assume increasing Y.
-            exrImage->images[c][(lineNo + v) * dataWidth + u] = f32.f;
-          }
-        }
-      }
-
-    } else if (compressionType == 0) { // No compression
-
-      std::vector<unsigned short> srcBuf(numChannels * dataWidth);
-      memcpy(&srcBuf.at(0), dataPtr + 8, numChannels * dataWidth * sizeof(unsigned short)); 
-
-      bool isBigEndian = IsBigEndian();
-
-      // scanline
-      for (int c = 0; c < numChannels; c++) {
-        for (int u = 0; u < dataWidth; u++) {
-          FP16 hf;
-
-          // Assume (A)BGR
-          hf.u = srcBuf[c * dataWidth + u];
-
-          if (isBigEndian) {
-            swap2(reinterpret_cast<unsigned short*>(&hf.u));
-          }
-
-          FP32 f32 = half_to_float(hf);
-
-          // Assume increasing Y.
-          exrImage->images[c][y * dataWidth + u] = f32.f;
-
-        }
-      }
-    } else {
-      if (err) {
-        (*err) = "Unsupported format.";
-      }
-      return -10;
-    }
-  }
+  // Blocks are decompressed in parallel. Each one fills its own scanlines.
+  LoadBlockTask task;
+  task.exrImage = exrImage;
+  task.head = head;
+  task.offsets = &offsets.at(0);
+  task.channels = &channels.at(0);
+  task.channelOffsets = &channelOffsets.at(0);
+  task.numChannels = numChannels;
+  task.numScanlineBlocks = numScanlineBlocks;
+  task.compressionType = compressionType;
+  task.bytesPerLine = bytesPerLine;
+  task.dataWidth = dataWidth;
+  task.dataHeight = dataHeight;
+  RunBlockTasks(LoadBlockTaskFunc, &task, numBlocks);
 
   {
     exrImage->channel_names =
@@ -7345,6 +7531,11 @@ int LoadMultiChannelEXR(EXRImage *exrImage, const char *filename,
     }
     exrImage->num_channels = numChannels;
 
+    exrImage->pixel_types = (int *)malloc(sizeof(int) * numChannels);
+    for (int c = 0; c < numChannels; c++) {
+      exrImage->pixel_types[c] = channels[c].pixelType;
+    }
+
     exrImage->width = dataWidth;
     exrImage->height = dataHeight;
   }
@@ -7524,23 +7715,10 @@ int SaveEXR(const float *in_rgba, int width, int height, const char *filename,
 }
 #endif
 
-int SaveMultiChannelEXR(const EXRImage *exrImage, const char *filename,
-                        const char **err) {
-  if (exrImage == NULL || filename == NULL) {
-    if (err) {
-      (*err) = "Invalid argument.";
-    }
-    return -1;
-  }
-
-  FILE *fp = fopen(filename, "wb");
-  if (!fp) {
-    if (err) {
-      (*err) = "Cannot write a file.";
-    }
-    return -1;
-  }
-
+// Magic, version and attributes up to the end of the header.
+// `tileWidth` = 0 for scanline images.
+static void WriteHeader(FILE *fp, const EXRImage *exrImage, int tileWidth,
+                        int tileHeight) {
   // Header
   {
     const char header[] = {0x76, 0x2f, 0x31, 0x01};
@@ -7548,15 +7726,13 @@ int SaveMultiChannelEXR(const EXRImage *exrImage, const char *filename,
     assert(n == 4);
   }
 
-  // Version, scanline.
+  // Version, scanline or single-part tiled.
   {
-    const char marker[] = {2, 0, 0, 0};
+    const char marker[] = {2, char((tileWidth > 0) ? 2 : 0), 0, 0};
     size_t n = fwrite(marker, 1, 4, fp);
     assert(n == 4);
   }
 
-  int numScanlineBlocks = 16; // 16 for ZIP compression.
-
   // Write attributes.
   {
     std::vector<unsigned char> data;
@@ -7565,7 +7741,8 @@ int SaveMultiChannelEXR(const EXRImage *exrImage, const char *filename,
     for (int c = 0; c < exrImage->num_channels; c++) {
       ChannelInfo info;
       info.pLinear = 0;
-      info.pixelType = 1; // Assume HALF
+      info.pixelType = exrImage->pixel_types ? exrImage->pixel_types[c]
+                                             : TINYEXR_PIXELTYPE_HALF;
       info.xSampling = 1;
       info.ySampling = 1;
       info.name = std::string(exrImage->channel_names[c]);
@@ -7605,7 +7782,8 @@ int SaveMultiChannelEXR(const EXRImage *exrImage, const char *filename,
   }
 
   {
-    unsigned char lineOrder = 0; // increasingY
+    // Tiles are written in the order they are finished.
+    unsigned char lineOrder = (tileWidth > 0) ? 2 : 0; // randomY, increasingY
     WriteAttribute(fp, "lineOrder", "lineOrder", &lineOrder, 1);
   }
 
@@ -7639,10 +7817,45 @@ int SaveMultiChannelEXR(const EXRImage *exrImage, const char *filename,
                    reinterpret_cast<const unsigned char *>(&w), sizeof(float));
   }
 
+  if (tileWidth > 0) {
+    // xSize, ySize, mode(ONE_LEVEL, ROUND_DOWN)
+    unsigned char data[9];
+    unsigned int size[2] = {(unsigned int)tileWidth, (unsigned int)tileHeight};
+    if (IsBigEndian()) {
+      swap4(&size[0]);
+      swap4(&size[1]);
+    }
+    memcpy(data, size, 8);
+    data[8] = 0;
+    WriteAttribute(fp, "tiles", "tiledesc", data, 9);
+  }
+
   { // end of header
     unsigned char e = 0;
     fwrite(&e, 1, 1, fp);
   }
+}
+
+int SaveMultiChannelEXR(const EXRImage *exrImage, const char *filename,
+                        const char **err) {
+  if (exrImage == NULL || filename == NULL) {
+    if (err) {
+      (*err) = "Invalid argument.";
+    }
+    return -1;
+  }
+
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    if (err) {
+      (*err) = "Cannot write a file.";
+    }
+    return -1;
+  }
+
+  WriteHeader(fp, exrImage, /* tiled */ 0, 0);
+
+  int numScanlineBlocks = 16; // 16 for ZIP compression.
 
   int numBlocks = exrImage->height / numScanlineBlocks;
   if (numBlocks * numScanlineBlocks < exrImage->height) {
@@ -7656,83 +7869,223 @@ int SaveMultiChannelEXR(const EXRImage *exrImage, const char *filename,
       headerSize +
       numBlocks * sizeof(long long); // sizeof(header) + sizeof(offsetTable)
 
-  std::vector<unsigned char> data;
+  bool isBigEndian = IsBigEndian();
 
+  // Byte offset of each channel in a scanline(per pixel of the line).
+  std::vector<int> channelOffsets(exrImage->num_channels);
+  size_t bytesPerLine = 0;
+  for (int c = 0; c < exrImage->num_channels; c++) {
+    int pixelType = exrImage->pixel_types ? exrImage->pixel_types[c]
+                                          : TINYEXR_PIXELTYPE_HALF;
+    channelOffsets[c] = int(bytesPerLine);
+    bytesPerLine += PixelTypeSize(pixelType);
+  }
+  bytesPerLine *= exrImage->width;
+
+  // Blocks are compressed independently in parallel, then written in order,
+  // so the file does not depend on the # of threads.
+  std::vector<std::vector<unsigned char> > blocks(numBlocks);
+
+  SaveBlockTask task;
+  task.exrImage = exrImage;
+  task.blocks = &blocks.at(0);
+  task.channelOffsets = &channelOffsets.at(0);
+  task.bytesPerLine = bytesPerLine;
+  task.numScanlineBlocks = numScanlineBlocks;
+  task.isBigEndian = isBigEndian;
+  RunBlockTasks(SaveBlockTaskFunc, &task, numBlocks);
 
-  bool isBigEndian = IsBigEndian();
+  for (int i = 0; i < numBlocks; i++) {
+    offsets[i] = offset;
+    if (IsBigEndian()) {
+      swap8(reinterpret_cast<unsigned long long*>(&offsets[i]));
+    }
+    offset += blocks[i].size(); // blockHeader + data
+  }
+
+  {
+    size_t n = fwrite(&offsets.at(0), 1, sizeof(unsigned long long) * numBlocks, fp);
+    assert(n == sizeof(unsigned long long) * numBlocks);
+  }
 
   for (int i = 0; i < numBlocks; i++) {
-    int startY = numScanlineBlocks * i;
-    int endY = std::min(numScanlineBlocks * (i + 1), exrImage->height);
-    int h = endY - startY;
+    size_t n = fwrite(&blocks[i].at(0), 1, blocks[i].size(), fp);
+    assert(n == blocks[i].size());
+  }
 
-    std::vector<unsigned short> buf(exrImage->num_channels * exrImage->width *
-                                    h);
+  fclose(fp);
 
-    for (int y = 0; y < h; y++) {
-      for (int c = 0; c < exrImage->num_channels; c++) {
-        for (int x = 0; x < exrImage->width; x++) {
-          FP32 f32;
-          f32.f = exrImage->images[c][(y + startY) * exrImage->width + x];
+  return 0; // OK
+}
 
-          FP16 h16;
-          h16 = float_to_half_full(f32);
+struct EXRTiledWriter {
+  FILE *fp;
+  int width;
+  int height;
+  int tileWidth;
+  int tileHeight;
+  int numXTiles;
+  int numYTiles;
+  std::vector<int> pixelTypes;
+  long offsetTablePos;
+  long long offset; // End of the file
+  std::vector<long long> offsets; // 0 = not written yet
+};
 
-          if (isBigEndian) {
-            swap2(reinterpret_cast<unsigned short*>(&h16.u));
-          }
+int BeginTiledEXR(EXRTiledWriter **writer, const EXRImage *header,
+                  int tile_width, int tile_height, const char *filename,
+                  const char **err) {
+  if (writer == NULL || header == NULL || filename == NULL ||
+      tile_width <= 0 || tile_height <= 0 || header->width <= 0 ||
+      header->height <= 0) {
+    if (err) {
+      (*err) = "Invalid argument.";
+    }
+    return -1;
+  }
 
-          // Assume increasing Y
-          buf[exrImage->num_channels * y * exrImage->width +
-              c * exrImage->width + x] = h16.u;
-        }
-      }
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    if (err) {
+      (*err) = "Cannot write a file.";
     }
+    return -1;
+  }
 
-    int bound = miniz::mz_compressBound(buf.size() * sizeof(unsigned short));
+  WriteHeader(fp, header, tile_width, tile_height);
+
+  EXRTiledWriter *w = new EXRTiledWriter;
+  w->fp = fp;
+  w->width = header->width;
+  w->height = header->height;
+  w->tileWidth = tile_width;
+  w->tileHeight = tile_height;
+  w->numXTiles = (header->width + tile_width - 1) / tile_width;
+  w->numYTiles = (header->height + tile_height - 1) / tile_height;
+  w->pixelTypes.resize(header->num_channels, TINYEXR_PIXELTYPE_HALF);
+  if (header->pixel_types) {
+    for (int c = 0; c < header->num_channels; c++) {
+      w->pixelTypes[c] = header->pixel_types[c];
+    }
+  }
 
-    std::vector<unsigned char> block(
-        miniz::mz_compressBound(buf.size() * sizeof(unsigned short)));
-    unsigned long long outSize = block.size();
+  // Offset table is filled by EndTiledEXR().
+  size_t numTiles = size_t(w->numXTiles) * size_t(w->numYTiles);
+  w->offsets.resize(numTiles, 0);
+  w->offsetTablePos = ftell(fp);
+  size_t n = fwrite(&w->offsets.at(0), 1, sizeof(long long) * numTiles, fp);
+  w->offset = w->offsetTablePos + (long long)(sizeof(long long) * numTiles);
 
-    CompressZip(&block.at(0), outSize,
-                reinterpret_cast<const unsigned char *>(&buf.at(0)),
-                buf.size() * sizeof(unsigned short));
+  if (n != sizeof(long long) * numTiles) {
+    if (err) {
+      (*err) = "Cannot write a file.";
+    }
+    fclose(fp);
+    delete w;
+    return -1;
+  }
 
-    // 4 byte: scan line
-    // 4 byte: data size
-    // ~     : pixel data(compressed)
-    std::vector<unsigned char> header(8);
-    unsigned int dataLen = outSize; // truncate
-    memcpy(&header.at(0), &startY, sizeof(int));
-    memcpy(&header.at(4), &dataLen, sizeof(unsigned int));
+  (*writer) = w;
 
-    if (IsBigEndian()) {
-      swap4(reinterpret_cast<unsigned int*>(&header.at(0)));
-      swap4(reinterpret_cast<unsigned int*>(&header.at(4)));
+  return 0; // OK
+}
+
+int WriteEXRTile(EXRTiledWriter *writer, int tile_x, int tile_y,
+                 const float *const *images, const char **err) {
+  if (writer == NULL || images == NULL || tile_x < 0 ||
+      tile_x >= writer->numXTiles || tile_y < 0 ||
+      tile_y >= writer->numYTiles) {
+    if (err) {
+      (*err) = "Invalid argument.";
     }
+    return -1;
+  }
 
-    data.insert(data.end(), header.begin(), header.end());
-    data.insert(data.end(), block.begin(), block.begin() + dataLen);
+  int numChannels = int(writer->pixelTypes.size());
+  int w = std::min(writer->tileWidth, writer->width - tile_x * writer->tileWidth);
+  int h =
+      std::min(writer->tileHeight, writer->height - tile_y * writer->tileHeight);
 
-    offsets[i] = offset;
-    if (IsBigEndian()) {
-      swap8(reinterpret_cast<unsigned long long*>(&offsets[i]));
+  // Lines of the tile, each of which has the channels in order.
+  size_t bytesPerLine = 0;
+  for (int c = 0; c < numChannels; c++) {
+    bytesPerLine += PixelTypeSize(writer->pixelTypes[c]) * w;
+  }
+
+  std::vector<unsigned char> buf(bytesPerLine * h);
+  unsigned char *p = &buf.at(0);
+  for (int y = 0; y < h; y++) {
+    for (int c = 0; c < numChannels; c++) {
+      int size = PixelTypeSize(writer->pixelTypes[c]);
+      for (int x = 0; x < w; x++) {
+        WritePixel(p, images[c][y * w + x], writer->pixelTypes[c]);
+        p += size;
+      }
     }
-    offset += dataLen + 8; // 8 = sizeof(blockHeader)
   }
 
-  {
-    size_t n = fwrite(&offsets.at(0), 1, sizeof(unsigned long long) * numBlocks, fp);
-    assert(n == sizeof(unsigned long long) * numBlocks);
+  // 4 x 4 byte: tile x, tile y, level x, level y
+  // 4 byte    : data size
+  // ~         : pixel data(compressed)
+  std::vector<unsigned char> block(20 + miniz::mz_compressBound(buf.size()));
+  unsigned long long outSize = block.size() - 20;
+  CompressZip(&block.at(20), outSize, &buf.at(0), buf.size());
+  if (outSize >= buf.size()) {
+    // Stored as is when ZIP does not reduce the size.
+    memcpy(&block.at(20), &buf.at(0), buf.size());
+    outSize = buf.size();
   }
 
-  {
-    size_t n = fwrite(&data.at(0), 1, data.size(), fp);
-    assert(n == data.size());
+  int header[5] = {tile_x, tile_y, 0, 0, int(outSize)};
+  if (IsBigEndian()) {
+    for (int i = 0; i < 5; i++) {
+      swap4(reinterpret_cast<unsigned int*>(&header[i]));
+    }
   }
+  memcpy(&block.at(0), header, 20);
+  block.resize(20 + outSize);
 
-  fclose(fp);
+  size_t n = fwrite(&block.at(0), 1, block.size(), writer->fp);
+  if (n != block.size()) {
+    if (err) {
+      (*err) = "Cannot write a file.";
+    }
+    return -1;
+  }
+
+  writer->offsets[size_t(tile_y) * writer->numXTiles + tile_x] =
+      writer->offset;
+  writer->offset += block.size();
+
+  return 0; // OK
+}
+
+int EndTiledEXR(EXRTiledWriter *writer, const char **err) {
+  if (writer == NULL) {
+    if (err) {
+      (*err) = "Invalid argument.";
+    }
+    return -1;
+  }
+
+  if (IsBigEndian()) {
+    for (size_t i = 0; i < writer->offsets.size(); i++) {
+      swap8(reinterpret_cast<unsigned long long*>(&writer->offsets[i]));
+    }
+  }
+
+  size_t size = sizeof(long long) * writer->offsets.size();
+  bool ok = (fseek(writer->fp, writer->offsetTablePos, SEEK_SET) == 0) &&
+            (fwrite(&writer->offsets.at(0), 1, size, writer->fp) == size);
+  ok = (fclose(writer->fp) == 0) && ok;
+  delete writer;
+
+  if (!ok) {
+    if (err) {
+      (*err) = "Cannot write a file.";
+    }
+    return -1;
+  }
 
   return 0; // OK
 }
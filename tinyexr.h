@@ -31,10 +31,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 extern "C" {
 #endif
 
+#define TINYEXR_PIXELTYPE_UINT (0)
+#define TINYEXR_PIXELTYPE_HALF (1)
+#define TINYEXR_PIXELTYPE_FLOAT (2)
+
 typedef struct {
   int num_channels;
   const char **channel_names;
   float **images; // image[channels][pixels]
+  int *pixel_types; // pixel_types[channels]. Type in the file. NULL = HALF
   int width;
   int height;
 } EXRImage;
@@ -49,6 +54,7 @@ typedef struct {
 } DeepImage;
 
 // Loads single-frame OpenEXR image. Assume EXR image contains RGB(A) channels.
+// Alpha is set to 1.0 when the image does not have A channel.
 // Application must free image data as returned by `out_rgba`
 // Result image format is: float x RGBA x width x hight
 // Return 0 if success
@@ -77,6 +83,29 @@ extern int LoadMultiChannelEXR(EXRImage *image, const char *filename,
 extern int SaveMultiChannelEXR(const EXRImage *image, const char *filename,
                                const char **err);
 
+// Tiled OpenEXR written tile by tile, so that the whole image need not be in
+// memory. Tiles may be written in any order, but not concurrently.
+typedef struct EXRTiledWriter EXRTiledWriter;
+
+// Creates a tiled(single level) OpenEXR image with the channels, pixel types
+// and size of `header`(`images` is not used).
+// Return 0 if success
+// Returns error string in `err` when there's an error
+extern int BeginTiledEXR(EXRTiledWriter **writer, const EXRImage *header,
+                         int tile_width, int tile_height, const char *filename,
+                         const char **err);
+
+// Writes the tile (`tile_x`, `tile_y`)(in tiles). `images` has the pixels of
+// the tile, which is clipped at the right and bottom edges of the image:
+// images[channels][pixels in the tile]
+// Return 0 if success
+extern int WriteEXRTile(EXRTiledWriter *writer, int tile_x, int tile_y,
+                        const float *const *images, const char **err);
+
+// Writes the offsets of the tiles and closes the file. `writer` is freed.
+// Return 0 if success
+extern int EndTiledEXR(EXRTiledWriter *writer, const char **err);
+
 // Loads single-frame OpenEXR deep image.
 // Application must free memory of variables in DeepImage(image, offset_table)
 // Return 0 if success
@@ -1,2 +1,818 @@
-#include "bsdf.h"
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include "vcm.h"
 #include "light.h"
+#include "random.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Defined in tasksys.cc
+extern "C" {
+void ISPCLaunch(void **handlePtr, void *f, void *data, int count);
+void *ISPCAlloc(void **handlePtr, int64_t size, int32_t alignment);
+void ISPCSync(void *handle);
+}
+
+using namespace mallie;
+
+namespace {
+
+const double kFar = 1.0e+30;
+const double kEPS = 1.0e-3;
+const int kMaxPathLength = 16;
+
+const int kVCMChunkSize = 256; // # of subpaths per task
+const real kRadiusAlpha = 0.75;
+
+inline bool IsZero(const real3 &c) {
+  return (c[0] == 0.0) && (c[1] == 0.0) && (c[2] == 0.0);
+}
+
+// Vertex merging query for HashGrid::Process().
+class RangeQuery {
+public:
+  RangeQuery(const real3 &hitpoint, const BSDF &bsdf,
+             const VCMRenderer::SubPathState &state, real misVcWeightFactor)
+      : hitpoint_(hitpoint), bsdf_(bsdf), state_(state),
+        misVcWeightFactor_(misVcWeightFactor), contrib_(0.0, 0.0, 0.0) {}
+
+  glrs::vector3 GetPosition() const {
+    return glrs::vector3(hitpoint_[0], hitpoint_[1], hitpoint_[2]);
+  }
+
+  const real3 &GetContrib() const { return contrib_; }
+
+  void Process(const VCMRenderer::PathVertex &lightVertex) {
+    if ((lightVertex.pathLength + state_.pathLength) > kMaxPathLength) {
+      return;
+    }
+
+    // Radiance arrives from the direction the light subpath came from.
+    const real3 lightDirection = lightVertex.bsdf.WorldDirFix();
+
+    real cosCamera, cameraBsdfDirPdfW, cameraBsdfRevPdfW;
+    const real3 cameraBsdfFactor = bsdf_.Evaluate(
+        lightDirection, cosCamera, &cameraBsdfDirPdfW, &cameraBsdfRevPdfW);
+
+    if (IsZero(cameraBsdfFactor)) {
+      return;
+    }
+
+    cameraBsdfDirPdfW *= bsdf_.ContinuationProb();
+    cameraBsdfRevPdfW *= bsdf_.ContinuationProb();
+
+    // Partial light/camera subpath MIS weights [tech. rep. (38), (39)]
+    const real wLight = lightVertex.dVCM * misVcWeightFactor_ +
+                        lightVertex.dVM * cameraBsdfDirPdfW;
+    const real wCamera = state_.dVCM * misVcWeightFactor_ +
+                         state_.dVM * cameraBsdfRevPdfW;
+
+    const real misWeight = 1.0 / (wLight + 1.0 + wCamera);
+
+    contrib_ += cameraBsdfFactor * lightVertex.throughput * misWeight;
+  }
+
+private:
+  real3 hitpoint_;
+  const BSDF &bsdf_;
+  const VCMRenderer::SubPathState &state_;
+  real misVcWeightFactor_;
+  real3 contrib_;
+};
+
+#if !defined(_OPENMP) // Tasksys version
+typedef struct {
+  VCMRenderer *renderer;
+  bool light; // light or camera subpath stage
+} VCMStageTask;
+
+void VCMStageTaskFunc(void *data, int threadIndex, int threadCount,
+                      int taskIndex, int taskCount) {
+  const VCMStageTask *task = reinterpret_cast<const VCMStageTask *>(data);
+  if (task->light) {
+    task->renderer->TraceLightChunk(taskIndex);
+  } else {
+    task->renderer->TraceCameraChunk(taskIndex);
+  }
+}
+#endif
+
+void RunVCMStage(VCMRenderer *renderer, bool light, int numChunks) {
+#if !defined(_OPENMP) // Tasksys version
+  VCMStageTask task;
+  task.renderer = renderer;
+  task.light = light;
+
+  void *handle = NULL;
+  // @note { No need to alloc memory with ISPCAlloc. }
+  ISPCAlloc(&handle, 0, /* align */ 16);
+
+  ISPCLaunch(&handle, reinterpret_cast<void *>(VCMStageTaskFunc), &task,
+             numChunks);
+  ISPCSync(handle);
+#else // OMP version
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < numChunks; i++) {
+    if (light) {
+      renderer->TraceLightChunk(i);
+    } else {
+      renderer->TraceCameraChunk(i);
+    }
+  }
+#endif
+}
+
+} // namespace
+
+VCMRenderer::VCMRenderer()
+    : scene_(NULL), camera_(NULL), plane_(NULL), iteration_(0) {}
+
+VCMRenderer::~VCMRenderer() {}
+
+void VCMRenderer::InitIteration(Scene &scene, const Camera &camera,
+                                const RenderConfig &config, int step,
+                                Plane *plane) {
+  scene_ = &scene;
+  camera_ = &camera;
+  plane_ = plane;
+  step_ = step;
+
+  gridWidth_ = (config.width + step - 1) / step;
+  gridHeight_ = (config.height + step - 1) / step;
+
+  if ((splat_.Width() != gridWidth_) || (splat_.Height() != gridHeight_)) {
+    splat_.Resize(gridWidth_, gridHeight_);
+  } else {
+    splat_.Clear();
+  }
+
+  useVC_ = true;
+  useVM_ = (config.integrator != "bpt");
+
+  // One light subpath per(grid) pixel. Pixel area is 1 in grid units.
+  lightSubPathCount_ = gridWidth_ * gridHeight_;
+  imagePlaneDist_ = camera.ImagePlaneDist() / step;
+
+  // Merging radius relative to the scene size, reduced per iteration
+  // [tech. rep. (20)]
+  real3 bmin, bmax;
+  scene.BoundingBox(bmin, bmax);
+  real3 extent = bmax - bmin;
+  real sceneRadius = 0.5 * extent.length();
+
+  real radius = config.vcm_radius * sceneRadius;
+  radius /= pow((real)(iteration_ + 1), 0.5 * (1.0 - kRadiusAlpha));
+  radius = (std::max)(radius, (real)1.0e-7);
+  radiusSqr_ = radius * radius;
+
+  // Factor used to normalize vertex merging contribution.
+  const real etaVCM = (M_PI * radiusSqr_) * lightSubPathCount_;
+  misVmWeightFactor_ = useVM_ ? etaVCM : 0.0;
+  misVcWeightFactor_ = useVC_ ? (1.0 / etaVCM) : 0.0;
+  vmNormalization_ = 1.0 / etaVCM;
+}
+
+bool VCMRenderer::Trace(Intersection &isect, const Ray &ray) const {
+  Ray r = ray;
+  bool hit = scene_->Trace(isect, r);
+
+  if (plane_ && plane_->intersect(&isect, ray)) {
+    isect.faceID = (unsigned int)(-1); // Not a light
+    hit = true;
+  }
+
+  return hit;
+}
+
+bool VCMRenderer::Occluded(const real3 &org, const real3 &dir,
+                           real dist) const {
+  Ray ray;
+  ray.org = org + kEPS * dir;
+  ray.dir = dir;
+
+  real maxT = dist - 2.0 * kEPS;
+
+  if (scene_->Occluded(ray, maxT)) {
+    return true;
+  }
+
+  if (plane_) {
+    Intersection isect;
+    isect.t = maxT;
+    if (plane_->intersect(&isect, ray)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool VCMRenderer::GenerateLightSample(SubPathState &state,
+                                      const real rnd[5]) const {
+  real lightPickProb;
+  int lightID = scene_->SampleLightPower(lightPickProb, rnd[0]);
+  if (lightID < 0) {
+    return false;
+  }
+
+  const TriangleLight &light = scene_->GetLight(lightID);
+
+  real3 P, N, dir;
+  real cosPdfW;
+  real posPdfA = light.SampleL(P, N, dir, cosPdfW, &rnd[1], &rnd[3]);
+
+  const real cosLight = vdot(N, dir);
+  const real emissionPdfW = lightPickProb * posPdfA * cosPdfW;
+  const real directPdfA = lightPickProb * posPdfA;
+
+  if ((emissionPdfW <= 0.0) || (cosLight <= 0.0)) {
+    return false;
+  }
+
+  state.origin = P;
+  state.direction = dir;
+  state.throughput = light.Radiance() * (cosLight / emissionPdfW);
+  state.pathLength = 1;
+
+  // Light subpath MIS quantities [tech. rep. (31)-(33)]
+  state.dVCM = directPdfA / emissionPdfW;
+  state.dVC = cosLight / emissionPdfW;
+  state.dVM = state.dVC * misVcWeightFactor_;
+
+  return true;
+}
+
+void VCMRenderer::ConnectToCamera(LightChunk &out, const SubPathState &state,
+                                  const real3 &hitpoint,
+                                  const BSDF &bsdf) {
+  double px, py;
+  if (!camera_->WorldToRaster(px, py, hitpoint)) {
+    return;
+  }
+
+  real3 directionToCamera = real3(camera_->origin_[0], camera_->origin_[1],
+                                  camera_->origin_[2]) - hitpoint;
+  const real distEye2 = vdot(directionToCamera, directionToCamera);
+  const real distance = sqrt(distEye2);
+  directionToCamera = directionToCamera * (1.0 / distance);
+
+  real cosToCamera, bsdfDirPdfW, bsdfRevPdfW;
+  const real3 bsdfFactor = bsdf.Evaluate(directionToCamera, cosToCamera,
+                                         &bsdfDirPdfW, &bsdfRevPdfW);
+
+  if (IsZero(bsdfFactor)) {
+    return;
+  }
+
+  bsdfRevPdfW *= bsdf.ContinuationProb();
+
+  const real cosAtCamera = -vdot(camera_->Forward(), directionToCamera);
+  if (cosAtCamera <= 0.0) {
+    return;
+  }
+
+  // Image plane -> surface area measure conversion.
+  const real imagePointToCameraDist = imagePlaneDist_ / cosAtCamera;
+  const real imageToSolidAngleFactor =
+      imagePointToCameraDist * imagePointToCameraDist / cosAtCamera;
+  const real imageToSurfaceFactor =
+      imageToSolidAngleFactor * std::abs(cosToCamera) / distEye2;
+
+  // Camera pdf of generating this vertex, in area measure.
+  const real cameraPdfA = imageToSurfaceFactor;
+
+  // Partial light subpath weight [tech. rep. (46)]. Note the division by
+  // the number of light subpaths: all of them can hit the pixel.
+  const real wLight = (cameraPdfA / lightSubPathCount_) *
+                      (misVmWeightFactor_ + state.dVCM +
+                       state.dVC * bsdfRevPdfW);
+
+  const real misWeight = 1.0 / (wLight + 1.0);
+
+  const real3 contrib =
+      state.throughput * bsdfFactor *
+      (misWeight * imageToSurfaceFactor / lightSubPathCount_);
+
+  if (IsZero(contrib)) {
+    return;
+  }
+
+  if (Occluded(hitpoint, directionToCamera, distance)) {
+    return;
+  }
+
+  int gx = (int)floor((px + 0.5) / step_);
+  int gy = (int)floor((py + 0.5) / step_);
+  gx = (std::max)(0, (std::min)(gx, gridWidth_ - 1));
+  gy = (std::max)(0, (std::min)(gy, gridHeight_ - 1));
+
+  out.numRetries += splat_.Splat(gy * gridWidth_ + gx, contrib);
+  out.numSplats++;
+}
+
+bool VCMRenderer::SampleScattering(const BSDF &bsdf, const real3 &hitpoint,
+                                   SubPathState &state,
+                                   const real rnd[4]) const {
+  real3 rayDirection;
+  real bsdfDirPdfW, cosThetaOut;
+  unsigned int sampledEvent;
+
+  const real3 bsdfFactor =
+      bsdf.Sample(rnd, rayDirection, bsdfDirPdfW, cosThetaOut, &sampledEvent);
+
+  if (IsZero(bsdfFactor)) {
+    return false;
+  }
+
+  // For specular event the reverse pdf equals the direct one.
+  real bsdfRevPdfW = bsdfDirPdfW;
+  if (!(sampledEvent & BSDF::kSpecular)) {
+    bsdfRevPdfW = bsdf.Pdf(rayDirection, true);
+  }
+
+  // Russian roulette
+  const real contProb = bsdf.ContinuationProb();
+  if (rnd[3] > contProb) {
+    return false;
+  }
+
+  bsdfDirPdfW *= contProb;
+  bsdfRevPdfW *= contProb;
+
+  // Sub-path MIS quantities for the next vertex [tech. rep. (34)-(36)]
+  if (sampledEvent & BSDF::kSpecular) {
+    state.dVCM = 0.0;
+    state.dVC *= cosThetaOut;
+    state.dVM *= cosThetaOut;
+  } else {
+    state.dVC = (cosThetaOut / bsdfDirPdfW) *
+                (state.dVC * bsdfRevPdfW + state.dVCM + misVmWeightFactor_);
+    state.dVM = (cosThetaOut / bsdfDirPdfW) *
+                (state.dVM * bsdfRevPdfW + state.dVCM * misVcWeightFactor_ +
+                 1.0);
+    state.dVCM = 1.0 / bsdfDirPdfW;
+  }
+
+  state.origin = hitpoint;
+  state.direction = rayDirection;
+  state.throughput =
+      state.throughput * bsdfFactor * (cosThetaOut / bsdfDirPdfW);
+
+  return true;
+}
+
+real3 VCMRenderer::GetLightRadiance(int lightID, const SubPathState &state,
+                                    const real3 &rayDir) const {
+  const TriangleLight &light = scene_->GetLight(lightID);
+
+  // Emission is one-sided.
+  const real cosOut = -vdot(light.Normal(), rayDir);
+  if (cosOut <= 0.0) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  const real3 radiance = light.Radiance();
+
+  // Directly visible light. No other strategy can sample it.
+  if (state.pathLength == 1) {
+    return radiance;
+  }
+
+  const real lightPickProb = scene_->LightPowerPdf(lightID);
+  const real directPdfA = lightPickProb / light.Area();
+  const real emissionPdfW = directPdfA * cosOut / M_PI;
+
+  // Partial camera subpath weight [tech. rep. (43)]
+  const real wCamera = directPdfA * state.dVCM + emissionPdfW * state.dVC;
+
+  const real misWeight = 1.0 / (1.0 + wCamera);
+
+  return radiance * misWeight;
+}
+
+real3 VCMRenderer::DirectIllumination(const SubPathState &state,
+                                      const real3 &hitpoint, const BSDF &bsdf,
+                                      const real rnd[3]) const {
+  real lightPickProb;
+  int lightID = scene_->SampleLightPower(lightPickProb, rnd[0]);
+  if (lightID < 0) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  const TriangleLight &light = scene_->GetLight(lightID);
+
+  real3 lightP, lightN;
+  const real posPdfA = light.SamplePosition(lightP, lightN, &rnd[1]);
+
+  real3 directionToLight = lightP - hitpoint;
+  const real distSqr = vdot(directionToLight, directionToLight);
+  const real distance = sqrt(distSqr);
+  directionToLight = directionToLight * (1.0 / distance);
+
+  const real cosAtLight = -vdot(lightN, directionToLight);
+  if (cosAtLight <= 1.0e-6) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  const real directPdfW = posPdfA * distSqr / cosAtLight;
+  const real emissionPdfW = posPdfA * cosAtLight / M_PI;
+
+  real cosToLight, bsdfDirPdfW, bsdfRevPdfW;
+  const real3 bsdfFactor = bsdf.Evaluate(directionToLight, cosToLight,
+                                         &bsdfDirPdfW, &bsdfRevPdfW);
+
+  if (IsZero(bsdfFactor)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  const real contProb = bsdf.ContinuationProb();
+  bsdfDirPdfW *= contProb;
+  bsdfRevPdfW *= contProb;
+
+  // [tech. rep. (40)-(42)]
+  const real wLight = bsdfDirPdfW / (lightPickProb * directPdfW);
+  const real wCamera =
+      (emissionPdfW * cosToLight / (directPdfW * cosAtLight)) *
+      (misVmWeightFactor_ + state.dVCM + state.dVC * bsdfRevPdfW);
+
+  const real misWeight = 1.0 / (wLight + 1.0 + wCamera);
+
+  const real3 contrib =
+      light.Radiance() * bsdfFactor *
+      (misWeight * cosToLight / (lightPickProb * directPdfW));
+
+  if (IsZero(contrib) || Occluded(hitpoint, directionToLight, distance)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  return contrib;
+}
+
+real3 VCMRenderer::ConnectVertices(const PathVertex &lightVertex,
+                                   const BSDF &cameraBsdf,
+                                   const real3 &cameraHitpoint,
+                                   const SubPathState &cameraState) const {
+  real3 direction = lightVertex.hitpoint - cameraHitpoint;
+  const real dist2 = vdot(direction, direction);
+  const real distance = sqrt(dist2);
+  direction = direction * (1.0 / distance);
+
+  real cosCamera, cameraBsdfDirPdfW, cameraBsdfRevPdfW;
+  const real3 cameraBsdfFactor = cameraBsdf.Evaluate(
+      direction, cosCamera, &cameraBsdfDirPdfW, &cameraBsdfRevPdfW);
+
+  if (IsZero(cameraBsdfFactor)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  const real cameraCont = cameraBsdf.ContinuationProb();
+  cameraBsdfDirPdfW *= cameraCont;
+  cameraBsdfRevPdfW *= cameraCont;
+
+  real cosLight, lightBsdfDirPdfW, lightBsdfRevPdfW;
+  const real3 lightBsdfFactor = lightVertex.bsdf.Evaluate(
+      direction * -1.0, cosLight, &lightBsdfDirPdfW, &lightBsdfRevPdfW);
+
+  if (IsZero(lightBsdfFactor)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  const real lightCont = lightVertex.bsdf.ContinuationProb();
+  lightBsdfDirPdfW *= lightCont;
+  lightBsdfRevPdfW *= lightCont;
+
+  const real geometryTerm = cosLight * cosCamera / dist2;
+
+  // Convert pdfs to area measure.
+  const real cameraBsdfDirPdfA = cameraBsdfDirPdfW * cosLight / dist2;
+  const real lightBsdfDirPdfA = lightBsdfDirPdfW * cosCamera / dist2;
+
+  // [tech. rep. (40)-(42)]
+  const real wLight =
+      cameraBsdfDirPdfA * (misVmWeightFactor_ + lightVertex.dVCM +
+                           lightVertex.dVC * lightBsdfRevPdfW);
+  const real wCamera =
+      lightBsdfDirPdfA * (misVmWeightFactor_ + cameraState.dVCM +
+                          cameraState.dVC * cameraBsdfRevPdfW);
+
+  const real misWeight = 1.0 / (wLight + 1.0 + wCamera);
+
+  const real3 contrib =
+      cameraBsdfFactor * lightBsdfFactor * (misWeight * geometryTerm);
+
+  if (IsZero(contrib) || Occluded(cameraHitpoint, direction, distance)) {
+    return real3(0.0, 0.0, 0.0);
+  }
+
+  return contrib;
+}
+
+void VCMRenderer::TraceLightChunk(int chunk) {
+  LightChunk &out = chunks_[chunk];
+  out.vertices.clear();
+  out.pathEnds.clear();
+  out.numSplats = 0;
+  out.numRetries = 0;
+
+  XorShift rng(iteration_, chunk, 0);
+
+  int numPaths = gridWidth_ * gridHeight_;
+  int begin = chunk * kVCMChunkSize;
+  int end = (std::min)(begin + kVCMChunkSize, numPaths);
+
+  for (int i = begin; i < end; i++) {
+    real rnd[5];
+    for (int k = 0; k < 5; k++) {
+      rnd[k] = rng.Next();
+    }
+
+    SubPathState state;
+    if (GenerateLightSample(state, rnd)) {
+
+      for (;; ++state.pathLength) {
+        Ray ray;
+        ray.org = state.origin + kEPS * state.direction;
+        ray.dir = state.direction;
+
+        Intersection isect;
+        isect.t = kFar;
+        if (!Trace(isect, ray)) {
+          break;
+        }
+
+        // Lights are not reflective.
+        if (scene_->GetLightID(isect.faceID) >= 0) {
+          break;
+        }
+
+        const real3 hitpoint = ray.org + isect.t * ray.dir;
+
+        BSDF bsdf;
+        bsdf.Setup(ray.dir, isect.normal,
+                   scene_->GetMaterial(isect.materialID), isect.materialID,
+                   /* fromLight */ true);
+        if (!bsdf.IsValid()) {
+          break;
+        }
+
+        // Update MIS quantities before storing them at the vertex.
+        const real cosFix = std::abs(bsdf.CosThetaFix());
+        state.dVCM *= isect.t * isect.t;
+        state.dVCM /= cosFix;
+        state.dVC /= cosFix;
+        state.dVM /= cosFix;
+
+        // Store vertex. Specular ones can't be connected or merged.
+        if (!bsdf.IsDelta()) {
+          PathVertex vertex;
+          vertex.hitpoint = hitpoint;
+          vertex.throughput = state.throughput;
+          vertex.pathLength = state.pathLength;
+          vertex.bsdf = bsdf;
+          vertex.dVCM = state.dVCM;
+          vertex.dVC = state.dVC;
+          vertex.dVM = state.dVM;
+          out.vertices.push_back(vertex);
+
+          // Connect to camera(light tracing).
+          if (useVC_) {
+            ConnectToCamera(out, state, hitpoint, bsdf);
+          }
+        }
+
+        // Terminate if the path would become too long after scattering.
+        if ((state.pathLength + 2) > kMaxPathLength) {
+          break;
+        }
+
+        real srnd[4];
+        for (int k = 0; k < 4; k++) {
+          srnd[k] = rng.Next();
+        }
+        if (!SampleScattering(bsdf, hitpoint, state, srnd)) {
+          break;
+        }
+      }
+    }
+
+    out.pathEnds.push_back((int)out.vertices.size());
+  }
+
+  splat_.AddStats(out.numSplats, out.numRetries);
+}
+
+void VCMRenderer::TraceCameraChunk(int chunk) {
+  XorShift rng(iteration_, chunk, 1);
+
+  const real3 forward = camera_->Forward();
+
+  int numPixels = gridWidth_ * gridHeight_;
+  int begin = chunk * kVCMChunkSize;
+  int end = (std::min)(begin + kVCMChunkSize, numPixels);
+
+  for (int pixel = begin; pixel < end; pixel++) {
+    int gx = pixel % gridWidth_;
+    int gy = pixel / gridWidth_;
+
+    // Jitter over the grid pixel(step x step pixels).
+    double u = gx * step_ - 0.5 + rng.Next() * step_;
+    double v = gy * step_ - 0.5 + rng.Next() * step_;
+    Ray ray = camera_->GenerateRay(u, v);
+
+    // Camera pdf in solid angle measure, for the grid pixel of area 1.
+    const real cosAtCamera = vdot(forward, ray.dir);
+    const real imagePointToCameraDist = imagePlaneDist_ / cosAtCamera;
+    const real cameraPdfW =
+        imagePointToCameraDist * imagePointToCameraDist / cosAtCamera;
+
+    SubPathState state;
+    state.origin = ray.org;
+    state.direction = ray.dir;
+    state.throughput = real3(1.0, 1.0, 1.0);
+    state.pathLength = 1;
+
+    // Camera subpath MIS quantities [tech. rep. (31)-(33)]
+    state.dVCM = lightSubPathCount_ / cameraPdfW;
+    state.dVC = 0.0;
+    state.dVM = 0.0;
+
+    real3 color(0.0, 0.0, 0.0);
+
+    for (;; ++state.pathLength) {
+      ray.org = state.origin;
+      ray.dir = state.direction;
+      if (state.pathLength > 1) {
+        ray.org = ray.org + kEPS * ray.dir;
+      }
+
+      Intersection isect;
+      isect.t = kFar;
+      if (!Trace(isect, ray)) {
+        // Environment is only reachable by camera subpaths.
+        if (scene_->HasEnvMap()) {
+          color += state.throughput * scene_->GetBackgroundRadiance(ray.dir);
+        }
+        break;
+      }
+
+      const real3 hitpoint = ray.org + isect.t * ray.dir;
+      const real dist2 = isect.t * isect.t;
+
+      int lightID = scene_->GetLightID(isect.faceID);
+      if (lightID >= 0) {
+        const real cosLight =
+            std::abs(vdot(scene_->GetLight(lightID).Normal(), ray.dir));
+        if (cosLight > 1.0e-6) {
+          state.dVCM *= dist2 / cosLight;
+          state.dVC /= cosLight;
+          state.dVM /= cosLight;
+          color +=
+              state.throughput * GetLightRadiance(lightID, state, ray.dir);
+        }
+        break;
+      }
+
+      BSDF bsdf;
+      bsdf.Setup(ray.dir, isect.normal, scene_->GetMaterial(isect.materialID),
+                 isect.materialID, /* fromLight */ false);
+      if (!bsdf.IsValid()) {
+        break;
+      }
+
+      const real cosFix = std::abs(bsdf.CosThetaFix());
+      state.dVCM *= dist2;
+      state.dVCM /= cosFix;
+      state.dVC /= cosFix;
+      state.dVM /= cosFix;
+
+      if (state.pathLength >= kMaxPathLength) {
+        break;
+      }
+
+      if (!bsdf.IsDelta()) {
+        if (useVC_) {
+          // Vertex connection: light source(next event estimation).
+          real lrnd[3];
+          for (int k = 0; k < 3; k++) {
+            lrnd[k] = rng.Next();
+          }
+          color += state.throughput *
+                   DirectIllumination(state, hitpoint, bsdf, lrnd);
+
+          // Vertex connection: vertices of the light subpath of this pixel.
+          for (int i = pathBegins_[pixel]; i < pathEnds_[pixel]; i++) {
+            const PathVertex &lightVertex = lightVertices_[i];
+
+            if ((lightVertex.pathLength + 1 + state.pathLength) >
+                kMaxPathLength) {
+              break;
+            }
+
+            color += state.throughput * lightVertex.throughput *
+                     ConnectVertices(lightVertex, bsdf, hitpoint, state);
+          }
+        }
+
+        // Vertex merging.
+        if (useVM_) {
+          RangeQuery query(hitpoint, bsdf, state, misVcWeightFactor_);
+          hashGrid_.Process(lightVertices_, query);
+          color += state.throughput * query.GetContrib() * vmNormalization_;
+        }
+      }
+
+      real srnd[4];
+      for (int k = 0; k < 4; k++) {
+        srnd[k] = rng.Next();
+      }
+      if (!SampleScattering(bsdf, hitpoint, state, srnd)) {
+        break;
+      }
+    }
+
+    color_[pixel] = color;
+  }
+}
+
+bool VCMRenderer::RenderPass(Scene &scene, const Camera &camera,
+                             const RenderConfig &config,
+                             std::vector<float> &image,
+                             std::vector<int> &count, int step, Plane *plane) {
+  if (scene.NumLights() == 0) {
+    printf("Mallie:warn\tmsg:VCM requires area lights(emissive triangles).\n");
+  }
+
+  InitIteration(scene, camera, config, step, plane);
+
+  int numPaths = gridWidth_ * gridHeight_;
+  int numChunks = (numPaths + kVCMChunkSize - 1) / kVCMChunkSize;
+
+  //
+  // 1. Trace light subpaths. Also connects them to the camera.
+  //
+  chunks_.resize(numChunks);
+  RunVCMStage(this, /* light */ true, numChunks);
+
+  lightVertices_.clear();
+  pathBegins_.resize(numPaths);
+  pathEnds_.resize(numPaths);
+  for (int c = 0; c < numChunks; c++) {
+    const LightChunk &chunk = chunks_[c];
+    int offset = (int)lightVertices_.size();
+    int pathBegin = c * kVCMChunkSize;
+    for (size_t k = 0; k < chunk.pathEnds.size(); k++) {
+      pathBegins_[pathBegin + k] = offset + ((k == 0) ? 0 : chunk.pathEnds[k - 1]);
+      pathEnds_[pathBegin + k] = offset + chunk.pathEnds[k];
+    }
+    lightVertices_.insert(lightVertices_.end(), chunk.vertices.begin(),
+                          chunk.vertices.end());
+  }
+
+  if (useVM_) {
+    hashGrid_.Reserve(numPaths);
+    hashGrid_.Build(lightVertices_, sqrt(radiusSqr_));
+  }
+
+  //
+  // 2. Trace camera subpaths.
+  //
+  color_.resize(numPaths);
+  RunVCMStage(this, /* light */ false, numChunks);
+
+  // Add light tracing contributions.
+  for (int i = 0; i < numPaths; i++) {
+    color_[i] += splat_.Get(i);
+  }
+
+  if (config.report_efficiency) {
+    splat_.PrintStats("VCM");
+  }
+
+  //
+  // 3. Write to the image(block fill for step > 1).
+  //
+  int width = config.width;
+  int height = config.height;
+  for (int gy = 0; gy < gridHeight_; gy++) {
+    for (int gx = 0; gx < gridWidth_; gx++) {
+      const real3 &c = color_[gy * gridWidth_ + gx];
+      for (int v = 0; (v < step) && ((gy * step + v) < height); v++) {
+        for (int u = 0; (u < step) && ((gx * step + u) < width); u++) {
+          int idx = (gy * step + v) * width + (gx * step + u);
+          image[3 * idx + 0] = c[0];
+          image[3 * idx + 1] = c[1];
+          image[3 * idx + 2] = c[2];
+          count[idx]++;
+        }
+      }
+    }
+  }
+
+  iteration_++;
+
+  return true;
+}
@@ -0,0 +1,136 @@
+#ifndef __MALLIE_VCM_H__
+#define __MALLIE_VCM_H__
+
+#include <vector>
+
+#include "common.h"
+#include "bsdf.h"
+#include "camera.h"
+#include "render.h"
+#include "prim-plane.h"
+#include "hashgrid.h"
+#include "splat.h"
+
+namespace mallie {
+
+///< Vertex connection and merging(VCM) integrator, after SmallVCM.
+///< Light subpaths are traced first(one per pixel), their vertices are stored
+///< in the hash grid, then camera subpaths combine vertex connection(BDPT)
+///< and vertex merging(photon density estimation) under MIS.
+///< "bpt" mode disables merging(pure bidirectional path tracing).
+///<
+///< Lights are non-reflective. Environment light is only gathered by camera
+///< subpaths which escape the scene(no connection, no MIS).
+class VCMRenderer {
+public:
+  VCMRenderer();
+  ~VCMRenderer();
+
+  ///< Render one iteration into `image`(same layout as Render()). The merging
+  ///< radius shrinks with the iteration count, so call Reset() when the view
+  ///< changes.
+  bool RenderPass(Scene &scene, const Camera &camera,
+                  const RenderConfig &config, std::vector<float> &image,
+                  std::vector<int> &count, int step, Plane *plane);
+
+  void Reset() { iteration_ = 0; }
+
+  int Iteration() const { return iteration_; }
+
+  ///< Path state shared by light and camera subpaths.
+  struct SubPathState {
+    real3 origin;
+    real3 direction;
+    real3 throughput;
+    int pathLength; // # of segments
+
+    // Partial MIS quantities [tech. rep. (31)-(33)]
+    real dVCM;
+    real dVC;
+    real dVM;
+  };
+
+  ///< Light subpath vertex stored for connection and merging.
+  struct PathVertex {
+    real3 hitpoint;
+    real3 throughput;
+    int pathLength;
+    BSDF bsdf; // Constructed with fromLight = true
+
+    real dVCM;
+    real dVC;
+    real dVM;
+
+    glrs::vector3 GetPosition() const {
+      return glrs::vector3(hitpoint[0], hitpoint[1], hitpoint[2]);
+    }
+  };
+
+  ///< Light paths produced by one chunk. Camera connections are splatted
+  ///< directly.
+  struct LightChunk {
+    std::vector<PathVertex> vertices;
+    std::vector<int> pathEnds;
+    int numSplats;
+    int numRetries;
+  };
+
+  // Per-chunk work, called from the parallel loops.
+  void TraceLightChunk(int chunk);
+  void TraceCameraChunk(int chunk);
+
+private:
+  void InitIteration(Scene &scene, const Camera &camera,
+                     const RenderConfig &config, int step, Plane *plane);
+
+  bool Trace(Intersection &isect, const Ray &ray) const;
+  bool Occluded(const real3 &org, const real3 &dir, real dist) const;
+
+  // Light emission. Returns false when the scene has no light.
+  bool GenerateLightSample(SubPathState &state, const real rnd[5]) const;
+
+  void ConnectToCamera(LightChunk &out, const SubPathState &state,
+                       const real3 &hitpoint, const BSDF &bsdf);
+
+  bool SampleScattering(const BSDF &bsdf, const real3 &hitpoint,
+                        SubPathState &state, const real rnd[4]) const;
+
+  real3 GetLightRadiance(int lightID, const SubPathState &state,
+                         const real3 &rayDir) const;
+
+  real3 DirectIllumination(const SubPathState &state, const real3 &hitpoint,
+                           const BSDF &bsdf, const real rnd[3]) const;
+
+  real3 ConnectVertices(const PathVertex &lightVertex, const BSDF &cameraBsdf,
+                        const real3 &cameraHitpoint,
+                        const SubPathState &cameraState) const;
+
+  // Per iteration
+  Scene *scene_;
+  const Camera *camera_;
+  Plane *plane_;
+  int iteration_;
+  bool useVM_;
+  bool useVC_;
+  int gridWidth_;
+  int gridHeight_;
+  int step_;
+  real imagePlaneDist_; // In grid pixel units
+  real lightSubPathCount_;
+  real misVmWeightFactor_;
+  real misVcWeightFactor_;
+  real vmNormalization_;
+  real radiusSqr_;
+
+  std::vector<LightChunk> chunks_;
+  std::vector<PathVertex> lightVertices_;
+  std::vector<int> pathBegins_; // Range of each light path in lightVertices_
+  std::vector<int> pathEnds_;
+  std::vector<real3> color_; // Camera subpath contribution(grid resolution)
+  SplatBuffer splat_;        // Light tracing contribution(grid resolution)
+  glrs::HashGrid hashGrid_;
+};
+
+} // namespace
+
+#endif // __MALLIE_VCM_H__